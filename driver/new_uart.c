@@ -25,11 +25,14 @@
 #ifdef _ENABLE_RING_BUFFER
     static ringbuf_t rxBuff;
     static ringbuf_t txBuff;
+    static ringbuf_t txRing;
+    static uint32 tx_bytes, tx_overruns, rx_overflows;
 #endif
 
 #ifdef _ENABLE_CONSOLE_INTEGRATION
     uint8_t linked_to_console = 0;
     uint8_t echo_on = 1;
+    uint8_t frame_end = 0;
 #endif
 
 extern UartDevice    UartDev;
@@ -40,6 +43,12 @@ static uint8 uart_recvTaskPrio = 0;
 /* Internal Functions */
 static  void ICACHE_FLASH_ATTR uart_config(uint8 uart_no);
 static  void uart0_rx_intr_handler(void *para);
+#ifdef _ENABLE_RING_BUFFER
+static  void uart0_tx_fill(void);
+static  void uart0_tx_queue(const char *buffer, int len);
+static  void uart0_tx_queue_isr(uint8 ch);
+LOCAL void ICACHE_FLASH_ATTR uart0_write_char(char c);
+#endif
 
 /* Public APIs */
 void ICACHE_FLASH_ATTR UART_init(UartBautRate uart0_br, UartBautRate uart1_br, uint8 recv_task_priority);
@@ -71,6 +80,10 @@ void ICACHE_FLASH_ATTR UART_init_console(UartBautRate uart0_br,
     linked_to_console = 1;
     echo_on = 1;
 
+    /* Without the tx ring UART0 falls back to the blocking output */
+    if (txRing == NULL)
+        txRing = ringbuf_new(TX_RING_BUFFER_SIZE);
+
     uart_config(UART0);
     UART_SetPrintPort(UART0);
 
@@ -233,11 +246,62 @@ int ICACHE_FLASH_ATTR UART_Echo(uint8 echo)
     return echo_on;
 }
 
+/******************************************************************************
+ * FunctionName : UART_SetFrameEnd
+ * Description  : Public API, binary input: SIG_CONSOLE_RX is posted for the
+ *                end_char of a frame instead of '\r' (0: console lines).
+ *                A full rx ring drops the new bytes (counted as overflow)
+ * Parameters   : IN uint8 end_char
+ *                IN ringbuf_t rxbuffer - the new rx ring, NULL keeps the old
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_FLASH_ATTR UART_SetFrameEnd(uint8 end_char, ringbuf_t rxbuffer)
+{
+    ETS_UART_INTR_DISABLE();
+    frame_end = end_char;
+    if (rxbuffer != NULL)
+        rxBuff = rxbuffer;
+    ETS_UART_INTR_ENABLE();
+}
+
+/******************************************************************************
+ * FunctionName : UART_RxOverflows
+ * Description  : Public API, bytes of binary input lost to a full rx ring
+ * Parameters   : NONE
+ * Returns      : uint32
+*******************************************************************************/
+uint32 ICACHE_FLASH_ATTR UART_RxOverflows(void)
+{
+#ifdef _ENABLE_RING_BUFFER
+    return rx_overflows;
+#else
+    return 0;
+#endif
+}
+
+/******************************************************************************
+ * FunctionName : UART_Send
+ * Description  : Public API, sends len bytes. For UART0 the bytes are queued
+ *                in the tx ring and sent by the tx fifo empty interrupt, only
+ *                a full ring waits for the fifo (counted as overrun)
+ * Parameters   :   IN      uart number (uart_no)
+ *                  IN      char *buffer
+ *                  IN      int len
+ * Returns      : int (number of bytes sent or queued)
+*******************************************************************************/
 int UART_Send(uint8 uart_no, char *buffer, int len)
 {
     int     index = 0;
     char    ch ;
 
+    #ifdef _ENABLE_RING_BUFFER
+    if (uart_no == UART0 && txRing != NULL)
+    {
+        uart0_tx_queue(buffer, len);
+        return len;
+    }
+    #endif
+
     //DBG1("Sending: %s\n", buffer);
     for (index=0; index <len; index ++)
     {
@@ -248,9 +312,136 @@ int UART_Send(uint8 uart_no, char *buffer, int len)
     return index;
 }
 
+/******************************************************************************
+ * FunctionName : UART_Flush
+ * Description  : Public API, waits until the tx ring of UART0 is sent to the
+ *                fifo, e.g. before a restart or a change of the bit rate
+ * Parameters   : IN uart number (uart_no)
+ * Returns      : NONE
+*******************************************************************************/
+void UART_Flush(uint8 uart_no)
+{
+    #ifdef _ENABLE_RING_BUFFER
+    if (uart_no != UART0 || txRing == NULL)
+        return;
+
+    while (!ringbuf_is_empty(txRing))
+    {
+        ETS_UART_INTR_DISABLE();
+        uart0_tx_fill();
+        ETS_UART_INTR_ENABLE();
+    }
+    #endif
+}
+
+void ICACHE_FLASH_ATTR UART_TxStats(uint32 *bytes, uint32 *overruns)
+{
+    #ifdef _ENABLE_RING_BUFFER
+    *bytes = tx_bytes;
+    *overruns = tx_overruns;
+    #else
+    *bytes = *overruns = 0;
+    #endif
+}
+
 /*---------------------------------------------------------------------------*
  *                          Internal Functions
  *---------------------------------------------------------------------------*/
+#ifdef _ENABLE_RING_BUFFER
+/******************************************************************************
+ * FunctionName : uart0_tx_fill
+ * Description  : Internal used function, moves bytes of the tx ring into the
+ *                fifo, the fifo empty interrupt stays on while more are left.
+ *                Called with the uart interrupt disabled or from the handler
+ * Parameters   : NONE
+ * Returns      : NONE
+*******************************************************************************/
+static void uart0_tx_fill(void)
+{
+    const void *span;
+    size_t len, index;
+    uint32 fifo_cnt = (READ_PERI_REG(UART_STATUS(UART0)) >> UART_TXFIFO_CNT_S) & UART_TXFIFO_CNT;
+    uint32 fifo_free = fifo_cnt < 126 ? 126 - fifo_cnt : 0;
+
+    while (fifo_free > 0 && (len = ringbuf_peek_span(txRing, &span)) != 0)
+    {
+        if (len > fifo_free)
+            len = fifo_free;
+        for (index = 0; index < len; index++)
+            WRITE_PERI_REG(UART_FIFO(UART0), ((const uint8 *)span)[index]);
+        ringbuf_consume(txRing, len);
+        fifo_free -= len;
+    }
+
+    if (ringbuf_is_empty(txRing))
+        CLEAR_PERI_REG_MASK(UART_INT_ENA(UART0), UART_TXFIFO_EMPTY_INT_ENA);
+    else
+        SET_PERI_REG_MASK(UART_INT_ENA(UART0), UART_TXFIFO_EMPTY_INT_ENA);
+}
+
+/******************************************************************************
+ * FunctionName : uart0_tx_queue
+ * Description  : Internal used function, copies the bytes into the tx ring.
+ *                If the ring is full, it waits until the fifo takes more
+ * Parameters   :   IN      char *buffer
+ *                  IN      int len
+ * Returns      : NONE
+*******************************************************************************/
+static void uart0_tx_queue(const char *buffer, int len)
+{
+    size_t n;
+    bool overrun = false;
+
+    if (txRing == NULL)
+    {
+        while (len-- > 0)
+            uart_tx_one_char(UART0, *buffer++);
+        return;
+    }
+
+    tx_bytes += len;
+    while (len > 0)
+    {
+        ETS_UART_INTR_DISABLE();
+        n = ringbuf_bytes_free(txRing);
+        if (n > len)
+            n = len;
+        ringbuf_memcpy_into(txRing, buffer, n);
+        uart0_tx_fill();
+        ETS_UART_INTR_ENABLE();
+
+        buffer += n;
+        len -= n;
+        if (len > 0 && n == 0 && !overrun)
+        {
+            overrun = true;
+            tx_overruns++;
+        }
+    }
+}
+
+/******************************************************************************
+ * FunctionName : uart0_tx_queue_isr
+ * Description  : Internal used function, uart0_tx_queue for the interrupt
+ *                handler. It never waits, a full ring drops the byte
+ *                (counted as overrun)
+ * Parameters   :   IN      uint8 ch
+ * Returns      : NONE
+*******************************************************************************/
+static void uart0_tx_queue_isr(uint8 ch)
+{
+    if (txRing == NULL || ringbuf_is_full(txRing))
+    {
+        tx_overruns++;
+        return;
+    }
+
+    tx_bytes++;
+    ringbuf_memcpy_into(txRing, &ch, 1);
+    uart0_tx_fill();
+}
+#endif
+
 /******************************************************************************
  * FunctionName : uart_rx_intr_disable
  * Description  : Internal used function disables the uart interrupts
@@ -320,12 +511,25 @@ static void uart0_rx_intr_handler(void *para)
                 uint8_t ch = (READ_PERI_REG(UART_FIFO(UART0)) & 0xFF);
 
                 //if (ch == '\r') ch = '\n';
+                #if _ENABLE_CONSOLE_INTEGRATION == 1
+                /* Unread bytes of a frame are never overwritten */
+                if (frame_end != 0 && ringbuf_is_full(rxBuff))
+                {
+                    rx_overflows++;
+                    continue;
+                }
+                #endif
 	        ringbuf_memcpy_into(rxBuff, &ch, 1);
                 #if _ENABLE_CONSOLE_INTEGRATION == 1
                 if (echo_on){
-		    uart_tx_one_char(uart_no, ch);
+		    uart0_tx_queue_isr(ch);
 		}
-                if (ch == '\r')
+                if (frame_end == 0 && ch == '\r')
+                {
+                    system_os_post(0, SIG_CONSOLE_RX, 0);
+                }
+                /* Binary frames have no line end, also signal half way to an overflow */
+                else if (frame_end != 0 && (ch == frame_end || ringbuf_bytes_used(rxBuff) == ringbuf_capacity(rxBuff) / 2))
                 {
                     system_os_post(0, SIG_CONSOLE_RX, 0);
                 }
@@ -362,12 +566,15 @@ static void uart0_rx_intr_handler(void *para)
     if(UART_TXFIFO_EMPTY_INT_ST == (READ_PERI_REG(UART_INT_ST(uart_no)) & UART_TXFIFO_EMPTY_INT_ST))
     {
         /* The Tx FIFO is empty, the FIFO needs to be fed with new data */
-        DBG1("Tx FIFO is empty\r\n");
         CLEAR_PERI_REG_MASK(UART_INT_ENA(UART0), UART_TXFIFO_EMPTY_INT_ENA);
 
         #if UART_BUFF_EN
             tx_start_uart_buffer(UART0);
         #endif
+        #ifdef _ENABLE_RING_BUFFER
+        if (txRing != NULL)
+            uart0_tx_fill();
+        #endif
         //system_os_post(uart_recvTaskPrio, 1, 0);
         WRITE_PERI_REG(UART_INT_CLR(uart_no), UART_TXFIFO_EMPTY_INT_CLR);
     }
@@ -460,6 +667,22 @@ LOCAL void ICACHE_FLASH_ATTR uart0_write_char_no_wait(char c)
 }
 
 
+#ifdef _ENABLE_RING_BUFFER
+/******************************************************************************
+ * FunctionName : uart0_write_char
+ * Description  : tx a single char of os_printf via the tx ring of uart 0
+ * Parameters   : char c - char to tx
+ * Returns      : NONE
+*******************************************************************************/
+LOCAL void ICACHE_FLASH_ATTR uart0_write_char(char c)
+{
+    if (c == '\n')
+        uart0_tx_queue("\r\n", 2);
+    else
+        uart0_tx_queue(&c, 1);
+}
+#endif
+
 /******************************************************************************
  * FunctionName : UART_SetPrintPort
  * Description  :
@@ -479,6 +702,11 @@ void ICACHE_FLASH_ATTR UART_SetPrintPort(uint8 uart_no)
         //os_install_putc1(uart0_write_char_no_wait);
         /*option 2: wait for a while if uart fifo is full*/
         //os_install_putc1(uart0_write_char);
+        #ifdef _ENABLE_RING_BUFFER
+        /*option 3: through the tx ring, keeps the order with UART_Send()*/
+        if (txRing != NULL)
+            os_install_putc1(uart0_write_char);
+        #endif
     }
 }
 
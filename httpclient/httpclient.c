@@ -15,6 +15,7 @@
 #include "mem.h"
 #include "limits.h"
 #include "httpclient.h"
+#include "conn_buf.h"
 
 
 // Debug output.
@@ -25,18 +26,30 @@
 #endif
 
 // Internal state.
-typedef struct {
+typedef struct request_args {
 	char * path;
 	int port;
 	char * post_data;
 	char * headers;
 	char * hostname;
-	char * buffer;
-	int buffer_size;
+	conn_buf buffer;
 	bool secure;
+	uint32_t connect_start;
+	struct espconn * conn;
+	struct request_args * next;
 	http_callback user_callback;
 } request_args;
 
+// The SDK handles only one SSL client connection at a time, and each
+// handshake needs a large temporary buffer. Further HTTPS requests
+// wait here until the active connection is closed.
+static struct espconn * secure_active = NULL;
+static request_args * secure_waiting = NULL;
+
+uint32_t http_tls_handshakes = 0;
+uint32_t http_tls_last_ms = 0;
+uint32_t http_tls_max_ms = 0;
+
 static char * ICACHE_FLASH_ATTR esp_strdup(const char * str)
 {
 	if (str == NULL) {
@@ -199,16 +212,14 @@ static void ICACHE_FLASH_ATTR receive_callback(void * arg, char * buf, unsigned
 	struct espconn * conn = (struct espconn *)arg;
 	request_args * req = (request_args *)conn->reverse;
 
-	if (req->buffer == NULL) {
+	if (req->buffer.data == NULL) {
 		return;
 	}
 
-	// Let's do the equivalent of a realloc().
-	const int new_size = req->buffer_size + len;
-	char * new_buffer;
-	if (new_size > BUFFER_SIZE_MAX || NULL == (new_buffer = (char *)os_malloc(new_size))) {
-		os_printf("Response too long (%d)\n", new_size);
-		req->buffer[0] = '\0'; // Discard the buffer to avoid using an incomplete response.
+	// The buffer grows geometrically, so a long response is not copied on every packet.
+	if (!conn_buf_append(&req->buffer, buf, len)) {
+		os_printf("Response too long (%d)\n", req->buffer.len + len + 1);
+		req->buffer.data[0] = '\0'; // Discard the buffer to avoid using an incomplete response.
 		if (req->secure)
 #ifdef HTTPCS
 			espconn_secure_disconnect(conn);
@@ -219,14 +230,6 @@ static void ICACHE_FLASH_ATTR receive_callback(void * arg, char * buf, unsigned
 			espconn_disconnect(conn);
 		return; // The disconnect callback will be called.
 	}
-
-	os_memcpy(new_buffer, req->buffer, req->buffer_size);
-	os_memcpy(new_buffer + req->buffer_size - 1 /*overwrite the null character*/, buf, len); // Append new data.
-	new_buffer[new_size - 1] = '\0'; // Make sure there is an end of string.
-
-	os_free(req->buffer);
-	req->buffer = new_buffer;
-	req->buffer_size = new_size;
 }
 
 static void ICACHE_FLASH_ATTR sent_callback(void * arg)
@@ -262,6 +265,13 @@ static void ICACHE_FLASH_ATTR connect_callback(void * arg)
 	espconn_regist_recvcb(conn, receive_callback);
 	espconn_regist_sentcb(conn, sent_callback);
 
+	if (req->secure) {
+		http_tls_handshakes++;
+		http_tls_last_ms = (system_get_time() - req->connect_start) / 1000;
+		if (http_tls_last_ms > http_tls_max_ms)
+			http_tls_max_ms = http_tls_last_ms;
+	}
+
 	const char * method = "GET";
 	char post_headers[32] = "";
 
@@ -295,42 +305,51 @@ static void ICACHE_FLASH_ATTR connect_callback(void * arg)
 	PRINTF("Sending request header\n");
 }
 
+static void ICACHE_FLASH_ATTR secure_connect(struct espconn * conn);
+
 static void ICACHE_FLASH_ATTR disconnect_callback(void * arg)
 {
 	PRINTF("Disconnected\n");
 	struct espconn *conn = (struct espconn *)arg;
+	bool start_next = false;
 
 	if(conn == NULL) {
 		return;
 	}
 
+	if (conn == secure_active) {
+		secure_active = NULL;
+		start_next = true;
+	}
+
 	if(conn->reverse != NULL) {
 		request_args * req = (request_args *)conn->reverse;
 		int http_status = -1;
 		int body_size = 0;
 		char * body = "";
-		if (req->buffer == NULL) {
+		char * buffer = req->buffer.data;
+		if (buffer == NULL) {
 			os_printf("Buffer shouldn't be NULL\n");
 		}
-		else if (req->buffer[0] != '\0') {
+		else if (buffer[0] != '\0') {
 			// FIXME: make sure this is not a partial response, using the Content-Length header.
 
 			const char * version10 = "HTTP/1.0 ";
 			const char * version11 = "HTTP/1.1 ";
-			if (os_strncmp(req->buffer, version10, strlen(version10)) != 0
-			 && os_strncmp(req->buffer, version11, strlen(version11)) != 0) {
-				os_printf("Invalid version in %s\n", req->buffer);
+			if (os_strncmp(buffer, version10, strlen(version10)) != 0
+			 && os_strncmp(buffer, version11, strlen(version11)) != 0) {
+				os_printf("Invalid version in %s\n", buffer);
 			}
 			else {
-				http_status = atoi(req->buffer + strlen(version10));
+				http_status = atoi(buffer + strlen(version10));
 				/* find body and zero terminate headers */
-				body = (char *)os_strstr(req->buffer, "\r\n\r\n") + 2;
+				body = (char *)os_strstr(buffer, "\r\n\r\n") + 2;
 				*body++ = '\0';
 				*body++ = '\0';
 
-				body_size = req->buffer_size - (body - req->buffer);
+				body_size = req->buffer.len + 1 - (body - buffer);
 
-				if(os_strstr(req->buffer, "Transfer-Encoding: chunked"))
+				if(os_strstr(buffer, "Transfer-Encoding: chunked"))
 				{
 					body_size = chunked_decode(body, body_size);
 					body[body_size] = '\0';
@@ -339,10 +358,10 @@ static void ICACHE_FLASH_ATTR disconnect_callback(void * arg)
 		}
 
 		if (req->user_callback != NULL) { // Callback is optional.
-			req->user_callback(req->hostname, req->path, body, http_status, req->buffer, body_size);
+			req->user_callback(req->hostname, req->path, body, http_status, buffer != NULL ? buffer : "", body_size);
 		}
 
-		os_free(req->buffer);
+		conn_buf_free(&req->buffer);
 		os_free(req->hostname);
 		os_free(req->path);
 		os_free(req);
@@ -352,6 +371,12 @@ static void ICACHE_FLASH_ATTR disconnect_callback(void * arg)
 		os_free(conn->proto.tcp);
 	}
 	os_free(conn);
+
+	if (start_next && secure_waiting != NULL) {
+		request_args * next = secure_waiting;
+		secure_waiting = next->next;
+		secure_connect(next->conn);
+	}
 }
 
 static void ICACHE_FLASH_ATTR error_callback(void *arg, sint8 errType)
@@ -360,6 +385,36 @@ static void ICACHE_FLASH_ATTR error_callback(void *arg, sint8 errType)
 	disconnect_callback(arg);
 }
 
+static void ICACHE_FLASH_ATTR secure_connect(struct espconn * conn)
+{
+	request_args * req = (request_args *)conn->reverse;
+
+	if (secure_active != NULL) {
+		request_args ** w;
+
+		PRINTF("HTTPS request waiting\n");
+		req->conn = conn;
+		req->next = NULL;
+		for (w = &secure_waiting; *w != NULL; w = &(*w)->next);
+		*w = req;
+		return;
+	}
+
+	secure_active = conn;
+	req->connect_start = system_get_time();
+#ifdef HTTPCS
+	espconn_secure_set_size(ESPCONN_CLIENT,5120); // set SSL buffer size
+	if (espconn_secure_connect(conn) != ESPCONN_OK) {
+		// E.g. the SSL connection of the MQTT client is in use
+		os_printf("SSL connect failed\r\n");
+		disconnect_callback(conn);
+	}
+#else
+	os_printf("SSL not available\r\n");
+	disconnect_callback(conn);
+#endif
+}
+
 static void ICACHE_FLASH_ATTR dns_callback(const char * hostname, ip_addr_t * addr, void * arg)
 {
 	request_args * req = (request_args *)arg;
@@ -369,7 +424,7 @@ static void ICACHE_FLASH_ATTR dns_callback(const char * hostname, ip_addr_t * ad
 		if (req->user_callback != NULL) {
 			req->user_callback(req->hostname, req->path, "", -1, "", 0);
 		}
-		os_free(req->buffer);
+		conn_buf_free(&req->buffer);
 		os_free(req->post_data);
 		os_free(req->headers);
 		os_free(req->path);
@@ -394,12 +449,7 @@ static void ICACHE_FLASH_ATTR dns_callback(const char * hostname, ip_addr_t * ad
 		espconn_regist_reconcb(conn, error_callback);
 
 		if (req->secure) {
-#ifdef HTTPCS
-			espconn_secure_set_size(ESPCONN_CLIENT,5120); // set SSL buffer size
-			espconn_secure_connect(conn);
-#else
-			os_printf("SSL not available\r\n");
-#endif
+			secure_connect(conn);
 		} else {
 			espconn_connect(conn);
 		}
@@ -417,10 +467,20 @@ void ICACHE_FLASH_ATTR http_raw_request(const char * hostname, int port, bool se
 	req->secure = secure;
 	req->headers = esp_strdup(headers);
 	req->post_data = esp_strdup(post_data);
-	req->buffer_size = 1;
-	req->buffer = (char *)os_malloc(1);
-	req->buffer[0] = '\0'; // Empty string.
 	req->user_callback = user_callback;
+	if (!conn_buf_init(&req->buffer, BUFFER_SIZE_MAX)) {
+		// The shared budget of the receive buffers is used up
+		os_printf("HTTP request failed (out of memory)\n");
+		if (user_callback != NULL) {
+			user_callback(req->hostname, req->path, "", -1, "", 0);
+		}
+		os_free(req->post_data);
+		os_free(req->headers);
+		os_free(req->path);
+		os_free(req->hostname);
+		os_free(req);
+		return;
+	}
 
 	ip_addr_t addr;
 	err_t error = espconn_gethostbyname((struct espconn *)req, // It seems we don't need a real espconn pointer here.
@@ -15,6 +15,9 @@
 #define HTTP_STATUS_GENERIC_ERROR  -1   // In case of TCP or DNS error the callback is called with this status.
 #define BUFFER_SIZE_MAX            5000 // Size of http responses that will cause an error.
 
+// Number and duration of the completed HTTPS handshakes.
+extern uint32_t http_tls_handshakes, http_tls_last_ms, http_tls_max_ms;
+
 /*
  * "full_response" is a string containing all response headers and the response body.
  * "response_body and "http_status" are extracted from "full_response" for convenience.
@@ -36,6 +36,7 @@
 #ifdef _ENABLE_RING_BUFFER
     #include "ringbuf.h"
     #define RX_RING_BUFFER_SIZE 250
+    #define TX_RING_BUFFER_SIZE 1024    //UART0 tx ring, fed into the fifo by the tx fifo empty interrupt
 #endif
 
 
@@ -230,5 +231,10 @@ void UART_init_console(UartBautRate uart0_br,
                        ringbuf_t txBuffer);
 
 int UART_Echo(uint8 echo);
+void UART_SetFrameEnd(uint8 end_char, ringbuf_t rxbuffer);
+uint32 UART_RxOverflows(void);
+int UART_Send(uint8 uart_no, char *buffer, int len);
+void UART_Flush(uint8 uart_no);
+void UART_TxStats(uint32 *bytes, uint32 *overruns);
 #endif
 
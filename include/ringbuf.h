@@ -137,6 +137,25 @@ ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count);
 void *
 ringbuf_memcpy_from(void *dst, ringbuf_t src, size_t count);
 
+/*
+ * Zero-copy read access: sets *span to the tail pointer of the ring
+ * buffer rb and returns the number of bytes that can be read there
+ * without a wrap (0 if rb is empty). The bytes remain in the ring
+ * buffer until they are released with ringbuf_consume; a second span
+ * follows after a wrap.
+ */
+size_t
+ringbuf_peek_span(const struct ringbuf_t *rb, const void **span);
+
+/*
+ * Release count bytes at the tail of the ring buffer rb, usually after
+ * reading them from ringbuf_peek_span. Like ringbuf_memcpy_from, it is
+ * not possible to underflow rb; if count is greater than the number of
+ * bytes used in rb, the ring buffer is not changed.
+ */
+void
+ringbuf_consume(ringbuf_t rb, size_t count);
+
 /*
  * Copy count bytes from ring buffer src, starting from its tail
  * pointer, into ring buffer dst. Returns dst's new head pointer after
@@ -0,0 +1,670 @@
+/*
+ * espconn of the host build: TCP and UDP over non-blocking sockets
+ *
+ * As in the SDK all callbacks come from the event loop: connect,
+ * receive and disconnect when the socket is ready, sent and DNS
+ * results deferred after the call that caused them. Connections
+ * accepted by a server are allocated here and freed after their
+ * disconnect callback.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+#include "espconn.h"
+#include "host.h"
+
+// lwip hands the data over segment by segment
+#define RECV_SIZE	1460
+#define MAX_INFO	16
+
+typedef struct _host_conn {
+    host_watch watch;
+    struct espconn *esp;
+    struct espconn *server;
+    int fd;
+    bool udp;
+    bool listening;
+    bool connecting;
+    bool held;
+    bool sent_pending;
+    uint8_t *out;
+    uint32_t out_len;
+    uint32_t out_size;
+    struct _host_conn *next;
+} host_conn;
+
+static host_conn *conn_list;
+static uint8 max_con = 5;
+static ip_addr_t dns_server;
+
+static void conn_io(void *ctx, uint32_t events);
+
+static host_conn *find_conn(struct espconn *esp) {
+    host_conn *hc;
+
+    for (hc = conn_list; hc != NULL; hc = hc->next) {
+	if (hc->esp == esp)
+	    return hc;
+    }
+    return NULL;
+}
+
+static host_conn *conn_new(struct espconn *esp, int fd) {
+    host_conn *hc = (host_conn *)os_zalloc(sizeof(host_conn));
+
+    if (hc == NULL)
+	return NULL;
+    hc->esp = esp;
+    hc->fd = fd;
+    hc->watch.cb = conn_io;
+    hc->watch.ctx = hc;
+    hc->next = conn_list;
+    conn_list = hc;
+    return hc;
+}
+
+static void conn_free(host_conn *hc) {
+    host_conn **p;
+
+    for (p = &conn_list; *p != NULL; p = &(*p)->next) {
+	if (*p == hc) {
+	    *p = hc->next;
+	    break;
+	}
+    }
+    host_unwatch_fd(&hc->watch);
+    host_cancel(hc);
+    if (hc->fd >= 0)
+	close(hc->fd);
+    os_free(hc->out);
+    os_free(hc);
+}
+
+static void conn_update(host_conn *hc) {
+    uint32_t events = 0;
+
+    if (!hc->held)
+	events |= EPOLLIN;
+    if (hc->connecting || hc->out_len > 0)
+	events |= EPOLLOUT;
+    host_watch_fd(&hc->watch, hc->fd, events);
+}
+
+static sint8 map_error(int err) {
+    switch (err) {
+    case ECONNREFUSED:
+    case ECONNRESET:
+	return ESPCONN_RST;
+    case ETIMEDOUT:
+	return ESPCONN_TIMEOUT;
+    case ENETUNREACH:
+    case EHOSTUNREACH:
+	return ESPCONN_RTE;
+    case ECONNABORTED:
+	return ESPCONN_ABRT;
+    default:
+	return ESPCONN_CONN;
+    }
+}
+
+/*
+ * Ends the connection and reports it with the disconnect callback
+ * (err == 0) or the reconnect callback. The state is gone before the
+ * callback runs, so the callback may connect or delete again.
+ */
+static void conn_close(host_conn *hc, sint8 err) {
+    struct espconn *esp = hc->esp;
+    bool accepted = hc->server != NULL;
+
+    conn_free(hc);
+    esp->state = ESPCONN_CLOSE;
+
+    if (err == 0) {
+	if (esp->proto.tcp->disconnect_callback != NULL)
+	    esp->proto.tcp->disconnect_callback(esp);
+    } else {
+	if (esp->proto.tcp->reconnect_callback != NULL)
+	    esp->proto.tcp->reconnect_callback(esp, err);
+    }
+
+    if (accepted) {
+	os_free(esp->proto.tcp);
+	os_free(esp);
+    }
+}
+
+static void conn_sent(void *arg) {
+    struct espconn *esp = ((host_conn *)arg)->esp;
+
+    if (esp->sent_callback != NULL)
+	esp->sent_callback(esp);
+    if (esp->type == ESPCONN_TCP && esp->proto.tcp->write_finish_fn != NULL)
+	esp->proto.tcp->write_finish_fn(esp);
+}
+
+// Returns false, if the connection is gone
+static bool conn_flush(host_conn *hc) {
+    ssize_t n;
+
+    while (hc->out_len > 0) {
+	n = send(hc->fd, hc->out, hc->out_len, MSG_NOSIGNAL);
+	if (n < 0) {
+	    if (errno == EAGAIN || errno == EINTR)
+		break;
+	    conn_close(hc, map_error(errno));
+	    return false;
+	}
+	os_memmove(hc->out, hc->out + n, hc->out_len - n);
+	hc->out_len -= n;
+    }
+    conn_update(hc);
+
+    if (hc->out_len == 0 && hc->sent_pending) {
+	hc->sent_pending = false;
+	host_defer(conn_sent, hc);
+    }
+    return true;
+}
+
+static void conn_accept(host_conn *server) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    struct espconn *esp;
+    host_conn *hc;
+    int fd, count = 0;
+
+    if ((fd = accept4(server->fd, (struct sockaddr *)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0)
+	return;
+
+    for (hc = conn_list; hc != NULL; hc = hc->next) {
+	if (hc->server != NULL)
+	    count++;
+    }
+    if (count >= max_con) {
+	close(fd);
+	return;
+    }
+
+    esp = (struct espconn *)os_zalloc(sizeof(struct espconn));
+    esp->proto.tcp = (esp_tcp *)os_zalloc(sizeof(esp_tcp));
+    // The callbacks are inherited from the server, as in the SDK
+    *esp->proto.tcp = *server->esp->proto.tcp;
+    esp->type = ESPCONN_TCP;
+    esp->state = ESPCONN_CONNECT;
+    esp->recv_callback = server->esp->recv_callback;
+    esp->sent_callback = server->esp->sent_callback;
+    esp->reverse = server->esp->reverse;
+    os_memcpy(esp->proto.tcp->remote_ip, &addr.sin_addr.s_addr, 4);
+    esp->proto.tcp->remote_port = ntohs(addr.sin_port);
+    len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr *)&addr, &len) == 0)
+	os_memcpy(esp->proto.tcp->local_ip, &addr.sin_addr.s_addr, 4);
+
+    if ((hc = conn_new(esp, fd)) == NULL) {
+	close(fd);
+	os_free(esp->proto.tcp);
+	os_free(esp);
+	return;
+    }
+    hc->server = server->esp;
+    conn_update(hc);
+
+    if (esp->proto.tcp->connect_callback != NULL)
+	esp->proto.tcp->connect_callback(esp);
+}
+
+static void conn_connected(host_conn *hc) {
+    struct espconn *esp = hc->esp;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int err = 0;
+
+    getsockopt(hc->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) {
+	conn_close(hc, map_error(err));
+	return;
+    }
+
+    hc->connecting = false;
+    esp->state = ESPCONN_CONNECT;
+    len = sizeof(addr);
+    if (getsockname(hc->fd, (struct sockaddr *)&addr, &len) == 0) {
+	os_memcpy(esp->proto.tcp->local_ip, &addr.sin_addr.s_addr, 4);
+	esp->proto.tcp->local_port = ntohs(addr.sin_port);
+    }
+    conn_update(hc);
+
+    if (esp->proto.tcp->connect_callback != NULL)
+	esp->proto.tcp->connect_callback(esp);
+}
+
+static void udp_recv(host_conn *hc) {
+    struct espconn *esp = hc->esp;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    char buf[RECV_SIZE];
+    ssize_t n;
+
+    n = recvfrom(hc->fd, buf, sizeof(buf), 0, (struct sockaddr *)&addr, &len);
+    if (n < 0)
+	return;
+    os_memcpy(esp->proto.udp->remote_ip, &addr.sin_addr.s_addr, 4);
+    esp->proto.udp->remote_port = ntohs(addr.sin_port);
+    if (esp->recv_callback != NULL)
+	esp->recv_callback(esp, buf, n);
+}
+
+static void conn_io(void *ctx, uint32_t events) {
+    host_conn *hc = (host_conn *)ctx;
+    char buf[RECV_SIZE];
+    ssize_t n;
+
+    if (hc->udp) {
+	udp_recv(hc);
+	return;
+    }
+    if (hc->listening) {
+	conn_accept(hc);
+	return;
+    }
+    if (hc->connecting) {
+	conn_connected(hc);
+	return;
+    }
+    if ((events & EPOLLOUT) && !conn_flush(hc))
+	return;
+
+    if (hc->held) {
+	if (events & (EPOLLERR | EPOLLHUP))
+	    conn_close(hc, ESPCONN_RST);
+	return;
+    }
+    if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) == 0)
+	return;
+
+    // One segment per wakeup, the callback may delete the connection
+    n = recv(hc->fd, buf, sizeof(buf), 0);
+    if (n > 0) {
+	if (hc->esp->recv_callback != NULL)
+	    hc->esp->recv_callback(hc->esp, buf, n);
+    } else if (n == 0) {
+	conn_close(hc, 0);
+    } else if (errno != EAGAIN && errno != EINTR) {
+	conn_close(hc, map_error(errno));
+    }
+}
+
+sint8 espconn_accept(struct espconn *espconn) {
+    struct sockaddr_in addr;
+    host_conn *hc;
+    int fd, on = 1;
+
+    if (espconn->type != ESPCONN_TCP || find_conn(espconn) != NULL)
+	return ESPCONN_ARG;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+	return ESPCONN_MEM;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    os_memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(espconn->proto.tcp->local_port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+	perror("espconn_accept");
+	close(fd);
+	return ESPCONN_ISCONN;
+    }
+
+    if ((hc = conn_new(espconn, fd)) == NULL) {
+	close(fd);
+	return ESPCONN_MEM;
+    }
+    hc->listening = true;
+    espconn->state = ESPCONN_LISTEN;
+    conn_update(hc);
+    return ESPCONN_OK;
+}
+
+sint8 espconn_connect(struct espconn *espconn) {
+    struct sockaddr_in addr;
+    host_conn *hc;
+    int fd;
+
+    if (espconn->type != ESPCONN_TCP)
+	return ESPCONN_ARG;
+    if (find_conn(espconn) != NULL)
+	return ESPCONN_ISCONN;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+	return ESPCONN_MEM;
+
+    os_memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    os_memcpy(&addr.sin_addr.s_addr, espconn->proto.tcp->remote_ip, 4);
+    addr.sin_port = htons(espconn->proto.tcp->remote_port);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS) {
+	sint8 err = map_error(errno);
+
+	close(fd);
+	return err;
+    }
+
+    if ((hc = conn_new(espconn, fd)) == NULL) {
+	close(fd);
+	return ESPCONN_MEM;
+    }
+    // Even a connect that is done already is reported from the event loop
+    hc->connecting = true;
+    espconn->state = ESPCONN_WAIT;
+    conn_update(hc);
+    return ESPCONN_OK;
+}
+
+static void conn_disconnect(void *arg) {
+    host_conn *hc = (host_conn *)arg;
+
+    // Last try for data that is still waiting
+    if (hc->out_len > 0)
+	send(hc->fd, hc->out, hc->out_len, MSG_NOSIGNAL);
+    shutdown(hc->fd, SHUT_RDWR);
+    conn_close(hc, 0);
+}
+
+sint8 espconn_disconnect(struct espconn *espconn) {
+    host_conn *hc = find_conn(espconn);
+
+    if (hc == NULL || hc->listening || hc->udp)
+	return ESPCONN_ARG;
+
+    host_cancel(hc);
+    host_defer(conn_disconnect, hc);
+    return ESPCONN_OK;
+}
+
+sint8 espconn_delete(struct espconn *espconn) {
+    host_conn *hc = find_conn(espconn);
+
+    if (hc != NULL)
+	conn_free(hc);
+    espconn->state = ESPCONN_CLOSE;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_create(struct espconn *espconn) {
+    struct sockaddr_in addr;
+    host_conn *hc;
+    int fd;
+
+    if (espconn->type != ESPCONN_UDP || find_conn(espconn) != NULL)
+	return ESPCONN_ARG;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+	return ESPCONN_MEM;
+
+    os_memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(espconn->proto.udp->local_port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+	close(fd);
+	return ESPCONN_ISCONN;
+    }
+
+    if ((hc = conn_new(espconn, fd)) == NULL) {
+	close(fd);
+	return ESPCONN_MEM;
+    }
+    hc->udp = true;
+    host_watch_fd(&hc->watch, fd, EPOLLIN);
+    return ESPCONN_OK;
+}
+
+static sint8 udp_send(host_conn *hc, uint8 *psent, uint16 length) {
+    struct espconn *esp = hc->esp;
+    struct sockaddr_in addr;
+
+    os_memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    os_memcpy(&addr.sin_addr.s_addr, esp->proto.udp->remote_ip, 4);
+    addr.sin_port = htons(esp->proto.udp->remote_port);
+    if (sendto(hc->fd, psent, length, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	return ESPCONN_IF;
+
+    host_defer(conn_sent, hc);
+    return ESPCONN_OK;
+}
+
+sint8 espconn_send(struct espconn *espconn, uint8 *psent, uint16 length) {
+    host_conn *hc = find_conn(espconn);
+
+    if (hc == NULL || hc->listening || hc->connecting)
+	return ESPCONN_ARG;
+    if (hc->udp)
+	return udp_send(hc, psent, length);
+
+    if (hc->out_len + length > hc->out_size) {
+	uint8_t *out = (uint8_t *)os_realloc(hc->out, hc->out_len + length);
+
+	if (out == NULL)
+	    return ESPCONN_MEM;
+	hc->out = out;
+	hc->out_size = hc->out_len + length;
+    }
+    os_memcpy(hc->out + hc->out_len, psent, length);
+    hc->out_len += length;
+    hc->sent_pending = true;
+
+    // Errors are reported later from the event loop
+    conn_update(hc);
+    return ESPCONN_OK;
+}
+
+sint8 espconn_sent(struct espconn *espconn, uint8 *psent, uint16 length) {
+    return espconn_send(espconn, psent, length);
+}
+
+sint8 espconn_regist_connectcb(struct espconn *espconn, espconn_connect_callback connect_cb) {
+    espconn->proto.tcp->connect_callback = connect_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_reconcb(struct espconn *espconn, espconn_reconnect_callback recon_cb) {
+    espconn->proto.tcp->reconnect_callback = recon_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_disconcb(struct espconn *espconn, espconn_connect_callback discon_cb) {
+    espconn->proto.tcp->disconnect_callback = discon_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb) {
+    espconn->recv_callback = recv_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_sentcb(struct espconn *espconn, espconn_sent_callback sent_cb) {
+    espconn->sent_callback = sent_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_write_finish(struct espconn *espconn, espconn_connect_callback write_finish_fn) {
+    espconn->proto.tcp->write_finish_fn = write_finish_fn;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_time(struct espconn *espconn, uint32 interval, uint8 type_flag) {
+    return ESPCONN_OK;
+}
+
+sint8 espconn_get_connection_info(struct espconn *pespconn, remot_info **pcon_info, uint8 typeflags) {
+    static remot_info info[MAX_INFO];
+    host_conn *hc;
+    int count = 0;
+
+    for (hc = conn_list; hc != NULL && count < MAX_INFO; hc = hc->next) {
+	struct espconn *esp = hc->esp;
+
+	if (esp != pespconn && hc->server != pespconn)
+	    continue;
+	if (hc->listening)
+	    continue;
+	info[count].state = esp->state;
+	info[count].remote_port = esp->proto.tcp->remote_port;
+	os_memcpy(info[count].remote_ip, esp->proto.tcp->remote_ip, 4);
+	count++;
+    }
+    pespconn->link_cnt = count;
+    *pcon_info = info;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_set_opt(struct espconn *espconn, uint8 opt) {
+    host_conn *hc = find_conn(espconn);
+    int on = 1;
+
+    if (hc != NULL && (opt & ESPCONN_NODELAY))
+	setsockopt(hc->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return ESPCONN_OK;
+}
+
+sint8 espconn_clear_opt(struct espconn *espconn, uint8 opt) {
+    return ESPCONN_OK;
+}
+
+sint8 espconn_recv_hold(struct espconn *pespconn) {
+    host_conn *hc = find_conn(pespconn);
+
+    if (hc == NULL)
+	return ESPCONN_ARG;
+    hc->held = true;
+    conn_update(hc);
+    return ESPCONN_OK;
+}
+
+sint8 espconn_recv_unhold(struct espconn *pespconn) {
+    host_conn *hc = find_conn(pespconn);
+
+    if (hc == NULL)
+	return ESPCONN_ARG;
+    hc->held = false;
+    conn_update(hc);
+    return ESPCONN_OK;
+}
+
+uint8 espconn_tcp_get_max_con(void) {
+    return max_con;
+}
+
+sint8 espconn_tcp_set_max_con(uint8 num) {
+    max_con = num;
+    return ESPCONN_OK;
+}
+
+uint32 espconn_port(void) {
+    return 49152 + os_random() % 16384;
+}
+
+/*
+ * DNS: the resolver of the host, blocking, but the result is delivered
+ * through the callback like from the SDK's DNS client
+ */
+
+typedef struct _dns_req {
+    struct espconn *esp;
+    dns_found_callback found;
+    ip_addr_t ip;
+    bool ok;
+    char name[];
+} dns_req;
+
+static void dns_done(void *arg) {
+    dns_req *req = (dns_req *)arg;
+
+    req->found(req->name, req->ok ? &req->ip : NULL, req->esp);
+    os_free(req);
+}
+
+err_t espconn_gethostbyname(struct espconn *pespconn, const char *hostname, ip_addr_t *addr, dns_found_callback found) {
+    struct addrinfo hints, *res;
+    struct in_addr in;
+    dns_req *req;
+
+    if (inet_pton(AF_INET, hostname, &in) == 1) {
+	addr->addr = in.s_addr;
+	return ESPCONN_OK;
+    }
+
+    if ((req = (dns_req *)os_zalloc(sizeof(dns_req) + os_strlen(hostname) + 1)) == NULL)
+	return ESPCONN_MEM;
+    req->esp = pespconn;
+    req->found = found;
+    os_strcpy(req->name, hostname);
+
+    os_memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(hostname, NULL, &hints, &res) == 0) {
+	req->ip.addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr;
+	req->ok = true;
+	freeaddrinfo(res);
+    }
+
+    host_defer(dns_done, req);
+    return ESPCONN_INPROGRESS;
+}
+
+void espconn_dns_setserver(char numdns, ip_addr_t *dnsserver) {
+    if (numdns == 0)
+	dns_server = *dnsserver;
+}
+
+uint32_t dns_getserver(uint8_t numdns) {
+    return numdns == 0 ? dns_server.addr : 0;
+}
+
+uint32_t ipaddr_addr(const char *cp) {
+    return inet_addr(cp);
+}
+
+/*
+ * No SSL on the host
+ */
+
+bool espconn_secure_set_size(uint8 level, uint16 size) {
+    return true;
+}
+
+sint8 espconn_secure_accept(struct espconn *espconn) {
+    return ESPCONN_ARG;
+}
+
+sint8 espconn_secure_connect(struct espconn *espconn) {
+    return ESPCONN_ARG;
+}
+
+sint8 espconn_secure_disconnect(struct espconn *espconn) {
+    return ESPCONN_ARG;
+}
+
+sint8 espconn_secure_send(struct espconn *espconn, uint8 *psent, uint16 length) {
+    return ESPCONN_ARG;
+}
+
+sint8 espconn_secure_sent(struct espconn *espconn, uint8 *psent, uint16 length) {
+    return ESPCONN_ARG;
+}
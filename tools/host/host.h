@@ -0,0 +1,48 @@
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include "c_types.h"
+
+/*
+ * Internal interface between the parts of the host shim: the event
+ * loop in main.c, the SDK calls in sdk.c, espconn.c and uart.c
+ */
+
+typedef void (*host_io_cb)(void *ctx, uint32_t events);
+
+typedef struct _host_watch {
+    host_io_cb cb;
+    void *ctx;
+    int fd;
+    bool active;
+} host_watch;
+
+// Adds the fd to the event loop or changes its events (EPOLLIN, EPOLLOUT)
+bool host_watch_fd(host_watch *w, int fd, uint32_t events);
+void host_unwatch_fd(host_watch *w);
+
+// Calls fn(arg) from the event loop, as the SDK does with its callbacks
+typedef void (*host_defer_fn)(void *arg);
+void host_defer(host_defer_fn fn, void *arg);
+// Drops all pending deferred calls with this arg
+void host_cancel(void *arg);
+
+uint32_t host_ms(void);
+
+// Runs the expired timers, returns the ms until the next one or -1
+int host_timers_run(void);
+// Dispatches one pending task event, returns false if there was none
+bool host_tasks_run(void);
+bool host_tasks_pending(void);
+
+bool host_flash_open(const char *path);
+void host_flash_sync(void);
+
+bool host_uart_open(bool use_pty);
+void host_uart_close(void);
+
+void host_wifi_start(void);
+
+extern char **host_argv;
+
+#endif /* _HOST_H_ */
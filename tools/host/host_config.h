@@ -0,0 +1,22 @@
+#ifndef _HOST_CONFIG_H_
+#define _HOST_CONFIG_H_
+
+/*
+ * Forced include (gcc -include) of the host build: the configuration
+ * of the firmware without the features that need the radio, UDP, SSL
+ * or the on-chip peripherals.
+ */
+
+#include "user_config.h"
+
+#undef MQTT_SSL_ENABLE
+#undef GPIO
+#undef GPIO_PWM
+#undef ADC
+#undef HTTPCS
+#undef JSON_PARSE
+#undef MDNS
+#undef DNS_RESP
+#undef ALLOW_SCANNING
+
+#endif /* _HOST_CONFIG_H_ */
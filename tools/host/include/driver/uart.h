@@ -0,0 +1,43 @@
+#ifndef _HOST_UART_H_
+#define _HOST_UART_H_
+
+#include "c_types.h"
+#include "eagle_soc.h"
+#include "ringbuf.h"
+
+/*
+ * The console UART of the host build: stdin/stdout or a pty instead
+ * of the UART0 registers, see tools/host/uart.c
+ */
+
+#define UART0	0
+#define UART1	1
+
+typedef enum {
+    BIT_RATE_9600   = 9600,
+    BIT_RATE_19200  = 19200,
+    BIT_RATE_38400  = 38400,
+    BIT_RATE_57600  = 57600,
+    BIT_RATE_74880  = 74880,
+    BIT_RATE_115200 = 115200,
+    BIT_RATE_230400 = 230400,
+    BIT_RATE_460800 = 460800,
+    BIT_RATE_921600 = 921600,
+} UartBautRate;
+
+void UART_init_console(UartBautRate uart0_br,
+                       uint8 recv_task_priority,
+                       ringbuf_t rxbuffer,
+                       ringbuf_t txBuffer);
+
+int UART_Echo(uint8 echo);
+void UART_SetFrameEnd(uint8 end_char, ringbuf_t rxbuffer);
+uint32 UART_RxOverflows(void);
+int UART_Recv(uint8 uart_no, char *buffer, int max_buf_len);
+int UART_Send(uint8 uart_no, char *buffer, int len);
+void UART_Flush(uint8 uart_no);
+void UART_TxStats(uint32 *bytes, uint32 *overruns);
+STATUS uart_tx_one_char(uint8 uart, uint8 TxChar);
+void uart_div_modify(uint8 uart_no, uint32 DivLatchValue);
+
+#endif /* _HOST_UART_H_ */
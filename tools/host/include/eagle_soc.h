@@ -0,0 +1,9 @@
+#ifndef _HOST_EAGLE_SOC_H_
+#define _HOST_EAGLE_SOC_H_
+
+#include "c_types.h"
+
+#define APB_CLK_FREQ		80000000
+#define UART_CLK_FREQ		APB_CLK_FREQ
+
+#endif /* _HOST_EAGLE_SOC_H_ */
@@ -0,0 +1,17 @@
+#ifndef _HOST_ETS_SYS_H_
+#define _HOST_ETS_SYS_H_
+
+#include "c_types.h"
+#include "eagle_soc.h"
+#include "os_type.h"
+
+/* There are no interrupts on the host, everything runs in the event loop */
+#define ETS_INTR_LOCK()
+#define ETS_INTR_UNLOCK()
+#define ETS_UART_INTR_ENABLE()
+#define ETS_UART_INTR_DISABLE()
+#define ETS_UART_INTR_ATTACH(func, arg)
+#define ETS_GPIO_INTR_ENABLE()
+#define ETS_GPIO_INTR_DISABLE()
+
+#endif /* _HOST_ETS_SYS_H_ */
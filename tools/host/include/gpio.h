@@ -0,0 +1,35 @@
+#ifndef _HOST_GPIO_H_
+#define _HOST_GPIO_H_
+
+/*
+ * GPIO API of the SDK. The host build runs without GPIO, the script
+ * replay (script_replay.c) implements the register access and
+ * records the pin changes.
+ */
+
+#include "c_types.h"
+
+#define GPIO_OUT_ADDRESS		0x00
+#define GPIO_ENABLE_ADDRESS		0x0c
+#define GPIO_IN_ADDRESS			0x18
+#define GPIO_STATUS_ADDRESS		0x1c
+#define GPIO_STATUS_W1TC_ADDRESS	0x24
+
+#define GPIO_ID_PIN(n)		(n)
+#define GPIO_REG_READ(reg)	gpio_reg_read(reg)
+#define GPIO_REG_WRITE(reg, val)	gpio_reg_write(reg, val)
+
+typedef enum {
+    GPIO_PIN_INTR_DISABLE = 0,
+    GPIO_PIN_INTR_POSEDGE = 1,
+    GPIO_PIN_INTR_NEGEDGE = 2,
+    GPIO_PIN_INTR_ANYEDGE = 3,
+    GPIO_PIN_INTR_LOLEVEL = 4,
+    GPIO_PIN_INTR_HILEVEL = 5
+} GPIO_INT_TYPE;
+
+uint32 gpio_reg_read(uint32 reg);
+void gpio_reg_write(uint32 reg, uint32 val);
+void gpio_pin_intr_state_set(uint32 i, GPIO_INT_TYPE intr_state);
+
+#endif /* _HOST_GPIO_H_ */
@@ -0,0 +1,42 @@
+#ifndef _HOST_IP_ADDR_H_
+#define _HOST_IP_ADDR_H_
+
+#include "c_types.h"
+
+/* Addresses are kept in network byte order, as in lwip */
+typedef struct ip_addr {
+    uint32_t addr;
+} ip_addr_t;
+
+struct ip_info {
+    struct ip_addr ip;
+    struct ip_addr netmask;
+    struct ip_addr gw;
+};
+
+#define IP4_ADDR(ipaddr, a,b,c,d) \
+	(ipaddr)->addr = ((uint32_t)((d) & 0xff) << 24) | \
+			 ((uint32_t)((c) & 0xff) << 16) | \
+			 ((uint32_t)((b) & 0xff) << 8)  | \
+			  (uint32_t)((a) & 0xff)
+
+#define ip4_addr1(ipaddr) (((uint8_t *)(ipaddr))[0])
+#define ip4_addr2(ipaddr) (((uint8_t *)(ipaddr))[1])
+#define ip4_addr3(ipaddr) (((uint8_t *)(ipaddr))[2])
+#define ip4_addr4(ipaddr) (((uint8_t *)(ipaddr))[3])
+
+#define ip4_addr1_16(ipaddr) ((uint16_t)ip4_addr1(ipaddr))
+#define ip4_addr2_16(ipaddr) ((uint16_t)ip4_addr2(ipaddr))
+#define ip4_addr3_16(ipaddr) ((uint16_t)ip4_addr3(ipaddr))
+#define ip4_addr4_16(ipaddr) ((uint16_t)ip4_addr4(ipaddr))
+
+#define IP2STR(ipaddr) ip4_addr1_16(ipaddr), \
+    ip4_addr2_16(ipaddr), \
+    ip4_addr3_16(ipaddr), \
+    ip4_addr4_16(ipaddr)
+
+#define IPSTR "%d.%d.%d.%d"
+
+uint32_t ipaddr_addr(const char *cp);
+
+#endif /* _HOST_IP_ADDR_H_ */
@@ -0,0 +1,8 @@
+#ifndef _HOST_LWIP_DEF_H_
+#define _HOST_LWIP_DEF_H_
+
+/* Byte order helpers of lwip, from the host's socket headers */
+
+#include <arpa/inet.h>
+
+#endif /* _HOST_LWIP_DEF_H_ */
@@ -0,0 +1,32 @@
+#ifndef _HOST_OS_TYPE_H_
+#define _HOST_OS_TYPE_H_
+
+#include "c_types.h"
+
+typedef uint32_t ETSSignal;
+// Wide enough for the pointers that are posted with the events
+typedef uintptr_t ETSParam;
+
+typedef struct ETSEventTag {
+    ETSSignal sig;
+    ETSParam par;
+} ETSEvent;
+
+typedef void (*ETSTask)(ETSEvent *e);
+
+typedef void ETSTimerFunc(void *timer_arg);
+
+typedef struct _ETSTIMER_ {
+    struct _ETSTIMER_ *timer_next;
+    uint32_t timer_expire;
+    uint32_t timer_period;
+    ETSTimerFunc *timer_func;
+    void *timer_arg;
+} ETSTimer;
+
+#define os_event_t	ETSEvent
+#define os_task_t	ETSTask
+#define os_timer_t	ETSTimer
+#define os_timer_func_t	ETSTimerFunc
+
+#endif /* _HOST_OS_TYPE_H_ */
@@ -0,0 +1,43 @@
+#ifndef _HOST_OSAPI_H_
+#define _HOST_OSAPI_H_
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c_types.h"
+#include "os_type.h"
+// The firmware uses system_get_time() and os_random() with just osapi.h
+#include "user_interface.h"
+
+#define os_memcpy	memcpy
+#define os_memmove	memmove
+#define os_memcmp	memcmp
+#define os_memset	memset
+#define os_bzero(s, n)	memset((s), 0, (n))
+#define os_strlen(s)	strlen((const char *)(s))
+#define os_strcmp(a, b)	strcmp((const char *)(a), (const char *)(b))
+#define os_strncmp(a, b, n) strncmp((const char *)(a), (const char *)(b), (n))
+#define os_strcpy(a, b)	strcpy((char *)(a), (const char *)(b))
+#define os_strncpy(a, b, n) strncpy((char *)(a), (const char *)(b), (n))
+#define os_strchr	strchr
+#define os_strstr	strstr
+#define os_sprintf(buf, ...) sprintf((char *)(buf), __VA_ARGS__)
+#define ets_vsprintf	sprintf
+
+#ifdef HOST_FIRMWARE
+/* The firmware's output goes through the simulated UART */
+int os_printf_plus(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+#define os_printf	os_printf_plus
+#else
+#define os_printf	printf
+#endif
+
+void os_install_putc1(void (*p)(char c));
+
+void os_timer_setfn(os_timer_t *ptimer, os_timer_func_t *pfunction, void *parg);
+void os_timer_arm(os_timer_t *ptimer, uint32_t milliseconds, bool repeat_flag);
+void os_timer_disarm(os_timer_t *ptimer);
+
+#endif /* _HOST_OSAPI_H_ */
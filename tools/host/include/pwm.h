@@ -0,0 +1,17 @@
+#ifndef _HOST_PWM_H_
+#define _HOST_PWM_H_
+
+/* PWM API of the SDK (libpwm) */
+
+#include "c_types.h"
+
+#define PWM_CHANNEL_NUM_MAX	8
+
+void pwm_init(uint32 period, uint32 *duty, uint32 pwm_channel_num, uint32 (*pin_info_list)[3]);
+void pwm_start(void);
+void pwm_set_duty(uint32 duty, uint8 channel);
+uint32 pwm_get_duty(uint8 channel);
+void pwm_set_period(uint32 period);
+uint32 pwm_get_period(void);
+
+#endif /* _HOST_PWM_H_ */
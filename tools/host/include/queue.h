@@ -0,0 +1,9 @@
+#ifndef _HOST_QUEUE_H_
+#define _HOST_QUEUE_H_
+
+#define STAILQ_ENTRY(type)						\
+struct {								\
+	struct type *stqe_next;	/* next element */			\
+}
+
+#endif /* _HOST_QUEUE_H_ */
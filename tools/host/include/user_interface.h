@@ -0,0 +1,200 @@
+#ifndef _HOST_USER_INTERFACE_H_
+#define _HOST_USER_INTERFACE_H_
+
+#include "c_types.h"
+#include "os_type.h"
+#include "ip_addr.h"
+#include "queue.h"
+#include "spi_flash.h"
+
+/*
+ * The subset of the SDK's user_interface.h used by the firmware. The
+ * implementation for the host build is in tools/host/sdk.c, the WiFi
+ * calls only keep their settings and report a station connection.
+ */
+
+enum flash_size_map {
+    FLASH_SIZE_4M_MAP_256_256 = 0,
+    FLASH_SIZE_2M,
+    FLASH_SIZE_8M_MAP_512_512,
+    FLASH_SIZE_16M_MAP_512_512,
+    FLASH_SIZE_32M_MAP_512_512,
+    FLASH_SIZE_16M_MAP_1024_1024,
+    FLASH_SIZE_32M_MAP_1024_1024
+};
+
+#define USER_TASK_PRIO_0	0
+#define USER_TASK_PRIO_1	1
+#define USER_TASK_PRIO_2	2
+#define USER_TASK_PRIO_MAX	3
+
+uint32 system_get_time(void);
+uint32 system_get_free_heap_size(void);
+void system_restart(void);
+void system_set_os_print(uint8 onoff);
+bool system_os_task(os_task_t task, uint8 prio, os_event_t *queue, uint8 qlen);
+bool system_os_post(uint8 prio, ETSSignal sig, ETSParam par);
+bool system_rtc_mem_read(uint8 src_addr, void *des_addr, uint16 load_size);
+bool system_rtc_mem_write(uint8 des_addr, const void *src_addr, uint16 save_size);
+bool system_update_cpu_freq(uint8 freq);
+uint8 system_get_cpu_freq(void);
+enum flash_size_map system_get_flash_size_map(void);
+unsigned long os_random(void);
+
+#define NULL_MODE	0x00
+#define STATION_MODE	0x01
+#define SOFTAP_MODE	0x02
+#define STATIONAP_MODE	0x03
+
+#define STATION_IF	0x00
+#define SOFTAP_IF	0x01
+
+typedef enum _auth_mode {
+    AUTH_OPEN = 0,
+    AUTH_WEP,
+    AUTH_WPA_PSK,
+    AUTH_WPA2_PSK,
+    AUTH_WPA_WPA2_PSK,
+    AUTH_MAX
+} AUTH_MODE;
+
+enum {
+    STATION_IDLE = 0,
+    STATION_CONNECTING,
+    STATION_WRONG_PASSWORD,
+    STATION_NO_AP_FOUND,
+    STATION_CONNECT_FAIL,
+    STATION_GOT_IP
+};
+
+struct softap_config {
+    uint8 ssid[32];
+    uint8 password[64];
+    uint8 ssid_len;
+    uint8 channel;
+    AUTH_MODE authmode;
+    uint8 ssid_hidden;
+    uint8 max_connection;
+    uint16 beacon_interval;
+};
+
+struct station_config {
+    uint8 ssid[32];
+    uint8 password[64];
+    uint8 bssid_set;
+    uint8 bssid[6];
+};
+
+struct dhcps_lease {
+    bool enable;
+    struct ip_addr start_ip;
+    struct ip_addr end_ip;
+};
+
+struct bss_info {
+    STAILQ_ENTRY(bss_info) next;
+    uint8 bssid[6];
+    uint8 ssid[32];
+    uint8 ssid_len;
+    uint8 channel;
+    sint8 rssi;
+    AUTH_MODE authmode;
+    uint8 is_hidden;
+};
+
+typedef void (*scan_done_cb_t)(void *arg, STATUS status);
+
+enum {
+    EVENT_STAMODE_CONNECTED = 0,
+    EVENT_STAMODE_DISCONNECTED,
+    EVENT_STAMODE_AUTHMODE_CHANGE,
+    EVENT_STAMODE_GOT_IP,
+    EVENT_STAMODE_DHCP_TIMEOUT,
+    EVENT_SOFTAPMODE_STACONNECTED,
+    EVENT_SOFTAPMODE_STADISCONNECTED,
+    EVENT_SOFTAPMODE_PROBEREQRECVED,
+    EVENT_MAX
+};
+
+typedef struct {
+    uint8 ssid[32];
+    uint8 ssid_len;
+    uint8 bssid[6];
+    uint8 channel;
+} Event_StaMode_Connected_t;
+
+typedef struct {
+    uint8 ssid[32];
+    uint8 ssid_len;
+    uint8 bssid[6];
+    uint8 reason;
+} Event_StaMode_Disconnected_t;
+
+typedef struct {
+    uint8 old_mode;
+    uint8 new_mode;
+} Event_StaMode_AuthMode_Change_t;
+
+typedef struct {
+    struct ip_addr ip;
+    struct ip_addr mask;
+    struct ip_addr gw;
+} Event_StaMode_Got_IP_t;
+
+typedef struct {
+    uint8 mac[6];
+    uint8 aid;
+} Event_SoftAPMode_StaConnected_t;
+
+typedef struct {
+    uint8 mac[6];
+    uint8 aid;
+} Event_SoftAPMode_StaDisconnected_t;
+
+typedef union {
+    Event_StaMode_Connected_t connected;
+    Event_StaMode_Disconnected_t disconnected;
+    Event_StaMode_AuthMode_Change_t auth_change;
+    Event_StaMode_Got_IP_t got_ip;
+    Event_SoftAPMode_StaConnected_t sta_connected;
+    Event_SoftAPMode_StaDisconnected_t sta_disconnected;
+} Event_Info_u;
+
+typedef struct _esp_event {
+    uint32 event;
+    Event_Info_u event_info;
+} System_Event_t;
+
+typedef void (*wifi_event_handler_cb_t)(System_Event_t *event);
+
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+
+uint8 wifi_get_opmode(void);
+bool wifi_set_opmode(uint8 opmode);
+bool wifi_station_get_config(struct station_config *config);
+bool wifi_station_set_config(struct station_config *config);
+bool wifi_station_connect(void);
+bool wifi_station_disconnect(void);
+uint8 wifi_station_get_connect_status(void);
+bool wifi_station_set_auto_connect(uint8 set);
+bool wifi_station_set_hostname(char *name);
+bool wifi_station_dhcpc_stop(void);
+bool wifi_station_scan(void *config, scan_done_cb_t cb);
+bool wifi_softap_get_config(struct softap_config *config);
+bool wifi_softap_set_config(struct softap_config *config);
+uint8 wifi_softap_get_station_num(void);
+bool wifi_softap_dhcps_start(void);
+bool wifi_softap_dhcps_stop(void);
+bool wifi_softap_set_dhcps_lease(struct dhcps_lease *please);
+bool wifi_get_ip_info(uint8 if_index, struct ip_info *info);
+bool wifi_set_ip_info(uint8 if_index, struct ip_info *info);
+bool wifi_get_macaddr(uint8 if_index, uint8 *macaddr);
+bool wifi_set_broadcast_if(uint8 interface);
+void wifi_set_event_handler_cb(wifi_event_handler_cb_t cb);
+
+// The SDK's SNTP client is not used, the firmware has its own in ntp/
+void sntp_setservername(unsigned char idx, char *server);
+void sntp_init(void);
+
+#endif /* _HOST_USER_INTERFACE_H_ */
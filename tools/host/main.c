@@ -0,0 +1,185 @@
+/*
+ * Host build of the firmware (make -C tools firmware_host)
+ *
+ * Runs user_init() and then the event loop of the SDK on a
+ * workstation: deferred SDK callbacks, task events, timers and
+ * socket/UART I/O via epoll, all in one thread. As on the ESP,
+ * a callback is never interrupted by another one.
+ *
+ * Usage: firmware_host [-f <flash file>] [-p]
+ *   -f  file with the simulated 4MB flash (default "flash.bin")
+ *   -p  console on a new pty instead of stdin/stdout
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "c_types.h"
+#include "mem.h"
+#include "host.h"
+
+#define MAX_EVENTS	16
+#define MAX_TASK_RUNS	32
+
+void user_init(void);
+
+char **host_argv;
+
+static int epoll_fd = -1;
+static struct epoll_event *batch;
+static int batch_len;
+
+typedef struct _deferred {
+    host_defer_fn fn;
+    void *arg;
+    struct _deferred *next;
+} deferred;
+
+static deferred *defer_head, *defer_tail;
+static int defer_count;
+
+bool host_watch_fd(host_watch *w, int fd, uint32_t events) {
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = w;
+    if (w->active && w->fd == fd)
+	return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0;
+
+    w->fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+	return false;
+    w->active = true;
+    return true;
+}
+
+void host_unwatch_fd(host_watch *w) {
+    int i;
+
+    if (!w->active)
+	return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->fd, NULL);
+    w->active = false;
+
+    // The watch may be freed after this, drop its events from the current batch
+    for (i = 0; i < batch_len; i++) {
+	if (batch[i].data.ptr == w)
+	    batch[i].data.ptr = NULL;
+    }
+}
+
+void host_defer(host_defer_fn fn, void *arg) {
+    deferred *d = (deferred *)os_malloc(sizeof(deferred));
+
+    if (d == NULL)
+	return;
+    d->fn = fn;
+    d->arg = arg;
+    d->next = NULL;
+    if (defer_tail != NULL)
+	defer_tail->next = d;
+    else
+	defer_head = d;
+    defer_tail = d;
+    defer_count++;
+}
+
+void host_cancel(void *arg) {
+    deferred **p = &defer_head, *d;
+
+    defer_tail = NULL;
+    while ((d = *p) != NULL) {
+	if (d->arg == arg) {
+	    *p = d->next;
+	    os_free(d);
+	    defer_count--;
+	} else {
+	    defer_tail = d;
+	    p = &d->next;
+	}
+    }
+}
+
+// Runs the calls that were pending on entry, new ones wait for the next round
+static void run_deferred(void) {
+    int n = defer_count;
+    deferred *d;
+
+    while (n-- > 0 && (d = defer_head) != NULL) {
+	defer_head = d->next;
+	if (defer_head == NULL)
+	    defer_tail = NULL;
+	defer_count--;
+	d->fn(d->arg);
+	os_free(d);
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-f <flash file>] [-p]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    struct epoll_event events[MAX_EVENTS];
+    const char *flash_file = "flash.bin";
+    bool use_pty = false;
+    int opt, i, n, timeout;
+
+    host_argv = argv;
+    while ((opt = getopt(argc, argv, "f:p")) != -1) {
+	switch (opt) {
+	case 'f':
+	    flash_file = optarg;
+	    break;
+	case 'p':
+	    use_pty = true;
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+	perror("epoll_create1");
+	return 1;
+    }
+    if (!host_flash_open(flash_file) || !host_uart_open(use_pty))
+	return 1;
+
+    user_init();
+    host_wifi_start();
+
+    while (true) {
+	run_deferred();
+	for (i = 0; i < MAX_TASK_RUNS && host_tasks_run(); i++);
+
+	timeout = host_timers_run();
+	if (defer_count > 0 || host_tasks_pending())
+	    timeout = 0;
+
+	n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("epoll_wait");
+	    return 1;
+	}
+
+	batch = events;
+	batch_len = n;
+	for (i = 0; i < n; i++) {
+	    host_watch *w = (host_watch *)events[i].data.ptr;
+
+	    if (w != NULL)
+		w->cb(w->ctx, events[i].events);
+	}
+	batch_len = 0;
+    }
+}
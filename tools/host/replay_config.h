@@ -0,0 +1,21 @@
+#ifndef _REPLAY_CONFIG_H_
+#define _REPLAY_CONFIG_H_
+
+/*
+ * Forced include (gcc -include) of the script replay: the interpreter
+ * with GPIO, PWM, ADC and HTTP, all of them simulated by
+ * script_replay.c. JSON parsing needs the json library of the SDK.
+ */
+
+#include "user_config.h"
+
+#undef MQTT_SSL_ENABLE
+#undef HTTPCS
+#undef JSON_PARSE
+#undef MDNS
+#undef DNS_RESP
+#undef ALLOW_SCANNING
+#undef TRACE
+#undef RECORDER
+
+#endif /* _REPLAY_CONFIG_H_ */
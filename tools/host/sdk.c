@@ -0,0 +1,471 @@
+/*
+ * SDK calls of the host build: timers, tasks, the flash, the RTC memory
+ * and the WiFi settings
+ */
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+#include "user_interface.h"
+#include "spi_flash.h"
+#include "driver/uart.h"
+#include "host.h"
+
+#define HOST_FLASH_SIZE		(4 * 1024 * 1024)
+// A heap as free as on a freshly booted ESP, the host does not run out
+#define HOST_FREE_HEAP		40000
+
+/*
+ * Timers: a list sorted by expiry time, as kept by the SDK in the
+ * timer_next field of the os_timer_t
+ */
+
+static os_timer_t *timer_list;
+
+static void timer_insert(os_timer_t *ptimer) {
+    os_timer_t **p;
+
+    for (p = &timer_list; *p != NULL; p = &(*p)->timer_next) {
+	if ((int32_t)((*p)->timer_expire - ptimer->timer_expire) > 0)
+	    break;
+    }
+    ptimer->timer_next = *p;
+    *p = ptimer;
+}
+
+void os_timer_disarm(os_timer_t *ptimer) {
+    os_timer_t **p;
+
+    // Compare pointers only, the timer may not be initialized yet
+    for (p = &timer_list; *p != NULL; p = &(*p)->timer_next) {
+	if (*p == ptimer) {
+	    *p = ptimer->timer_next;
+	    break;
+	}
+    }
+}
+
+void os_timer_setfn(os_timer_t *ptimer, os_timer_func_t *pfunction, void *parg) {
+    os_timer_disarm(ptimer);
+    ptimer->timer_func = pfunction;
+    ptimer->timer_arg = parg;
+    ptimer->timer_next = NULL;
+}
+
+void os_timer_arm(os_timer_t *ptimer, uint32_t milliseconds, bool repeat_flag) {
+    os_timer_disarm(ptimer);
+    ptimer->timer_expire = host_ms() + milliseconds;
+    ptimer->timer_period = repeat_flag ? milliseconds : 0;
+    timer_insert(ptimer);
+}
+
+int host_timers_run(void) {
+    uint32_t now = host_ms();
+    os_timer_t *ptimer;
+
+    while ((ptimer = timer_list) != NULL && (int32_t)(ptimer->timer_expire - now) <= 0) {
+	timer_list = ptimer->timer_next;
+	ptimer->timer_next = NULL;
+	if (ptimer->timer_period != 0) {
+	    ptimer->timer_expire += ptimer->timer_period;
+	    if ((int32_t)(ptimer->timer_expire - now) < 0)
+		ptimer->timer_expire = now + ptimer->timer_period;
+	    timer_insert(ptimer);
+	}
+	ptimer->timer_func(ptimer->timer_arg);
+	now = host_ms();
+    }
+
+    if (timer_list == NULL)
+	return -1;
+    if ((int32_t)(timer_list->timer_expire - now) < 0)
+	return 0;
+    return timer_list->timer_expire - now;
+}
+
+/*
+ * Tasks: one event queue per priority, the highest priority is served first
+ */
+
+typedef struct _host_task {
+    os_task_t task;
+    os_event_t *queue;
+    uint8 qlen;
+    uint8 head;
+    uint8 count;
+} host_task;
+
+static host_task tasks[USER_TASK_PRIO_MAX];
+
+bool system_os_task(os_task_t task, uint8 prio, os_event_t *queue, uint8 qlen) {
+    if (prio >= USER_TASK_PRIO_MAX || queue == NULL || qlen == 0)
+	return false;
+
+    tasks[prio].task = task;
+    tasks[prio].queue = queue;
+    tasks[prio].qlen = qlen;
+    tasks[prio].head = tasks[prio].count = 0;
+    return true;
+}
+
+bool system_os_post(uint8 prio, ETSSignal sig, ETSParam par) {
+    host_task *t;
+    os_event_t *e;
+
+    if (prio >= USER_TASK_PRIO_MAX)
+	return false;
+    t = &tasks[prio];
+    if (t->task == NULL || t->count == t->qlen)
+	return false;
+
+    e = &t->queue[(t->head + t->count) % t->qlen];
+    e->sig = sig;
+    e->par = par;
+    t->count++;
+    return true;
+}
+
+bool host_tasks_run(void) {
+    int prio;
+
+    for (prio = USER_TASK_PRIO_MAX - 1; prio >= 0; prio--) {
+	host_task *t = &tasks[prio];
+	os_event_t e;
+
+	if (t->count == 0)
+	    continue;
+	e = t->queue[t->head];
+	t->head = (t->head + 1) % t->qlen;
+	t->count--;
+	t->task(&e);
+	return true;
+    }
+    return false;
+}
+
+bool host_tasks_pending(void) {
+    int prio;
+
+    for (prio = 0; prio < USER_TASK_PRIO_MAX; prio++) {
+	if (tasks[prio].count != 0)
+	    return true;
+    }
+    return false;
+}
+
+/*
+ * Flash: a file mapped into memory. Erasing sets all bits of a sector,
+ * writing can only clear bits, as on the NOR flash.
+ */
+
+static uint8_t *flash;
+
+bool host_flash_open(const char *path) {
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0 || fstat(fd, &st) != 0) {
+	perror(path);
+	return false;
+    }
+    if (st.st_size < HOST_FLASH_SIZE && ftruncate(fd, HOST_FLASH_SIZE) != 0) {
+	perror(path);
+	close(fd);
+	return false;
+    }
+
+    flash = mmap(NULL, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (flash == MAP_FAILED) {
+	perror("mmap");
+	return false;
+    }
+    // A new file reads as erased flash
+    if (st.st_size < HOST_FLASH_SIZE)
+	os_memset(flash + st.st_size, 0xff, HOST_FLASH_SIZE - st.st_size);
+    return true;
+}
+
+void host_flash_sync(void) {
+    msync(flash, HOST_FLASH_SIZE, MS_SYNC);
+}
+
+SpiFlashOpResult spi_flash_erase_sector(uint16 sec) {
+    if ((sec + 1) * SPI_FLASH_SEC_SIZE > HOST_FLASH_SIZE)
+	return SPI_FLASH_RESULT_ERR;
+
+    os_memset(flash + sec * SPI_FLASH_SEC_SIZE, 0xff, SPI_FLASH_SEC_SIZE);
+    return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_write(uint32 des_addr, uint32 *src_addr, uint32 size) {
+    uint8_t *src = (uint8_t *)src_addr;
+    uint32 i;
+
+    if ((des_addr & 3) != 0 || des_addr + size > HOST_FLASH_SIZE)
+	return SPI_FLASH_RESULT_ERR;
+
+    for (i = 0; i < size; i++)
+	flash[des_addr + i] &= src[i];
+    return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_read(uint32 src_addr, uint32 *des_addr, uint32 size) {
+    if ((src_addr & 3) != 0 || src_addr + size > HOST_FLASH_SIZE)
+	return SPI_FLASH_RESULT_ERR;
+
+    os_memcpy(des_addr, flash + src_addr, size);
+    return SPI_FLASH_RESULT_OK;
+}
+
+enum flash_size_map system_get_flash_size_map(void) {
+    return FLASH_SIZE_32M_MAP_512_512;
+}
+
+/*
+ * System
+ */
+
+static void (*putc1)(char c);
+static uint8 os_print = 1;
+static uint8 cpu_freq = 80;
+// 768 bytes, unlike on the ESP not kept over a system_restart()
+static uint32_t rtc_mem[192];
+
+int os_printf_plus(const char *format, ...) {
+    char buf[512];
+    va_list args;
+    int len, i;
+
+    va_start(args, format);
+    len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len >= sizeof(buf))
+	len = sizeof(buf) - 1;
+
+    if (!os_print)
+	return len;
+    if (putc1 == NULL) {
+	UART_Send(0, buf, len);
+    } else {
+	for (i = 0; i < len; i++)
+	    putc1(buf[i]);
+    }
+    return len;
+}
+
+void os_install_putc1(void (*p)(char c)) {
+    putc1 = p;
+}
+
+void system_set_os_print(uint8 onoff) {
+    os_print = onoff;
+}
+
+uint32 system_get_free_heap_size(void) {
+    return HOST_FREE_HEAP;
+}
+
+unsigned long os_random(void) {
+    return (unsigned long)random();
+}
+
+bool system_update_cpu_freq(uint8 freq) {
+    cpu_freq = freq;
+    return true;
+}
+
+uint8 system_get_cpu_freq(void) {
+    return cpu_freq;
+}
+
+bool system_rtc_mem_read(uint8 src_addr, void *des_addr, uint16 load_size) {
+    if (src_addr * 4 + load_size > sizeof(rtc_mem))
+	return false;
+    os_memcpy(des_addr, (uint8_t *)rtc_mem + src_addr * 4, load_size);
+    return true;
+}
+
+bool system_rtc_mem_write(uint8 des_addr, const void *src_addr, uint16 save_size) {
+    if (des_addr * 4 + save_size > sizeof(rtc_mem))
+	return false;
+    os_memcpy((uint8_t *)rtc_mem + des_addr * 4, src_addr, save_size);
+    return true;
+}
+
+// The restart runs the binary again, in the same process and with the same arguments
+static void restart(void *arg) {
+    host_flash_sync();
+    host_uart_close();
+    execv("/proc/self/exe", host_argv);
+    perror("execv");
+    exit(1);
+}
+
+void system_restart(void) {
+    host_defer(restart, NULL);
+}
+
+/*
+ * WiFi: the settings are only stored. In station mode the
+ * connection succeeds right after the start, with the loopback
+ * address as IP (or the static IP, if one is set).
+ */
+
+static uint8 opmode = STATION_MODE;
+static struct station_config station_config;
+static struct softap_config softap_config;
+static struct ip_info ip_info[2];
+static bool station_got_ip;
+static wifi_event_handler_cb_t event_cb;
+static os_timer_t wifi_timer;
+
+static void wifi_connect(void *arg) {
+    System_Event_t evt;
+
+    if (event_cb == NULL || !(opmode & STATION_MODE))
+	return;
+
+    os_memset(&evt, 0, sizeof(evt));
+    evt.event = EVENT_STAMODE_CONNECTED;
+    os_memcpy(evt.event_info.connected.ssid, station_config.ssid, sizeof(station_config.ssid));
+    evt.event_info.connected.ssid_len = os_strlen(station_config.ssid);
+    evt.event_info.connected.channel = 1;
+    event_cb(&evt);
+
+    if (ip_info[STATION_IF].ip.addr == 0) {
+	IP4_ADDR(&ip_info[STATION_IF].ip, 127, 0, 0, 1);
+	IP4_ADDR(&ip_info[STATION_IF].netmask, 255, 0, 0, 0);
+	ip_info[STATION_IF].gw = ip_info[STATION_IF].ip;
+    }
+    os_memset(&evt, 0, sizeof(evt));
+    evt.event = EVENT_STAMODE_GOT_IP;
+    evt.event_info.got_ip.ip = ip_info[STATION_IF].ip;
+    evt.event_info.got_ip.mask = ip_info[STATION_IF].netmask;
+    evt.event_info.got_ip.gw = ip_info[STATION_IF].gw;
+    station_got_ip = true;
+    event_cb(&evt);
+}
+
+void host_wifi_start(void) {
+    os_timer_setfn(&wifi_timer, wifi_connect, NULL);
+    os_timer_arm(&wifi_timer, 100, 0);
+}
+
+uint8 wifi_get_opmode(void) {
+    return opmode;
+}
+
+bool wifi_set_opmode(uint8 mode) {
+    opmode = mode;
+    return true;
+}
+
+bool wifi_station_get_config(struct station_config *config) {
+    *config = station_config;
+    return true;
+}
+
+bool wifi_station_set_config(struct station_config *config) {
+    station_config = *config;
+    return true;
+}
+
+bool wifi_station_connect(void) {
+    return true;
+}
+
+bool wifi_station_disconnect(void) {
+    return true;
+}
+
+uint8 wifi_station_get_connect_status(void) {
+    return station_got_ip ? STATION_GOT_IP : STATION_CONNECTING;
+}
+
+bool wifi_station_set_auto_connect(uint8 set) {
+    return true;
+}
+
+bool wifi_station_set_hostname(char *name) {
+    return true;
+}
+
+bool wifi_station_dhcpc_stop(void) {
+    return true;
+}
+
+bool wifi_station_scan(void *config, scan_done_cb_t cb) {
+    return false;
+}
+
+bool wifi_softap_get_config(struct softap_config *config) {
+    *config = softap_config;
+    return true;
+}
+
+bool wifi_softap_set_config(struct softap_config *config) {
+    softap_config = *config;
+    return true;
+}
+
+uint8 wifi_softap_get_station_num(void) {
+    return 0;
+}
+
+bool wifi_softap_dhcps_start(void) {
+    return true;
+}
+
+bool wifi_softap_dhcps_stop(void) {
+    return true;
+}
+
+bool wifi_softap_set_dhcps_lease(struct dhcps_lease *please) {
+    return true;
+}
+
+bool wifi_get_ip_info(uint8 if_index, struct ip_info *info) {
+    if (if_index > SOFTAP_IF)
+	return false;
+    *info = ip_info[if_index];
+    return true;
+}
+
+bool wifi_set_ip_info(uint8 if_index, struct ip_info *info) {
+    if (if_index > SOFTAP_IF)
+	return false;
+    ip_info[if_index] = *info;
+    return true;
+}
+
+bool wifi_get_macaddr(uint8 if_index, uint8 *macaddr) {
+    static const uint8 mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+    os_memcpy(macaddr, mac, sizeof(mac));
+    macaddr[5] += if_index;
+    return true;
+}
+
+bool wifi_set_broadcast_if(uint8 interface) {
+    return true;
+}
+
+void wifi_set_event_handler_cb(wifi_event_handler_cb_t cb) {
+    event_cb = cb;
+}
+
+void sntp_setservername(unsigned char idx, char *server) {
+}
+
+void sntp_init(void) {
+}
@@ -0,0 +1,31 @@
+/*
+ * The system clock of the host tools: the 32 bit microsecond counter
+ * of the SDK and the millisecond clock of the timers, both counting
+ * from the start of the process like from the boot of the ESP
+ */
+
+#include <time.h>
+
+#include "c_types.h"
+#include "user_interface.h"
+#include "host.h"
+
+static uint64_t now_us(void) {
+    static uint64_t start;
+    struct timespec ts;
+    uint64_t us;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (start == 0)
+	start = us;
+    return us - start;
+}
+
+uint32 system_get_time(void) {
+    return (uint32_t)now_us();
+}
+
+uint32_t host_ms(void) {
+    return (uint32_t)(now_us() / 1000);
+}
@@ -0,0 +1,188 @@
+/*
+ * Console UART of the host build, replaces driver/new_uart.c
+ *
+ * Input comes from stdin (a terminal is switched to raw mode) or from
+ * a pty and goes through the same rx ringbuffer and SIG_CONSOLE_RX
+ * signal as the characters from the UART0 interrupt on the ESP.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "c_types.h"
+#include "osapi.h"
+#include "user_interface.h"
+#include "driver/uart.h"
+#include "host.h"
+
+static int uart_in = -1, uart_out = -1, pty_slave = -1;
+static bool tty_saved;
+static struct termios tty_attr;
+static host_watch uart_watch;
+
+static ringbuf_t rxBuff;
+static uint8 echo_on = 1;
+static uint8 frame_end = 0;
+static uint32 tx_bytes, rx_overflows;
+
+static void set_raw(int fd, bool save) {
+    struct termios attr;
+
+    if (tcgetattr(fd, &attr) != 0)
+	return;
+    if (save) {
+	tty_attr = attr;
+	tty_saved = true;
+    }
+    // Keep ISIG and OPOST, so that ^C and the os_printf() "\n" still work
+    attr.c_lflag &= ~(ICANON | ECHO);
+    attr.c_iflag &= ~(ICRNL | INLCR | IXON);
+    attr.c_cc[VMIN] = 1;
+    attr.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &attr);
+}
+
+bool host_uart_open(bool use_pty) {
+    if (!use_pty) {
+	uart_in = STDIN_FILENO;
+	uart_out = STDOUT_FILENO;
+	if (isatty(uart_in)) {
+	    set_raw(uart_in, true);
+	    atexit(host_uart_close);
+	}
+	return true;
+    }
+
+    if ((uart_in = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0 ||
+	grantpt(uart_in) != 0 || unlockpt(uart_in) != 0) {
+	perror("posix_openpt");
+	return false;
+    }
+    // Hold the slave side open, so the master does not hang up between two terminal sessions
+    if ((pty_slave = open(ptsname(uart_in), O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0) {
+	perror(ptsname(uart_in));
+	return false;
+    }
+    set_raw(pty_slave, false);
+    fcntl(uart_in, F_SETFL, O_NONBLOCK);
+    uart_out = uart_in;
+    fprintf(stderr, "Console on %s\n", ptsname(uart_in));
+    return true;
+}
+
+void host_uart_close(void) {
+    if (tty_saved)
+	tcsetattr(uart_in, TCSANOW, &tty_attr);
+}
+
+static void uart_rx(void *ctx, uint32_t events) {
+    char buf[64];
+    int len, i;
+
+    len = read(uart_in, buf, sizeof(buf));
+    if (len <= 0) {
+	// End of the input, keep running with the TCP console only
+	if (len == 0 || errno != EAGAIN)
+	    host_unwatch_fd(&uart_watch);
+	return;
+    }
+
+    for (i = 0; i < len; i++) {
+	uint8_t ch = buf[i];
+
+	if (frame_end != 0) {
+	    // Binary frames, as is
+	    if (ringbuf_is_full(rxBuff)) {
+		rx_overflows++;
+		continue;
+	    }
+	    ringbuf_memcpy_into(rxBuff, &ch, 1);
+	    if (ch == frame_end || ringbuf_bytes_used(rxBuff) == ringbuf_capacity(rxBuff) / 2)
+		system_os_post(0, SIG_CONSOLE_RX, 0);
+	    continue;
+	}
+	// Lines from a pipe end with '\n', the terminal sends '\r'
+	if (ch == '\n')
+	    ch = '\r';
+	ringbuf_memcpy_into(rxBuff, &ch, 1);
+	if (echo_on)
+	    uart_tx_one_char(UART0, ch);
+	if (ch == '\r')
+	    system_os_post(0, SIG_CONSOLE_RX, 0);
+    }
+}
+
+void UART_init_console(UartBautRate uart0_br,
+                       uint8 recv_task_priority,
+                       ringbuf_t rxbuffer,
+                       ringbuf_t txBuffer) {
+    rxBuff = rxbuffer;
+    uart_watch.cb = uart_rx;
+    host_watch_fd(&uart_watch, uart_in, EPOLLIN);
+}
+
+void uart_div_modify(uint8 uart_no, uint32 DivLatchValue) {
+    // No bit rate on the host
+}
+
+int UART_Echo(uint8 echo) {
+    echo_on = echo;
+
+    return echo_on;
+}
+
+void UART_SetFrameEnd(uint8 end_char, ringbuf_t rxbuffer) {
+    frame_end = end_char;
+    if (rxbuffer != NULL)
+	rxBuff = rxbuffer;
+}
+
+uint32 UART_RxOverflows(void) {
+    return rx_overflows;
+}
+
+int UART_Recv(uint8 uart_no, char *buffer, int max_buf_len) {
+    int bytes = ringbuf_bytes_used(rxBuff);
+
+    if (bytes > max_buf_len)
+	bytes = max_buf_len;
+    if (bytes > 0)
+	ringbuf_memcpy_from(buffer, rxBuff, bytes);
+    return bytes;
+}
+
+int UART_Send(uint8 uart_no, char *buffer, int len) {
+    int sent = 0, n;
+
+    tx_bytes += len;
+    while (sent < len) {
+	n = write(uart_out, buffer + sent, len - sent);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    // Nobody reads the pty, drop the output as the UART does
+	    break;
+	}
+	sent += n;
+    }
+    return len;
+}
+
+// The output is written synchronously, there is no tx ring to wait for
+void UART_Flush(uint8 uart_no) {
+}
+
+void UART_TxStats(uint32 *bytes, uint32 *overruns) {
+    *bytes = tx_bytes;
+    *overruns = 0;
+}
+
+STATUS uart_tx_one_char(uint8 uart, uint8 TxChar) {
+    UART_Send(uart, (char *)&TxChar, 1);
+    return OK;
+}
@@ -0,0 +1,721 @@
+/*
+ * MQTT load generator for the broker (ESP or host build)
+ *
+ * Connects a number of subscribers and publishers, publishes QoS 0
+ * messages with a timestamp in the payload and measures the delivery
+ * rate and the end to end latency at the subscribers. Optionally a set
+ * of retained topics is published and the time to deliver all of them
+ * to a new subscriber is measured. The free heap of the broker is taken
+ * from its $SYS topics (see "set sys_interval"), for the host build the
+ * peak RSS of the process can be read with -P.
+ *
+ * Usage: mqtt_bench [-h host] [-p port] [-c publishers] [-s subscribers]
+ *                   [-t topics] [-f fanout] [-w wildcard%] [-m messages]
+ *                   [-r rate] [-l payload] [-R retained] [-P pid]
+ *                   [-n name] [-o results.json]
+ *
+ * Build and run: make -C tools mqtt_bench && tools/mqtt_bench -h 192.168.4.1
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define MAX_PACKET	2048
+#define OUT_LIMIT	4096	// publish only while less than this is queued
+#define MAX_EVENTS	64
+#define KEEPALIVE	60
+#define MIN_PAYLOAD	16
+#define PAYLOAD_MAGIC	0x4d514254	// "MQBT"
+#define CONNECT_TIMEOUT	5000
+#define DRAIN_TIMEOUT	3000
+
+enum role { PUBLISHER, SUBSCRIBER, MONITOR };
+
+typedef struct _client {
+    char id[24];
+    int fd;
+    enum role role;
+    bool connected;		// CONNACK received
+    bool failed;
+    int subacks;		// SUBACKs pending
+    int pings;			// PINGRESPs pending
+    uint8_t in[MAX_PACKET + 8];
+    size_t in_len;
+    uint8_t *out;
+    size_t out_len, out_size;
+    uint64_t last_tx;
+    long to_send;
+    uint64_t next_pub;
+    int topic;
+    long received;
+} client;
+
+static struct {
+    const char *host;
+    int port;
+    int publishers, subscribers, topics, fanout, wildcard;
+    long messages;
+    int rate;
+    int payload;
+    int retained;
+    int pid;
+    const char *name;
+    const char *output;
+} opt = { "127.0.0.1", 1883, 1, 4, 8, 1, 0, 1000, 0, 64, 0, 0, "mqtt_bench", NULL };
+
+static int epfd;
+static client *clients[1024];
+static int num_clients;
+static int *sub_count;		// exact subscriptions per topic
+static int wildcard_subs;
+
+static uint32_t *lat;
+static long lat_count, lat_size;
+static long received, retained_received, sent, expected;
+static uint64_t last_rx;
+static long heap_min = -1;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void die(const char *msg) {
+    fprintf(stderr, "mqtt_bench: %s\n", msg);
+    exit(1);
+}
+
+/* Packet encoding */
+
+static void queue(client *c, const void *data, size_t len) {
+    if (c->out_len + len > c->out_size) {
+	c->out_size = (c->out_len + len) * 2;
+	if ((c->out = realloc(c->out, c->out_size)) == NULL)
+	    die("out of memory");
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+}
+
+static void queue_header(client *c, uint8_t type, size_t len) {
+    uint8_t hdr[5];
+    int n = 0;
+
+    hdr[n++] = type;
+    do {
+	hdr[n] = len % 128;
+	len /= 128;
+	if (len > 0)
+	    hdr[n] |= 0x80;
+	n++;
+    } while (len > 0);
+    queue(c, hdr, n);
+}
+
+static void queue_string(client *c, const char *s) {
+    size_t len = strlen(s);
+    uint8_t l[2] = { len >> 8, len & 0xff };
+
+    queue(c, l, 2);
+    queue(c, s, len);
+}
+
+static void flush(client *c);
+
+static void mqtt_connect(client *c, const char *client_id) {
+    static const uint8_t var_hdr[] = { 0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, KEEPALIVE };
+
+    queue_header(c, 0x10, sizeof(var_hdr) + 2 + strlen(client_id));
+    queue(c, var_hdr, sizeof(var_hdr));
+    queue_string(c, client_id);
+    flush(c);
+}
+
+static void mqtt_subscribe(client *c, const char *topic) {
+    static uint16_t packet_id;
+    uint8_t id[2], qos = 0;
+
+    packet_id = packet_id % 0xffff + 1;
+    id[0] = packet_id >> 8;
+    id[1] = packet_id & 0xff;
+    queue_header(c, 0x82, 2 + 2 + strlen(topic) + 1);
+    queue(c, id, 2);
+    queue_string(c, topic);
+    queue(c, &qos, 1);
+    c->subacks++;
+    flush(c);
+}
+
+static void mqtt_publish(client *c, const char *topic, const uint8_t *payload, size_t len, bool retain) {
+    queue_header(c, retain ? 0x31 : 0x30, 2 + strlen(topic) + len);
+    queue_string(c, topic);
+    queue(c, payload, len);
+    flush(c);
+}
+
+static void mqtt_ping(client *c) {
+    static const uint8_t ping[] = { 0xc0, 0 };
+
+    queue(c, ping, sizeof(ping));
+    c->pings++;
+    flush(c);
+}
+
+static void mqtt_disconnect(client *c) {
+    static const uint8_t disc[] = { 0xe0, 0 };
+
+    queue(c, disc, sizeof(disc));
+    flush(c);
+}
+
+/* Connection handling */
+
+static void fail(client *c, const char *why) {
+    if (!c->failed)
+	fprintf(stderr, "mqtt_bench: %s: %s\n", c->id, why);
+    c->failed = true;
+    if (c->fd >= 0) {
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+    }
+}
+
+static void watch(client *c, bool out) {
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void flush(client *c) {
+    ssize_t n;
+    bool was_blocked = c->out_len > 0;
+
+    while (c->fd >= 0 && c->out_len > 0) {
+	n = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL);
+	if (n < 0) {
+	    if (errno == EAGAIN || errno == EINPROGRESS || errno == ENOTCONN)
+		break;
+	    fail(c, strerror(errno));
+	    return;
+	}
+	memmove(c->out, c->out + n, c->out_len - n);
+	c->out_len -= n;
+	c->last_tx = now_us();
+    }
+    if (c->fd >= 0 && (c->out_len > 0 || was_blocked))
+	watch(c, c->out_len > 0);
+}
+
+static client *new_client(enum role role, const char *client_id) {
+    struct addrinfo hints = { 0 }, *res;
+    struct epoll_event ev;
+    char port[8];
+    client *c;
+    int one = 1;
+
+    if (num_clients >= sizeof(clients) / sizeof(clients[0]))
+	die("too many clients");
+    snprintf(port, sizeof(port), "%d", opt.port);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(opt.host, port, &hints, &res) != 0)
+	die("unknown host");
+
+    if ((c = calloc(1, sizeof(client))) == NULL)
+	die("out of memory");
+    snprintf(c->id, sizeof(c->id), "%s", client_id);
+    c->role = role;
+    c->last_tx = now_us();
+    c->fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, res->ai_addr, res->ai_addrlen) != 0 && errno != EINPROGRESS)
+	die(strerror(errno));
+    freeaddrinfo(res);
+
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    clients[num_clients++] = c;
+
+    mqtt_connect(c, client_id);
+    return c;
+}
+
+static void handle_publish(client *c, uint8_t flags, const uint8_t *p, size_t len) {
+    size_t topic_len, off;
+    uint32_t magic;
+    uint64_t ts;
+
+    if (len < 2)
+	return;
+    topic_len = (p[0] << 8) | p[1];
+    off = 2 + topic_len + ((flags & 0x06) ? 2 : 0);
+    if (off > len)
+	return;
+
+    if (c->role == MONITOR) {
+	char value[16];
+	size_t n = len - off < sizeof(value) - 1 ? len - off : sizeof(value) - 1;
+	long heap;
+
+	memcpy(value, p + off, n);
+	value[n] = '\0';
+	heap = atol(value);
+	if (heap > 0 && (heap_min < 0 || heap < heap_min))
+	    heap_min = heap;
+	return;
+    }
+
+    if (topic_len > 15 && memcmp(p + 2, "bench/retained/", 15) == 0) {
+	// Only the stored messages, not the forwards to the running subscriptions
+	if (flags & 0x01)
+	    retained_received++;
+	return;
+    }
+
+    if (len - off < MIN_PAYLOAD)
+	return;
+    memcpy(&magic, p + off, 4);
+    if (magic != PAYLOAD_MAGIC)
+	return;
+    memcpy(&ts, p + off + 8, 8);
+
+    c->received++;
+    received++;
+    if (lat_count == lat_size) {
+	lat_size = lat_size ? lat_size * 2 : 4096;
+	if ((lat = realloc(lat, lat_size * sizeof(uint32_t))) == NULL)
+	    die("out of memory");
+    }
+    last_rx = now_us();
+    lat[lat_count++] = last_rx - ts;
+}
+
+static void handle_packet(client *c, uint8_t type, const uint8_t *p, size_t len) {
+    switch (type >> 4) {
+    case 2:		// CONNACK
+	if (len < 2 || p[1] != 0)
+	    fail(c, "connection refused");
+	else
+	    c->connected = true;
+	break;
+    case 3:		// PUBLISH
+	handle_publish(c, type & 0x0f, p, len);
+	break;
+    case 9:		// SUBACK
+	if (len >= 3 && p[2] == 0x80)
+	    fail(c, "subscription refused");
+	c->subacks--;
+	break;
+    case 13:		// PINGRESP
+	c->pings--;
+	break;
+    }
+}
+
+static void receive(client *c) {
+    size_t pos, len, hdr;
+    ssize_t n;
+    int shift;
+
+    while (c->fd >= 0) {
+	n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+	if (n == 0 || (n < 0 && errno != EAGAIN)) {
+	    fail(c, n == 0 ? "closed by broker" : strerror(errno));
+	    return;
+	}
+	if (n < 0)
+	    return;
+	c->in_len += n;
+
+	// Split into packets, a partial one stays in the buffer
+	pos = 0;
+	while (c->in_len - pos >= 2) {
+	    len = 0;
+	    shift = 0;
+	    for (hdr = 1; hdr < 5 && pos + hdr < c->in_len; hdr++) {
+		len |= (c->in[pos + hdr] & 0x7f) << shift;
+		shift += 7;
+		if (!(c->in[pos + hdr] & 0x80))
+		    break;
+	    }
+	    if (hdr == 5 || len > MAX_PACKET) {
+		fail(c, "bad packet");
+		return;
+	    }
+	    if (pos + hdr >= c->in_len || pos + hdr + 1 + len > c->in_len)
+		break;
+	    handle_packet(c, c->in[pos], c->in + pos + hdr + 1, len);
+	    pos += hdr + 1 + len;
+	}
+	memmove(c->in, c->in + pos, c->in_len - pos);
+	c->in_len -= pos;
+    }
+}
+
+static void poll_clients(int timeout_ms) {
+    struct epoll_event events[MAX_EVENTS];
+    uint64_t now = now_us();
+    int i, n;
+
+    for (i = 0; i < num_clients; i++) {
+	if (clients[i]->fd >= 0 && now - clients[i]->last_tx > KEEPALIVE / 2 * 1000000ULL)
+	    mqtt_ping(clients[i]);
+    }
+
+    n = epoll_wait(epfd, events, MAX_EVENTS, timeout_ms);
+    for (i = 0; i < n; i++) {
+	client *c = (client *)events[i].data.ptr;
+
+	if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+	    receive(c);
+	if (c->fd >= 0 && (events[i].events & EPOLLOUT))
+	    flush(c);
+    }
+}
+
+// Runs the event loop until all clients of the role are ready or the timeout
+static bool wait_ready(enum role role, int timeout_ms) {
+    uint64_t end = now_us() + timeout_ms * 1000ULL;
+    bool ready;
+    int i;
+
+    do {
+	ready = true;
+	for (i = 0; i < num_clients; i++) {
+	    client *c = clients[i];
+
+	    if (c->role != role)
+		continue;
+	    if (c->failed)
+		return false;
+	    if (!c->connected || c->subacks > 0 || c->pings > 0 || c->out_len > 0)
+		ready = false;
+	}
+	if (ready)
+	    return true;
+	poll_clients(10);
+    } while (now_us() < end);
+    return false;
+}
+
+/* Benchmark phases */
+
+static void connect_subscribers(void) {
+    char id[32], topic[64];
+    client *c;
+    int i, k;
+
+    sub_count = calloc(opt.topics, sizeof(int));
+    for (i = 0; i < opt.subscribers; i++) {
+	snprintf(id, sizeof(id), "bench_sub_%d", i);
+	c = new_client(SUBSCRIBER, id);
+	if (i < opt.subscribers * opt.wildcard / 100) {
+	    // Alternate between the two kinds of wildcards
+	    mqtt_subscribe(c, i % 2 ? "bench/#" : "bench/+/data");
+	    wildcard_subs++;
+	} else {
+	    for (k = 0; k < opt.fanout; k++) {
+		int t = (i * opt.fanout + k) % opt.topics;
+
+		snprintf(topic, sizeof(topic), "bench/%d/data", t);
+		mqtt_subscribe(c, topic);
+		sub_count[t]++;
+	    }
+	}
+	// One at a time, the ESP only accepts a few pending connections
+	if (!wait_ready(SUBSCRIBER, CONNECT_TIMEOUT))
+	    die("subscribers failed to connect");
+    }
+}
+
+static void connect_publishers(void) {
+    char id[32];
+    client *c;
+    int i;
+
+    for (i = 0; i < opt.publishers; i++) {
+	snprintf(id, sizeof(id), "bench_pub_%d", i);
+	c = new_client(PUBLISHER, id);
+	c->topic = i % opt.topics;
+	if (!wait_ready(PUBLISHER, CONNECT_TIMEOUT))
+	    die("publishers failed to connect");
+    }
+}
+
+static void fill_payload(uint8_t *payload, long seq) {
+    uint32_t magic = PAYLOAD_MAGIC, s = seq;
+    uint64_t ts = now_us();
+
+    memcpy(payload, &magic, 4);
+    memcpy(payload + 4, &s, 4);
+    memcpy(payload + 8, &ts, 8);
+}
+
+static double run_publish(void) {
+    uint8_t *payload = malloc(opt.payload);
+    uint64_t start, now, last_sent = 0, next;
+    uint64_t interval = opt.rate > 0 ? 1000000ULL / opt.rate : 0;
+    char topic[64];
+    bool pending;
+    long seq = 0;
+    int i, timeout;
+
+    memset(payload, 'x', opt.payload);
+    start = now_us();
+    for (i = 0; i < num_clients; i++) {
+	clients[i]->to_send = opt.messages;
+	clients[i]->next_pub = start;
+    }
+
+    while (true) {
+	now = now_us();
+	pending = false;
+	next = now + 10000;
+	for (i = 0; i < num_clients; i++) {
+	    client *c = clients[i];
+
+	    if (c->role != PUBLISHER || c->fd < 0)
+		continue;
+	    while (c->to_send > 0 && c->next_pub <= now && c->out_len < OUT_LIMIT) {
+		snprintf(topic, sizeof(topic), "bench/%d/data", c->topic);
+		fill_payload(payload, seq++);
+		mqtt_publish(c, topic, payload, opt.payload, false);
+		expected += wildcard_subs + sub_count[c->topic];
+		sent++;
+		c->topic = (c->topic + 1) % opt.topics;
+		c->to_send--;
+		c->next_pub = interval ? c->next_pub + interval : now;
+		last_sent = now;
+	    }
+	    if (c->to_send > 0) {
+		pending = true;
+		if (c->out_len < OUT_LIMIT && c->next_pub < next)
+		    next = c->next_pub;
+	    }
+	}
+
+	if (!pending) {
+	    if (received >= expected || now - last_sent > DRAIN_TIMEOUT * 1000ULL)
+		break;
+	    next = now + 10000;
+	}
+	timeout = next > now ? (next - now + 999) / 1000 : 0;
+	poll_clients(timeout);
+    }
+    free(payload);
+
+    // Up to the last delivery, the drain timeout is not part of the run
+    if (last_rx > last_sent)
+	last_sent = last_rx;
+    return (last_sent - start) / 1e6;
+}
+
+static double run_retained(void) {
+    uint8_t *payload = malloc(opt.payload);
+    uint64_t start, end;
+    char topic[64];
+    client *pub, *sub;
+    int i;
+
+    memset(payload, 'r', opt.payload);
+    pub = new_client(PUBLISHER, "bench_retained_pub");
+    if (!wait_ready(PUBLISHER, CONNECT_TIMEOUT))
+	die("retained publisher failed to connect");
+    for (i = 0; i < opt.retained; i++) {
+	snprintf(topic, sizeof(topic), "bench/retained/%d", i);
+	mqtt_publish(pub, topic, payload, opt.payload, true);
+	if (pub->out_len > OUT_LIMIT)
+	    poll_clients(10);
+    }
+    // The PINGRESP comes after the broker has stored all of them
+    mqtt_ping(pub);
+    if (!wait_ready(PUBLISHER, 10000))
+	die("retained publish failed");
+
+    start = now_us();
+    sub = new_client(SUBSCRIBER, "bench_retained_sub");
+    mqtt_subscribe(sub, "bench/retained/#");
+    end = start + 10000000ULL;
+    while (retained_received < opt.retained && now_us() < end && !sub->failed)
+	poll_clients(10);
+    end = now_us();
+
+    // Clean up, an empty retained message deletes the topic
+    for (i = 0; i < opt.retained; i++) {
+	snprintf(topic, sizeof(topic), "bench/retained/%d", i);
+	mqtt_publish(pub, topic, NULL, 0, true);
+	if (pub->out_len > OUT_LIMIT)
+	    poll_clients(10);
+    }
+    mqtt_ping(pub);
+    wait_ready(PUBLISHER, 10000);
+    free(payload);
+
+    return (end - start) / 1e6;
+}
+
+static long read_rss_hwm(int pid) {
+    char path[64], line[128];
+    long kb = -1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if ((f = fopen(path, "r")) == NULL)
+	return -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+	if (sscanf(line, "VmHWM: %ld", &kb) == 1)
+	    break;
+    }
+    fclose(f);
+    return kb;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(double p) {
+    if (lat_count == 0)
+	return 0;
+    return lat[(long)(p / 100 * (lat_count - 1) + 0.5)];
+}
+
+static void print_long(FILE *f, const char *name, long value, const char *sep) {
+    if (value < 0)
+	fprintf(f, "  \"%s\": null%s\n", name, sep);
+    else
+	fprintf(f, "  \"%s\": %ld%s\n", name, value, sep);
+}
+
+static void write_results(FILE *f, double duration, double retained_time, long rss_hwm) {
+    fprintf(f, "{\n");
+    fprintf(f, "  \"name\": \"%s\",\n", opt.name);
+    fprintf(f, "  \"timestamp\": %ld,\n", (long)time(NULL));
+    fprintf(f, "  \"broker\": \"%s:%d\",\n", opt.host, opt.port);
+    fprintf(f, "  \"params\": { \"publishers\": %d, \"subscribers\": %d, \"topics\": %d, "
+	    "\"fanout\": %d, \"wildcard_pct\": %d, \"messages\": %ld, \"rate\": %d, "
+	    "\"payload\": %d, \"retained\": %d },\n",
+	    opt.publishers, opt.subscribers, opt.topics, opt.fanout, opt.wildcard,
+	    opt.messages, opt.rate, opt.payload, opt.retained);
+    fprintf(f, "  \"sent\": %ld,\n", sent);
+    fprintf(f, "  \"expected\": %ld,\n", expected);
+    fprintf(f, "  \"received\": %ld,\n", received);
+    fprintf(f, "  \"duration_s\": %.3f,\n", duration);
+    fprintf(f, "  \"publish_rate\": %.1f,\n", duration > 0 ? sent / duration : 0);
+    fprintf(f, "  \"delivery_rate\": %.1f,\n", duration > 0 ? received / duration : 0);
+    fprintf(f, "  \"latency_us\": { \"min\": %u, \"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u },\n",
+	    percentile(0), percentile(50), percentile(90), percentile(99), percentile(100));
+    if (opt.retained > 0)
+	fprintf(f, "  \"retained\": { \"count\": %d, \"received\": %ld, \"duration_s\": %.3f },\n",
+		opt.retained, retained_received, retained_time);
+    print_long(f, "broker_heap_free_min", heap_min, ",");
+    print_long(f, "host_rss_hwm_kb", rss_hwm, "");
+    fprintf(f, "}\n");
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-h host] [-p port] [-c publishers] [-s subscribers] [-t topics]\n"
+	    "          [-f fanout] [-w wildcard%%] [-m messages] [-r rate] [-l payload]\n"
+	    "          [-R retained] [-P pid] [-n name] [-o results.json]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    double duration, retained_time = 0;
+    long rss_hwm = -1;
+    FILE *f;
+    int i, c;
+
+    while ((c = getopt(argc, argv, "h:p:c:s:t:f:w:m:r:l:R:P:n:o:")) != -1) {
+	switch (c) {
+	case 'h': opt.host = optarg; break;
+	case 'p': opt.port = atoi(optarg); break;
+	case 'c': opt.publishers = atoi(optarg); break;
+	case 's': opt.subscribers = atoi(optarg); break;
+	case 't': opt.topics = atoi(optarg); break;
+	case 'f': opt.fanout = atoi(optarg); break;
+	case 'w': opt.wildcard = atoi(optarg); break;
+	case 'm': opt.messages = atol(optarg); break;
+	case 'r': opt.rate = atoi(optarg); break;
+	case 'l': opt.payload = atoi(optarg); break;
+	case 'R': opt.retained = atoi(optarg); break;
+	case 'P': opt.pid = atoi(optarg); break;
+	case 'n': opt.name = optarg; break;
+	case 'o': opt.output = optarg; break;
+	default: usage(argv[0]);
+	}
+    }
+    if (opt.publishers < 1 || opt.subscribers < 0 || opt.topics < 1 || opt.fanout < 1 ||
+	opt.wildcard < 0 || opt.wildcard > 100 || opt.messages < 0 || opt.rate < 0 ||
+	opt.publishers + opt.subscribers + 3 > sizeof(clients) / sizeof(clients[0]))
+	usage(argv[0]);
+    if (opt.fanout > opt.topics)
+	opt.fanout = opt.topics;
+    if (opt.payload < MIN_PAYLOAD)
+	opt.payload = MIN_PAYLOAD;
+
+    signal(SIGPIPE, SIG_IGN);
+    if ((epfd = epoll_create1(0)) < 0)
+	die(strerror(errno));
+
+    new_client(MONITOR, "bench_monitor");
+    mqtt_subscribe(clients[0], "$SYS/broker/heap/free/min");
+    mqtt_subscribe(clients[0], "$SYS/broker/heap/free");
+    if (!wait_ready(MONITOR, CONNECT_TIMEOUT))
+	die("cannot connect to the broker");
+
+    connect_subscribers();
+    connect_publishers();
+    duration = run_publish();
+    if (opt.retained > 0)
+	retained_time = run_retained();
+
+    for (i = 0; i < num_clients; i++) {
+	if (clients[i]->fd >= 0)
+	    mqtt_disconnect(clients[i]);
+    }
+    if (opt.pid > 0)
+	rss_hwm = read_rss_hwm(opt.pid);
+    qsort(lat, lat_count, sizeof(uint32_t), cmp_u32);
+
+    printf("%ld msgs sent, %ld of %ld received in %.3f s: %.1f msgs/s published, %.1f msgs/s delivered\n",
+	   sent, received, expected, duration, duration > 0 ? sent / duration : 0,
+	   duration > 0 ? received / duration : 0);
+    printf("latency (us): min %u, p50 %u, p90 %u, p99 %u, max %u\n",
+	   percentile(0), percentile(50), percentile(90), percentile(99), percentile(100));
+    if (opt.retained > 0)
+	printf("retained: %ld of %d delivered in %.3f s\n", retained_received, opt.retained, retained_time);
+    if (heap_min >= 0)
+	printf("broker heap free min: %ld bytes\n", heap_min);
+    if (rss_hwm >= 0)
+	printf("broker process peak RSS: %ld kB\n", rss_hwm);
+
+    if (opt.output != NULL) {
+	if ((f = fopen(opt.output, "w")) == NULL)
+	    die(strerror(errno));
+	write_results(f, duration, retained_time, rss_hwm);
+	fclose(f);
+    }
+    return received < expected ? 2 : 0;
+}
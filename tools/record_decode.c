@@ -0,0 +1,305 @@
+/*
+ * Host decoder for the recordings of the event recorder (user/recorder.c)
+ *
+ * Reads a recording, either the binary stream of the recorder port
+ * ("nc <ip> 7780 > rec.bin", starts with REC_MAGIC) or the output of
+ * "show record dump" (lines "R <hex>", all other lines of a console log
+ * are skipped), and writes one recording as a timeline for
+ * tools/script_replay, times in ms from the start of the recording:
+ *
+ *   - GPIO events are moved back by the 50ms of the debouncing, the
+ *     replay adds it again
+ *   - ADC values are written before the event that read them
+ *   - timers and alarms are written as comments, the replay runs them
+ *   - local topics published by the script itself are recorded as well,
+ *     drop them from the timeline if the script republishes them
+ *
+ * Usage: record_decode [-l] [-s <n>] [<file>]
+ *   -l  list the recordings instead
+ *   -s  the recording to decode (default: the last one)
+ *
+ * Build and run: make -C tools record_decode && tools/record_decode console.log > events.txt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "c_types.h"
+#include "recorder.h"
+
+#define PAD4(x)		(((x) + 3) & ~3)
+#define GPIO_DEBOUNCE	50
+
+typedef struct {
+    uint32_t time;
+    uint8_t type;
+    uint8_t arg;
+    uint16_t len;
+    const uint8_t *data;
+} record;
+
+static uint8_t *rec_buf;
+static size_t rec_size;
+
+static const char *type_names[REC_TYPES] = {
+    "", "start", "topic local", "topic remote", "timer", "alarm", "clock",
+    "gpio", "serial", "http", "wifi", "mqtt", "adc"
+};
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+	return c - '0';
+    if (c >= 'a' && c <= 'f')
+	return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+	return c - 'A' + 10;
+    return -1;
+}
+
+static void append(const uint8_t *data, size_t len) {
+    static size_t capacity;
+
+    if (rec_size + len > capacity) {
+	capacity = (rec_size + len) * 2 + 4096;
+	if ((rec_buf = realloc(rec_buf, capacity)) == NULL) {
+	    perror("realloc");
+	    exit(1);
+	}
+    }
+    memcpy(rec_buf + rec_size, data, len);
+    rec_size += len;
+}
+
+static void read_input(FILE *f) {
+    uint8_t raw[4096];
+    char line[1024], *p;
+    size_t n;
+    int hi, lo;
+
+    n = fread(raw, 1, 4, f);
+    if (n == 4 && (raw[0] | raw[1] << 8 | raw[2] << 16 | (uint32_t)raw[3] << 24) == REC_MAGIC) {
+	while ((n = fread(raw, 1, sizeof(raw), f)) > 0)
+	    append(raw, n);
+	return;
+    }
+
+    // A console log: the first bytes start the first line
+    memcpy(line, raw, n);
+    line[n] = '\0';
+    if (strchr(line, '\n') == NULL && fgets(line + n, sizeof(line) - n, f) == NULL && n == 0)
+	return;
+    do {
+	// The echo of the command may precede a line of a raw capture
+	for (n = strlen(line); n > 0 && (line[n - 1] == '\r' || line[n - 1] == '\n'); n--)
+	    line[n - 1] = '\0';
+	p = strrchr(line, '\r') != NULL ? strrchr(line, '\r') + 1 : line;
+	if (p[0] != 'R' || p[1] != ' ')
+	    continue;
+	for (p += 2; (hi = hex_value(p[0])) >= 0 && (lo = hex_value(p[1])) >= 0; p += 2) {
+	    uint8_t b = hi << 4 | lo;
+	    append(&b, 1);
+	}
+    } while (fgets(line, sizeof(line), f) != NULL);
+}
+
+// The record at pos, false at the end or on garbage
+static bool get_record(size_t pos, record *rec) {
+    const uint8_t *p = rec_buf + pos;
+
+    if (pos + sizeof(rec_header) > rec_size)
+	return false;
+    rec->time = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    rec->type = p[4];
+    rec->arg = p[5];
+    rec->len = p[6] | p[7] << 8;
+    rec->data = p + sizeof(rec_header);
+    return rec->type != REC_NONE && rec->type < REC_TYPES
+	&& pos + sizeof(rec_header) + rec->len <= rec_size;
+}
+
+#define NEXT_RECORD(pos, rec)	((pos) + PAD4(sizeof(rec_header) + (rec)->len))
+
+// Escapes the data as expected by script_replay
+static void print_data(const uint8_t *data, int len) {
+    int i;
+
+    for (i = 0; i < len; i++) {
+	if (data[i] == '\n')
+	    printf("\\n");
+	else if (data[i] == '\r')
+	    printf("\\r");
+	else if (data[i] == '\t')
+	    printf("\\t");
+	else if (data[i] == '\\')
+	    printf("\\\\");
+	else if (data[i] < 0x20 || data[i] >= 0x7f || (i == 0 && data[i] == ' '))
+	    printf("\\x%02x", data[i]);
+	else
+	    putchar(data[i]);
+    }
+}
+
+/*
+ * The event of a record is held back until the next record, as the ADC
+ * values read by the script are recorded after the event. Events run
+ * by the replay itself need the value 1ms before.
+ */
+static record held;
+static bool have_held;
+static uint32_t start_time, last_time, adc_time;
+
+static void print_time(uint32_t t) {
+    t -= start_time;
+    // Moved back events never go before the previous ones
+    if ((int32_t)(t - last_time) < 0)
+	t = last_time;
+    last_time = t;
+    printf("%u ", t);
+}
+
+static void print_record(const record *rec) {
+    const uint8_t *topic_end;
+
+    switch (rec->type) {
+    case REC_TOPIC_LOCAL:
+    case REC_TOPIC_REMOTE:
+	if ((topic_end = memchr(rec->data, '\0', rec->len)) == NULL)
+	    break;
+	print_time(rec->time);
+	printf("%s %s ", type_names[rec->type], rec->data);
+	print_data(topic_end + 1, rec->len - (topic_end + 1 - rec->data));
+	printf("\n");
+	break;
+    case REC_TIMER:
+    case REC_ALARM:
+	printf("# %u %s %d\n", rec->time - start_time, type_names[rec->type], rec->arg);
+	break;
+    case REC_CLOCK:
+	print_time(rec->time);
+	printf("clock %.*s\n", rec->len, rec->data);
+	break;
+    case REC_GPIO:
+	print_time(rec->time - GPIO_DEBOUNCE);
+	printf("gpio %d %d\n", rec->arg, rec->len > 0 && rec->data[0] != 0);
+	break;
+    case REC_SERIAL:
+	print_time(rec->time);
+	printf("serial ");
+	print_data(rec->data, rec->len);
+	printf("\n");
+	break;
+    case REC_HTTP:
+	if (rec->len < 2)
+	    break;
+	print_time(rec->time);
+	printf("http %d ", rec->data[0] | rec->data[1] << 8);
+	print_data(rec->data + 2, rec->len - 2);
+	printf("\n");
+	break;
+    case REC_WIFI:
+    case REC_MQTT:
+	print_time(rec->time);
+	printf("%s %s\n", type_names[rec->type], rec->arg ? "connect" : "disconnect");
+	break;
+    }
+}
+
+static void decode_record(const record *rec) {
+    if (rec->type == REC_ADC) {
+	if (rec->len < 2)
+	    return;
+	print_time(adc_time);
+	printf("adc %d\n", rec->data[0] | rec->data[1] << 8);
+	return;
+    }
+
+    if (have_held) {
+	print_record(&held);
+	have_held = false;
+    }
+    if (rec->type == REC_GPIO || rec->type == REC_TIMER || rec->type == REC_ALARM) {
+	print_record(rec);
+	adc_time = rec->time - 1;
+    } else {
+	held = *rec;
+	have_held = true;
+	adc_time = rec->time;
+    }
+}
+
+int main(int argc, char **argv) {
+    record rec;
+    size_t pos, start = 0;
+    uint32_t end_time = 0;
+    int opt, n, session = -1, sessions = 0;
+    bool list = false;
+    FILE *f = stdin;
+
+    while ((opt = getopt(argc, argv, "ls:")) != -1) {
+	switch (opt) {
+	case 'l':
+	    list = true;
+	    break;
+	case 's':
+	    session = atoi(optarg);
+	    break;
+	default:
+	    fprintf(stderr, "Usage: %s [-l] [-s <n>] [<file>]\n", argv[0]);
+	    return 1;
+	}
+    }
+    if (optind < argc && (f = fopen(argv[optind], "rb")) == NULL) {
+	perror(argv[optind]);
+	return 1;
+    }
+    read_input(f);
+
+    // Recordings start with REC_START, records before the first one are
+    // the rest of a recording overwritten in the flash ring
+    for (pos = 0, n = 0; get_record(pos, &rec); pos = NEXT_RECORD(pos, &rec), n++) {
+	if (rec.type == REC_START || pos == 0) {
+	    if (list && sessions > 0)
+		printf("%d records, %u ms\n", n, last_time - start_time);
+	    if (list)
+		printf("%d: %s at %u ms after boot, ", sessions, rec.type == REC_START ? "start" : "partial", rec.time);
+	    if (sessions == session || session < 0)
+		start = pos;
+	    start_time = rec.time;
+	    sessions++;
+	    n = 0;
+	}
+	last_time = rec.time;
+    }
+    if (list) {
+	if (sessions > 0)
+	    printf("%d records, %u ms\n", n, last_time - start_time);
+	return 0;
+    }
+    if (pos < rec_size)
+	fprintf(stderr, "Invalid record at byte %zu, ignoring the rest\n", pos);
+    if (sessions == 0 || session >= sessions) {
+	fprintf(stderr, "No recording %d\n", session);
+	return 1;
+    }
+
+    get_record(start, &rec);
+    start_time = rec.time;
+    last_time = 0;
+    if (rec.type == REC_START)
+	printf("# Recording %d, firmware %.*s\n", session < 0 ? sessions - 1 : session, rec.len, rec.data);
+    else
+	printf("# Recording %d, partial\n", session < 0 ? sessions - 1 : session);
+
+    for (pos = start; get_record(pos, &rec); pos = NEXT_RECORD(pos, &rec)) {
+	if (rec.type == REC_START && pos != start)
+	    break;
+	decode_record(&rec);
+	end_time = rec.time - start_time;
+    }
+    if (have_held)
+	print_record(&held);
+    printf("%u end\n", end_time > last_time ? end_time : last_time);
+    return 0;
+}
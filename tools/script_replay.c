@@ -0,0 +1,937 @@
+/*
+ * Deterministic replay of a timeline of events against a script
+ *
+ * The script is loaded with the interpreter of the firmware (user/lang.c:
+ * text_into_tokens(), interpreter_syntax_check(), interpreter_config()
+ * and parse_statement()), then the events of the timeline are fed to it
+ * in virtual time. Timers, the GPIO debouncing and the alarms run on the
+ * same virtual clock, so a replay always gives the same output. Every
+ * event and its effects (publishes, subscriptions, GPIO and PWM writes,
+ * serial output, HTTP requests, commands and prints) are written to
+ * stdout, followed by the cost of the interpreter per kind of event and
+ * per clause.
+ *
+ * Usage: script_replay [-l] [-q] [-T] [-c HH:MM:SS] [-e <ms>] <script> [<timeline>]
+ *   -l  log of the interpreter ("set script_logging 1")
+ *   -q  no event output, only the summary (benchmarks)
+ *   -T  no timing in the summary (output for a diff)
+ *   -c  start of the wall clock, "on alarm" needs a time
+ *   -e  run the timers until this time after the last event
+ *
+ * The timeline (stdin if not given) has one event per line, time in ms
+ * from the start of the script or "+<ms>" after the previous event.
+ * In the data "\n", "\r", "\t", "\\" and "\xNN" are escaped:
+ *
+ *   <ms> topic local|remote <topic> [<data>]
+ *   <ms> retained <topic> <data>	retained message in the broker, no event
+ *   <ms> serial <line>
+ *   <ms> gpio <pin> 0|1		input level, "on gpio_interrupt" after 50ms
+ *   <ms> adc <value>
+ *   <ms> http <status> [<body>]	response to the last http_get/http_post
+ *   <ms> wifi connect|disconnect
+ *   <ms> mqtt connect|disconnect
+ *   <ms> clock HH:MM:SS [<weekday>]
+ *   <ms> end			run the timers up to this time and stop
+ *
+ * Build and run: make -C tools script_replay && tools/script_replay script.txt events.txt
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+#include "gpio.h"
+#include "pwm.h"
+#include "global.h"
+#include "remote_queue.h"
+#include "sub_refs.h"
+#include "easygpio.h"
+#include "adc.h"
+#include "httpclient.h"
+
+#define MAX_LINE	1024
+#define MAX_PINS	17
+#define CLOCK_TICK	1000
+
+void interpreter_http_reply(char *hostname, char *path, char *response_body, int http_status, char *response_headers, int body_size);
+
+sysconfig_t config;
+uint8_t *my_script;
+MQTT_Client mqttClient;
+bool mqtt_enabled, mqtt_connected;
+
+static bool quiet, no_timing;
+static uint32_t vtime;			// virtual ms since the start of the script
+static char quiet_event[64];		// printed only if the event has effects
+
+typedef enum { EV_INIT, EV_TOPIC_LOCAL, EV_TOPIC_REMOTE, EV_TIMER, EV_CLOCK, EV_SERIAL,
+	       EV_GPIO, EV_HTTP, EV_WIFI, EV_MQTT, EV_TYPES } event_type;
+static const char *event_names[EV_TYPES] = { "init", "topic local", "topic remote", "timer",
+	"clock", "serial", "gpio", "http", "wifi", "mqtt" };
+
+static struct {
+    unsigned long count;
+    uint64_t total_ns, max_ns;
+} costs[EV_TYPES];
+static uint64_t event_start;
+
+/* Output */
+
+static void emit(bool effect, const char *fmt, ...) {
+    va_list ap;
+
+    if (quiet)
+	return;
+    if (quiet_event[0] != '\0') {
+	printf("%9u %s\n", vtime, quiet_event);
+	quiet_event[0] = '\0';
+    }
+    printf("%9u %s", vtime, effect ? "  " : "");
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+}
+
+#define event_line(...)	emit(false, __VA_ARGS__)
+#define effect_line(...)	emit(true, __VA_ARGS__)
+
+// Printable form of data, as in the timeline
+static const char *escape(const uint8_t *data, int len) {
+    static char buf[MAX_LINE];
+    int i, pos = 0;
+
+    for (i = 0; i < len && pos < sizeof(buf) - 8; i++) {
+	if (data[i] == '\\')
+	    pos += sprintf(buf + pos, "\\\\");
+	else if (data[i] == '\n')
+	    pos += sprintf(buf + pos, "\\n");
+	else if (data[i] == '\r')
+	    pos += sprintf(buf + pos, "\\r");
+	else if (data[i] == '\t')
+	    pos += sprintf(buf + pos, "\\t");
+	else if (data[i] < ' ' || data[i] > '~')
+	    pos += sprintf(buf + pos, "\\x%02x", data[i]);
+	else
+	    buf[pos++] = data[i];
+    }
+    if (i < len)
+	pos += sprintf(buf + pos, "...");
+    buf[pos] = '\0';
+    return buf;
+}
+
+static int unescape(char *s) {
+    char *p = s, *q = s;
+
+    while (*p != '\0') {
+	if (*p != '\\' || p[1] == '\0') {
+	    *q++ = *p++;
+	    continue;
+	}
+	p++;
+	switch (*p) {
+	case 'n': *q++ = '\n'; p++; break;
+	case 'r': *q++ = '\r'; p++; break;
+	case 't': *q++ = '\t'; p++; break;
+	case 'x':
+	    *q++ = strtol((char[3]){ p[1], p[1] ? p[2] : 0, 0 }, NULL, 16);
+	    p += p[1] && p[2] ? 3 : 2;
+	    break;
+	default: *q++ = *p++;
+	}
+    }
+    *q = '\0';
+    return q - s;
+}
+
+/* Cost of the interpreter */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void cost_start(void) {
+    event_start = now_ns();
+}
+
+static void cost_end(event_type type) {
+    uint64_t ns = now_ns() - event_start;
+
+    costs[type].count++;
+    costs[type].total_ns += ns;
+    if (ns > costs[type].max_ns)
+	costs[type].max_ns = ns;
+}
+
+/* Virtual timers, same ordering as in the SDK shim (host/sdk.c) */
+
+static os_timer_t *timer_list;
+
+static void timer_insert(os_timer_t *ptimer) {
+    os_timer_t **p;
+
+    for (p = &timer_list; *p != NULL; p = &(*p)->timer_next) {
+	if ((int32_t)((*p)->timer_expire - ptimer->timer_expire) > 0)
+	    break;
+    }
+    ptimer->timer_next = *p;
+    *p = ptimer;
+}
+
+void os_timer_disarm(os_timer_t *ptimer) {
+    os_timer_t **p;
+
+    for (p = &timer_list; *p != NULL; p = &(*p)->timer_next) {
+	if (*p == ptimer) {
+	    *p = ptimer->timer_next;
+	    break;
+	}
+    }
+}
+
+void os_timer_setfn(os_timer_t *ptimer, os_timer_func_t *pfunction, void *parg) {
+    os_timer_disarm(ptimer);
+    ptimer->timer_func = pfunction;
+    ptimer->timer_arg = parg;
+    ptimer->timer_next = NULL;
+}
+
+void os_timer_arm(os_timer_t *ptimer, uint32_t milliseconds, bool repeat_flag) {
+    os_timer_disarm(ptimer);
+    ptimer->timer_expire = vtime + milliseconds;
+    ptimer->timer_period = repeat_flag ? milliseconds : 0;
+    timer_insert(ptimer);
+}
+
+/* Wall clock (NTP) */
+
+static bool clock_set;
+static int32_t clock_base;		// seconds of the day at vtime 0
+static int clock_weekday;
+static uint32_t next_tick;
+static const char *weekdays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+
+static bool set_clock(const char *timestr, const char *weekday) {
+    int h, m, s, i;
+
+    if (sscanf(timestr, "%d:%d:%d", &h, &m, &s) != 3)
+	return false;
+    clock_base = h * 3600 + m * 60 + s - vtime / 1000;
+    if (weekday != NULL) {
+	for (i = 0; i < 7; i++) {
+	    if (strcasecmp(weekday, weekdays[i]) == 0)
+		clock_weekday = i;
+	}
+    }
+    if (!clock_set)
+	next_tick = (vtime / CLOCK_TICK + 1) * CLOCK_TICK;
+    clock_set = true;
+    return true;
+}
+
+bool ntp_sync_done() {
+    return clock_set;
+}
+
+uint8_t *get_timestr() {
+    static char buf[16];
+    int32_t t = clock_base + vtime / 1000;
+
+    t = (t % 86400 + 86400) % 86400;
+    sprintf(buf, "%02d:%02d:%02d", t / 3600, (t / 60) % 60, t % 60);
+    return (uint8_t *)buf;
+}
+
+uint8_t *get_weekday() {
+    int32_t t = clock_base + vtime / 1000;
+    int days = t >= 0 ? t / 86400 : (t - 86399) / 86400;
+
+    return (uint8_t *)weekdays[((clock_weekday + days) % 7 + 7) % 7];
+}
+
+/* Broker: local subscriptions, retained messages and local deliveries */
+
+typedef struct _message {
+    char *topic;
+    uint8_t *data;
+    int data_len;
+    struct _message *next;
+} message;
+
+static message *retained_list;
+static message *pending_head, *pending_tail;
+static char **local_subs;
+static int local_sub_count;
+
+static bool filter_matches(const char *filter, const char *topic) {
+    while (*filter != '\0' && *topic != '\0') {
+	if (*filter == '#')
+	    return true;
+	if (*filter == '+') {
+	    filter++;
+	    while (*topic != '\0' && *topic != '/')
+		topic++;
+	    continue;
+	}
+	if (*filter != *topic)
+	    return false;
+	filter++;
+	topic++;
+    }
+    if (*filter == '\0' && *topic == '\0')
+	return true;
+    return os_strcmp(filter, "/#") == 0 || os_strcmp(filter, "#") == 0 || os_strcmp(filter, "+") == 0;
+}
+
+int Topics_matches(char *wildTopic, int wildcards, char *topic) {
+    return wildcards ? filter_matches(wildTopic, topic) : os_strcmp(wildTopic, topic) == 0;
+}
+
+int Topics_hasWildcards(char *topic) {
+    return os_strchr(topic, '+') != NULL || os_strchr(topic, '#') != NULL;
+}
+
+static message *new_message(const char *topic, const uint8_t *data, int data_len) {
+    message *m = (message *)os_zalloc(sizeof(message));
+
+    m->topic = strdup(topic);
+    m->data = (uint8_t *)os_malloc(data_len + 1);
+    os_memcpy(m->data, data, data_len);
+    m->data[data_len] = '\0';
+    m->data_len = data_len;
+    return m;
+}
+
+static void free_message(message *m) {
+    os_free(m->topic);
+    os_free(m->data);
+    os_free(m);
+}
+
+static void update_retained(const char *topic, const uint8_t *data, int data_len) {
+    message **p, *m;
+
+    for (p = &retained_list; (m = *p) != NULL; p = &m->next) {
+	if (os_strcmp(m->topic, topic) == 0) {
+	    *p = m->next;
+	    free_message(m);
+	    break;
+	}
+    }
+    if (data_len == 0)
+	return;
+    m = new_message(topic, data, data_len);
+    m->next = retained_list;
+    retained_list = m;
+}
+
+bool retained_index_find(uint8_t *topic, find_retainedtopic_cb cb, void *user_data) {
+    retained_entry entry;
+    bool found = false;
+    message *m;
+
+    for (m = retained_list; m != NULL; m = m->next) {
+	if (!filter_matches((char *)topic, m->topic))
+	    continue;
+	found = true;
+	entry.topic = (uint8_t *)m->topic;
+	entry.data = m->data;
+	entry.data_len = m->data_len;
+	entry.qos = 0;
+	if (cb(&entry, user_data))
+	    break;
+    }
+    return found;
+}
+
+// Delivered to the script after the current event, as with pub_list on the ESP
+static bool queue_local(const char *topic, const uint8_t *data, int data_len) {
+    message *m;
+    int i;
+
+    for (i = 0; i < local_sub_count; i++) {
+	if (filter_matches(local_subs[i], topic))
+	    break;
+    }
+    if (i == local_sub_count)
+	return false;
+    m = new_message(topic, data, data_len);
+    if (pending_tail != NULL)
+	pending_tail->next = m;
+    else
+	pending_head = m;
+    pending_tail = m;
+    return true;
+}
+
+static void deliver_topic(const char *topic, const uint8_t *data, int data_len, bool local) {
+    event_line("topic %s %s %s", local ? "local" : "remote", topic, escape(data, data_len));
+    cost_start();
+    interpreter_topic_received(topic, (const char *)data, data_len, local);
+    cost_end(local ? EV_TOPIC_LOCAL : EV_TOPIC_REMOTE);
+}
+
+static void deliver_pending(void) {
+    message *m;
+
+    while ((m = pending_head) != NULL) {
+	pending_head = m->next;
+	if (pending_head == NULL)
+	    pending_tail = NULL;
+	deliver_topic(m->topic, m->data, m->data_len, true);
+	free_message(m);
+    }
+}
+
+bool MQTT_local_publish(uint8_t *topic, uint8_t *data, uint16_t data_length, uint8_t qos, uint8_t retain) {
+    effect_line("publish local %s %s%s", topic, escape(data, data_length), retain ? " (retained)" : "");
+    if (retain)
+	update_retained((char *)topic, data, data_length);
+    queue_local((char *)topic, data, data_length);
+    return true;
+}
+
+bool MQTT_local_subscribe(uint8_t *topic, uint8_t qos) {
+    message *m;
+
+    effect_line("subscribe local %s", topic);
+    local_subs = (char **)os_realloc(local_subs, (local_sub_count + 1) * sizeof(char *));
+    local_subs[local_sub_count++] = strdup((char *)topic);
+
+    // The broker sends the matching retained messages to a new subscription
+    for (m = retained_list; m != NULL; m = m->next) {
+	if (filter_matches((char *)topic, m->topic))
+	    queue_local(m->topic, m->data, m->data_len);
+    }
+    return true;
+}
+
+bool MQTT_local_unsubscribe(uint8_t *topic) {
+    int i;
+
+    effect_line("unsubscribe local %s", topic);
+    for (i = 0; i < local_sub_count; i++) {
+	if (os_strcmp(local_subs[i], topic) == 0) {
+	    os_free(local_subs[i]);
+	    local_subs[i] = local_subs[--local_sub_count];
+	    return true;
+	}
+    }
+    return false;
+}
+
+/* Remote broker */
+
+bool remote_publish(const char *topic, const char *data, uint32_t data_len, uint8_t qos, uint8_t retain) {
+    effect_line("publish remote %s %s%s", topic, escape((uint8_t *)data, data_len), retain ? " (retained)" : "");
+    return true;
+}
+
+BOOL MQTT_Subscribe(MQTT_Client *client, char *topic, uint8_t qos) {
+    effect_line("subscribe remote %s", topic);
+    return true;
+}
+
+BOOL MQTT_UnSubscribe(MQTT_Client *client, char *topic) {
+    effect_line("unsubscribe remote %s", topic);
+    return true;
+}
+
+/* GPIO, PWM and ADC */
+
+static uint8_t pin_level[MAX_PINS];
+static GPIO_INT_TYPE pin_intr[MAX_PINS];
+static uint32_t gpio_status;
+static void (*gpio_handler)(void *arg);
+static void *gpio_handler_arg;
+static uint32_t pwm_pins[PWM_CHANNEL_NUM_MAX];
+static uint16 adc_value;
+
+bool easygpio_pinMode(uint8_t gpio_pin, EasyGPIO_PullStatus pullStatus, EasyGPIO_PinMode pinMode) {
+    if (gpio_pin >= MAX_PINS)
+	return false;
+    if (pinMode == EASYGPIO_INPUT)
+	pin_level[gpio_pin] = pullStatus == EASYGPIO_PULLUP;
+    return true;
+}
+
+bool easygpio_attachInterrupt(uint8_t gpio_pin, EasyGPIO_PullStatus pullStatus, void (*interruptHandler)(void *arg), void *interruptArg) {
+    gpio_handler = interruptHandler;
+    gpio_handler_arg = interruptArg;
+    return gpio_pin < MAX_PINS;
+}
+
+uint8_t easygpio_inputGet(uint8_t gpio_pin) {
+    return gpio_pin < MAX_PINS ? pin_level[gpio_pin] : 0;
+}
+
+void easygpio_outputSet(uint8_t gpio_pin, uint8_t value) {
+    effect_line("gpio_out %d %d", gpio_pin, value);
+    if (gpio_pin < MAX_PINS)
+	pin_level[gpio_pin] = value;
+}
+
+void gpio_pin_intr_state_set(uint32 i, GPIO_INT_TYPE intr_state) {
+    if (i < MAX_PINS)
+	pin_intr[i] = intr_state;
+}
+
+uint32 gpio_reg_read(uint32 reg) {
+    uint32 in = 0;
+    int i;
+
+    if (reg == GPIO_STATUS_ADDRESS)
+	return gpio_status;
+    if (reg == GPIO_IN_ADDRESS) {
+	for (i = 0; i < MAX_PINS; i++)
+	    in |= pin_level[i] ? BIT(i) : 0;
+    }
+    return in;
+}
+
+void gpio_reg_write(uint32 reg, uint32 val) {
+    if (reg == GPIO_STATUS_W1TC_ADDRESS)
+	gpio_status &= ~val;
+}
+
+static void gpio_input(int pin, int level) {
+    level = level != 0;
+    if (pin_level[pin] == level)
+	return;
+    pin_level[pin] = level;
+    if (gpio_handler == NULL || pin_intr[pin] == GPIO_PIN_INTR_DISABLE)
+	return;
+    // The interrupt, the clause runs after the debounce timer
+    gpio_status |= BIT(pin);
+    gpio_handler(gpio_handler_arg);
+}
+
+void pwm_init(uint32 period, uint32 *duty, uint32 pwm_channel_num, uint32 (*pin_info_list)[3]) {
+    int i;
+
+    for (i = 0; i < pwm_channel_num && i < PWM_CHANNEL_NUM_MAX; i++)
+	pwm_pins[i] = pin_info_list[i][2];
+}
+
+void pwm_set_duty(uint32 duty, uint8 channel) {
+    effect_line("gpio_pwm %d %u", channel < PWM_CHANNEL_NUM_MAX ? pwm_pins[channel] : -1, duty);
+}
+
+void pwm_start(void) {
+}
+
+uint16 adc_read(void) {
+    return adc_value;
+}
+
+/* HTTP client */
+
+static http_callback http_cb;
+static char http_url[MAX_LINE];
+
+void http_get(const char *url, const char *headers, http_callback user_callback) {
+    effect_line("http_get %s", url);
+    snprintf(http_url, sizeof(http_url), "%s", url);
+    http_cb = user_callback;
+}
+
+void http_post(const char *url, const char *post_data, const char *headers, http_callback user_callback) {
+    effect_line("http_post %s %s", url, escape((uint8_t *)post_data, os_strlen(post_data)));
+    snprintf(http_url, sizeof(http_url), "%s", url);
+    http_cb = user_callback;
+}
+
+static void http_response(int status, char *body, int body_len) {
+    char hostname[MAX_LINE], *path, *p = http_url;
+    http_callback cb = http_cb;
+
+    if (cb == NULL) {
+	event_line("http %d (no request, ignored)", status);
+	return;
+    }
+    http_cb = NULL;
+
+    if ((path = strstr(p, "://")) != NULL)
+	p = path + 3;
+    snprintf(hostname, sizeof(hostname), "%.*s", (int)strcspn(p, ":/"), p);
+    path = strchr(p, '/') != NULL ? strchr(p, '/') : "/";
+
+    event_line("http %d %s", status, escape((uint8_t *)body, body_len));
+    cost_start();
+    cb(hostname, path, body, status, "", body_len);
+    cost_end(EV_HTTP);
+}
+
+/* Console, flash and the rest of the firmware */
+
+static char print_line[MAX_LINE];
+static int print_len;
+
+void con_print(uint8_t *str) {
+    for (; *str != '\0'; str++) {
+	if (*str == '\n' || print_len == sizeof(print_line) - 1) {
+	    print_line[print_len] = '\0';
+	    effect_line("print %s", print_line);
+	    print_len = 0;
+	} else if (*str != '\r') {
+	    print_line[print_len++] = *str;
+	}
+    }
+}
+
+void serial_out(uint8_t *str) {
+    effect_line("serial_out %s", escape(str, os_strlen(str)));
+}
+
+void do_command(char *cmd_line) {
+    effect_line("command %s", cmd_line);
+}
+
+// Any "set" parameter is known, the ids are the order of the first use
+static char *config_names[64];
+static int config_count;
+
+int config_param_id(const char *name) {
+    int i;
+
+    for (i = 0; i < config_count; i++) {
+	if (strcmp(config_names[i], name) == 0)
+	    return i;
+    }
+    if (config_count == sizeof(config_names) / sizeof(config_names[0]))
+	return -1;
+    config_names[config_count] = strdup(name);
+    return config_count++;
+}
+
+void config_set(int param_id, const char *value, char *response) {
+    effect_line("config %s %s", config_names[param_id], value);
+    if (response != NULL)
+	sprintf(response, "%s set\r\n", config_names[param_id]);
+}
+
+static uint8_t *blobs[MAX_FLASH_SLOTS + 2];
+static uint16_t blob_lens[MAX_FLASH_SLOTS + 2];
+
+void blob_save(uint8_t blob_no, uint32_t *data, uint16_t len) {
+    if (blob_no >= sizeof(blobs) / sizeof(blobs[0]))
+	return;
+    blobs[blob_no] = (uint8_t *)os_realloc(blobs[blob_no], len);
+    os_memcpy(blobs[blob_no], data, len);
+    blob_lens[blob_no] = len;
+}
+
+void blob_load(uint8_t blob_no, uint32_t *data, uint16_t len) {
+    uint16_t n = 0;
+
+    if (blob_no < sizeof(blobs) / sizeof(blobs[0])) {
+	n = blob_lens[blob_no] < len ? blob_lens[blob_no] : len;
+	os_memcpy(data, blobs[blob_no], n);
+    }
+    os_memset((uint8_t *)data + n, 0, len - n);
+}
+
+int os_printf_plus(const char *format, ...) {
+    va_list ap;
+    int n;
+
+    va_start(ap, format);
+    n = vprintf(format, ap);
+    va_end(ap);
+    return n;
+}
+
+/* Replay */
+
+// Runs the timers and the clock ticks that are due up to the given time
+static void advance(uint32_t until) {
+    os_timer_t *ptimer;
+    bool timer_due, tick_due;
+
+    while (true) {
+	timer_due = timer_list != NULL && (int32_t)(timer_list->timer_expire - until) <= 0;
+	tick_due = clock_set && (int32_t)(next_tick - until) <= 0;
+	if (!timer_due && !tick_due)
+	    break;
+
+	if (timer_due && (!tick_due || (int32_t)(timer_list->timer_expire - next_tick) <= 0)) {
+	    ptimer = timer_list;
+	    vtime = ptimer->timer_expire;
+	    timer_list = ptimer->timer_next;
+	    ptimer->timer_next = NULL;
+	    if (ptimer->timer_period != 0) {
+		ptimer->timer_expire += ptimer->timer_period;
+		timer_insert(ptimer);
+	    }
+
+	    if (ptimer->timer_func == inttimer_func) {
+		event_line("gpio_interrupt %d %d", ((gpio_entry_t *)ptimer->timer_arg)->no,
+			   pin_level[((gpio_entry_t *)ptimer->timer_arg)->no]);
+		cost_start();
+		ptimer->timer_func(ptimer->timer_arg);
+		cost_end(EV_GPIO);
+	    } else {
+		event_line("timer %d", (int)(intptr_t)ptimer->timer_arg + 1);
+		cost_start();
+		ptimer->timer_func(ptimer->timer_arg);
+		cost_end(EV_TIMER);
+	    }
+	} else {
+	    // Once a second, as the main timer of the firmware
+	    vtime = next_tick;
+	    next_tick += CLOCK_TICK;
+	    snprintf(quiet_event, sizeof(quiet_event), "clock %s", get_timestr());
+	    cost_start();
+	    check_timestamps(get_timestr());
+	    cost_end(EV_CLOCK);
+	    quiet_event[0] = '\0';
+	}
+	deliver_pending();
+    }
+    vtime = until;
+}
+
+static char *next_word(char **p) {
+    char *w;
+
+    while (**p == ' ' || **p == '\t')
+	(*p)++;
+    w = *p;
+    while (**p != '\0' && **p != ' ' && **p != '\t')
+	(*p)++;
+    if (**p != '\0')
+	*(*p)++ = '\0';
+    return w;
+}
+
+// 1: next line, 0: "end", -1: error
+static int replay_line(char *line, int line_no) {
+    char *p = line, *time_str, *event, *arg1, *arg2;
+    uint32_t t;
+    int len;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    time_str = next_word(&p);
+    if (*time_str == '\0' || *time_str == '#')
+	return 1;
+    t = strtoul(time_str + (*time_str == '+'), NULL, 10);
+    if (*time_str == '+')
+	t += vtime;
+    if ((int32_t)(t - vtime) < 0) {
+	fprintf(stderr, "line %d: time goes backwards\n", line_no);
+	return -1;
+    }
+    advance(t);
+
+    event = next_word(&p);
+    if (strcmp(event, "topic") == 0) {
+	arg1 = next_word(&p);
+	arg2 = next_word(&p);
+	if (*arg2 == '\0' || (strcmp(arg1, "local") != 0 && strcmp(arg1, "remote") != 0))
+	    goto error;
+	len = unescape(p);
+	if (strcmp(arg1, "local") == 0) {
+	    // Only via a local subscription, as from the broker
+	    if (!queue_local(arg2, (uint8_t *)p, len))
+		event_line("topic local %s %s (not subscribed)", arg2, escape((uint8_t *)p, len));
+	} else {
+	    deliver_topic(arg2, (uint8_t *)p, len, false);
+	}
+    } else if (strcmp(event, "retained") == 0) {
+	arg1 = next_word(&p);
+	if (*arg1 == '\0')
+	    goto error;
+	len = unescape(p);
+	update_retained(arg1, (uint8_t *)p, len);
+    } else if (strcmp(event, "serial") == 0) {
+	len = unescape(p);
+	event_line("serial %s", escape((uint8_t *)p, len));
+	cost_start();
+	interpreter_serial_input(p, len);
+	cost_end(EV_SERIAL);
+    } else if (strcmp(event, "gpio") == 0) {
+	arg1 = next_word(&p);
+	arg2 = next_word(&p);
+	if (*arg2 == '\0' || atoi(arg1) < 0 || atoi(arg1) >= MAX_PINS)
+	    goto error;
+	event_line("gpio %d %d", atoi(arg1), atoi(arg2) != 0);
+	gpio_input(atoi(arg1), atoi(arg2));
+    } else if (strcmp(event, "adc") == 0) {
+	adc_value = atoi(next_word(&p));
+	event_line("adc %d", adc_value);
+    } else if (strcmp(event, "http") == 0) {
+	arg1 = next_word(&p);
+	if (*arg1 == '\0')
+	    goto error;
+	len = unescape(p);
+	http_response(atoi(arg1), p, len);
+    } else if (strcmp(event, "wifi") == 0 || strcmp(event, "mqtt") == 0) {
+	bool wifi = event[0] == 'w';
+
+	arg1 = next_word(&p);
+	if (strcmp(arg1, "connect") != 0 && strcmp(arg1, "disconnect") != 0)
+	    goto error;
+	event_line("%s %s", event, arg1);
+	cost_start();
+	if (wifi && arg1[0] == 'c')
+	    interpreter_wifi_connect();
+	else if (wifi)
+	    interpreter_wifi_disconnect();
+	else if ((mqtt_connected = (arg1[0] == 'c'))) {
+	    sub_refs_mqtt_connected();
+	    interpreter_mqtt_connect();
+	}
+	cost_end(wifi ? EV_WIFI : EV_MQTT);
+    } else if (strcmp(event, "clock") == 0) {
+	arg1 = next_word(&p);
+	arg2 = next_word(&p);
+	if (!set_clock(arg1, *arg2 ? arg2 : NULL))
+	    goto error;
+	event_line("clock %s %s", get_timestr(), get_weekday());
+    } else if (strcmp(event, "end") == 0) {
+	return 0;
+    } else {
+	goto error;
+    }
+    deliver_pending();
+    return 1;
+
+ error:
+    fprintf(stderr, "line %d: invalid event\n", line_no);
+    return -1;
+}
+
+static void print_summary(void) {
+    uint64_t total_ns = 0;
+    unsigned long total = 0;
+    char buf[64];
+    int i;
+
+    printf("\nevent           count");
+    if (!no_timing)
+	printf("    total us      avg us      max us");
+    printf("\n");
+    for (i = 0; i < EV_TYPES; i++) {
+	if (costs[i].count == 0)
+	    continue;
+	total += costs[i].count;
+	total_ns += costs[i].total_ns;
+	printf("%-12s %9lu", event_names[i], costs[i].count);
+	if (!no_timing)
+	    printf(" %11.1f %11.2f %11.2f", costs[i].total_ns / 1e3,
+		   costs[i].total_ns / 1e3 / costs[i].count, costs[i].max_ns / 1e3);
+	printf("\n");
+    }
+    printf("%-12s %9lu", "all", total);
+    if (!no_timing && total > 0)
+	printf(" %11.1f %11.2f", total_ns / 1e3, total_ns / 1e3 / total);
+    printf("\n");
+
+    // Per clause, as "show script profile"
+    printf("\nclause                         calls  fired  actions");
+    if (!no_timing)
+	printf("  total us  max us");
+    printf("\n");
+    for (i = 0; i < clause_profile_count; i++) {
+	clause_profile *p = &clause_profiles[i];
+
+	clause_event_text(p->on_token, buf, sizeof(buf));
+	printf("%-28s %7u %6u %8u", buf, p->calls, p->fired, p->actions);
+	if (!no_timing)
+	    printf(" %9u %7u", p->total_us, p->max_us);
+	printf("\n");
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-l] [-q] [-T] [-c HH:MM:SS] [-e <ms>] <script> [<timeline>]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    char line[MAX_LINE];
+    FILE *f, *timeline = stdin;
+    long size;
+    uint32_t end_time = 0;
+    bool end_given = false;
+    int opt, line_no = 0, res = 1;
+
+    while ((opt = getopt(argc, argv, "lqTc:e:")) != -1) {
+	switch (opt) {
+	case 'l':
+	    lang_logging = true;
+	    break;
+	case 'q':
+	    quiet = true;
+	    break;
+	case 'T':
+	    no_timing = true;
+	    break;
+	case 'c':
+	    if (!set_clock(optarg, NULL))
+		usage(argv[0]);
+	    break;
+	case 'e':
+	    end_time = strtoul(optarg, NULL, 10);
+	    end_given = true;
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (optind >= argc || argc - optind > 2)
+	usage(argv[0]);
+
+    if ((f = fopen(argv[optind], "r")) == NULL) {
+	perror(argv[optind]);
+	return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    // As in the flash: 4 bytes length, then the text
+    my_script = (uint8_t *)os_malloc(size + 5);
+    size = fread(my_script + 4, 1, size, f);
+    my_script[4 + size] = '\0';
+    fclose(f);
+
+    if (argc - optind == 2 && (timeline = fopen(argv[optind + 1], "r")) == NULL) {
+	perror(argv[optind + 1]);
+	return 1;
+    }
+
+    config.pwm_period = 5000;
+    if (text_into_tokens((char *)my_script + 4) == 0 || interpreter_syntax_check() == -1) {
+	fprintf(stderr, "Error in script: %s\n", tmp_buffer);
+	return 1;
+    }
+    script_enabled = true;
+    interpreter_config();
+
+    event_line("init");
+    cost_start();
+    interpreter_init();
+    cost_end(EV_INIT);
+    deliver_pending();
+
+    while (res > 0 && fgets(line, sizeof(line), timeline) != NULL)
+	res = replay_line(line, ++line_no);
+    if (res < 0)
+	return 1;
+    if (res > 0 && end_given && (int32_t)(end_time - vtime) > 0)
+	advance(end_time);
+
+    print_summary();
+    return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * Host benchmark for the topic trie (user/topic_trie.c)
+ *
+ * Compares the linear scan over all subscriptions, as done with
+ * Topics_matches() on the subscription list, with a lookup in the
+ * trie for a growing number of subscriptions. Both must report the
+ * same number of matches.
+ *
+ * Build and run: make -C tools topic_bench && tools/topic_bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "c_types.h"
+#include "topic_trie.h"
+
+#define NUM_TOPICS	1024
+#define MIN_DURATION	0.2
+
+static char **filters;
+static char *topics[NUM_TOPICS];
+
+// Reference matcher with the semantics of Topics_matches()
+static bool filter_matches(const char *filter, const char *topic) {
+    while (*filter != '\0' && *topic != '\0') {
+	if (*filter == '#')
+	    return true;
+	if (*filter == '+') {
+	    filter++;
+	    while (*topic != '\0' && *topic != '/')
+		topic++;
+	    continue;
+	}
+	if (*filter != *topic)
+	    return false;
+	filter++;
+	topic++;
+    }
+    if (*filter == '\0' && *topic == '\0')
+	return true;
+    // "a/#" also matches "a"
+    return strcmp(filter, "/#") == 0 && *topic == '\0';
+}
+
+static bool count_match(void *value, void *user_data) {
+    (*(int *)user_data)++;
+    return false;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *make_string(const char *fmt, int a, int b) {
+    char buf[64];
+
+    snprintf(buf, sizeof(buf), fmt, a, b);
+    return strdup(buf);
+}
+
+// A mix of exact filters and filters with '+' and '#'
+static char *make_filter(int i) {
+    switch (i % 8) {
+    case 0:
+	return make_string("home/room%d/+/state", i % 97, 0);
+    case 1:
+	return make_string("home/room%d/#", i % 97, 0);
+    case 2:
+	return make_string("home/+/sensor%d/value", i % 31, 0);
+    default:
+	return make_string("home/room%d/sensor%d/value", i % 97, i % 31);
+    }
+}
+
+static double run_linear(int num_filters, long *matches) {
+    double start = now(), elapsed;
+    long rounds = 0;
+    int i, t;
+
+    *matches = 0;
+    do {
+	for (t = 0; t < NUM_TOPICS; t++) {
+	    for (i = 0; i < num_filters; i++) {
+		if (filter_matches(filters[i], topics[t]))
+		    (*matches)++;
+	    }
+	}
+	rounds++;
+    } while ((elapsed = now() - start) < MIN_DURATION);
+
+    *matches /= rounds;
+    return rounds * NUM_TOPICS / elapsed;
+}
+
+static double run_trie(topic_node *trie, long *matches) {
+    double start = now(), elapsed;
+    long rounds = 0;
+    int count, t;
+
+    *matches = 0;
+    do {
+	for (t = 0; t < NUM_TOPICS; t++) {
+	    count = 0;
+	    topic_trie_match(trie, topics[t], count_match, &count);
+	    *matches += count;
+	}
+	rounds++;
+    } while ((elapsed = now() - start) < MIN_DURATION);
+
+    *matches /= rounds;
+    return rounds * NUM_TOPICS / elapsed;
+}
+
+int main(int argc, char **argv) {
+    static const int counts[] = { 10, 30, 100, 300, 1000, 3000 };
+    int max_filters = counts[sizeof(counts) / sizeof(counts[0]) - 1];
+    int i, c, failed = 0;
+
+    filters = calloc(max_filters, sizeof(char *));
+    for (i = 0; i < max_filters; i++)
+	filters[i] = make_filter(i);
+    for (i = 0; i < NUM_TOPICS; i++)
+	topics[i] = make_string("home/room%d/sensor%d/value", rand() % 128, rand() % 40);
+
+    printf("%8s %14s %14s %8s %10s\n", "subs", "linear pub/s", "trie pub/s", "speedup", "matches");
+    for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+	topic_node *trie = topic_trie_new();
+	long linear_matches, trie_matches;
+	double linear, tree;
+
+	for (i = 0; i < counts[c]; i++)
+	    topic_trie_insert(trie, filters[i], filters[i]);
+
+	linear = run_linear(counts[c], &linear_matches);
+	tree = run_trie(trie, &trie_matches);
+	printf("%8d %14.0f %14.0f %7.1fx %10ld\n", counts[c], linear, tree, tree / linear, trie_matches);
+
+	if (linear_matches != trie_matches) {
+	    printf("mismatch: linear %ld, trie %ld matches\n", linear_matches, trie_matches);
+	    failed = 1;
+	}
+
+	for (i = 0; i < counts[c]; i++)
+	    topic_trie_remove(trie, filters[i], filters[i]);
+	if (trie->child != NULL) {
+	    printf("trie not empty after removing all filters\n");
+	    failed = 1;
+	}
+	topic_trie_free(trie);
+    }
+    return failed;
+}
@@ -0,0 +1,45 @@
+/*
+ * Host decoder for the binary trace of the firmware (user/trace.c)
+ *
+ * Reads the output of "show trace dump" (lines "T <time> <id> <arg1> <arg2>"
+ * in hex, all other lines of a console log are skipped) and prints the
+ * records with the same formatting as "show trace", followed by the
+ * number of records per event.
+ *
+ * Build and run: make -C tools trace_decode && tools/trace_decode < console.log
+ */
+
+#include <stdio.h>
+
+#include "c_types.h"
+#include "trace.h"
+
+int main(int argc, char **argv) {
+    char line[256], buf[128];
+    unsigned int time, id, arg1, arg2;
+    unsigned long counts[TR_EVENTS + 1] = { 0 };
+    uint32_t prev_time = 0;
+    trace_rec rec;
+    int i;
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+	if (sscanf(line, "T %x %x %x %x", &time, &id, &arg1, &arg2) != 4)
+	    continue;
+	rec.time = time;
+	rec.id = id;
+	rec.arg1 = arg1;
+	rec.arg2 = arg2;
+	trace_format(buf, &rec, prev_time);
+	printf("%s\n", buf);
+	prev_time = rec.time;
+	counts[id < TR_EVENTS ? id : TR_EVENTS]++;
+    }
+
+    printf("\n");
+    for (i = 1; i <= TR_EVENTS; i++) {
+	if (counts[i] == 0)
+	    continue;
+	printf("%8lu %s\n", counts[i], trace_event_name(i));
+    }
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+#include "user_interface.h"
+
+#include "global.h"
+#include "bridge.h"
+#include "remote_queue.h"
+#include "sub_refs.h"
+
+#ifdef MQTT_CLIENT
+
+// Messages forwarded in the last BRIDGE_ORIGIN_TIMEOUT us, per direction
+typedef struct _origin_tag {
+    uint32_t hash;
+    uint32_t time;
+} origin_tag;
+
+static origin_tag origin_tags[2][BRIDGE_ORIGIN_TAGS];
+static uint8_t origin_next[2];
+
+uint32_t bridge_in_count, bridge_out_count;
+uint32_t bridge_loop_count, bridge_drop_count;
+
+static uint32_t ICACHE_FLASH_ATTR message_hash(const char *topic, uint32_t topic_len, const char *data, uint32_t data_len) {
+    uint32_t hash = 2166136261;
+    uint32_t i;
+
+    // FNV-1a over topic and data
+    for (i = 0; i < topic_len; i++)
+	hash = (hash ^ (uint8_t)topic[i]) * 16777619;
+    hash = (hash ^ 0xff) * 16777619;
+    for (i = 0; i < data_len; i++)
+	hash = (hash ^ (uint8_t)data[i]) * 16777619;
+    return hash;
+}
+
+static void ICACHE_FLASH_ATTR origin_add(int dir, uint32_t hash) {
+    origin_tag *tag = &origin_tags[dir][origin_next[dir]];
+
+    tag->hash = hash;
+    tag->time = system_get_time();
+    origin_next[dir] = (origin_next[dir] + 1) % BRIDGE_ORIGIN_TAGS;
+}
+
+// Was this message forwarded by the bridge itself in the given direction?
+static bool ICACHE_FLASH_ATTR origin_check(int dir, uint32_t hash) {
+    uint32_t now = system_get_time();
+    int i;
+
+    for (i = 0; i < BRIDGE_ORIGIN_TAGS; i++) {
+	origin_tag *tag = &origin_tags[dir][i];
+
+	if (tag->time != 0 && tag->hash == hash && now - tag->time < BRIDGE_ORIGIN_TIMEOUT) {
+	    // Each forwarded message suppresses only one echo
+	    tag->time = 0;
+	    return true;
+	}
+    }
+    return false;
+}
+
+/*
+ * Maps the topic from the "from" pattern to the "to" pattern. Patterns
+ * ending with "#" map the prefix, others only the exact topic.
+ */
+static bool ICACHE_FLASH_ATTR map_topic(const char *topic, uint32_t topic_len, uint8_t *from, uint8_t *to,
+					char *result, uint32_t result_size) {
+    uint32_t from_len = os_strlen(from);
+    uint32_t to_len = os_strlen(to);
+
+    if (from_len > 0 && from[from_len - 1] == '#') {
+	from_len--;
+	if (topic_len < from_len || os_strncmp(topic, from, from_len) != 0)
+	    return false;
+	if (to_len > 0 && to[to_len - 1] == '#')
+	    to_len--;
+    } else if (topic_len != from_len || os_strncmp(topic, from, from_len) != 0) {
+	return false;
+    }
+
+    if (to_len + topic_len - from_len + 1 > result_size)
+	return false;
+    os_memcpy(result, to, to_len);
+    os_memcpy(result + to_len, topic + from_len, topic_len - from_len);
+    result[to_len + topic_len - from_len] = '\0';
+    return true;
+}
+
+// Would a message on this topic be forwarded in the given direction?
+static bool ICACHE_FLASH_ATTR is_bridged(uint8_t dir, const char *topic) {
+    char mapped[BRIDGE_TOPIC_LEN];
+    uint32_t topic_len = os_strlen(topic);
+    int i;
+
+    for (i = 0; i < MAX_BRIDGE_RULES; i++) {
+	bridge_rule_t *r = &config.bridge_rules[i];
+
+	if ((r->dir & dir) == 0)
+	    continue;
+	if (dir == BRIDGE_OUT && map_topic(topic, topic_len, r->local, r->remote, mapped, sizeof(mapped)))
+	    return true;
+	if (dir == BRIDGE_IN && map_topic(topic, topic_len, r->remote, r->local, mapped, sizeof(mapped)))
+	    return true;
+    }
+    return false;
+}
+
+void ICACHE_FLASH_ATTR bridge_rule_added(int rule) {
+    bridge_rule_t *r = &config.bridge_rules[rule];
+
+    if (r->dir & BRIDGE_OUT)
+	sub_refs_add(r->local, false, 0, SUB_BRIDGE);
+    if (r->dir & BRIDGE_IN)
+	sub_refs_add(r->remote, true, r->qos, SUB_BRIDGE);
+}
+
+// Call before the rule is cleared
+void ICACHE_FLASH_ATTR bridge_rule_deleted(int rule) {
+    bridge_rule_t *r = &config.bridge_rules[rule];
+
+    if (r->dir & BRIDGE_OUT)
+	sub_refs_remove(r->local, false, SUB_BRIDGE);
+    if (r->dir & BRIDGE_IN)
+	sub_refs_remove(r->remote, true, SUB_BRIDGE);
+}
+
+void ICACHE_FLASH_ATTR bridge_init(void) {
+    int i;
+
+    for (i = 0; i < MAX_BRIDGE_RULES; i++) {
+	if (config.bridge_rules[i].dir != 0)
+	    bridge_rule_added(i);
+    }
+}
+
+void ICACHE_FLASH_ATTR bridge_local_received(msg_src *src) {
+    const char *topic = src->topic, *data = src->data;
+    uint32_t topic_len = src->topic_len, data_len = src->data_len;
+    char remote_topic[BRIDGE_TOPIC_LEN];
+    bool checked = false;
+    int i;
+
+    for (i = 0; i < MAX_BRIDGE_RULES; i++) {
+	bridge_rule_t *r = &config.bridge_rules[i];
+
+	if ((r->dir & BRIDGE_OUT) == 0 ||
+	    !map_topic(topic, topic_len, r->local, r->remote, remote_topic, sizeof(remote_topic)))
+	    continue;
+
+	if (!checked) {
+	    checked = true;
+	    // Published locally by the bridge?
+	    if (origin_check(0, message_hash(topic, topic_len, data, data_len))) {
+		bridge_loop_count++;
+		return;
+	    }
+	}
+
+	if (!remote_publish_src(remote_topic, src, r->qos, r->retain)) {
+	    bridge_drop_count++;
+	    continue;
+	}
+	// Expect the echo, if the remote broker sends it back to us
+	if (is_bridged(BRIDGE_IN, remote_topic))
+	    origin_add(1, message_hash(remote_topic, os_strlen(remote_topic), data, data_len));
+	bridge_out_count++;
+    }
+}
+
+void ICACHE_FLASH_ATTR bridge_remote_received(const char *topic, uint32_t topic_len, const char *data, uint32_t data_len) {
+    char local_topic[BRIDGE_TOPIC_LEN];
+    bool checked = false;
+    int i;
+
+    for (i = 0; i < MAX_BRIDGE_RULES; i++) {
+	bridge_rule_t *r = &config.bridge_rules[i];
+
+	if ((r->dir & BRIDGE_IN) == 0 ||
+	    !map_topic(topic, topic_len, r->remote, r->local, local_topic, sizeof(local_topic)))
+	    continue;
+
+	if (!checked) {
+	    checked = true;
+	    // Echo of a message the bridge published remotely?
+	    if (origin_check(1, message_hash(topic, topic_len, data, data_len))) {
+		bridge_loop_count++;
+		return;
+	    }
+	}
+
+	// Tag it before, the local broker delivers it synchronously
+	if (is_bridged(BRIDGE_OUT, local_topic))
+	    origin_add(0, message_hash(local_topic, os_strlen(local_topic), data, data_len));
+	if (!MQTT_local_publish(local_topic, (uint8_t *)data, data_len, 0, r->retain)) {
+	    bridge_drop_count++;
+	    continue;
+	}
+	bridge_in_count++;
+    }
+}
+
+#endif /* MQTT_CLIENT */
@@ -0,0 +1,28 @@
+#ifndef _BRIDGE_
+#define _BRIDGE_
+
+#include "c_types.h"
+#include "msg_buf.h"
+
+/*
+ * Native bridge between the local broker and the remote MQTT client.
+ * The rules are stored in config.bridge_rules, each maps a local topic
+ * (prefix, if it ends with "#") to a remote one and vice versa.
+ */
+
+#define BRIDGE_IN	0x01	// remote -> local
+#define BRIDGE_OUT	0x02	// local -> remote
+
+extern uint32_t bridge_in_count, bridge_out_count;
+extern uint32_t bridge_loop_count, bridge_drop_count;
+
+// Subscriptions for the rules, see sub_refs.h
+void bridge_init(void);
+void bridge_rule_added(int rule);
+void bridge_rule_deleted(int rule);
+
+// Called for every message from the local broker or the remote client
+void bridge_local_received(msg_src *src);
+void bridge_remote_received(const char *topic, uint32_t topic_len, const char *data, uint32_t data_len);
+
+#endif /* _BRIDGE_ */
@@ -0,0 +1,297 @@
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+#include "espconn.h"
+
+#include "global.h"
+#include "broker_conn.h"
+#include "trace.h"
+
+#define PKT_HEADER	0
+#define PKT_LENGTH	1
+#define PKT_BODY	2
+
+#define MQTT_PUBLISH	3
+
+broker_conn *broker_conn_list = NULL;
+
+uint32_t broker_msgs_received, broker_msgs_sent;
+uint32_t broker_pubs_received, broker_pubs_sent;
+uint32_t broker_bytes_received, broker_bytes_sent;
+
+// The broker's own callbacks, the same for all its connections
+static espconn_recv_callback broker_recv_cb = NULL;
+static espconn_connect_callback broker_discon_cb = NULL;
+static espconn_reconnect_callback broker_recon_cb = NULL;
+
+static broker_conn * ICACHE_FLASH_ATTR find_conn(struct espconn *pCon) {
+    broker_conn *bc;
+
+    for (bc = broker_conn_list; bc != NULL; bc = bc->next) {
+	if (bc->pCon == pCon)
+	    return bc;
+    }
+    return NULL;
+}
+
+static bool ICACHE_FLASH_ATTR is_client_conn(struct espconn *pCon) {
+    MQTT_ClientCon *clientcon;
+
+    for (clientcon = clientcon_list; clientcon != NULL; clientcon = clientcon->next) {
+	if (clientcon->pCon == pCon)
+	    return true;
+    }
+    return false;
+}
+
+static bool ICACHE_FLASH_ATTR rate_limited(void) {
+    return config.broker_rate_msgs != 0 || config.broker_rate_bytes != 0;
+}
+
+static void ICACHE_FLASH_ATTR packet_done(broker_conn *bc) {
+    bool all_traffic = os_strcmp(config.broker_rate_topic, "none") == 0;
+
+    bc->pkt_state = PKT_HEADER;
+    broker_msgs_received++;
+    if (bc->pkt_type == MQTT_PUBLISH)
+	broker_pubs_received++;
+    if (!rate_limited())
+	return;
+
+    if (all_traffic || (bc->pkt_type == MQTT_PUBLISH && bc->pkt_match)) {
+	if (bc->pkt_type == MQTT_PUBLISH && config.broker_rate_msgs != 0)
+	    bc->msg_tokens--;
+	if (config.broker_rate_bytes != 0)
+	    bc->byte_tokens -= bc->pkt_size;
+    }
+
+    // Pause reading until the buckets are refilled
+    if (bc->msg_tokens < 0 || bc->byte_tokens < 0)
+	broker_conn_hold(bc, HOLD_RATE);
+}
+
+/*
+ * Follows the MQTT packet boundaries in the inbound stream. Only the
+ * fixed header and, for a PUBLISH, the start of the topic are looked
+ * at, the rest of the packet is skipped in one step.
+ */
+static void ICACHE_FLASH_ATTR parse_packets(broker_conn *bc, uint8_t *p, uint32_t len) {
+    uint32_t prefix_len = 0;
+    uint32_t n;
+
+    if (os_strcmp(config.broker_rate_topic, "none") != 0)
+	prefix_len = os_strlen(config.broker_rate_topic);
+
+    while (len > 0) {
+	switch (bc->pkt_state) {
+	case PKT_HEADER:
+	    bc->pkt_type = *p >> 4;
+	    bc->pkt_size = 1;
+	    bc->pkt_remaining = 0;
+	    bc->pkt_shift = 0;
+	    bc->pkt_pos = 0;
+	    bc->pkt_topic_len = 0;
+	    bc->pkt_match = true;
+	    bc->pkt_state = PKT_LENGTH;
+	    p++;
+	    len--;
+	    break;
+
+	case PKT_LENGTH:
+	    bc->pkt_remaining |= (uint32_t)(*p & 0x7f) << bc->pkt_shift;
+	    bc->pkt_shift += 7;
+	    bc->pkt_size++;
+	    if ((*p & 0x80) == 0 || bc->pkt_shift >= 28) {
+		bc->pkt_size += bc->pkt_remaining;
+		bc->pkt_state = PKT_BODY;
+		if (bc->pkt_remaining == 0)
+		    packet_done(bc);
+	    }
+	    p++;
+	    len--;
+	    break;
+
+	case PKT_BODY:
+	    // Topic length and the prefix are compared bytewise
+	    if (bc->pkt_type == MQTT_PUBLISH && bc->pkt_match && bc->pkt_pos < 2 + prefix_len) {
+		if (bc->pkt_pos < 2)
+		    bc->pkt_topic_len = (bc->pkt_topic_len << 8) | *p;
+		else if (bc->pkt_topic_len < prefix_len || *p != config.broker_rate_topic[bc->pkt_pos - 2])
+		    bc->pkt_match = false;
+		n = 1;
+	    } else {
+		n = len < bc->pkt_remaining ? len : bc->pkt_remaining;
+	    }
+	    bc->pkt_pos += n;
+	    bc->pkt_remaining -= n;
+	    p += n;
+	    len -= n;
+	    if (bc->pkt_remaining == 0)
+		packet_done(bc);
+	    break;
+	}
+    }
+}
+
+static void ICACHE_FLASH_ATTR broker_conn_recv_cb(void *arg, char *pdata, unsigned short len) {
+    broker_conn *bc = find_conn((struct espconn *)arg);
+
+    if (bc != NULL) {
+	broker_bytes_received += len;
+	bc->rx_bytes += len;
+	bc->rx_window += len;
+	parse_packets(bc, (uint8_t *)pdata, len);
+    }
+    if (broker_recv_cb != NULL)
+	broker_recv_cb(arg, pdata, len);
+}
+
+// Clients still connected, the closed ones wait for the tick to be freed
+static uint16_t ICACHE_FLASH_ATTR count_open_conns(struct espconn *closed) {
+    broker_conn *bc;
+    uint16_t count = 0;
+
+    for (bc = broker_conn_list; bc != NULL; bc = bc->next) {
+	if (bc->pCon != closed && is_client_conn(bc->pCon))
+	    count++;
+    }
+    return count;
+}
+
+static void ICACHE_FLASH_ATTR broker_conn_discon_cb(void *arg) {
+    bool tracked = find_conn((struct espconn *)arg) != NULL;
+
+    if (broker_discon_cb != NULL)
+	broker_discon_cb(arg);
+    if (tracked)
+	TRACE_EVENT(TR_DISCONNECT, count_open_conns((struct espconn *)arg), 0);
+}
+
+static void ICACHE_FLASH_ATTR broker_conn_recon_cb(void *arg, sint8 err) {
+    bool tracked = find_conn((struct espconn *)arg) != NULL;
+
+    if (broker_recon_cb != NULL)
+	broker_recon_cb(arg, err);
+    if (tracked)
+	TRACE_EVENT(TR_DISCONNECT, count_open_conns((struct espconn *)arg), err);
+}
+
+/*
+ * The firmware is linked with --wrap for espconn_send/espconn_sent, so
+ * the sends of the broker pass through here as well. The broker sends
+ * one packet at a time, so the first byte tells the packet type.
+ */
+static void ICACHE_FLASH_ATTR count_sent(struct espconn *espconn, uint8 *psent, uint16 length) {
+    if (length == 0 || find_conn(espconn) == NULL)
+	return;
+
+    broker_bytes_sent += length;
+    broker_msgs_sent++;
+    if ((psent[0] >> 4) == MQTT_PUBLISH)
+	broker_pubs_sent++;
+}
+
+sint8 __real_espconn_send(struct espconn *espconn, uint8 *psent, uint16 length);
+sint8 __real_espconn_sent(struct espconn *espconn, uint8 *psent, uint16 length);
+
+sint8 ICACHE_FLASH_ATTR __wrap_espconn_send(struct espconn *espconn, uint8 *psent, uint16 length) {
+    sint8 result = __real_espconn_send(espconn, psent, length);
+
+    if (result == ESPCONN_OK)
+	count_sent(espconn, psent, length);
+    return result;
+}
+
+sint8 ICACHE_FLASH_ATTR __wrap_espconn_sent(struct espconn *espconn, uint8 *psent, uint16 length) {
+    sint8 result = __real_espconn_sent(espconn, psent, length);
+
+    if (result == ESPCONN_OK)
+	count_sent(espconn, psent, length);
+    return result;
+}
+
+void ICACHE_FLASH_ATTR broker_conn_track(struct espconn *pCon) {
+    broker_conn *bc;
+
+    // Already gone again?
+    if (!is_client_conn(pCon) || pCon->recv_callback == NULL)
+	return;
+
+    // A new connection may reuse the espconn of a closed one
+    if ((bc = find_conn(pCon)) == NULL) {
+	if ((bc = (broker_conn *)os_malloc(sizeof(broker_conn))) == NULL)
+	    return;
+	bc->pCon = pCon;
+	bc->next = broker_conn_list;
+	broker_conn_list = bc;
+    }
+    bc->rx_bytes = bc->rx_window = bc->rx_last = 0;
+    bc->hold = 0;
+    bc->msg_tokens = config.broker_rate_msgs;
+    bc->byte_tokens = config.broker_rate_bytes;
+    bc->pkt_state = PKT_HEADER;
+
+    if (pCon->recv_callback != broker_conn_recv_cb) {
+	broker_recv_cb = pCon->recv_callback;
+	espconn_regist_recvcb(pCon, broker_conn_recv_cb);
+    }
+    if (pCon->proto.tcp->disconnect_callback != broker_conn_discon_cb) {
+	broker_discon_cb = pCon->proto.tcp->disconnect_callback;
+	espconn_regist_disconcb(pCon, broker_conn_discon_cb);
+    }
+    if (pCon->proto.tcp->reconnect_callback != broker_conn_recon_cb) {
+	broker_recon_cb = pCon->proto.tcp->reconnect_callback;
+	espconn_regist_reconcb(pCon, broker_conn_recon_cb);
+    }
+}
+
+void ICACHE_FLASH_ATTR broker_conn_tick(void) {
+    broker_conn **bc_p = &broker_conn_list, *bc;
+
+    while ((bc = *bc_p) != NULL) {
+	if (!is_client_conn(bc->pCon)) {
+	    *bc_p = bc->next;
+	    os_free(bc);
+	    continue;
+	}
+	bc->rx_last = bc->rx_window;
+	bc->rx_window = 0;
+
+	// Refill the buckets, a full bucket allows a burst of one second
+	bc->msg_tokens += config.broker_rate_msgs;
+	if (bc->msg_tokens > (int32_t)config.broker_rate_msgs)
+	    bc->msg_tokens = config.broker_rate_msgs;
+	bc->byte_tokens += config.broker_rate_bytes;
+	if (bc->byte_tokens > (int32_t)config.broker_rate_bytes)
+	    bc->byte_tokens = config.broker_rate_bytes;
+	if (bc->msg_tokens >= 0 && bc->byte_tokens >= 0)
+	    broker_conn_release(bc, HOLD_RATE);
+
+	bc_p = &bc->next;
+    }
+}
+
+void ICACHE_FLASH_ATTR broker_conn_hold(broker_conn *bc, uint8_t reason) {
+    if (bc->hold == 0)
+	espconn_recv_hold(bc->pCon);
+    bc->hold |= reason;
+}
+
+void ICACHE_FLASH_ATTR broker_conn_release(broker_conn *bc, uint8_t reason) {
+    if (bc->hold == 0)
+	return;
+    bc->hold &= ~reason;
+    if (bc->hold == 0)
+	espconn_recv_unhold(bc->pCon);
+}
+
+uint16_t ICACHE_FLASH_ATTR broker_conn_count_held(void) {
+    broker_conn *bc;
+    uint16_t count = 0;
+
+    for (bc = broker_conn_list; bc != NULL; bc = bc->next) {
+	if (bc->hold != 0)
+	    count++;
+    }
+    return count;
+}
@@ -0,0 +1,57 @@
+#ifndef _BROKER_CONN_
+#define _BROKER_CONN_
+
+#include "c_types.h"
+#include "espconn.h"
+
+/*
+ * Per-connection bookkeeping for the clients of the local broker.
+ * The broker's receive callback is wrapped to count the inbound
+ * bytes, its disconnect and error callbacks to trace the close, and
+ * a connection can be held (no more reads) for several independent
+ * reasons.
+ */
+
+#define HOLD_MEMORY	0x01
+#define HOLD_RATE	0x02
+
+typedef struct _broker_conn {
+    struct espconn *pCon;
+    uint32_t rx_bytes;		// Total since connect
+    uint32_t rx_window;		// Since the last tick
+    uint32_t rx_last;		// In the last full tick
+    uint8_t hold;		// Bitmask of HOLD_* reasons
+
+    // Token buckets of the rate limit, negative while in debt
+    int32_t msg_tokens;
+    int32_t byte_tokens;
+
+    // MQTT packet framing of the inbound stream
+    uint8_t pkt_state;
+    uint8_t pkt_type;
+    uint8_t pkt_shift;
+    bool pkt_match;		// Topic matches broker_rate_topic so far
+    uint16_t pkt_topic_len;
+    uint32_t pkt_size;
+    uint32_t pkt_remaining;
+    uint32_t pkt_pos;		// Position in the variable header
+    struct _broker_conn *next;
+} broker_conn;
+
+extern broker_conn *broker_conn_list;
+
+// Totals over all clients, msgs are MQTT packets of any type, pubs only PUBLISH
+extern uint32_t broker_msgs_received, broker_msgs_sent;
+extern uint32_t broker_pubs_received, broker_pubs_sent;
+extern uint32_t broker_bytes_received, broker_bytes_sent;
+
+// Call deferred after the broker accepted the connection
+void broker_conn_track(struct espconn *pCon);
+// Call once per second
+void broker_conn_tick(void);
+
+void broker_conn_hold(broker_conn *bc, uint8_t reason);
+void broker_conn_release(broker_conn *bc, uint8_t reason);
+uint16_t broker_conn_count_held(void);
+
+#endif /* _BROKER_CONN_ */
@@ -3,9 +3,25 @@
 #include "ets_sys.h"
 #include "osapi.h"
 #include "os_type.h"
+#include "driver/uart.h"
 
 #include "global.h"
 #include "sys_time.h"
+#include "broker_conn.h"
+#include "mem_gov.h"
+#include "bridge.h"
+#include "remote_queue.h"
+#include "reconnect.h"
+#include "httpclient.h"
+#include "sys_metrics.h"
+#include "latency.h"
+#include "trace.h"
+#include "recorder.h"
+#include "serial_frame.h"
+
+#ifdef NTP
+#include "ntp.h"
+#endif
 
 #define os_sprintf_flash(str, fmt, ...) do {	\
 	static const char flash_str[] ICACHE_RODATA_ATTR STORE_ATTR = fmt;	\
@@ -118,981 +134,1531 @@ bool    in_token = false;
    return token_count;
 }
 
-void ICACHE_FLASH_ATTR console_handle_command(struct espconn *pespconn) {
-#define MAX_CMD_TOKENS 6
-
-    char cmd_line[MAX_CON_CMD_SIZE + 1];
-    char response[256];
-    char *tokens[MAX_CMD_TOKENS];
-
-    int bytes_count, nTokens;
-
-    bytes_count = ringbuf_bytes_used(console_rx_buffer);
-    ringbuf_memcpy_from(cmd_line, console_rx_buffer, bytes_count);
+/*
+ * Commands and "set" parameters: tables sorted by name (strcmp() order),
+ * looked up with a binary search
+ */
+#define CMD_UNKNOWN	0	// Not handled, "Invalid Command"
+#define CMD_RESPONSE	1	// Send the response
+#define CMD_DONE	2	// Output already sent to the console
+
+typedef uint8_t (*cli_cmd_fn)(struct espconn *pespconn, int nTokens, char **tokens, char *response);
+typedef void (*cli_set_fn)(char *val, char *response);
+
+typedef struct _cli_command {
+    const char *name;
+    cli_cmd_fn fn;
+} cli_command;
+
+typedef struct _cli_param {
+    const char *name;
+    cli_set_fn fn;
+} cli_param;
+
+// The name is the first member of an entry
+static int ICACHE_FLASH_ATTR find_name(const void *table, int count, int size, const char *name) {
+    int low = 0, high = count - 1, mid, cmp;
+
+    while (low <= high) {
+	mid = (low + high) / 2;
+	cmp = os_strcmp(name, *(const char **)((const uint8_t *)table + mid * size));
+	if (cmp == 0)
+	    return mid;
+	if (cmp < 0)
+	    high = mid - 1;
+	else
+	    low = mid + 1;
+    }
+    return -1;
+}
 
-    cmd_line[bytes_count] = 0;
-    response[0] = 0;
+static void ICACHE_FLASH_ATTR cli_set_ssid(char *val, char *response) {
+    os_sprintf(config.ssid, "%s", val);
+    config.auto_connect = 1;
+    os_sprintf_flash(response, "SSID set (auto_connect = 1)\r\n");
+}
 
-    nTokens = parse_str_into_tokens(cmd_line, tokens, MAX_CMD_TOKENS);
+static void ICACHE_FLASH_ATTR cli_set_password(char *val, char *response) {
+    os_sprintf(config.password, "%s", val);
+    os_sprintf_flash(response, "Password set\r\n");
+}
 
-    if (nTokens == 0) {
-	char c = '\n';
-	ringbuf_memcpy_into(console_tx_buffer, &c, 1);
-	goto command_handled_2;
-    }
+static void ICACHE_FLASH_ATTR cli_set_auto_connect(char *val, char *response) {
+    config.auto_connect = atoi(val);
+    os_sprintf_flash(response, "Auto Connect set\r\n");
+}
 
-    if (strcmp(tokens[0], "help") == 0) {
-	os_sprintf_flash(response, "show [config|stats|mqtt]\r\nsave\r\nreset [factory]\r\nlock [<password>]\r\nunlock <password>\r\nquit\r\n");
-	to_console(response);
-#ifdef ALLOW_SCANNING
-	os_sprintf_flash(response, "scan\r\n");
-	to_console(response);
-#endif
-	os_sprintf_flash(response, "set [ssid|password|auto_connect|ap_ssid|ap_password|ap_on|ap_open] <val>\r\n");
-	to_console(response);
-	os_sprintf_flash(response, "set [network|dns|ip|netmask|gw] <val>\r\n");
-	to_console(response);
-	os_sprintf_flash(response, "set [config_port|config_access|bitrate|system_output] <val>\r\n");
-	to_console(response);
-	os_sprintf_flash(response, "set [broker_port|broker_user|broker_password|broker_access|broker_clients] <val>\r\n");
-	to_console(response);
-	os_sprintf_flash(response, "set [broker_subscriptions|broker_retained_messages|broker_autoretain] <val>\r\n");
-	to_console(response);
-	os_sprintf_flash(response, "delete_retained|save_retained\r\n");
-	to_console(response);
-	os_sprintf_flash(response, "publish [local|remote] <topic> <data> [retained]\r\n");
-	to_console(response);
-#ifdef SCRIPTED
-	os_sprintf_flash(response, "script <port>|<url>|delete\r\nshow [script|vars]\r\n");
-	to_console(response);
-#ifdef GPIO
-#ifdef GPIO_PWM
-	os_sprintf_flash(response, "set pwm_period <val>\r\n");
-	to_console(response);
-#endif
-#endif
-#endif
-#ifdef NTP
-	os_sprintf_flash(response, "time\r\nset [ntp_server|ntp_interval|ntp_timezone|ntp_time|ntp_weekday] <val>\r\n");
-	to_console(response);
-#endif
-#ifdef DNS_RESP
-	os_sprintf_flash(response, "set dns_name <name>\r\n");
-	to_console(response);
-#endif
-#ifdef MQTT_CLIENT
-	os_sprintf_flash(response, "set [mqtt_host|mqtt_port|mqtt_ssl|mqtt_user|mqtt_password|mqtt_id] <val>\r\n");
-	to_console(response);
-#endif
+static void ICACHE_FLASH_ATTR cli_set_ap_ssid(char *val, char *response) {
+    os_sprintf(config.ap_ssid, "%s", val);
+    os_sprintf_flash(response, "AP SSID set\r\n");
+}
 
-	goto command_handled_2;
+static void ICACHE_FLASH_ATTR cli_set_ap_password(char *val, char *response) {
+    if (os_strlen(val) < 8) {
+	os_sprintf_flash(response, "Password to short (min. 8)\r\n");
+    } else {
+	os_sprintf(config.ap_password, "%s", val);
+	config.ap_open = 0;
+	os_sprintf_flash(response, "AP Password set\r\n");
     }
+}
 
-    if (strcmp(tokens[0], "show") == 0) {
-	int16_t i;
-	ip_addr_t i_ip;
-
-	if (nTokens == 1 || (nTokens == 2 && strcmp(tokens[1], "config") == 0)) {
-	    os_sprintf(response, "Version %s (build: %s)\r\n", ESP_UBROKER_VERSION, __TIMESTAMP__);
-	    to_console(response);
-
-	    os_sprintf(response, "STA: SSID:%s PW:%s%s\r\n",
-		       config.ssid,
-		       config.locked ? "***" : (char *)config.password, config.auto_connect ? "" : " [AutoConnect:0]");
-	    to_console(response);
+static void ICACHE_FLASH_ATTR cli_set_ap_open(char *val, char *response) {
+    config.ap_open = atoi(val);
+    os_sprintf_flash(response, "Open Auth set\r\n");
+}
 
-	    os_sprintf(response, "AP:  SSID:%s PW:%s%s%s IP:%d.%d.%d.%d/24\r\n",
-		       config.ap_ssid,
-		       config.locked ? "***" : (char *)config.ap_password,
-		       config.ap_open ? " [open]" : "",
-		       config.ap_on ? "" : " [disabled]", IP2STR(&config.network_addr));
-	    to_console(response);
+static void ICACHE_FLASH_ATTR cli_set_ap_on(char *val, char *response) {
+    if (atoi(val)) {
+	if (!config.ap_on) {
+	    wifi_set_opmode(STATIONAP_MODE);
+	    user_set_softap_wifi_config();
+	    do_ip_config = true;
+	    config.ap_on = true;
+	    os_sprintf_flash(response, "AP on\r\n");
+	} else {
+	    os_sprintf_flash(response, "AP already on\r\n");
+	}
 
-	    // if static IP, add it
-	    os_sprintf(response,
-		       config.my_addr.addr ?
-		       "Static IP: %d.%d.%d.%d Netmask: %d.%d.%d.%d Gateway: %d.%d.%d.%d\r\n"
-		       : "", IP2STR(&config.my_addr), IP2STR(&config.my_netmask), IP2STR(&config.my_gw));
-	    to_console(response);
-	    // if static DNS, add it
-	    os_sprintf(response, config.dns_addr.addr ? "DNS: %d.%d.%d.%d\r\n" : "", IP2STR(&config.dns_addr));
-	    to_console(response);
-#ifdef DNS_RESP
-            if (strcmp(config.broker_dns_name, "none")!=0 && config.ap_on) {
-		os_sprintf(response, "DNS name: %s\r\n", config.broker_dns_name);
-		to_console(response);
-	    }
-#endif
+    } else {
+	if (config.ap_on) {
+	    wifi_set_opmode(STATION_MODE);
 #ifdef MDNS
-	    if (config.mdns_mode) {
-		os_sprintf(response, "mDNS: %s interface\r\n", config.mdns_mode==1 ? "STA": "SoftAP");
-		to_console(response);
-	    }
-#endif
-#ifdef REMOTE_CONFIG
-	    if (config.config_port == 0 || config.config_access == 0) {
-		os_sprintf(response, "No network console access\r\n");
-	    } else {
-		os_sprintf(response, "Network console access on port %d (mode %d)\r\n", config.config_port, config.config_access);
+	    if (config.mdns_mode == 2) {
+		espconn_mdns_close();
 	    }
-	    to_console(response);
 #endif
+	    config.ap_on = false;
+	    os_sprintf_flash(response, "AP off\r\n");
+	} else {
+	    os_sprintf_flash(response, "AP already off\r\n");
+	}
+    }
+}
 
-	    os_sprintf(response, "MQTT broker max. subscription: %d\r\nMQTT broker max. retained messages: %d%s\r\n",
-		       config.max_subscriptions, config.max_retained_messages, config.auto_retained?" (auto saved)":"");
-	    to_console(response);
+static void ICACHE_FLASH_ATTR cli_set_speed(char *val, char *response) {
+    uint16_t speed = atoi(val);
+    bool succ = system_update_cpu_freq(speed);
+    if (succ)
+	config.clock_speed = speed;
+    os_sprintf(response, "Clock speed update %s\r\n", succ ? "successful" : "failed");
+}
 
-	    if (config.mqtt_broker_port != MQTT_PORT) {
-		os_sprintf(response, "MQTT broker port: %d\r\n", config.mqtt_broker_port);
-		to_console(response);
-	    }
-	    if (config.max_clients != 0) {
-		os_sprintf(response, "MQTT broker max. clients: %d\r\n", config.max_clients);
-		to_console(response);
-	    }
+static void ICACHE_FLASH_ATTR cli_set_bitrate(char *val, char *response) {
+    config.bit_rate = atoi(val);
+    os_sprintf(response, "Bitrate set to %d\r\n", config.bit_rate);
+}
 
-	    if (os_strcmp(config.mqtt_broker_user, "none") != 0) {
-		os_sprintf(response,
-			   "MQTT broker username: %s\r\nMQTT broker password: %s\r\n",
-			   config.mqtt_broker_user,
-			   config.locked ? "***" : (char *)config.mqtt_broker_password);
-		to_console(response);
-	    }
-	    response[0] = '\0';
-	    if (config.mqtt_broker_access == LOCAL_ACCESS)
-		os_sprintf(response, "MQTT broker: local access only\r\n");
-	    if (config.mqtt_broker_access == REMOTE_ACCESS)
-		os_sprintf(response, "MQTT broker: remote access only\r\n");
-	    if (config.mqtt_broker_access == 0)
-		os_sprintf(response, "MQTT broker: disabled\r\n");
-	    to_console(response);
-#ifdef MQTT_CLIENT
-	    os_sprintf(response, "MQTT client %s\r\n", mqtt_enabled ? "enabled" : "disabled");
-	    to_console(response);
+static void ICACHE_FLASH_ATTR cli_set_system_output(char *val, char *response) {
+    config.system_output = atoi(val);
+    os_sprintf(response, "System output set to %d\r\n", config.system_output);
+}
 
-	    if (os_strcmp(config.mqtt_host, "none") != 0) {
-		os_sprintf(response,
-			   "MQTT client host: %s\r\nMQTT client port: %d\r\nMQTT client user: %s\r\nMQTT client password: %s\r\nMQTT client id: %s\r\nMQTT SSL: %s\r\n",
-			   config.mqtt_host, config.mqtt_port, config.mqtt_user,
-			   config.locked ? "***" : (char *)config.mqtt_password, config.mqtt_id,
-			   config.mqtt_ssl ? "on" : "off");
-		to_console(response);
-	    }
-#endif
-#ifdef NTP
-	    if (os_strcmp(config.ntp_server, "none") != 0) {
-		os_sprintf(response,
-			   "NTP server: %s (interval: %d s, tz: %d)\r\n",
-			   config.ntp_server, config.ntp_interval / 1000000, config.ntp_timezone);
-		to_console(response);
-	    }
-#endif
-	    os_sprintf(response, "Clock speed: %d\r\n", config.clock_speed);
-	    to_console(response);
+static void ICACHE_FLASH_ATTR cli_set_network(char *val, char *response) {
+    config.network_addr.addr = ipaddr_addr(val);
+    ip4_addr4(&config.network_addr) = 0;
+    os_sprintf(response, "Network set to %d.%d.%d.%d\r\n", IP2STR(&config.network_addr));
+}
 
-	    os_sprintf(response, "Serial bitrate: %d\r\n", config.bit_rate);
-	    to_console(response);
-	    if (config.system_output < SYSTEM_OUTPUT_INFO) {
-                os_sprintf(response, "System output: %s\r\n", config.system_output==SYSTEM_OUTPUT_NONE?"none":"command reply");
-		to_console(response);
-	    }
-	    goto command_handled_2;
+static void ICACHE_FLASH_ATTR cli_set_dns(char *val, char *response) {
+    if (os_strcmp(val, "dhcp") == 0) {
+	config.dns_addr.addr = 0;
+	os_sprintf_flash(response, "DNS from DHCP\r\n");
+    } else {
+	config.dns_addr.addr = ipaddr_addr(val);
+	os_sprintf(response, "DNS set to %d.%d.%d.%d\r\n", IP2STR(&config.dns_addr));
+	if (config.dns_addr.addr) {
+	    dns_ip.addr = config.dns_addr.addr;
 	}
+    }
+}
 
-	if (nTokens == 2 && strcmp(tokens[1], "stats") == 0) {
-	    uint32_t time = (uint32_t) (get_long_systime() / 1000000);
-	    int16_t i;
+static void ICACHE_FLASH_ATTR cli_set_ip(char *val, char *response) {
+    if (os_strcmp(val, "dhcp") == 0) {
+	config.my_addr.addr = 0;
+	os_sprintf_flash(response, "IP from DHCP\r\n");
+    } else {
+	config.my_addr.addr = ipaddr_addr(val);
+	os_sprintf(response, "IP address set to %d.%d.%d.%d\r\n", IP2STR(&config.my_addr));
+    }
+}
 
-	    os_sprintf(response, "System uptime: %d:%02d:%02d\r\n", time / 3600, (time % 3600) / 60, time % 60);
-	    to_console(response);
+static void ICACHE_FLASH_ATTR cli_set_netmask(char *val, char *response) {
+    config.my_netmask.addr = ipaddr_addr(val);
+    os_sprintf(response, "IP netmask set to %d.%d.%d.%d\r\n", IP2STR(&config.my_netmask));
+}
 
-	    os_sprintf(response, "Free mem: %d\r\n", system_get_free_heap_size());
-	    to_console(response);
-#ifdef SCRIPTED
-	    os_sprintf(response, "Interpreter loop: %d (%d us)\r\n", loop_count, loop_time);
-	    to_console(response);
+static void ICACHE_FLASH_ATTR cli_set_gw(char *val, char *response) {
+    config.my_gw.addr = ipaddr_addr(val);
+    os_sprintf(response, "Gateway set to %d.%d.%d.%d\r\n", IP2STR(&config.my_gw));
+}
+
+#ifdef MDNS
+static void ICACHE_FLASH_ATTR cli_set_mdns_mode(char *val, char *response) {
+    config.mdns_mode = atoi(val);
+    os_sprintf(response, "mDNS mode set to %d\r\n", config.mdns_mode);
+}
 #endif
-	    if (connected) {
-		os_sprintf(response, "External IP-address: " IPSTR "\r\n", IP2STR(&my_ip));
-	    } else {
-		os_sprintf_flash(response, "Not connected to AP\r\n");
-	    }
-	    to_console(response);
-	    if (config.ap_on)
-		os_sprintf(response, "%d Station%s connected to AP\r\n",
-			   wifi_softap_get_station_num(), wifi_softap_get_station_num() == 1 ? "" : "s");
-	    else
-		os_sprintf_flash(response, "AP disabled\r\n");
-	    to_console(response);
-#ifdef NTP
-	    if (ntp_sync_done()) {
-		os_sprintf(response, "NTP synced: %s \r\n", get_timestr());
-	    } else {
-		os_sprintf_flash(response, "NTP no sync\r\n");
-	    }
-	    to_console(response);
+
+#ifdef REMOTE_CONFIG
+static void ICACHE_FLASH_ATTR cli_set_config_port(char *val, char *response) {
+    config.config_port = atoi(val);
+    if (config.config_port == 0)
+	os_sprintf_flash(response, "WARNING: if you save this, remote console access will be disabled!\r\n");
+    else
+	os_sprintf(response, "Config port set to %d\r\n", config.config_port);
+}
+
+static void ICACHE_FLASH_ATTR cli_set_config_access(char *val, char *response) {
+    config.config_access = atoi(val) & (LOCAL_ACCESS | REMOTE_ACCESS);
+    if (config.config_access == 0)
+	os_sprintf_flash(response, "WARNING: if you save this, remote console access will be disabled!\r\n");
+    else
+	os_sprintf(response, "Config access set\r\n");
+}
 #endif
-	    goto command_handled_2;
-	}
 
-	if (nTokens == 2 && strcmp(tokens[1], "mqtt") == 0) {
-	    if (config.locked) {
-		os_sprintf(response, INVALID_LOCKED);
-		goto command_handled;
-	    }
+static void ICACHE_FLASH_ATTR cli_set_broker_subscriptions(char *val, char *response) {
+    config.max_subscriptions = atoi(val);
+    os_sprintf_flash(response, "Broker subscriptions set\r\n");
+}
 
-	    MQTT_ClientCon *clientcon;
-	    int ccnt = 0;
+static void ICACHE_FLASH_ATTR cli_set_broker_retained_messages(char *val, char *response) {
+    config.max_retained_messages = atoi(val);
+    os_sprintf_flash(response, "Broker retained messages set\r\n");
+}
 
-	    os_sprintf(response, "Current clients: %d\r\n", MQTT_server_countClientCon());
-	    to_console(response);
-	    for (clientcon = clientcon_list; clientcon != NULL; clientcon = clientcon->next, ccnt++) {
-		os_sprintf(response, "%s%s", clientcon->connect_info.client_id, clientcon->next != NULL ? ", " : "");
-		to_console(response);
-	    }
-	    os_sprintf(response, "%sCurrent subsriptions:\r\n", ccnt ? "\r\n" : "");
-	    to_console(response);
-	    iterate_topics(printf_topic, response);
-	    os_sprintf_flash(response, "Retained topics:\r\n");
-	    to_console(response);
-	    iterate_retainedtopics(printf_retainedtopic, response);
-#ifdef MQTT_CLIENT
-	    os_sprintf(response, "MQTT client %s\r\n", mqtt_connected ? "connected" : "disconnected");
-	    to_console(response);
-#endif
-#ifdef SCRIPTED
-	    os_sprintf(response, "Script %s\r\n", script_enabled ? "enabled" : "disabled");
-	    to_console(response);
-#endif
-	    goto command_handled_2;
-	}
-#ifdef BACKLOG
-	if (nTokens >= 2 && strcmp(tokens[1], "backlog") == 0) {
-	    uint16_t len;
-	    if (backlog_buffer == NULL)
-		goto command_handled_2;
-	    while (ringbuf_bytes_free(console_tx_buffer) && (len=ringbuf_bytes_used(backlog_buffer))) {
-		if (len > sizeof(response)-1)
-		    len = sizeof(response)-1;
-		ringbuf_memcpy_from(response, backlog_buffer, len);
-		to_console(response);
-	    }
+static void ICACHE_FLASH_ATTR cli_set_broker_clients(char *val, char *response) {
+    config.max_clients = atoi(val);
+    os_sprintf_flash(response, "Broker max clients set\r\n");
+}
 
-	    goto command_handled_2;
-	}
-#endif
-#ifdef SCRIPTED
-	if (nTokens >= 2 && strcmp(tokens[1], "script") == 0) {
-	    if (config.locked) {
-		os_sprintf(response, INVALID_LOCKED);
-		goto command_handled;
-	    }
+static void ICACHE_FLASH_ATTR cli_set_broker_port(char *val, char *response) {
+    config.mqtt_broker_port = atoi(val);
+    os_sprintf_flash(response, "Broker port set\r\n");
+}
 
-	    uint32_t line_count, char_count, start_line = 1;
-	    if (nTokens == 3)
-		start_line = atoi(tokens[2]);
+static void ICACHE_FLASH_ATTR cli_set_broker_user(char *val, char *response) {
+    os_strncpy(config.mqtt_broker_user, val, 32);
+    config.mqtt_broker_user[31] = '\0';
+    os_sprintf_flash(response, "Broker username set\r\n");
+}
 
-	    uint32_t size = get_script_size();
-	    if (size == 0)
-		goto command_handled;
+static void ICACHE_FLASH_ATTR cli_set_broker_password(char *val, char *response) {
+    if (os_strcmp(val, "none") == 0) {
+	config.mqtt_broker_password[0] = '\0';
+    } else {
+	os_strncpy(config.mqtt_broker_password, val, 32);
+	config.mqtt_broker_password[31] = '\0';
+    }
+    os_sprintf_flash(response, "Broker password set\r\n");
+}
 
-	    uint8_t *script = (uint8_t *) os_malloc(size);
-	    uint8_t *p;
-	    bool nl;
+static void ICACHE_FLASH_ATTR cli_set_broker_access(char *val, char *response) {
+    config.mqtt_broker_access = atoi(val) & (LOCAL_ACCESS | REMOTE_ACCESS);
+    os_sprintf_flash(response, "Broker access set\r\n");
+}
 
-	    if (script == 0) {
-		os_sprintf_flash(response, "Out of memory");
-		goto command_handled;
-	    }
+static void ICACHE_FLASH_ATTR cli_set_broker_autoretain(char *val, char *response) {
+    config.auto_retained = atoi(val) != 0;
+    os_sprintf_flash(response, "Broker autoretain set\r\n");
+}
 
-	    blob_load(SCRIPT_SLOT, (uint32_t *) script, size);
+static void ICACHE_FLASH_ATTR cli_set_broker_rate_msgs(char *val, char *response) {
+    config.broker_rate_msgs = atoi(val);
+    os_sprintf_flash(response, "Broker message rate set\r\n");
+}
 
-	    p = script + 4;
-	    for (line_count = 1; line_count < start_line && *p != 0; p++) {
-		if (*p == '\n')
-		    line_count++;
-	    }
-	    nl = true;
-	    for (char_count = 0; *p != 0 && char_count < MAX_CON_SEND_SIZE - 20; p++, char_count++) {
-		if (nl) {
-		    os_sprintf(response, "\r%4d: ", line_count);
-		    char_count += 7;
-		    to_console(response);
-		    line_count++;
-		    nl = false;
-		}
-		ringbuf_memcpy_into(console_tx_buffer, p, 1);
-		if (*p == '\n')
-		    nl = true;
-	    }
-	    if (*p == 0) {
-		ringbuf_memcpy_into(console_tx_buffer, "\r\n--end--", 9);
-	    } else {
-		ringbuf_memcpy_into(console_tx_buffer, "...", 3);
-	    }
-	    ringbuf_memcpy_into(console_tx_buffer, "\r\n", 2);
+static void ICACHE_FLASH_ATTR cli_set_broker_rate_bytes(char *val, char *response) {
+    config.broker_rate_bytes = atoi(val);
+    os_sprintf_flash(response, "Broker byte rate set\r\n");
+}
 
-	    os_free(script);
-	    goto command_handled_2;
-	}
+static void ICACHE_FLASH_ATTR cli_set_broker_rate_topic(char *val, char *response) {
+    os_strncpy(config.broker_rate_topic, val, 32);
+    config.broker_rate_topic[31] = '\0';
+    os_sprintf_flash(response, "Broker rate topic set\r\n");
+}
 
-	if (nTokens >= 2 && strcmp(tokens[1], "vars") == 0) {
-	    if (config.locked) {
-		os_sprintf(response, INVALID_LOCKED);
-		goto command_handled;
-	    }
-	    int i;
-
-	    if (script_enabled) {
-		for (i = 0; i < MAX_VARS; i++) {
-		    if (!vars[i].free) {
-			os_sprintf(response, "%s: %s\r\n", vars[i].name, vars[i].data);
-			to_console(response);
-		    }
-		}
-	    }
+static void ICACHE_FLASH_ATTR cli_set_sys_interval(char *val, char *response) {
+    config.sys_interval = atoi(val);
+    os_sprintf_flash(response, "$SYS interval set\r\n");
+}
 
-	    uint8_t slots[MAX_FLASH_SLOTS*FLASH_SLOT_LEN];
-	    blob_load(VARS_SLOT, (uint32_t *)slots, sizeof(slots));
+static void ICACHE_FLASH_ATTR cli_set_sys_latency(char *val, char *response) {
+    config.sys_latency = atoi(val) != 0;
+    os_sprintf_flash(response, "$SYS latency set\r\n");
+}
 
-	    for (i = 0; i < MAX_FLASH_SLOTS; i++) {
-		os_sprintf(response, "@%d: %s\r\n", i+1, &slots[i*FLASH_SLOT_LEN]);
-		to_console(response);
-	    }
-	    goto command_handled_2;
-	}
+#ifdef RECORDER
+static void ICACHE_FLASH_ATTR cli_set_record_mode(char *val, char *response) {
+    uint8_t mode;
+
+    if (strcmp(val, "flash") == 0)
+	mode = REC_FLASH;
+    else if (strcmp(val, "tcp") == 0)
+	mode = REC_TCP;
+    else if (strcmp(val, "off") == 0)
+	mode = REC_OFF;
+    else
+	mode = atoi(val);
+    if (mode > REC_TCP || !recorder_set_mode(mode))
+	os_sprintf_flash(response, "Recorder mode not available\r\n");
+    else
+	os_sprintf_flash(response, "Recorder mode set\r\n");
+}
 #endif
+
+#ifdef SERIAL_FRAMES
+static void ICACHE_FLASH_ATTR cli_set_serial_mode(char *val, char *response) {
+    if (strcmp(val, "slip") == 0 || strcmp(val, "1") == 0)
+	config.serial_mode = SERIAL_SLIP;
+    else if (strcmp(val, "line") == 0 || strcmp(val, "0") == 0)
+	config.serial_mode = SERIAL_LINES;
+    else {
+	os_sprintf(response, INVALID_ARG);
+	return;
     }
+    os_sprintf_flash(response, "Serial mode set (save and reset to activate)\r\n");
+}
 
-    if (strcmp(tokens[0], "save") == 0) {
-	if (config.locked) {
-	    os_sprintf(response, INVALID_LOCKED);
-	    goto command_handled;
-	}
+static void ICACHE_FLASH_ATTR cli_set_serial_topic(char *val, char *response) {
+    serial_frame_set_topic(val);
+    os_sprintf(response, "Serial topic set to %s\r\n", config.serial_topic);
+}
+#endif
 
-	if (nTokens == 1 || (nTokens == 2 && strcmp(tokens[1], "config") == 0)) {
-	    config_save(&config);
-	    os_sprintf_flash(response, "Config saved\r\n");
-	    goto command_handled;
+#ifdef BACKLOG
+static void ICACHE_FLASH_ATTR cli_set_backlog(char *val, char *response) {
+    int backlog_size = atoi(val);
+    if (backlog_size != 0) {
+	if (backlog_buffer != NULL) {
+	    os_sprintf_flash(response, "Backlog already set\r\n");
+	    return;
 	}
+	backlog_buffer = ringbuf_new(backlog_size);
+	if (backlog_buffer == NULL) {
+	    os_sprintf(response, "No memory\r\n");
+	    return;
+	}
+	os_sprintf(response, "Backlog set to %d chars\r\n", backlog_size);
+    } else {
+	if (backlog_buffer != NULL) {
+	    ringbuf_free(&backlog_buffer);
+	}
+	os_sprintf_flash(response, "Backlog off\r\n");
     }
-#ifdef ALLOW_SCANNING
-    if (strcmp(tokens[0], "scan") == 0) {
-	wifi_station_scan(NULL, scan_done);
-	os_sprintf_flash(response, "Scanning...\r\n");
-	goto command_handled;
-    }
+}
 #endif
-#ifdef NTP
-    if (strcmp(tokens[0], "time") == 0) {
-	os_sprintf(response, "%s %s\r\n", get_weekday(), get_timestr());
-	goto command_handled;
-    }
+
+#ifdef SCRIPTED
+static void ICACHE_FLASH_ATTR cli_set_script_logging(char *val, char *response) {
+    lang_logging = atoi(val);
+    os_sprintf_flash(response, "Script logging set\r\n");
+}
 #endif
-    if (strcmp(tokens[0], "reset") == 0) {
-	if (config.locked && pespconn != NULL) {
-	    os_sprintf(response, INVALID_LOCKED);
-	    goto command_handled;
-	}
-	if (nTokens == 2 && strcmp(tokens[1], "factory") == 0) {
-	    config_load_default(&config);
-	    config_save(&config);
+
 #ifdef SCRIPTED
-	    // Clear script, vars, and retained topics
-	    blob_zero(SCRIPT_SLOT, MAX_SCRIPT_SIZE);
-	    blob_zero(VARS_SLOT, MAX_FLASH_SLOTS * FLASH_SLOT_LEN);
-	    blob_zero(RETAINED_SLOT, MAX_RETAINED_LEN);
+#ifdef GPIO
+#ifdef GPIO_PWM
+static void ICACHE_FLASH_ATTR cli_set_pwm_period(char *val, char *response) {
+    config.pwm_period = atoi(val);
+    os_sprintf_flash(response, "PWM period set\r\n");
+}
 #endif
-	}
+#endif
+#endif
+
+#ifdef NTP
+static void ICACHE_FLASH_ATTR cli_set_ntp_server(char *val, char *response) {
+    os_strncpy(config.ntp_server, val, 32);
+    config.ntp_server[31] = 0;
+    ntp_set_server(config.ntp_server);
+    os_sprintf(response, "NTP server set to %s\r\n", config.ntp_server);
+}
+
+static void ICACHE_FLASH_ATTR cli_set_ntp_interval(char *val, char *response) {
+    config.ntp_interval = atoi(val) * 1000000;
+    os_sprintf(response, "NTP interval set to %d s\r\n", atoi(val));
+}
 
-	save_retainedtopics();
+static void ICACHE_FLASH_ATTR cli_set_ntp_timezone(char *val, char *response) {
+    config.ntp_timezone = atoi(val);
+    set_timezone(config.ntp_timezone);
+    os_sprintf(response, "NTP timezone set to %d h\r\n", config.ntp_timezone);
+}
 
-	os_printf("Restarting ... \r\n");
-	system_restart();
-	while (true);
+static void ICACHE_FLASH_ATTR cli_set_ntp_time(char *val, char *response) {
+    if (strlen(val) != 8 || val[2] != ':' || val[5] != ':') {
+	os_sprintf_flash(response, "Time format hh:mm:ss\r\n");
+	return;
     }
+    val[2] = '\0';
+    val[5] = '\0';
+    set_time_local(atoi(val), atoi(&val[3]), atoi(&val[6]));
+    os_sprintf(response, "Time set to %s \r\n", get_timestr());
+}
 
-    if (strcmp(tokens[0], "quit") == 0) {
-	remote_console_disconnect = 1;
-	os_sprintf_flash(response, "Quitting console\r\n");
-	goto command_handled;
+static void ICACHE_FLASH_ATTR cli_set_ntp_weekday(char *val, char *response) {
+    if (set_weekday_local(val)) {
+	os_sprintf(response, "Weekday set to %s\r\n", get_weekday());
+    } else {
+	os_sprintf_flash(response, "Set weekday failed\r\n");
     }
-#ifdef SCRIPTED
-    if (strcmp(tokens[0], "script") == 0) {
-	uint16_t port;
+}
+#endif
 
-	if (config.locked) {
-	    os_sprintf(response, INVALID_LOCKED);
-	    goto command_handled;
-	}
+#ifdef DNS_RESP
+static void ICACHE_FLASH_ATTR cli_set_dns_name(char *val, char *response) {
+    os_strncpy(config.broker_dns_name, val, 32);
+    config.mqtt_host[31] = 0;
+    os_sprintf_flash(response, "DNS name set\r\n");
+}
+#endif
 
-	if (nTokens != 2) {
-	    os_sprintf(response, INVALID_NUMARGS);
-	    goto command_handled;
-	}
+#ifdef MQTT_CLIENT
+static void ICACHE_FLASH_ATTR cli_set_mqtt_host(char *val, char *response) {
+    os_strncpy(config.mqtt_host, val, 32);
+    config.mqtt_host[31] = 0;
+    os_sprintf_flash(response, "MQTT host set\r\n");
+}
 
-	if (strcmp(tokens[1], "delete") == 0) {
-#ifdef GPIO
-	    stop_gpios();
-#endif
-	    script_enabled = false;
-	    if (my_script != NULL)
-		free_script();
-	    blob_zero(0, MAX_SCRIPT_SIZE);
-	    blob_zero(1, MAX_FLASH_SLOTS * FLASH_SLOT_LEN);
-	    os_sprintf_flash(response, "Script deleted\r\n");
-	    goto command_handled;
-	}
+static void ICACHE_FLASH_ATTR cli_set_mqtt_port(char *val, char *response) {
+    config.mqtt_port = atoi(val);
+    os_sprintf_flash(response, "MQTT port set\r\n");
+}
 
-	if (!isdigit(tokens[1][0])) {
-	    scriptcon = pespconn;
-	    http_get(tokens[1], "", http_script_cb);
-	    os_sprintf(response, "HTTP request to %s started\r\n", tokens[1]);
-	    goto command_handled;  
-	}
+static void ICACHE_FLASH_ATTR cli_set_mqtt_ssl(char *val, char *response) {
+    config.mqtt_ssl = atoi(val);
+    os_sprintf(response, "MQTT ssl %s\r\n", config.mqtt_ssl?"on":"off");
+}
 
-	port = atoi(tokens[1]);
-	if (port == 0) {
-	    os_sprintf_flash(response, "Invalid port\r\n");
-	    goto command_handled;
-	}
-	// delete and disable existing script
-#ifdef GPIO
-	stop_gpios();
-#endif
-	script_enabled = false;
-	if (my_script != NULL)
-	    free_script();
+static void ICACHE_FLASH_ATTR cli_set_mqtt_user(char *val, char *response) {
+    os_strncpy(config.mqtt_user, val, 32);
+    config.mqtt_user[31] = 0;
+    os_sprintf_flash(response, "MQTT user set\r\n");
+}
 
-	scriptcon = pespconn;
-	downloadCon = (struct espconn *)os_zalloc(sizeof(struct espconn));
+static void ICACHE_FLASH_ATTR cli_set_mqtt_password(char *val, char *response) {
+    os_strncpy(config.mqtt_password, val, 32);
+    config.mqtt_password[31] = 0;
+    os_sprintf_flash(response, "MQTT password set\r\n");
+}
 
-	/* Equivalent to bind */
-	downloadCon->type = ESPCONN_TCP;
-	downloadCon->state = ESPCONN_NONE;
-	downloadCon->proto.tcp = (esp_tcp *) os_zalloc(sizeof(esp_tcp));
-	downloadCon->proto.tcp->local_port = port;
+static void ICACHE_FLASH_ATTR cli_set_mqtt_id(char *val, char *response) {
+    os_strncpy(config.mqtt_id, val, 32);
+    config.mqtt_id[31] = 0;
+    os_sprintf_flash(response, "MQTT id set\r\n");
+}
 
-	/* Register callback when clients connect to the server */
-	espconn_regist_connectcb(downloadCon, script_connected_cb);
+static void ICACHE_FLASH_ATTR cli_set_mqtt_queue(char *val, char *response) {
+    config.mqtt_queue_mode = atoi(val);
+    if (config.mqtt_queue_mode > QUEUE_LATEST)
+	config.mqtt_queue_mode = QUEUE_OFF;
+    os_sprintf_flash(response, "MQTT queue set\r\n");
+}
 
-	/* Put the connection in accept mode */
-	espconn_accept(downloadCon);
+static void ICACHE_FLASH_ATTR cli_set_mqtt_queue_rate(char *val, char *response) {
+    config.mqtt_queue_rate = atoi(val);
+    os_sprintf_flash(response, "MQTT queue rate set\r\n");
+}
 
-	os_sprintf(response, "Waiting for script upload on port %d\r\n", port);
-	goto command_handled;
-    }
 #endif
-    if (strcmp(tokens[0], "lock") == 0) {
-	if (config.locked) {
-	    os_sprintf_flash(response, "Config already locked\r\n");
-	    goto command_handled;
+
+static const cli_param set_params[] = {
+    { "ap_on", cli_set_ap_on },
+    { "ap_open", cli_set_ap_open },
+    { "ap_password", cli_set_ap_password },
+    { "ap_ssid", cli_set_ap_ssid },
+    { "auto_connect", cli_set_auto_connect },
+#ifdef BACKLOG
+    { "backlog", cli_set_backlog },
+#endif
+    { "bitrate", cli_set_bitrate },
+    { "broker_access", cli_set_broker_access },
+    { "broker_autoretain", cli_set_broker_autoretain },
+    { "broker_clients", cli_set_broker_clients },
+    { "broker_password", cli_set_broker_password },
+    { "broker_port", cli_set_broker_port },
+    { "broker_rate_bytes", cli_set_broker_rate_bytes },
+    { "broker_rate_msgs", cli_set_broker_rate_msgs },
+    { "broker_rate_topic", cli_set_broker_rate_topic },
+    { "broker_retained_messages", cli_set_broker_retained_messages },
+    { "broker_subscriptions", cli_set_broker_subscriptions },
+    { "broker_user", cli_set_broker_user },
+#ifdef REMOTE_CONFIG
+    { "config_access", cli_set_config_access },
+    { "config_port", cli_set_config_port },
+#endif
+    { "dns", cli_set_dns },
+#ifdef DNS_RESP
+    { "dns_name", cli_set_dns_name },
+#endif
+    { "gw", cli_set_gw },
+    { "ip", cli_set_ip },
+#ifdef MDNS
+    { "mdns_mode", cli_set_mdns_mode },
+#endif
+#ifdef MQTT_CLIENT
+    { "mqtt_host", cli_set_mqtt_host },
+    { "mqtt_id", cli_set_mqtt_id },
+    { "mqtt_password", cli_set_mqtt_password },
+    { "mqtt_port", cli_set_mqtt_port },
+    { "mqtt_queue", cli_set_mqtt_queue },
+    { "mqtt_queue_rate", cli_set_mqtt_queue_rate },
+    { "mqtt_ssl", cli_set_mqtt_ssl },
+    { "mqtt_user", cli_set_mqtt_user },
+#endif
+    { "netmask", cli_set_netmask },
+    { "network", cli_set_network },
+#ifdef NTP
+    { "ntp_interval", cli_set_ntp_interval },
+    { "ntp_server", cli_set_ntp_server },
+    { "ntp_time", cli_set_ntp_time },
+    { "ntp_timezone", cli_set_ntp_timezone },
+    { "ntp_weekday", cli_set_ntp_weekday },
+#endif
+    { "password", cli_set_password },
+#ifdef SCRIPTED
+#ifdef GPIO
+#ifdef GPIO_PWM
+    { "pwm_period", cli_set_pwm_period },
+#endif
+#endif
+#endif
+#ifdef RECORDER
+    { "record_mode", cli_set_record_mode },
+#endif
+#ifdef SCRIPTED
+    { "script_logging", cli_set_script_logging },
+#endif
+#ifdef SERIAL_FRAMES
+    { "serial_mode", cli_set_serial_mode },
+    { "serial_topic", cli_set_serial_topic },
+#endif
+    { "speed", cli_set_speed },
+    { "ssid", cli_set_ssid },
+    { "sys_interval", cli_set_sys_interval },
+    { "sys_latency", cli_set_sys_latency },
+    { "system_output", cli_set_system_output },
+};
+
+static uint8_t ICACHE_FLASH_ATTR cli_help(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    os_sprintf_flash(response, "show [config|stats|mqtt]\r\nsave\r\nreset [factory]\r\nlock [<password>]\r\nunlock <password>\r\nquit\r\n");
+    to_console(response);
+#ifdef REMOTE_CONFIG
+    os_sprintf_flash(response, "log\r\n");
+    to_console(response);
+#endif
+#ifdef ALLOW_SCANNING
+    os_sprintf_flash(response, "scan\r\n");
+    to_console(response);
+#endif
+    os_sprintf_flash(response, "set [ssid|password|auto_connect|ap_ssid|ap_password|ap_on|ap_open] <val>\r\n");
+    to_console(response);
+    os_sprintf_flash(response, "set [network|dns|ip|netmask|gw] <val>\r\n");
+    to_console(response);
+    os_sprintf_flash(response, "set [config_port|config_access|bitrate|system_output] <val>\r\n");
+    to_console(response);
+    os_sprintf_flash(response, "set [broker_port|broker_user|broker_password|broker_access|broker_clients] <val>\r\n");
+    to_console(response);
+    os_sprintf_flash(response, "set [broker_subscriptions|broker_retained_messages|broker_autoretain] <val>\r\n");
+    to_console(response);
+    os_sprintf_flash(response, "set [broker_rate_msgs|broker_rate_bytes|broker_rate_topic] <val>\r\n");
+    to_console(response);
+    os_sprintf_flash(response, "set [sys_interval|sys_latency] <val>\r\n");
+    to_console(response);
+#ifdef SERIAL_FRAMES
+    os_sprintf_flash(response, "set [serial_mode|serial_topic] <val>\r\n");
+    to_console(response);
+#endif
+    os_sprintf_flash(response, "delete_retained|save_retained\r\n");
+    to_console(response);
+    os_sprintf_flash(response, "publish [local|remote] <topic> <data> [retained]\r\n");
+    to_console(response);
+#ifdef SCRIPTED
+    os_sprintf_flash(response, "script <port>|<url>|delete\r\nshow [script|vars]\r\nshow script profile [<start>]\r\nshow latency\r\n");
+    to_console(response);
+#ifdef GPIO
+#ifdef GPIO_PWM
+    os_sprintf_flash(response, "set pwm_period <val>\r\n");
+    to_console(response);
+#endif
+#endif
+#endif
+#ifdef TRACE
+    os_sprintf_flash(response, "show trace [dump] [<start>]\r\n");
+    to_console(response);
+#endif
+#ifdef RECORDER
+    os_sprintf_flash(response, "set record_mode [off|flash|tcp]\r\nshow record [dump] [<start>]\r\ndelete_record\r\n");
+    to_console(response);
+#endif
+#ifdef NTP
+    os_sprintf_flash(response, "time\r\nset [ntp_server|ntp_interval|ntp_timezone|ntp_time|ntp_weekday] <val>\r\n");
+    to_console(response);
+#endif
+#ifdef DNS_RESP
+    os_sprintf_flash(response, "set dns_name <name>\r\n");
+    to_console(response);
+#endif
+#ifdef MQTT_CLIENT
+    os_sprintf_flash(response, "set [mqtt_host|mqtt_port|mqtt_ssl|mqtt_user|mqtt_password|mqtt_id] <val>\r\n");
+    to_console(response);
+    os_sprintf_flash(response, "set [mqtt_queue|mqtt_queue_rate] <val>\r\n");
+    to_console(response);
+    os_sprintf_flash(response, "bridge [in|out|both] <local_topic> <remote_topic> [<qos>] [retain]\r\nbridge delete <no>\r\nshow bridge\r\n");
+    to_console(response);
+#endif
+
+    return CMD_DONE;
+}
+
+static uint8_t ICACHE_FLASH_ATTR cli_show(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    int16_t i;
+    ip_addr_t i_ip;
+
+    if (nTokens == 1 || (nTokens == 2 && strcmp(tokens[1], "config") == 0)) {
+	os_sprintf(response, "Version %s (build: %s)\r\n", ESP_UBROKER_VERSION, __TIMESTAMP__);
+	to_console(response);
+
+	os_sprintf(response, "STA: SSID:%s PW:%s%s\r\n",
+		   config.ssid,
+		   config.locked ? "***" : (char *)config.password, config.auto_connect ? "" : " [AutoConnect:0]");
+	to_console(response);
+
+	os_sprintf(response, "AP:  SSID:%s PW:%s%s%s IP:%d.%d.%d.%d/24\r\n",
+		   config.ap_ssid,
+		   config.locked ? "***" : (char *)config.ap_password,
+		   config.ap_open ? " [open]" : "",
+		   config.ap_on ? "" : " [disabled]", IP2STR(&config.network_addr));
+	to_console(response);
+
+	// if static IP, add it
+	os_sprintf(response,
+		   config.my_addr.addr ?
+		   "Static IP: %d.%d.%d.%d Netmask: %d.%d.%d.%d Gateway: %d.%d.%d.%d\r\n"
+		   : "", IP2STR(&config.my_addr), IP2STR(&config.my_netmask), IP2STR(&config.my_gw));
+	to_console(response);
+	// if static DNS, add it
+	os_sprintf(response, config.dns_addr.addr ? "DNS: %d.%d.%d.%d\r\n" : "", IP2STR(&config.dns_addr));
+	to_console(response);
+#ifdef DNS_RESP
+	if (strcmp(config.broker_dns_name, "none")!=0 && config.ap_on) {
+	    os_sprintf(response, "DNS name: %s\r\n", config.broker_dns_name);
+	    to_console(response);
 	}
-	if (nTokens == 1) {
-	    if (os_strlen(config.lock_password) == 0) {
-		os_sprintf_flash(response, "No password defined\r\n");
-		goto command_handled;
-	    }
+#endif
+#ifdef MDNS
+	if (config.mdns_mode) {
+	    os_sprintf(response, "mDNS: %s interface\r\n", config.mdns_mode==1 ? "STA": "SoftAP");
+	    to_console(response);
 	}
-	else if (nTokens == 2) {
-	    os_sprintf(config.lock_password, "%s", tokens[1]);
+#endif
+#ifdef REMOTE_CONFIG
+	if (config.config_port == 0 || config.config_access == 0) {
+	    os_sprintf(response, "No network console access\r\n");
+	} else {
+	    os_sprintf(response, "Network console access on port %d (mode %d)\r\n", config.config_port, config.config_access);
+	}
+	to_console(response);
+#endif
+
+	os_sprintf(response, "MQTT broker max. subscription: %d\r\nMQTT broker max. retained messages: %d%s\r\n",
+		   config.max_subscriptions, config.max_retained_messages, config.auto_retained?" (auto saved)":"");
+	to_console(response);
+
+	if (config.mqtt_broker_port != MQTT_PORT) {
+	    os_sprintf(response, "MQTT broker port: %d\r\n", config.mqtt_broker_port);
+	    to_console(response);
 	}
-	else {
-	    os_sprintf(response, INVALID_NUMARGS);
-	    goto command_handled;
+	if (config.max_clients != 0) {
+	    os_sprintf(response, "MQTT broker max. clients: %d\r\n", config.max_clients);
+	    to_console(response);
 	}
-	config.locked = 1;
-	config_save(&config);
-	os_sprintf(response, "Config locked (pw: %s)\r\n", config.lock_password);
-	goto command_handled;
+	if (config.broker_rate_msgs != 0 || config.broker_rate_bytes != 0) {
+	    os_sprintf(response, "MQTT broker rate limit: %d msgs/s, %d bytes/s per client (topic: %s)\r\n",
+		       config.broker_rate_msgs, config.broker_rate_bytes, config.broker_rate_topic);
+	    to_console(response);
+	}
+	if (config.sys_interval != 10) {
+	    os_sprintf(response, "MQTT broker $SYS interval: %d s\r\n", config.sys_interval);
+	    to_console(response);
+	}
+	if (config.sys_latency) {
+	    os_sprintf_flash(response, "MQTT broker $SYS latency: on\r\n");
+	    to_console(response);
+	}
+#ifdef RECORDER
+	if (config.record_mode != REC_OFF) {
+	    os_sprintf(response, "Recorder: %s\r\n", config.record_mode == REC_FLASH ? "flash" : "tcp");
+	    to_console(response);
+	}
+#endif
+
+	if (os_strcmp(config.mqtt_broker_user, "none") != 0) {
+	    os_sprintf(response,
+		       "MQTT broker username: %s\r\nMQTT broker password: %s\r\n",
+		       config.mqtt_broker_user,
+		       config.locked ? "***" : (char *)config.mqtt_broker_password);
+	    to_console(response);
+	}
+	response[0] = '\0';
+	if (config.mqtt_broker_access == LOCAL_ACCESS)
+	    os_sprintf(response, "MQTT broker: local access only\r\n");
+	if (config.mqtt_broker_access == REMOTE_ACCESS)
+	    os_sprintf(response, "MQTT broker: remote access only\r\n");
+	if (config.mqtt_broker_access == 0)
+	    os_sprintf(response, "MQTT broker: disabled\r\n");
+	to_console(response);
+#ifdef MQTT_CLIENT
+	os_sprintf(response, "MQTT client %s\r\n", mqtt_enabled ? "enabled" : "disabled");
+	to_console(response);
+
+	if (os_strcmp(config.mqtt_host, "none") != 0) {
+	    os_sprintf(response,
+		       "MQTT client host: %s\r\nMQTT client port: %d\r\nMQTT client user: %s\r\nMQTT client password: %s\r\nMQTT client id: %s\r\nMQTT SSL: %s\r\n",
+		       config.mqtt_host, config.mqtt_port, config.mqtt_user,
+		       config.locked ? "***" : (char *)config.mqtt_password, config.mqtt_id,
+		       config.mqtt_ssl ? "on" : "off");
+	    to_console(response);
+	    os_sprintf(response, "MQTT client queue: %s (replay %d msgs/s)\r\n",
+		       config.mqtt_queue_mode == QUEUE_OFF ? "off" :
+		       config.mqtt_queue_mode == QUEUE_LATEST ? "latest per topic" : "all",
+		       config.mqtt_queue_rate);
+	    to_console(response);
+	}
+#endif
+#ifdef NTP
+	if (os_strcmp(config.ntp_server, "none") != 0) {
+	    os_sprintf(response,
+		       "NTP server: %s (interval: %d s, tz: %d)\r\n",
+		       config.ntp_server, config.ntp_interval / 1000000, config.ntp_timezone);
+	    to_console(response);
+	}
+#endif
+	os_sprintf(response, "Clock speed: %d\r\n", config.clock_speed);
+	to_console(response);
+
+	os_sprintf(response, "Serial bitrate: %d\r\n", config.bit_rate);
+	to_console(response);
+	if (config.system_output < SYSTEM_OUTPUT_INFO) {
+	    os_sprintf(response, "System output: %s\r\n", config.system_output==SYSTEM_OUTPUT_NONE?"none":"command reply");
+	    to_console(response);
+	}
+#ifdef SERIAL_FRAMES
+	if (config.serial_mode == SERIAL_SLIP) {
+	    os_sprintf(response, "Serial mode: slip frames (topic: %s)\r\n", config.serial_topic);
+	    to_console(response);
+	}
+#endif
+	return CMD_DONE;
     }
 
-    if (strcmp(tokens[0], "unlock") == 0) {
-	if (nTokens != 2) {
-	    os_sprintf(response, INVALID_NUMARGS);
-	} else if (os_strcmp(tokens[1], config.lock_password) == 0) {
-	    config.locked = 0;
-	    config_save(&config);
-	    os_sprintf_flash(response, "Config unlocked\r\n");
+    if (nTokens == 2 && strcmp(tokens[1], "stats") == 0) {
+	uint32_t time = (uint32_t) (get_long_systime() / 1000000);
+	int16_t i;
+
+	os_sprintf(response, "System uptime: %d:%02d:%02d\r\n", time / 3600, (time % 3600) / 60, time % 60);
+	to_console(response);
+
+	os_sprintf(response, "Free mem: %d (min %d)\r\n", system_get_free_heap_size(), sys_heap_min);
+	to_console(response);
+
+	uint32_t uart_bytes, uart_overruns;
+	UART_TxStats(&uart_bytes, &uart_overruns);
+	os_sprintf(response, "Serial out: %d bytes, %d overruns of the tx ring\r\n", uart_bytes, uart_overruns);
+	to_console(response);
+#ifdef SERIAL_FRAMES
+	if (serial_frame_active()) {
+	    os_sprintf(response, "Serial frames: %d in, %d out, %d bad, %d dropped, %d bytes rx overflow\r\n",
+		       serial_frames_in, serial_frames_out, serial_frames_bad, serial_frames_dropped, UART_RxOverflows());
+	    to_console(response);
+	}
+#endif
+
+	mem_usage usage;
+	mem_gov_usage(&usage);
+	os_sprintf(response, "Mem usage: clients ~%d, script queue %d, retained %d, conn buffers %d, script %d\r\n",
+		   usage.client_bufs, usage.pub_queue, usage.retained, usage.conn_bufs, usage.script);
+	to_console(response);
+	os_sprintf(response, "Mem governor: %s (throttle <%d, reject <%d, drop <%d)\r\n",
+		   mem_gov_level_name(mem_gov_level()), MEM_THROTTLE_HEAP, MEM_REJECT_HEAP, MEM_DROP_HEAP);
+	to_console(response);
+	os_sprintf(response, "Mem governor: %d clients held, %d connects rejected, %d messages dropped\r\n",
+		   broker_conn_count_held(), mem_rejected_connections, mem_dropped_messages);
+	to_console(response);
+#ifdef MQTT_CLIENT
+	if (mqtt_enabled) {
+	    os_sprintf(response, "MQTT reconnect: %d connects (last %d ms), %d failed attempts, backoff %d ms",
+		       reconnect_connects, reconnect_last_ms, reconnect_attempts, reconnect_backoff());
+	    if (reconnect_next_in() >= 0)
+		os_sprintf(response + os_strlen(response), ", next in %d s", reconnect_next_in());
+	    os_sprintf(response + os_strlen(response), "\r\n");
+	    to_console(response);
+	}
+	os_sprintf(response, "Remote queue: %d msgs in RAM (%d bytes), %d in flash, %d dropped\r\n",
+		   remote_queue_ram_count(), remote_queue_ram_bytes(), remote_queue_flash_count(), remote_queue_dropped);
+	to_console(response);
+#endif
+#ifdef HTTPCS
+	os_sprintf(response, "HTTPS handshakes: %d (last %d ms, max %d ms)\r\n",
+		   http_tls_handshakes, http_tls_last_ms, http_tls_max_ms);
+	to_console(response);
+#endif
+#ifdef SCRIPTED
+	os_sprintf(response, "Interpreter loop: %d (%d us)\r\n", loop_count, loop_time);
+	to_console(response);
+#endif
+	if (connected) {
+	    os_sprintf(response, "External IP-address: " IPSTR "\r\n", IP2STR(&my_ip));
+	} else {
+	    os_sprintf_flash(response, "Not connected to AP\r\n");
+	}
+	to_console(response);
+	if (config.ap_on)
+	    os_sprintf(response, "%d Station%s connected to AP\r\n",
+		       wifi_softap_get_station_num(), wifi_softap_get_station_num() == 1 ? "" : "s");
+	else
+	    os_sprintf_flash(response, "AP disabled\r\n");
+	to_console(response);
+#ifdef NTP
+	if (ntp_sync_done()) {
+	    os_sprintf(response, "NTP synced: %s \r\n", get_timestr());
 	} else {
-	    os_sprintf_flash(response, "Unlock failed. Invalid password\r\n");
+	    os_sprintf_flash(response, "NTP no sync\r\n");
 	}
-	goto command_handled;
+	to_console(response);
+#endif
+	return CMD_DONE;
     }
 
-    if (strcmp(tokens[0], "publish") == 0)
-    {
+    if (nTokens == 2 && strcmp(tokens[1], "mqtt") == 0) {
 	if (config.locked) {
 	    os_sprintf(response, INVALID_LOCKED);
-	    goto command_handled;
+	    return CMD_RESPONSE;
+	}
+
+	MQTT_ClientCon *clientcon;
+	int ccnt = 0;
+
+	os_sprintf(response, "Current clients: %d\r\n", MQTT_server_countClientCon());
+	to_console(response);
+	for (clientcon = clientcon_list; clientcon != NULL; clientcon = clientcon->next, ccnt++) {
+	    os_sprintf(response, "%s%s", clientcon->connect_info.client_id, clientcon->next != NULL ? ", " : "");
+	    to_console(response);
 	}
+	os_sprintf(response, "%sCurrent subsriptions:\r\n", ccnt ? "\r\n" : "");
+	to_console(response);
+	iterate_topics(printf_topic, response);
+	os_sprintf_flash(response, "Retained topics:\r\n");
+	to_console(response);
+	iterate_retainedtopics(printf_retainedtopic, response);
+#ifdef MQTT_CLIENT
+	os_sprintf(response, "MQTT client %s\r\n", mqtt_connected ? "connected" : "disconnected");
+	to_console(response);
+#endif
+#ifdef SCRIPTED
+	os_sprintf(response, "Script %s\r\n", script_enabled ? "enabled" : "disabled");
+	to_console(response);
+#endif
+	return CMD_DONE;
+    }
+#ifdef MQTT_CLIENT
+    if (nTokens == 2 && strcmp(tokens[1], "bridge") == 0) {
+	static const char *dir_str[] = { "", "in", "out", "both" };
 
-	uint8_t retained = 0;
+	for (i = 0; i < MAX_BRIDGE_RULES; i++) {
+	    bridge_rule_t *r = &config.bridge_rules[i];
 
-	if (nTokens < 4 || nTokens > 5) {
-            os_sprintf(response, INVALID_NUMARGS);
-            goto command_handled;
+	    if (r->dir == 0)
+		continue;
+	    os_sprintf(response, "%d: %s %s <-> %s (QoS %d)%s\r\n", i, dir_str[r->dir & 3],
+		       r->local, r->remote, r->qos, r->retain ? " retained" : "");
+	    to_console(response);
 	}
-	if (nTokens == 5) {
-	    if (strcmp(tokens[4], "retained")==0) {
-		retained = 1;
+	os_sprintf(response, "Bridged in: %d, out: %d, loops suppressed: %d, dropped: %d\r\n",
+		   bridge_in_count, bridge_out_count, bridge_loop_count, bridge_drop_count);
+	to_console(response);
+	return CMD_DONE;
+    }
+#endif
+#ifdef TRACE
+    if (nTokens >= 2 && strcmp(tokens[1], "trace") == 0) {
+	bool dump = nTokens >= 3 && strcmp(tokens[2], "dump") == 0;
+	uint16_t no = 0;
+	uint32_t prev_time = 0;
+	trace_rec rec;
+
+	if (nTokens == (dump ? 4 : 3))
+	    no = atoi(tokens[nTokens - 1]);
+	if (no > 0 && trace_get(no - 1, &rec))
+	    prev_time = rec.time;
+
+	for (; trace_get(no, &rec); no++) {
+	    if (ringbuf_bytes_free(console_tx_buffer) < 128) {
+		os_sprintf(response, "... (show trace %s%d)\r\n", dump ? "dump " : "", no);
+		to_console(response);
+		break;
+	    }
+	    if (dump) {
+		// Raw records for tools/trace_decode
+		os_sprintf(response, "T %08x %04x %04x %08x\r\n", rec.time, rec.id, rec.arg1, rec.arg2);
 	    } else {
-        	os_sprintf(response, "Invalid arg %s\r\n", tokens[4]);
-        	goto command_handled;
+		trace_format(response, &rec, prev_time);
+		os_sprintf(response + os_strlen(response), "\r\n");
 	    }
+	    to_console(response);
+	    prev_time = rec.time;
 	}
-	if (strcmp(tokens[1], "local") == 0) {
-	    MQTT_local_publish(tokens[2], tokens[3], os_strlen(tokens[3]), 0, retained);
+	return CMD_DONE;
+    }
+#endif
+#ifdef RECORDER
+    if (nTokens >= 2 && strcmp(tokens[1], "record") == 0) {
+	uint32_t buf[12], pos = 0;
+	uint16_t len, i;
+
+	if (nTokens < 3 || strcmp(tokens[2], "dump") != 0) {
+	    os_sprintf(response, "Recorder: %s%s, %d events, %d dropped, %d bytes in flash\r\n",
+		       config.record_mode == REC_FLASH ? "flash" : config.record_mode == REC_TCP ? "tcp" : "off",
+		       config.record_mode == REC_TCP && recorder_client_connected() ? " (client connected)" : "",
+		       recorder_count, recorder_dropped, recorder_flash_bytes());
+	    to_console(response);
+	    return CMD_DONE;
 	}
-#ifdef MQTT_CLIENT
-	else if (strcmp(tokens[1], "remote") == 0 && mqtt_connected) {
-	    MQTT_Publish(&mqttClient, tokens[2], tokens[3], os_strlen(tokens[3]), 0, retained);
+
+	// Raw bytes of the flash ring for tools/record_decode
+	if (nTokens == 4)
+	    pos = atoi(tokens[3]) & ~3;
+	while ((len = recorder_flash_read(pos, (uint8_t *)buf, sizeof(buf))) != 0) {
+	    if (ringbuf_bytes_free(console_tx_buffer) < 128) {
+		os_sprintf(response, "... (show record dump %d)\r\n", pos);
+		to_console(response);
+		break;
+	    }
+	    os_sprintf(response, "R ");
+	    for (i = 0; i < len; i++)
+		os_sprintf(response + 2 + 2 * i, "%02x", ((uint8_t *)buf)[i]);
+	    os_sprintf(response + 2 + 2 * len, "\r\n");
+	    to_console(response);
+	    pos += len;
 	}
+	return CMD_DONE;
+    }
 #endif
-	else {
-            os_sprintf(response, "Invalid arg %s\r\n", tokens[1]);
-            goto command_handled;
+#ifdef BACKLOG
+    if (nTokens >= 2 && strcmp(tokens[1], "backlog") == 0) {
+	const void *span;
+	size_t len;
+	if (backlog_buffer == NULL)
+	    return CMD_DONE;
+	while (ringbuf_bytes_free(console_tx_buffer) && (len = ringbuf_peek_span(backlog_buffer, &span))) {
+	    if (len > ringbuf_bytes_free(console_tx_buffer))
+		len = ringbuf_bytes_free(console_tx_buffer);
+	    ringbuf_memcpy_into(console_tx_buffer, span, len);
+	    ringbuf_consume(backlog_buffer, len);
 	}
-	os_sprintf_flash(response, "Published topic\r\n");
-	goto command_handled;
+
+	return CMD_DONE;
     }
+#endif
+#ifdef SCRIPTED
+    if (nTokens == 2 && strcmp(tokens[1], "latency") == 0) {
+	LAT_STAGE stage;
 
-    if (strcmp(tokens[0], "delete_retained") == 0)
-    {
-	if (config.locked) {
-	    os_sprintf(response, INVALID_LOCKED);
-	    goto command_handled;
+	for (stage = 0; stage < LAT_STAGES; stage++) {
+	    os_sprintf(response, "%s: %d samples, p50 %d us, p90 %d us, p99 %d us, max %d us\r\n",
+		       latency_stage_name(stage), lat_hists[stage].count, latency_percentile(stage, 50),
+		       latency_percentile(stage, 90), latency_percentile(stage, 99), lat_hists[stage].max_us);
+	    to_console(response);
 	}
+	return CMD_DONE;
+    }
 
-	if (nTokens != 1) {
-            os_sprintf(response, INVALID_NUMARGS);
-            goto command_handled;
+    if (nTokens >= 3 && strcmp(tokens[1], "script") == 0 && strcmp(tokens[2], "profile") == 0) {
+	uint16_t order[clause_profile_count + 1];
+	char event[48];
+	int i, j, start = 0;
+
+	if (nTokens == 4)
+	    start = atoi(tokens[3]);
+
+	// Most expensive clauses first
+	for (i = 0; i < clause_profile_count; i++) {
+	    for (j = i; j > 0 && clause_profiles[order[j-1]].total_us < clause_profiles[i].total_us; j--)
+		order[j] = order[j-1];
+	    order[j] = i;
 	}
 
-	delete_retainedtopics();
+	for (i = start; i < clause_profile_count; i++) {
+	    clause_profile *prof = &clause_profiles[order[i]];
 
-	os_sprintf_flash(response, "Deleted retained topics\r\n");
-	goto command_handled;
+	    if (ringbuf_bytes_free(console_tx_buffer) < 128) {
+		os_sprintf(response, "... (show script profile %d)\r\n", i);
+		to_console(response);
+		break;
+	    }
+
+	    clause_event_text(prof->on_token, event, sizeof(event));
+	    os_sprintf(response, "%s: %d calls, %d fired, %d actions, %d us total, %d us max\r\n",
+		       event, prof->calls, prof->fired, prof->actions, prof->total_us, prof->max_us);
+	    to_console(response);
+	}
+	return CMD_DONE;
     }
 
-    if (strcmp(tokens[0], "save_retained") == 0)
-    {
+    if (nTokens >= 2 && strcmp(tokens[1], "script") == 0) {
 	if (config.locked) {
 	    os_sprintf(response, INVALID_LOCKED);
-	    goto command_handled;
+	    return CMD_RESPONSE;
 	}
 
-	if (nTokens != 1) {
-            os_sprintf(response, INVALID_NUMARGS);
-            goto command_handled;
-	}
+	uint32_t line_count, char_count, start_line = 1;
+	if (nTokens == 3)
+	    start_line = atoi(tokens[2]);
 
-	bool success = save_retainedtopics();
+	uint32_t size = get_script_size();
+	if (size == 0)
+	    return CMD_RESPONSE;
 
-	os_sprintf(response, "Saved retained topics %ssuccessfully\r\n", success?"":"un");
-	goto command_handled;
-    }
-/*
-    if (strcmp(tokens[0], "load_retained") == 0)
-    {
-	if (nTokens != 1) {
-            os_sprintf(response, INVALID_NUMARGS);
-            goto command_handled;
+	uint8_t *script = (uint8_t *) os_malloc(size);
+	uint8_t *p;
+	bool nl;
+
+	if (script == 0) {
+	    os_sprintf_flash(response, "Out of memory");
+	    return CMD_RESPONSE;
 	}
 
-	bool success = load_retainedtopics();
+	blob_load(SCRIPT_SLOT, (uint32_t *) script, size);
 
-	os_sprintf(response, "Loaded retained topics %ssuccessfully\r\n", success?"":"un");
-	goto command_handled;
+	p = script + 4;
+	for (line_count = 1; line_count < start_line && *p != 0; p++) {
+	    if (*p == '\n')
+		line_count++;
+	}
+	nl = true;
+	for (char_count = 0; *p != 0 && char_count < MAX_CON_SEND_SIZE - 20; p++, char_count++) {
+	    if (nl) {
+		os_sprintf(response, "\r%4d: ", line_count);
+		char_count += 7;
+		to_console(response);
+		line_count++;
+		nl = false;
+	    }
+	    ringbuf_memcpy_into(console_tx_buffer, p, 1);
+	    if (*p == '\n')
+		nl = true;
+	}
+	if (*p == 0) {
+	    ringbuf_memcpy_into(console_tx_buffer, "\r\n--end--", 9);
+	} else {
+	    ringbuf_memcpy_into(console_tx_buffer, "...", 3);
+	}
+	ringbuf_memcpy_into(console_tx_buffer, "\r\n", 2);
+
+	os_free(script);
+	return CMD_DONE;
     }
-*/
-    if (strcmp(tokens[0], "set") == 0) {
+
+    if (nTokens >= 2 && strcmp(tokens[1], "vars") == 0) {
 	if (config.locked) {
 	    os_sprintf(response, INVALID_LOCKED);
-	    goto command_handled;
+	    return CMD_RESPONSE;
 	}
+	int i;
 
-	/*
-	 * For set commands atleast 2 tokens "set" "parameter" "value" is needed
-	 * hence the check
-	 */
-	if (nTokens < 3) {
-	    os_sprintf(response, INVALID_NUMARGS);
-	    goto command_handled;
-	} else {
-	    // atleast 3 tokens, proceed
-	    if (strcmp(tokens[1], "ssid") == 0) {
-		os_sprintf(config.ssid, "%s", tokens[2]);
-		config.auto_connect = 1;
-		os_sprintf_flash(response, "SSID set (auto_connect = 1)\r\n");
-		goto command_handled;
+	if (script_enabled) {
+	    for (i = 0; i < MAX_VARS; i++) {
+		if (!vars[i].free) {
+		    os_sprintf(response, "%s: %s\r\n", vars[i].name, vars[i].data);
+		    to_console(response);
+		}
 	    }
+	}
 
-	    if (strcmp(tokens[1], "password") == 0) {
-		os_sprintf(config.password, "%s", tokens[2]);
-		os_sprintf_flash(response, "Password set\r\n");
-		goto command_handled;
-	    }
+	uint8_t slots[MAX_FLASH_SLOTS*FLASH_SLOT_LEN];
+	blob_load(VARS_SLOT, (uint32_t *)slots, sizeof(slots));
 
-	    if (strcmp(tokens[1], "auto_connect") == 0) {
-		config.auto_connect = atoi(tokens[2]);
-		os_sprintf_flash(response, "Auto Connect set\r\n");
-		goto command_handled;
-	    }
+	for (i = 0; i < MAX_FLASH_SLOTS; i++) {
+	    os_sprintf(response, "@%d: %s\r\n", i+1, &slots[i*FLASH_SLOT_LEN]);
+	    to_console(response);
+	}
+	return CMD_DONE;
+    }
+#endif
+    return CMD_UNKNOWN;
+}
 
-	    if (strcmp(tokens[1], "ap_ssid") == 0) {
-		os_sprintf(config.ap_ssid, "%s", tokens[2]);
-		os_sprintf_flash(response, "AP SSID set\r\n");
-		goto command_handled;
-	    }
+static uint8_t ICACHE_FLASH_ATTR cli_save(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    if (config.locked) {
+	os_sprintf(response, INVALID_LOCKED);
+	return CMD_RESPONSE;
+    }
 
-	    if (strcmp(tokens[1], "ap_password") == 0) {
-		if (os_strlen(tokens[2]) < 8) {
-		    os_sprintf_flash(response, "Password to short (min. 8)\r\n");
-		} else {
-		    os_sprintf(config.ap_password, "%s", tokens[2]);
-		    config.ap_open = 0;
-		    os_sprintf_flash(response, "AP Password set\r\n");
-		}
-		goto command_handled;
-	    }
+    if (nTokens == 1 || (nTokens == 2 && strcmp(tokens[1], "config") == 0)) {
+	config_save(&config);
+	os_sprintf_flash(response, "Config saved\r\n");
+	return CMD_RESPONSE;
+    }
+    return CMD_UNKNOWN;
+}
 
-	    if (strcmp(tokens[1], "ap_open") == 0) {
-		config.ap_open = atoi(tokens[2]);
-		os_sprintf_flash(response, "Open Auth set\r\n");
-		goto command_handled;
-	    }
+#ifdef ALLOW_SCANNING
+static uint8_t ICACHE_FLASH_ATTR cli_scan(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    wifi_station_scan(NULL, scan_done);
+    os_sprintf_flash(response, "Scanning...\r\n");
+    return CMD_RESPONSE;
+}
+#endif
 
-	    if (strcmp(tokens[1], "ap_on") == 0) {
-		if (atoi(tokens[2])) {
-		    if (!config.ap_on) {
-			wifi_set_opmode(STATIONAP_MODE);
-			user_set_softap_wifi_config();
-			do_ip_config = true;
-			config.ap_on = true;
-			os_sprintf_flash(response, "AP on\r\n");
-		    } else {
-			os_sprintf_flash(response, "AP already on\r\n");
-		    }
-
-		} else {
-		    if (config.ap_on) {
-			wifi_set_opmode(STATION_MODE);
-#ifdef MDNS
-			if (config.mdns_mode == 2) {
-			    espconn_mdns_close();
-			}
-#endif
-			config.ap_on = false;
-			os_sprintf_flash(response, "AP off\r\n");
-		    } else {
-			os_sprintf_flash(response, "AP already off\r\n");
-		    }
-		}
-		goto command_handled;
-	    }
+#ifdef NTP
+static uint8_t ICACHE_FLASH_ATTR cli_time(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    os_sprintf(response, "%s %s\r\n", get_weekday(), get_timestr());
+    return CMD_RESPONSE;
+}
+#endif
 
-	    if (strcmp(tokens[1], "speed") == 0) {
-		uint16_t speed = atoi(tokens[2]);
-		bool succ = system_update_cpu_freq(speed);
-		if (succ)
-		    config.clock_speed = speed;
-		os_sprintf(response, "Clock speed update %s\r\n", succ ? "successful" : "failed");
-		goto command_handled;
-	    }
+static uint8_t ICACHE_FLASH_ATTR cli_reset(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    if (config.locked && pespconn != NULL) {
+	os_sprintf(response, INVALID_LOCKED);
+	return CMD_RESPONSE;
+    }
+    if (nTokens == 2 && strcmp(tokens[1], "factory") == 0) {
+	config_load_default(&config);
+	config_save(&config);
+#ifdef SCRIPTED
+	// Clear script, vars, and retained topics
+	blob_zero(SCRIPT_SLOT, MAX_SCRIPT_SIZE);
+	blob_zero(VARS_SLOT, MAX_FLASH_SLOTS * FLASH_SLOT_LEN);
+	blob_zero(RETAINED_SLOT, MAX_RETAINED_LEN);
+#endif
+    }
 
-            if (strcmp(tokens[1],"bitrate") == 0)
-            {
-                config.bit_rate = atoi(tokens[2]);
-                os_sprintf(response, "Bitrate set to %d\r\n", config.bit_rate);
-                goto command_handled;
-            }
-
-            if (strcmp(tokens[1],"system_output") == 0)
-            {
-                config.system_output = atoi(tokens[2]);
-                os_sprintf(response, "System output set to %d\r\n", config.system_output);
-                goto command_handled;
-            }
-
-	    if (strcmp(tokens[1], "network") == 0) {
-		config.network_addr.addr = ipaddr_addr(tokens[2]);
-		ip4_addr4(&config.network_addr) = 0;
-		os_sprintf(response, "Network set to %d.%d.%d.%d\r\n", IP2STR(&config.network_addr));
-		goto command_handled;
-	    }
+    save_retainedtopics();
 
-	    if (strcmp(tokens[1], "dns") == 0) {
-		if (os_strcmp(tokens[2], "dhcp") == 0) {
-		    config.dns_addr.addr = 0;
-		    os_sprintf_flash(response, "DNS from DHCP\r\n");
-		} else {
-		    config.dns_addr.addr = ipaddr_addr(tokens[2]);
-		    os_sprintf(response, "DNS set to %d.%d.%d.%d\r\n", IP2STR(&config.dns_addr));
-		    if (config.dns_addr.addr) {
-			dns_ip.addr = config.dns_addr.addr;
-		    }
-		}
-		goto command_handled;
-	    }
+    os_printf("Restarting ... \r\n");
+    UART_Flush(UART0);
+    system_restart();
+    while (true);
+}
 
-	    if (strcmp(tokens[1], "ip") == 0) {
-		if (os_strcmp(tokens[2], "dhcp") == 0) {
-		    config.my_addr.addr = 0;
-		    os_sprintf_flash(response, "IP from DHCP\r\n");
-		} else {
-		    config.my_addr.addr = ipaddr_addr(tokens[2]);
-		    os_sprintf(response, "IP address set to %d.%d.%d.%d\r\n", IP2STR(&config.my_addr));
-		}
-		goto command_handled;
-	    }
+static uint8_t ICACHE_FLASH_ATTR cli_quit(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    remote_console_disconnect = 1;
+    os_sprintf_flash(response, "Quitting console\r\n");
+    return CMD_RESPONSE;
+}
 
-	    if (strcmp(tokens[1], "netmask") == 0) {
-		config.my_netmask.addr = ipaddr_addr(tokens[2]);
-		os_sprintf(response, "IP netmask set to %d.%d.%d.%d\r\n", IP2STR(&config.my_netmask));
-		goto command_handled;
-	    }
+#ifdef REMOTE_CONFIG
+static uint8_t ICACHE_FLASH_ATTR cli_log(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    console_session *session = console_session_of(pespconn);
 
-	    if (strcmp(tokens[1], "gw") == 0) {
-		config.my_gw.addr = ipaddr_addr(tokens[2]);
-		os_sprintf(response, "Gateway set to %d.%d.%d.%d\r\n", IP2STR(&config.my_gw));
-		goto command_handled;
-	    }
-#ifdef MDNS
-	    if (strcmp(tokens[1], "mdns_mode") == 0) {
-		config.mdns_mode = atoi(tokens[2]);
-		os_sprintf(response, "mDNS mode set to %d\r\n", config.mdns_mode);
-		goto command_handled;
-	    }
+    if (pespconn == NULL || session == NULL) {
+	os_sprintf_flash(response, "Log only on a remote console\r\n");
+	return CMD_RESPONSE;
+    }
+    session->log = true;
+#ifdef TRACE
+    session->trace_seq = trace_seq();
+#endif
+    os_sprintf_flash(response, "Log session, input is ignored\r\n");
+    return CMD_RESPONSE;
+}
 #endif
-#ifdef REMOTE_CONFIG
-	    if (strcmp(tokens[1], "config_port") == 0) {
-		config.config_port = atoi(tokens[2]);
-		if (config.config_port == 0)
-		    os_sprintf_flash(response, "WARNING: if you save this, remote console access will be disabled!\r\n");
-		else
-		    os_sprintf(response, "Config port set to %d\r\n", config.config_port);
-		goto command_handled;
-	    }
 
-	    if (strcmp(tokens[1], "config_access") == 0) {
-		config.config_access = atoi(tokens[2]) & (LOCAL_ACCESS | REMOTE_ACCESS);
-		if (config.config_access == 0)
-		    os_sprintf_flash(response, "WARNING: if you save this, remote console access will be disabled!\r\n");
-		else
-		    os_sprintf(response, "Config access set\r\n");
-		goto command_handled;
-	    }
+#ifdef SCRIPTED
+static uint8_t ICACHE_FLASH_ATTR cli_script(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    uint16_t port;
+
+    if (config.locked) {
+	os_sprintf(response, INVALID_LOCKED);
+	return CMD_RESPONSE;
+    }
+
+    if (nTokens != 2) {
+	os_sprintf(response, INVALID_NUMARGS);
+	return CMD_RESPONSE;
+    }
+
+    if (strcmp(tokens[1], "delete") == 0) {
+#ifdef GPIO
+	stop_gpios();
 #endif
-	    if (strcmp(tokens[1], "broker_subscriptions") == 0) {
-		config.max_subscriptions = atoi(tokens[2]);
-		os_sprintf_flash(response, "Broker subscriptions set\r\n");
-		goto command_handled;
-	    }
+	script_enabled = false;
+	if (my_script != NULL)
+	    free_script();
+	blob_zero(0, MAX_SCRIPT_SIZE);
+	blob_zero(1, MAX_FLASH_SLOTS * FLASH_SLOT_LEN);
+	os_sprintf_flash(response, "Script deleted\r\n");
+	return CMD_RESPONSE;
+    }
 
-	    if (strcmp(tokens[1], "broker_retained_messages") == 0) {
-		config.max_retained_messages = atoi(tokens[2]);
-		os_sprintf_flash(response, "Broker retained messages set\r\n");
-		goto command_handled;
-	    }
+    if (!isdigit(tokens[1][0])) {
+	scriptcon = pespconn;
+	http_get(tokens[1], "", http_script_cb);
+	os_sprintf(response, "HTTP request to %s started\r\n", tokens[1]);
+	return CMD_RESPONSE;  
+    }
 
-	    if (strcmp(tokens[1], "broker_clients") == 0) {
-		config.max_clients = atoi(tokens[2]);
-		os_sprintf_flash(response, "Broker max clients set\r\n");
-		goto command_handled;
-	    }
+    port = atoi(tokens[1]);
+    if (port == 0) {
+	os_sprintf_flash(response, "Invalid port\r\n");
+	return CMD_RESPONSE;
+    }
+    // delete and disable existing script
+#ifdef GPIO
+    stop_gpios();
+#endif
+    script_enabled = false;
+    if (my_script != NULL)
+	free_script();
 
-	    if (strcmp(tokens[1], "broker_port") == 0) {
-		config.mqtt_broker_port = atoi(tokens[2]);
-		os_sprintf_flash(response, "Broker port set\r\n");
-		goto command_handled;
-	    }
+    scriptcon = pespconn;
+    downloadCon = (struct espconn *)os_zalloc(sizeof(struct espconn));
 
-	    if (strcmp(tokens[1], "broker_user") == 0) {
-		os_strncpy(config.mqtt_broker_user, tokens[2], 32);
-		config.mqtt_broker_user[31] = '\0';
-		os_sprintf_flash(response, "Broker username set\r\n");
-		goto command_handled;
-	    }
+    /* Equivalent to bind */
+    downloadCon->type = ESPCONN_TCP;
+    downloadCon->state = ESPCONN_NONE;
+    downloadCon->proto.tcp = (esp_tcp *) os_zalloc(sizeof(esp_tcp));
+    downloadCon->proto.tcp->local_port = port;
 
-	    if (strcmp(tokens[1], "broker_password") == 0) {
-		if (os_strcmp(tokens[2], "none") == 0) {
-		    config.mqtt_broker_password[0] = '\0';
-		} else {
-		    os_strncpy(config.mqtt_broker_password, tokens[2], 32);
-		    config.mqtt_broker_password[31] = '\0';
-		}
-		os_sprintf_flash(response, "Broker password set\r\n");
-		goto command_handled;
-	    }
+    /* Register callback when clients connect to the server */
+    espconn_regist_connectcb(downloadCon, script_connected_cb);
 
-	    if (strcmp(tokens[1], "broker_access") == 0) {
-		config.mqtt_broker_access = atoi(tokens[2]) & (LOCAL_ACCESS | REMOTE_ACCESS);
-		os_sprintf_flash(response, "Broker access set\r\n");
-		goto command_handled;
-	    }
+    /* Put the connection in accept mode */
+    espconn_accept(downloadCon);
 
-	    if (strcmp(tokens[1], "broker_autoretain") == 0) {
-		config.auto_retained = atoi(tokens[2]) != 0;
-		os_sprintf_flash(response, "Broker autoretain set\r\n");
-		goto command_handled;
-	    }
-#ifdef BACKLOG
-	    if (strcmp(tokens[1], "backlog") == 0) {
-		int backlog_size = atoi(tokens[2]);
-		if (backlog_size != 0) {
-		    if (backlog_buffer != NULL) {
-			os_sprintf_flash(response, "Backlog already set\r\n");
-			goto command_handled;
-		    }
-		    backlog_buffer = ringbuf_new(backlog_size);
-		    if (backlog_buffer == NULL) {
-			os_sprintf(response, "No memory\r\n");
-			goto command_handled;
-		    }
-		    os_sprintf(response, "Backlog set to %d chars\r\n", backlog_size);
-		} else {
-		    if (backlog_buffer != NULL) {
-			ringbuf_free(&backlog_buffer);
-		    }
-		    os_sprintf_flash(response, "Backlog off\r\n");
-		}
-		goto command_handled;
-	    }
+    os_sprintf(response, "Waiting for script upload on port %d\r\n", port);
+    return CMD_RESPONSE;
+}
 #endif
-#ifdef SCRIPTED
-	    if (strcmp(tokens[1], "script_logging") == 0) {
-		lang_logging = atoi(tokens[2]);
-		os_sprintf_flash(response, "Script logging set\r\n");
-		goto command_handled;
-	    }
 
-	    if (tokens[1][0] == '@') {
-		uint32_t slot_no = atoi(&tokens[1][1]);
-		if (slot_no == 0 || slot_no > MAX_FLASH_SLOTS) {
-		    os_sprintf_flash(response, "Invalid flash slot number");
-		} else {
-		    slot_no--;
-		    uint8_t slots[MAX_FLASH_SLOTS*FLASH_SLOT_LEN];
-		    blob_load(VARS_SLOT, (uint32_t *)slots, sizeof(slots));
-		    os_strcpy(&slots[slot_no*FLASH_SLOT_LEN], tokens[2]);
-		    blob_save(VARS_SLOT, (uint32_t *)slots, sizeof(slots));
-		    os_sprintf(response, "%s written to flash\r\n", tokens[1]);
-		}
-		goto command_handled;
-	    }
-#ifdef GPIO
-#ifdef GPIO_PWM
-	    if (strcmp(tokens[1], "pwm_period") == 0) {
-		config.pwm_period = atoi(tokens[2]);
-		os_sprintf_flash(response, "PWM period set\r\n");
-		goto command_handled;
-	    }
-#endif
+static uint8_t ICACHE_FLASH_ATTR cli_lock(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    if (config.locked) {
+	os_sprintf_flash(response, "Config already locked\r\n");
+	return CMD_RESPONSE;
+    }
+    if (nTokens == 1) {
+	if (os_strlen(config.lock_password) == 0) {
+	    os_sprintf_flash(response, "No password defined\r\n");
+	    return CMD_RESPONSE;
+	}
+    }
+    else if (nTokens == 2) {
+	os_sprintf(config.lock_password, "%s", tokens[1]);
+    }
+    else {
+	os_sprintf(response, INVALID_NUMARGS);
+	return CMD_RESPONSE;
+    }
+    config.locked = 1;
+    config_save(&config);
+    os_sprintf(response, "Config locked (pw: %s)\r\n", config.lock_password);
+    return CMD_RESPONSE;
+}
+
+static uint8_t ICACHE_FLASH_ATTR cli_unlock(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    if (nTokens != 2) {
+	os_sprintf(response, INVALID_NUMARGS);
+    } else if (os_strcmp(tokens[1], config.lock_password) == 0) {
+	config.locked = 0;
+	config_save(&config);
+	os_sprintf_flash(response, "Config unlocked\r\n");
+    } else {
+	os_sprintf_flash(response, "Unlock failed. Invalid password\r\n");
+    }
+    return CMD_RESPONSE;
+}
+
+static uint8_t ICACHE_FLASH_ATTR cli_publish(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    if (config.locked) {
+	os_sprintf(response, INVALID_LOCKED);
+	return CMD_RESPONSE;
+    }
+
+    uint8_t retained = 0;
+
+    if (nTokens < 4 || nTokens > 5) {
+	os_sprintf(response, INVALID_NUMARGS);
+	return CMD_RESPONSE;
+    }
+    if (nTokens == 5) {
+	if (strcmp(tokens[4], "retained")==0) {
+	    retained = 1;
+	} else {
+	    os_sprintf(response, "Invalid arg %s\r\n", tokens[4]);
+	    return CMD_RESPONSE;
+	}
+    }
+    if (strcmp(tokens[1], "local") == 0) {
+	MQTT_local_publish(tokens[2], tokens[3], os_strlen(tokens[3]), 0, retained);
+    }
+#ifdef MQTT_CLIENT
+    else if (strcmp(tokens[1], "remote") == 0) {
+	if (!remote_publish(tokens[2], tokens[3], os_strlen(tokens[3]), 0, retained)) {
+	    os_sprintf_flash(response, "Remote publish failed\r\n");
+	    return CMD_RESPONSE;
+	}
+    }
 #endif
+    else {
+	os_sprintf(response, "Invalid arg %s\r\n", tokens[1]);
+	return CMD_RESPONSE;
+    }
+    os_sprintf_flash(response, "Published topic\r\n");
+    return CMD_RESPONSE;
+}
+
+#ifdef MQTT_CLIENT
+static uint8_t ICACHE_FLASH_ATTR cli_bridge(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    int i;
+
+    if (config.locked) {
+	os_sprintf(response, INVALID_LOCKED);
+	return CMD_RESPONSE;
+    }
+
+    if (nTokens == 3 && strcmp(tokens[1], "delete") == 0) {
+	i = atoi(tokens[2]);
+	if (i < 0 || i >= MAX_BRIDGE_RULES || config.bridge_rules[i].dir == 0) {
+	    os_sprintf(response, INVALID_ARG);
+	    return CMD_RESPONSE;
+	}
+	bridge_rule_deleted(i);
+	os_memset(&config.bridge_rules[i], 0, sizeof(bridge_rule_t));
+	os_sprintf_flash(response, "Bridge rule deleted\r\n");
+	return CMD_RESPONSE;
+    }
+
+    if (nTokens < 4 || nTokens > 6) {
+	os_sprintf(response, INVALID_NUMARGS);
+	return CMD_RESPONSE;
+    }
+
+    uint8_t dir = 0;
+    if (strcmp(tokens[1], "in") == 0)
+	dir = BRIDGE_IN;
+    if (strcmp(tokens[1], "out") == 0)
+	dir = BRIDGE_OUT;
+    if (strcmp(tokens[1], "both") == 0)
+	dir = BRIDGE_IN | BRIDGE_OUT;
+    if (dir == 0 || os_strlen(tokens[2]) > 31 || os_strlen(tokens[3]) > 31 ||
+	os_strchr(tokens[2], '+') != NULL || os_strchr(tokens[3], '+') != NULL) {
+	os_sprintf(response, INVALID_ARG);
+	return CMD_RESPONSE;
+    }
+
+    // [<qos>] [retain], nothing else
+    uint8_t qos = 0;
+    bool retain = false;
+    int arg = 4;
+    if (arg < nTokens && tokens[arg][0] >= '0' && tokens[arg][0] <= '2' && tokens[arg][1] == '\0')
+	qos = tokens[arg++][0] - '0';
+    if (arg < nTokens && strcmp(tokens[arg], "retain") == 0) {
+	retain = true;
+	arg++;
+    }
+    if (arg != nTokens) {
+	os_sprintf(response, INVALID_ARG);
+	return CMD_RESPONSE;
+    }
+
+    for (i = 0; i < MAX_BRIDGE_RULES && config.bridge_rules[i].dir != 0; i++);
+    if (i >= MAX_BRIDGE_RULES) {
+	os_sprintf_flash(response, "No free bridge rule\r\n");
+	return CMD_RESPONSE;
+    }
+
+    bridge_rule_t *r = &config.bridge_rules[i];
+    r->dir = dir;
+    r->qos = qos;
+    r->retain = retain;
+    os_strcpy(r->local, tokens[2]);
+    os_strcpy(r->remote, tokens[3]);
+    bridge_rule_added(i);
+
+    os_sprintf(response, "Bridge rule %d set\r\n", i);
+    return CMD_RESPONSE;
+}
 #endif
-#ifdef NTP
-	    if (strcmp(tokens[1], "ntp_server") == 0) {
-		os_strncpy(config.ntp_server, tokens[2], 32);
-		config.ntp_server[31] = 0;
-		ntp_set_server(config.ntp_server);
-		os_sprintf(response, "NTP server set to %s\r\n", config.ntp_server);
-		goto command_handled;
-	    }
 
-	    if (strcmp(tokens[1], "ntp_interval") == 0) {
-		config.ntp_interval = atoi(tokens[2]) * 1000000;
-		os_sprintf(response, "NTP interval set to %d s\r\n", atoi(tokens[2]));
-		goto command_handled;
-	    }
+static uint8_t ICACHE_FLASH_ATTR cli_delete_retained(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    if (config.locked) {
+	os_sprintf(response, INVALID_LOCKED);
+	return CMD_RESPONSE;
+    }
 
-	    if (strcmp(tokens[1], "ntp_timezone") == 0) {
-		config.ntp_timezone = atoi(tokens[2]);
-		set_timezone(config.ntp_timezone);
-		os_sprintf(response, "NTP timezone set to %d h\r\n", config.ntp_timezone);
-		goto command_handled;
-	    }
+    if (nTokens != 1) {
+	os_sprintf(response, INVALID_NUMARGS);
+	return CMD_RESPONSE;
+    }
 
-	    if (strcmp(tokens[1], "ntp_time") == 0) {
-		if (strlen(tokens[2]) != 8 || tokens[2][2] != ':' || tokens[2][5] != ':') {
-		    os_sprintf_flash(response, "Time format hh:mm:ss\r\n");
-		    goto command_handled;
-		}
-		tokens[2][2] = '\0';
-		tokens[2][5] = '\0';
-		set_time_local(atoi(tokens[2]), atoi(&tokens[2][3]), atoi(&tokens[2][6]));
-		os_sprintf(response, "Time set to %s \r\n", get_timestr());
-		goto command_handled;
-	    }
+    delete_retainedtopics();
 
-	    if (strcmp(tokens[1], "ntp_weekday") == 0) {
-		if (set_weekday_local(tokens[2])) {
-		    os_sprintf(response, "Weekday set to %s\r\n", get_weekday());
-		} else {
-		    os_sprintf_flash(response, "Set weekday failed\r\n");
-		}
-		goto command_handled;
-	    }
+    os_sprintf_flash(response, "Deleted retained topics\r\n");
+    return CMD_RESPONSE;
+}
+
+#ifdef RECORDER
+static uint8_t ICACHE_FLASH_ATTR cli_delete_record(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    if (config.locked) {
+	os_sprintf(response, INVALID_LOCKED);
+	return CMD_RESPONSE;
+    }
+
+    if (nTokens != 1) {
+	os_sprintf(response, INVALID_NUMARGS);
+	return CMD_RESPONSE;
+    }
+
+    recorder_flash_clear();
+
+    os_sprintf_flash(response, "Deleted the recording\r\n");
+    return CMD_RESPONSE;
+}
 #endif
-#ifdef DNS_RESP
-	    if (strcmp(tokens[1], "dns_name") == 0) {
-		os_strncpy(config.broker_dns_name, tokens[2], 32);
-		config.mqtt_host[31] = 0;
-		os_sprintf_flash(response, "DNS name set\r\n");
-		goto command_handled;
-	    }
+
+static uint8_t ICACHE_FLASH_ATTR cli_save_retained(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    if (config.locked) {
+	os_sprintf(response, INVALID_LOCKED);
+	return CMD_RESPONSE;
+    }
+
+    if (nTokens != 1) {
+	os_sprintf(response, INVALID_NUMARGS);
+	return CMD_RESPONSE;
+    }
+
+    bool success = save_retainedtopics();
+
+    os_sprintf(response, "Saved retained topics %ssuccessfully\r\n", success?"":"un");
+    return CMD_RESPONSE;
+}
+
+static uint8_t ICACHE_FLASH_ATTR cli_set(struct espconn *pespconn, int nTokens, char **tokens, char *response) {
+    int i;
+
+    if (config.locked) {
+	os_sprintf(response, INVALID_LOCKED);
+	return CMD_RESPONSE;
+    }
+
+    /*
+     * For set commands atleast 2 tokens "set" "parameter" "value" is needed
+     * hence the check
+     */
+    if (nTokens < 3) {
+	os_sprintf(response, INVALID_NUMARGS);
+	return CMD_RESPONSE;
+    }
+#ifdef SCRIPTED
+    if (tokens[1][0] == '@') {
+	uint32_t slot_no = atoi(&tokens[1][1]);
+	if (slot_no == 0 || slot_no > MAX_FLASH_SLOTS) {
+	    os_sprintf_flash(response, "Invalid flash slot number");
+	} else {
+	    slot_no--;
+	    uint8_t slots[MAX_FLASH_SLOTS*FLASH_SLOT_LEN];
+	    blob_load(VARS_SLOT, (uint32_t *)slots, sizeof(slots));
+	    os_strcpy(&slots[slot_no*FLASH_SLOT_LEN], tokens[2]);
+	    blob_save(VARS_SLOT, (uint32_t *)slots, sizeof(slots));
+	    os_sprintf(response, "%s written to flash\r\n", tokens[1]);
+	}
+	return CMD_RESPONSE;
+    }
 #endif
+
+    if ((i = config_param_id(tokens[1])) < 0)
+	return CMD_UNKNOWN;
+    set_params[i].fn(tokens[2], response);
+    return CMD_RESPONSE;
+}
+
+static const cli_command commands[] = {
 #ifdef MQTT_CLIENT
-	    if (strcmp(tokens[1], "mqtt_host") == 0) {
-		os_strncpy(config.mqtt_host, tokens[2], 32);
-		config.mqtt_host[31] = 0;
-		os_sprintf_flash(response, "MQTT host set\r\n");
-		goto command_handled;
-	    }
+    { "bridge", cli_bridge },
+#endif
+#ifdef RECORDER
+    { "delete_record", cli_delete_record },
+#endif
+    { "delete_retained", cli_delete_retained },
+    { "help", cli_help },
+    { "lock", cli_lock },
+#ifdef REMOTE_CONFIG
+    { "log", cli_log },
+#endif
+    { "publish", cli_publish },
+    { "quit", cli_quit },
+    { "reset", cli_reset },
+    { "save", cli_save },
+    { "save_retained", cli_save_retained },
+#ifdef ALLOW_SCANNING
+    { "scan", cli_scan },
+#endif
+#ifdef SCRIPTED
+    { "script", cli_script },
+#endif
+    { "set", cli_set },
+    { "show", cli_show },
+#ifdef NTP
+    { "time", cli_time },
+#endif
+    { "unlock", cli_unlock },
+};
 
-	    if (strcmp(tokens[1], "mqtt_port") == 0) {
-		config.mqtt_port = atoi(tokens[2]);
-		os_sprintf_flash(response, "MQTT port set\r\n");
-		goto command_handled;
-	    }
+// Executes a command line, the line is tokenized in place
+void ICACHE_FLASH_ATTR console_execute(struct espconn *pespconn, char *cmd_line) {
+#define MAX_CMD_TOKENS 6
 
-	    if (strcmp(tokens[1], "mqtt_ssl") == 0) {
-		config.mqtt_ssl = atoi(tokens[2]);
-		os_sprintf(response, "MQTT ssl %s\r\n", config.mqtt_ssl?"on":"off");
-		goto command_handled;
-	    }
+    char response[256];
+    char *tokens[MAX_CMD_TOKENS];
 
-	    if (strcmp(tokens[1], "mqtt_user") == 0) {
-		os_strncpy(config.mqtt_user, tokens[2], 32);
-		config.mqtt_user[31] = 0;
-		os_sprintf_flash(response, "MQTT user set\r\n");
-		goto command_handled;
-	    }
+    int nTokens, i;
+    uint8_t result = CMD_UNKNOWN;
 
-	    if (strcmp(tokens[1], "mqtt_password") == 0) {
-		os_strncpy(config.mqtt_password, tokens[2], 32);
-		config.mqtt_password[31] = 0;
-		os_sprintf_flash(response, "MQTT password set\r\n");
-		goto command_handled;
-	    }
+    response[0] = 0;
 
-	    if (strcmp(tokens[1], "mqtt_id") == 0) {
-		os_strncpy(config.mqtt_id, tokens[2], 32);
-		config.mqtt_id[31] = 0;
-		os_sprintf_flash(response, "MQTT id set\r\n");
-		goto command_handled;
-	    }
-#endif				/* MQTT_CLIENT */
-	}
+    nTokens = parse_str_into_tokens(cmd_line, tokens, MAX_CMD_TOKENS);
 
+    if (nTokens == 0) {
+	char c = '\n';
+	ringbuf_memcpy_into(console_tx_buffer, &c, 1);
+    } else {
+	i = find_name(commands, sizeof(commands) / sizeof(commands[0]), sizeof(commands[0]), tokens[0]);
+	if (i >= 0)
+	    result = commands[i].fn(pespconn, nTokens, tokens, response);
+	if (result == CMD_UNKNOWN)
+	    os_sprintf_flash(response, "\r\nInvalid Command\r\n");
+	if (result != CMD_DONE)
+	    to_console(response);
     }
 
-    /* Control comes here only if the tokens[0] command is not handled */
-    os_sprintf_flash(response, "\r\nInvalid Command\r\n");
-
- command_handled:
-    to_console(response);
- command_handled_2:
     system_os_post(user_procTaskPrio, SIG_CONSOLE_TX, (ETSParam) pespconn);
-    return;
+}
+
+void ICACHE_FLASH_ATTR console_handle_command(struct espconn *pespconn) {
+    char cmd_line[MAX_CON_CMD_SIZE + 1];
+    int bytes_count;
+
+    bytes_count = ringbuf_bytes_used(console_rx_buffer);
+    ringbuf_memcpy_from(cmd_line, console_rx_buffer, bytes_count);
+    cmd_line[bytes_count] = 0;
+
+    console_execute(pespconn, cmd_line);
+}
+
+int ICACHE_FLASH_ATTR config_param_id(const char *name) {
+    return find_name(set_params, sizeof(set_params) / sizeof(set_params[0]), sizeof(set_params[0]), name);
+}
+
+void ICACHE_FLASH_ATTR config_set(int param_id, const char *value, char *response) {
+    char val[MAX_CON_CMD_SIZE + 1], buf[128];
+
+    if (param_id < 0 || param_id >= sizeof(set_params) / sizeof(set_params[0]))
+	return;
+    // Handlers may modify the value
+    os_strncpy(val, value, MAX_CON_CMD_SIZE);
+    val[MAX_CON_CMD_SIZE] = '\0';
+    set_params[param_id].fn(val, response != NULL ? response : buf);
 }
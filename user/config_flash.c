@@ -1,5 +1,6 @@
 #include "user_interface.h"
 #include "config_flash.h"
+#include "trace.h"
 
 /*     From the document 99A-SDK-Espressif IOT Flash RW Operation_v0.2      *
  * -------------------------------------------------------------------------*
@@ -48,6 +49,14 @@ void ICACHE_FLASH_ATTR config_load_default(sysconfig_p config) {
     os_sprintf(config->mqtt_broker_user, "%s", "none");
     config->mqtt_broker_password[0] = 0;
     config->mqtt_broker_access = LOCAL_ACCESS | REMOTE_ACCESS;
+    config->broker_rate_msgs = 0;
+    config->broker_rate_bytes = 0;
+    os_sprintf(config->broker_rate_topic, "%s", "none");
+    config->sys_interval = 10;
+    config->sys_latency = 0;
+    config->record_mode = 0;
+    config->serial_mode = 0;
+    os_sprintf(config->serial_topic, "%s", "none");
 
 #ifdef MQTT_CLIENT
     os_sprintf(config->mqtt_host, "%s", "none");
@@ -57,6 +66,8 @@ void ICACHE_FLASH_ATTR config_load_default(sysconfig_p config) {
     config->mqtt_password[0] = 0;
     wifi_get_macaddr(0, mac);
     os_sprintf(config->mqtt_id, "%s_%02x%02x%02x", MQTT_ID, mac[3], mac[4], mac[5]);
+    config->mqtt_queue_mode = 1;
+    config->mqtt_queue_rate = 10;
 #endif
 #ifdef NTP
     os_sprintf(config->ntp_server, "%s", "1.pool.ntp.org");
@@ -103,12 +114,14 @@ void ICACHE_FLASH_ATTR config_save(sysconfig_p config) {
     os_printf("Saving configuration\r\n");
     spi_flash_erase_sector(base_address);
     spi_flash_write(base_address * SPI_FLASH_SEC_SIZE, (uint32 *) config, sizeof(sysconfig_t));
+    TRACE_EVENT(TR_FLASH_WRITE, base_address, sizeof(sysconfig_t));
 }
 
 void ICACHE_FLASH_ATTR blob_save(uint8_t blob_no, uint32_t * data, uint16_t len) {
     uint16_t base_address = FLASH_BLOCK_NO + 1 + blob_no;
     spi_flash_erase_sector(base_address);
     spi_flash_write(base_address * SPI_FLASH_SEC_SIZE, data, len);
+    TRACE_EVENT(TR_FLASH_WRITE, base_address, len);
 }
 
 void ICACHE_FLASH_ATTR blob_load(uint8_t blob_no, uint32_t * data, uint16_t len) {
@@ -123,6 +136,7 @@ void ICACHE_FLASH_ATTR blob_zero(uint8_t blob_no, uint16_t len) {
     uint16_t base_address = FLASH_BLOCK_NO + 1 + blob_no;
     spi_flash_erase_sector(base_address);
     spi_flash_write(base_address * SPI_FLASH_SEC_SIZE, (uint32_t *) z, len);
+    TRACE_EVENT(TR_FLASH_WRITE, base_address, len);
 }
 
 const uint8_t esp_init_data_default[] = {
@@ -21,6 +21,17 @@
 
 #define MQTT_PORT	1883
 
+#ifdef MQTT_CLIENT
+typedef struct
+{
+    uint8_t	dir;		// BRIDGE_IN | BRIDGE_OUT, 0: unused
+    uint8_t	qos;		// QoS for the remote side
+    uint8_t	retain;		// Forward with retained flag
+    uint8_t	local[32];	// Local topic, prefix if it ends with "#"
+    uint8_t	remote[32];	// Remote topic, prefix if it ends with "#"
+} bridge_rule_t;
+#endif
+
 typedef struct
 {
     // To check if the structure is initialized or not in flash
@@ -66,6 +77,14 @@ typedef struct
     uint8_t     mqtt_broker_user[32];	// Username for client login, "none" if empty
     uint8_t     mqtt_broker_password[32]; // Password for client login
     uint8_t	mqtt_broker_access;	// Controls the interfaces that allow MQTT access (default LOCAL_ACCESS | REMOTE_ACCESS)
+    uint16_t	broker_rate_msgs;	// Max. publishes per second and client (0: no limit)
+    uint32_t	broker_rate_bytes;	// Max. bytes per second and client (0: no limit)
+    uint8_t	broker_rate_topic[32];	// Limit only publishes with this topic prefix, "none" for all traffic
+    uint16_t	sys_interval;	// Interval of the $SYS metrics in seconds (0: off)
+    uint8_t	sys_latency;	// Publish the latency percentiles of the script pipeline as well
+    uint8_t	record_mode;	// Recorder of script inputs (0: off, 1: flash, 2: tcp)
+    uint8_t	serial_mode;	// Serial input (0: console/script lines, 1: SLIP frames of local topics)
+    uint8_t	serial_topic[32];	// Local topics sent as frames in serial mode 1, "none" if empty
 
 #ifdef MQTT_CLIENT
     uint8_t     mqtt_host[32];	// IP or hostname of the MQTT broker, "none" if empty
@@ -75,6 +94,9 @@ typedef struct
     uint8_t     mqtt_user[32];	// Username for broker login, "none" if empty
     uint8_t     mqtt_password[32]; // Password for broker login
     uint8_t	mqtt_id[32];    // MQTT clientId
+    bridge_rule_t bridge_rules[MAX_BRIDGE_RULES];	// Native local <-> remote bridge
+    uint8_t	mqtt_queue_mode;	// Store-and-forward while disconnected (0: off, 1: all, 2: latest per topic)
+    uint16_t	mqtt_queue_rate;	// Replay rate in msgs/s (0: no limit)
 #endif
 #ifdef NTP
     uint8_t	ntp_server[32];	// IP or hostname of the MQTT broker, "none" if empty
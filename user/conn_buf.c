@@ -0,0 +1,75 @@
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+#include "user_config.h"
+
+#include "conn_buf.h"
+
+static uint32_t conn_buf_total = 0;
+
+static bool ICACHE_FLASH_ATTR conn_buf_resize(conn_buf *buf, uint32_t new_size) {
+    char *new_data;
+
+    if (conn_buf_total - buf->size + new_size > CONN_BUF_BUDGET)
+	return false;
+    if ((new_data = (char *)os_malloc(new_size)) == NULL)
+	return false;
+
+    if (buf->data != NULL) {
+	os_memcpy(new_data, buf->data, buf->len + 1);
+	os_free(buf->data);
+    }
+    conn_buf_total = conn_buf_total - buf->size + new_size;
+    buf->data = new_data;
+    buf->size = new_size;
+    return true;
+}
+
+bool ICACHE_FLASH_ATTR conn_buf_init(conn_buf *buf, uint32_t max_size) {
+    uint32_t initial = CONN_BUF_INITIAL_SIZE < max_size ? CONN_BUF_INITIAL_SIZE : max_size;
+
+    buf->data = NULL;
+    buf->len = 0;
+    buf->size = 0;
+    buf->max_size = max_size;
+    if (!conn_buf_resize(buf, initial))
+	return false;
+    buf->data[0] = '\0';
+    return true;
+}
+
+bool ICACHE_FLASH_ATTR conn_buf_append(conn_buf *buf, const char *data, uint32_t len) {
+    uint32_t needed = buf->len + len + 1;
+    uint32_t new_size;
+
+    if (buf->data == NULL || needed > buf->max_size)
+	return false;
+
+    if (needed > buf->size) {
+	for (new_size = buf->size; new_size < needed; new_size *= 2);
+	if (new_size > buf->max_size)
+	    new_size = buf->max_size;
+	// Take what is left, if doubling exceeds the budget
+	if (!conn_buf_resize(buf, new_size) && !conn_buf_resize(buf, needed))
+	    return false;
+    }
+
+    os_memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+    return true;
+}
+
+void ICACHE_FLASH_ATTR conn_buf_free(conn_buf *buf) {
+    if (buf->data != NULL) {
+	os_free(buf->data);
+	conn_buf_total -= buf->size;
+    }
+    buf->data = NULL;
+    buf->len = 0;
+    buf->size = 0;
+}
+
+uint32_t ICACHE_FLASH_ATTR conn_buf_allocated(void) {
+    return conn_buf_total;
+}
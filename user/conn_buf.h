@@ -0,0 +1,26 @@
+#ifndef _CONN_BUF_
+#define _CONN_BUF_
+
+#include "c_types.h"
+
+/*
+ * Receive buffer of a connection. It starts small and doubles on
+ * demand up to max_size, all buffers together are limited to
+ * CONN_BUF_BUDGET bytes. The data is always null-terminated.
+ */
+
+typedef struct _conn_buf {
+    char *data;
+    uint32_t len;
+    uint32_t size;
+    uint32_t max_size;
+} conn_buf;
+
+bool conn_buf_init(conn_buf *buf, uint32_t max_size);
+bool conn_buf_append(conn_buf *buf, const char *data, uint32_t len);
+void conn_buf_free(conn_buf *buf);
+
+// Bytes currently allocated by all connection buffers
+uint32_t conn_buf_allocated(void);
+
+#endif /* _CONN_BUF_ */
@@ -7,6 +7,7 @@
 #include "mqtt/mqtt_server.h"
 #include "mqtt/mqtt_topiclist.h"
 #include "mqtt/mqtt_retainedlist.h"
+#include "retained_index.h"
 
 #ifdef SCRIPTED
 #include "lang.h"
@@ -17,6 +18,23 @@
 #define user_procTaskPrio        0
 
 extern sysconfig_t config;
+/*
+ * Console sessions, 0 is the serial console. console_rx_buffer,
+ * console_tx_buffer and console_conn are the buffers and the connection
+ * of the current session (the one of the last command).
+ */
+typedef struct _console_session {
+    struct espconn *conn;	// NULL for the serial console or an unused session
+    uint8_t remote_ip[4];
+    uint16_t remote_port;
+    ringbuf_t rx_buffer, tx_buffer;
+    bool sent_pending;
+    bool disconnect;		// once the output is sent
+    bool log;			// read-only, gets the serial output and the trace
+    uint32_t trace_seq;		// next trace record of a log session
+} console_session;
+
+extern console_session con_sessions[MAX_CON_SESSIONS + 1];
 extern ringbuf_t console_rx_buffer, console_tx_buffer;
 extern struct espconn *console_conn;
 extern uint8_t remote_console_disconnect;
@@ -45,8 +63,17 @@ void script_connected_cb(void *arg);
 ringbuf_t backlog_buffer;
 #endif
 
+// The session of a connection (NULL: serial), NULL if there is none
+console_session *console_session_of(struct espconn *pespconn);
+void console_select(console_session *session);
 void console_handle_command(struct espconn *pespconn);
+void console_execute(struct espconn *pespconn, char *cmd_line);
+bool check_connection_access(struct espconn *pesp_conn, uint8_t access_flags);
 void to_console(char *str);
-void do_command(char *t1, char *t2, char *t3);
+void do_command(char *cmd_line);
+
+// The "set" parameters without the console, -1 for an unknown name
+int config_param_id(const char *name);
+void config_set(int param_id, const char *value, char *response);
 void con_print(uint8_t *str);
 void serial_out(uint8_t *str);
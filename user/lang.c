@@ -25,6 +25,13 @@
 #include "json_path.h"
 #endif
 
+#include "topic_trie.h"
+#include "remote_queue.h"
+#include "sub_refs.h"
+#include "latency.h"
+#include "trace.h"
+#include "recorder.h"
+
 #define lang_debug	//os_printf
 
 #define lang_log(...) 	{if (lang_logging){char log_buffer[256]; os_sprintf (log_buffer, "%s: ", get_timestr()); con_print(log_buffer); os_sprintf (log_buffer, __VA_ARGS__); con_print(log_buffer);}}
@@ -43,11 +50,6 @@ typedef struct _timestamp_entry_t {
 } timestamp_entry_t;
 
 #ifdef GPIO
-typedef struct _gpio_entry_t {
-    os_timer_t inttimer;
-    uint8_t no;
-    bool val;
-} gpio_entry_t;
 static gpio_entry_t gpios[MAX_GPIOS];
 int gpio_counter;
 
@@ -89,6 +91,16 @@ static os_timer_t timers[MAX_TIMERS];
 var_entry_t vars[MAX_VARS];
 static timestamp_entry_t timestamps[MAX_TIMESTAMPS];
 
+// Index of the "on topic" clauses: [0] local, [1] remote, values are the "on" tokens
+static topic_node *topic_clauses[2];
+static int topic_clause_count;
+static bool topic_index_valid;
+
+// One entry per "on" clause, in script order
+clause_profile *clause_profiles;
+int clause_profile_count;
+static uint32_t action_count;
+
 var_entry_t ICACHE_FLASH_ATTR *find_var(const uint8_t *name, var_entry_t **free_var) {
     int i;
 
@@ -113,6 +125,8 @@ static void ICACHE_FLASH_ATTR lang_timers_timeout(void *arg) {
     os_timer_disarm(&timers[interpreter_timer]);
     if (!script_enabled)
 	return;
+    TRACE_EVENT(TR_TIMER, interpreter_timer + 1, 0);
+    RECORD_EVENT(REC_TIMER, interpreter_timer + 1, NULL, 0, NULL, 0);
 
     lang_debug("timer %d expired\r\n", interpreter_timer + 1);
 
@@ -140,6 +154,7 @@ void ICACHE_FLASH_ATTR check_timestamps(uint8_t * curr_time) {
 	    if (timestamps[i].state == HAPPENED)
 		continue;
 	    lang_debug("timerstamp %s happened\r\n", timestamps[i].ts);
+	    RECORD_EVENT(REC_ALARM, i + 1, NULL, 0, NULL, 0);
 
 	    interpreter_topic = interpreter_data = "";
 	    interpreter_data_len = 0;
@@ -167,6 +182,8 @@ void ICACHE_FLASH_ATTR inttimer_func(void *arg){
 
 	if (script_enabled) {
 	    lang_debug("interpreter GPIO %d %d\r\n", my_gpio_entry->no, interpreter_gpioval);
+	    uint8_t level = interpreter_gpioval;
+	    RECORD_EVENT(REC_GPIO, my_gpio_entry->no, &level, 1, NULL, 0);
 
 	    interpreter_status = GPIO_INT;
 	    interpreter_topic = interpreter_data = "";
@@ -247,6 +264,124 @@ void ICACHE_FLASH_ATTR init_pwm() {
 #endif /* GPIO_PWM */
 #endif /* GPIO */
 
+static void ICACHE_FLASH_ATTR index_topic_clause(int on_token, int lr, int filter_token) {
+    char *filter = my_token[filter_token];
+
+    if (filter[0] == '"') {
+	filter++;
+    } else if (filter[0] == '$' || filter[0] == '@' || filter[0] == '#') {
+	// Only known at runtime - check this clause on every topic
+	filter = "#";
+    }
+
+    if (topic_clauses[lr] == NULL && (topic_clauses[lr] = topic_trie_new()) == NULL) {
+	topic_index_valid = false;
+	return;
+    }
+    if (!topic_trie_insert(topic_clauses[lr], filter, (void *)on_token))
+	topic_index_valid = false;
+    topic_clause_count++;
+}
+
+static void ICACHE_FLASH_ATTR free_profiles(void) {
+    if (clause_profiles != NULL)
+	os_free(clause_profiles);
+    clause_profiles = NULL;
+    clause_profile_count = 0;
+}
+
+static void ICACHE_FLASH_ATTR alloc_profiles(void) {
+    int i, count = 0;
+
+    free_profiles();
+    for (i = 0; i < max_token; i++) {
+	if (is_token(i, "on"))
+	    count++;
+    }
+    if (count > 0)
+	clause_profiles = (clause_profile *)os_malloc(count * sizeof(clause_profile));
+}
+
+// Called for each clause during the syntax check, so the entries are sorted by on_token
+static void ICACHE_FLASH_ATTR add_profile(int on_token) {
+    clause_profile *prof;
+
+    if (clause_profiles == NULL)
+	return;
+    prof = &clause_profiles[clause_profile_count++];
+    os_bzero(prof, sizeof(clause_profile));
+    prof->on_token = on_token;
+}
+
+static clause_profile * ICACHE_FLASH_ATTR find_profile(int on_token) {
+    int lo = 0, hi = clause_profile_count - 1, mid;
+
+    while (lo <= hi) {
+	mid = (lo + hi) / 2;
+	if (clause_profiles[mid].on_token == on_token)
+	    return &clause_profiles[mid];
+	if (clause_profiles[mid].on_token < on_token)
+	    lo = mid + 1;
+	else
+	    hi = mid - 1;
+    }
+    return NULL;
+}
+
+static void ICACHE_FLASH_ATTR profile_clause(int on_token, uint32_t start, uint32_t actions, bool fired) {
+    clause_profile *prof = find_profile(on_token);
+    uint32_t duration = system_get_time() - start;
+
+    if (prof == NULL)
+	return;
+    prof->calls++;
+    if (fired) {
+	prof->fired++;
+	TRACE_EVENT(TR_CLAUSE, on_token, duration);
+    }
+    prof->actions += action_count - actions;
+    prof->total_us += duration;
+    if (duration > prof->max_us)
+	prof->max_us = duration;
+}
+
+void ICACHE_FLASH_ATTR clause_event_text(int on_token, char *buf, int size) {
+    int i, pos = 0;
+
+    buf[0] = '\0';
+    for (i = on_token; i < max_token && i < on_token + 5 && !is_token(i, "do"); i++) {
+	if (pos + os_strlen(my_token[i]) + 2 >= size)
+	    break;
+	pos += os_sprintf(buf + pos, "%s%s", i == on_token ? "" : " ", my_token[i]);
+    }
+}
+
+static void ICACHE_FLASH_ATTR free_topic_index(void) {
+    topic_trie_free(topic_clauses[0]);
+    topic_trie_free(topic_clauses[1]);
+    topic_clauses[0] = topic_clauses[1] = NULL;
+    topic_clause_count = 0;
+    topic_index_valid = false;
+}
+
+typedef struct _clause_list {
+    int *clauses;
+    int count;
+} clause_list;
+
+static bool ICACHE_FLASH_ATTR collect_clause(void *value, void *user_data) {
+    clause_list *list = (clause_list *)user_data;
+    int on_token = (int)value;
+    int i;
+
+    // Keep the script order of the clauses
+    for (i = list->count; i > 0 && list->clauses[i-1] > on_token; i--)
+	list->clauses[i] = list->clauses[i-1];
+    list->clauses[i] = on_token;
+    list->count++;
+    return false;
+}
+
 void ICACHE_FLASH_ATTR test_tokens(void) {
     int i;
 
@@ -426,6 +561,8 @@ int ICACHE_FLASH_ATTR text_into_tokens(char *str) {
 }
 
 void ICACHE_FLASH_ATTR free_tokens(void) {
+    free_topic_index();
+    free_profiles();
     if (my_token != NULL)
 	os_free((uint32_t *) my_token);
     my_token = NULL;
@@ -458,49 +595,66 @@ int ICACHE_FLASH_ATTR syntax_error(int i, char *message) {
     return -1;
 }
 
-int ICACHE_FLASH_ATTR parse_statement(int next_token) {
+static int ICACHE_FLASH_ATTR parse_clause(int next_token) {
     bool event_happened;
-    int on_token;
-
-    uint32_t start = system_get_time();
-
-    while ((next_token = syn_chk ? next_token : search_token(next_token, "on")) < max_token) {
 
-	in_topic_statement = false;
-	in_serial_statement = false;
+    in_topic_statement = false;
+    in_serial_statement = false;
 #ifdef GPIO
-	in_gpio_statement = false;
+    in_gpio_statement = false;
 #endif
 #ifdef HTTPC
-	in_http_statement = false;
+    in_http_statement = false;
 #endif
 
-	if (is_token(next_token, "on")) {
-	    lang_debug("statement on\r\n");
+    if (is_token(next_token, "on")) {
+	int on_token = next_token;
+	uint32_t start = system_get_time();
+	uint32_t actions = action_count;
 
-	    if ((next_token = parse_event(next_token + 1, &event_happened)) == -1)
-		return -1;
-	    if (!syn_chk && !event_happened)
-		continue;
+	lang_debug("statement on\r\n");
+	if (syn_chk)
+	    add_profile(on_token);
 
-	    if (syn_chk && !is_token(next_token, "do"))
-		return syntax_error(next_token, "'do' expected");
-	    if ((next_token = parse_action(next_token + 1, event_happened)) == -1)
-		return -1;
-	} else if (is_token(next_token, "config")) {
-	    next_token += 3;
-	} else {
-	    return syntax_error(next_token, "'on' or 'config' expected");
+	if ((next_token = parse_event(next_token + 1, &event_happened)) == -1)
+	    return -1;
+	if (!syn_chk && !event_happened) {
+	    profile_clause(on_token, start, actions, false);
+	    return next_token;
 	}
+	if (!syn_chk)
+	    latency_clause_start();
+
+	if (syn_chk && !is_token(next_token, "do"))
+	    return syntax_error(next_token, "'do' expected");
+	next_token = parse_action(next_token + 1, event_happened);
+	if (!syn_chk)
+	    profile_clause(on_token, start, actions, true);
+	return next_token;
+    } else if (is_token(next_token, "config")) {
+	return next_token + 3;
     }
+    return syntax_error(next_token, "'on' or 'config' expected");
+}
 
+static void ICACHE_FLASH_ATTR loop_done(uint32_t start) {
     loop_count++;
     lang_debug("Interpreter loop: %d us\r\n", (system_get_time()-start));
     if (interpreter_status == INIT)
 	loop_time = system_get_time()-start;
     else
 	loop_time = (loop_time * 7 + (system_get_time()-start)) / 8;
+}
+
+int ICACHE_FLASH_ATTR parse_statement(int next_token) {
+    uint32_t start = system_get_time();
 
+    while ((next_token = syn_chk ? next_token : search_token(next_token, "on")) < max_token) {
+	if ((next_token = parse_clause(next_token)) == -1)
+	    return -1;
+    }
+
+    loop_done(start);
     return next_token;
 }
 
@@ -548,6 +702,7 @@ int ICACHE_FLASH_ATTR parse_event(int next_token, bool * happend) {
 	int topic_len;
 	Value_Type topic_type;
 	int lr_token = next_token + 1;
+	int on_token = next_token - 1;
 
 	lang_debug("event topic\r\n");
 	in_topic_statement = true;
@@ -556,6 +711,11 @@ int ICACHE_FLASH_ATTR parse_event(int next_token, bool * happend) {
 	if ((next_token = parse_value(next_token + 2, &topic, &topic_len, &topic_type)) == -1)
 	    return -1;
 
+	if (syn_chk && is_token(lr_token, "local"))
+	    index_topic_clause(on_token, 0, lr_token + 1);
+	if (syn_chk && is_token(lr_token, "remote"))
+	    index_topic_clause(on_token, 1, lr_token + 1);
+
 	if (is_token(lr_token, "remote")) {
 	    if (interpreter_status != TOPIC_REMOTE)
 		return next_token;
@@ -668,6 +828,7 @@ int ICACHE_FLASH_ATTR parse_action(int next_token, bool doit) {
 
 	if (doit) {
 	    lang_debug("action %s\r\n", my_token[next_token]);
+	    action_count++;
 	}
 	//os_printf("action %s %s\r\n", my_token[next_token], doit ? "do" : "ignore");
 
@@ -710,7 +871,7 @@ int ICACHE_FLASH_ATTR parse_action(int next_token, bool doit) {
 		return -1;
 	    if (doit) {
 		lang_log("system '%s'\r\n", p_char);
-		do_command(p_char, "", "");
+		do_command(p_char);
 	    }
 	}
 
@@ -743,13 +904,15 @@ int ICACHE_FLASH_ATTR parse_action(int next_token, bool doit) {
 
 #ifdef MQTT_CLIENT
 	    if (is_token(lr_token, "remote")) {
-		if (doit && mqtt_connected) {
+		if (doit) {
 		    if (data_type == STRING_T) {
 		    	lang_log("publish remote %s %s\r\n", topic, data);
 		    } else {
 			lang_log("publish remote %s binary (%d bytes)\r\n", topic, data_len);
 		    }
-		    MQTT_Publish(&mqttClient, topic, data, data_len, 0, retained);
+		    // Queued while the client is disconnected
+		    remote_publish(topic, data, data_len, 0, retained);
+		    latency_published();
 		}
 	    } else
 #endif
@@ -761,6 +924,8 @@ int ICACHE_FLASH_ATTR parse_action(int next_token, bool doit) {
 			lang_log("publish local %s binary (%d bytes)\r\n", topic, data_len);
 		    }
 		    MQTT_local_publish(topic, data, data_len, 0, retained);
+		    TRACE_EVENT(TR_LOCAL_PUBLISH, 0, data_len);
+		    latency_published();
 		}
 	    } else {
 		return syntax_error(lr_token, "'local' or 'remote' expected");
@@ -779,16 +944,16 @@ int ICACHE_FLASH_ATTR parse_action(int next_token, bool doit) {
 		return -1;
 #ifdef MQTT_CLIENT
 	    if (is_token(rl_token, "remote")) {
-		if (doit && mqtt_connected) {
+		if (doit) {
 		    lang_log("subscribe remote %s\r\n", topic);
-		    retval = MQTT_Subscribe(&mqttClient, topic, 0);
+		    retval = sub_refs_add(topic, true, 0, SUB_SCRIPT);
 		}
 	    } else 
 #endif
 	    if (is_token(rl_token, "local")) {
 		if (doit) {
 		    lang_log("subscribe local %s\r\n", topic);
-		    retval = MQTT_local_subscribe(topic, 0);
+		    retval = sub_refs_add(topic, false, 0, SUB_SCRIPT);
 		}
 	    } else {
 		return syntax_error(next_token + 1, "'local' or 'remote' expected");
@@ -807,16 +972,16 @@ int ICACHE_FLASH_ATTR parse_action(int next_token, bool doit) {
 		return -1;
 #ifdef MQTT_CLIENT
 	    if (is_token(rl_token, "remote")) {
-		if (doit && mqtt_connected) {
+		if (doit) {
 		    lang_log("unsubscribe remote %s\r\n", topic);
-		    retval = MQTT_UnSubscribe(&mqttClient, topic);
+		    retval = sub_refs_remove(topic, true, SUB_SCRIPT);
 		}
 	    } else
 #endif
 	    if (is_token(rl_token, "local")) {
 		if (doit) {
-		    lang_log("subscribe local %s\r\n", topic);
-		    retval = MQTT_local_unsubscribe(topic);
+		    lang_log("unsubscribe local %s\r\n", topic);
+		    retval = sub_refs_remove(topic, false, SUB_SCRIPT);
 		}
 	    } else {
 		return syntax_error(next_token + 1, "'local' or 'remote' expected");
@@ -1193,7 +1358,7 @@ int ICACHE_FLASH_ATTR parse_expression(int next_token, char **data, int *data_le
 	*data_type = DATA_T;
 	if (doit) {
 	    retained_entry *retained_entry_p;
-	    if (find_retainedtopic(topic_data, retained_cb, &retained_entry_p)) {
+	    if (retained_index_find(topic_data, retained_cb, &retained_entry_p)) {
 		*data_len = retained_entry_p->data_len > sizeof(tmp_buffer)-1? sizeof(tmp_buffer)-1 : retained_entry_p->data_len;
 		os_memcpy(tmp_buffer, retained_entry_p->data, *data_len);
 		tmp_buffer[*data_len] = '\0';
@@ -1793,7 +1958,9 @@ int ICACHE_FLASH_ATTR parse_value(int next_token, char **data, int *data_len, Va
 	static char adcbuf[8];
 	lang_debug("val $adc\r\n");
 
-	os_sprintf(adcbuf, "%d", adc_read());
+	uint16_t adc_val = adc_read();
+	RECORD_EVENT(REC_ADC, 0, &adc_val, sizeof(adc_val), NULL, 0);
+	os_sprintf(adcbuf, "%d", adc_val);
 	*data = adcbuf;
 	*data_len = os_strlen(*data);
 	*data_type = STRING_T;
@@ -1857,6 +2024,11 @@ int ICACHE_FLASH_ATTR interpreter_syntax_check() {
 	vars[i].data_len = 0;
     }
 
+    free_topic_index();
+    topic_index_valid = true;
+    alloc_profiles();
+    latency_reset();
+
     os_sprintf(tmp_buffer, "Syntax okay");
     interpreter_status = SYNTAX_CHECK;
     interpreter_topic = interpreter_data = "";
@@ -1877,6 +2049,8 @@ int ICACHE_FLASH_ATTR interpreter_config() {
     while ((next_token = search_token(next_token, "config")) < max_token) {
 	lang_debug("statement config\r\n");
 	uint8_t *val;
+	char response[128];
+	int param;
 
 	len_check(2);
 
@@ -1895,7 +2069,13 @@ int ICACHE_FLASH_ATTR interpreter_config() {
 	    val = my_token[next_token + 2];
 	}
 
-	do_command("set", my_token[next_token + 1], val);
+	if ((param = config_param_id(my_token[next_token + 1])) >= 0) {
+	    config_set(param, (char *)val, response);
+	    lang_log("config %s: %s", my_token[next_token + 1], response);
+	} else {
+	    os_sprintf(response, "Invalid config %s\r\n", my_token[next_token + 1]);
+	    con_print(response);
+	}
 	next_token += 3;
     }
     return next_token;
@@ -1927,6 +2107,7 @@ int ICACHE_FLASH_ATTR interpreter_wifi_connect(void) {
 	return -1;
 
     lang_debug("interpreter_wifi_connect\r\n");
+    RECORD_EVENT(REC_WIFI, 1, NULL, 0, NULL, 0);
 
     interpreter_status = WIFI_CONNECT;
     interpreter_topic = interpreter_data = "";
@@ -1939,6 +2120,7 @@ int ICACHE_FLASH_ATTR interpreter_wifi_disconnect(void) {
 	return -1;
 
     lang_debug("interpreter_wifi_disconnect\r\n");
+    RECORD_EVENT(REC_WIFI, 0, NULL, 0, NULL, 0);
 
     interpreter_status = WIFI_DISCONNECT;
     interpreter_topic = interpreter_data = "";
@@ -1951,6 +2133,7 @@ int ICACHE_FLASH_ATTR interpreter_mqtt_connect(void) {
 	return -1;
 
     lang_debug("interpreter_mqtt_connect\r\n");
+    RECORD_EVENT(REC_MQTT, 1, NULL, 0, NULL, 0);
 
     interpreter_status = MQTT_CLIENT_CONNECT;
     interpreter_topic = interpreter_data = "";
@@ -1967,13 +2150,30 @@ int ICACHE_FLASH_ATTR interpreter_topic_received(const char *topic, const char *
     data_null[data_len] = '\0';
 
     lang_debug("interpreter_topic_received\r\n");
+    RECORD_EVENT(local ? REC_TOPIC_LOCAL : REC_TOPIC_REMOTE, 0, topic, os_strlen(topic) + 1, data, data_len);
 
     interpreter_status = (local) ? TOPIC_LOCAL : TOPIC_REMOTE;
     interpreter_topic = (char *)topic;
     interpreter_data = data_null;
     interpreter_data_len = data_len;
 
-    return parse_statement(0);
+    if (!topic_index_valid)
+	return parse_statement(0);
+
+    // Only evaluate the clauses whose topic filter can match
+    int clauses[topic_clause_count + 1];
+    clause_list list = { clauses, 0 };
+    int i, next_token = 0;
+    uint32_t start = system_get_time();
+
+    topic_trie_match(topic_clauses[local ? 0 : 1], topic, collect_clause, &list);
+    for (i = 0; i < list.count; i++) {
+	if ((next_token = parse_clause(clauses[i])) == -1)
+	    return -1;
+    }
+
+    loop_done(start);
+    return next_token;
 }
 
 int ICACHE_FLASH_ATTR interpreter_serial_input(const char *data, int data_len) {
@@ -1981,6 +2181,7 @@ int ICACHE_FLASH_ATTR interpreter_serial_input(const char *data, int data_len) {
 	return -1;
 
     lang_debug("interpreter_serial_input\r\n");
+    RECORD_EVENT(REC_SERIAL, 0, data, data_len, NULL, 0);
 
     interpreter_status = SERIAL_INPUT;
     interpreter_serial_data = (char *)data;
@@ -1995,6 +2196,8 @@ void ICACHE_FLASH_ATTR interpreter_http_reply(char *hostname, char *path, char *
 	return;
 
     lang_debug("interpreter_http_reply\r\n");
+    uint16_t status = http_status;
+    RECORD_EVENT(REC_HTTP, 0, &status, sizeof(status), response_body, body_size);
 
     interpreter_status = HTTP_RESPONSE;
     interpreter_topic = response_headers;
@@ -1,6 +1,8 @@
 #ifndef _LANG_
 #define _LANG_
 
+#include "os_type.h"
+#include "user_config.h"
 #include "mqtt/mqtt_server.h"
 
 typedef enum {SYNTAX_CHECK, CONFIG, INIT, MQTT_CLIENT_CONNECT, WIFI_CONNECT, WIFI_DISCONNECT, TOPIC_LOCAL, TOPIC_REMOTE, TIMER, SERIAL_INPUT, GPIO_INT, ALARM, HTTP_RESPONSE} Interpreter_Status;
@@ -20,6 +22,18 @@ extern MQTT_Client mqttClient;
 extern bool mqtt_enabled, mqtt_connected;
 extern bool lang_logging;
 
+typedef struct _clause_profile {
+    int on_token;
+    uint32_t calls;		// Event evaluated
+    uint32_t fired;		// Event happened, actions executed
+    uint32_t actions;
+    uint32_t total_us;
+    uint32_t max_us;
+} clause_profile;
+extern clause_profile *clause_profiles;
+extern int clause_profile_count;
+void clause_event_text(int on_token, char *buf, int size);
+
 uint8_t tmp_buffer[128];
 uint32_t loop_time;
 uint32_t loop_count;
@@ -52,4 +66,15 @@ void check_timestamps(uint8_t *curr_time);
 void init_gpios();
 void stop_gpios();
 
+#ifdef GPIO
+// Debouncing of a GPIO interrupt, the argument of inttimer_func()
+typedef struct _gpio_entry_t {
+    os_timer_t inttimer;
+    uint8_t no;
+    bool val;
+} gpio_entry_t;
+
+void inttimer_func(void *arg);
+#endif
+
 #endif /* _LANG_ */
@@ -0,0 +1,84 @@
+#include "c_types.h"
+#include "osapi.h"
+#include "user_interface.h"
+
+#include "latency.h"
+
+lat_hist lat_hists[LAT_STAGES];
+
+static const char *stage_names[LAT_STAGES] = { "queue", "dispatch", "script", "total" };
+
+// Timestamps of the message the script is working on
+static bool in_message = false, dispatched;
+static uint32_t t_received, t_dequeued, t_clause;
+
+static void ICACHE_FLASH_ATTR record(LAT_STAGE stage, uint32_t us) {
+    lat_hist *h = &lat_hists[stage];
+    uint8_t i;
+
+    for (i = 0; i < LAT_BUCKETS - 1 && (us >> (i + 1)) != 0; i++);
+    h->buckets[i]++;
+    h->count++;
+    if (us > h->max_us)
+	h->max_us = us;
+}
+
+const char * ICACHE_FLASH_ATTR latency_stage_name(LAT_STAGE stage) {
+    return stage_names[stage];
+}
+
+uint32_t ICACHE_FLASH_ATTR latency_percentile(LAT_STAGE stage, uint8_t percent) {
+    lat_hist *h = &lat_hists[stage];
+    uint32_t rank, sum = 0;
+    uint8_t i;
+
+    if (h->count == 0)
+	return 0;
+
+    rank = ((uint64_t) h->count * percent + 99) / 100;
+    for (i = 0; i < LAT_BUCKETS - 1; i++) {
+	sum += h->buckets[i];
+	if (sum >= rank)
+	    break;
+    }
+    // The last bucket is open, the max is the best estimate
+    if (i == LAT_BUCKETS - 1 || (2UL << i) > h->max_us)
+	return h->max_us;
+    return 2UL << i;
+}
+
+void ICACHE_FLASH_ATTR latency_reset(void) {
+    os_bzero(lat_hists, sizeof(lat_hists));
+}
+
+void ICACHE_FLASH_ATTR latency_dequeued(uint32_t received) {
+    t_received = received;
+    t_dequeued = system_get_time();
+    in_message = true;
+    dispatched = false;
+    record(LAT_QUEUE, t_dequeued - t_received);
+}
+
+void ICACHE_FLASH_ATTR latency_clause_start(void) {
+    if (!in_message)
+	return;
+    t_clause = system_get_time();
+    // Once per message, at the first clause that fires
+    if (!dispatched) {
+	dispatched = true;
+	record(LAT_DISPATCH, t_clause - t_dequeued);
+    }
+}
+
+void ICACHE_FLASH_ATTR latency_published(void) {
+    uint32_t now = system_get_time();
+
+    if (!in_message)
+	return;
+    record(LAT_SCRIPT, now - t_clause);
+    record(LAT_TOTAL, now - t_received);
+}
+
+void ICACHE_FLASH_ATTR latency_done(void) {
+    in_message = false;
+}
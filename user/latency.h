@@ -0,0 +1,41 @@
+#ifndef _LATENCY_
+#define _LATENCY_
+
+#include "c_types.h"
+
+/*
+ * Latency histograms of the event pipeline of the script. Each stage
+ * has fixed log2 buckets: bucket i counts the samples of less than
+ * 2^(i+1) us, the last one all longer ones.
+ */
+
+#define LAT_BUCKETS	24
+
+typedef enum {
+    LAT_QUEUE = 0,	// Received by the broker -> dequeued for the script
+    LAT_DISPATCH,	// Dequeued -> first clause that fires
+    LAT_SCRIPT,		// Clause fires -> publish by the clause
+    LAT_TOTAL,		// Received -> publish by a clause
+    LAT_STAGES
+} LAT_STAGE;
+
+typedef struct _lat_hist {
+    uint32_t count;
+    uint32_t max_us;
+    uint32_t buckets[LAT_BUCKETS];
+} lat_hist;
+
+extern lat_hist lat_hists[LAT_STAGES];
+
+const char *latency_stage_name(LAT_STAGE stage);
+// Upper bound of the bucket that holds the given percentile, 0 if empty
+uint32_t latency_percentile(LAT_STAGE stage, uint8_t percent);
+void latency_reset(void);
+
+// Hooks along the pipeline, all times from system_get_time()
+void latency_dequeued(uint32_t received);
+void latency_clause_start(void);
+void latency_published(void);
+void latency_done(void);
+
+#endif /* _LATENCY_ */
@@ -0,0 +1,92 @@
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+#include "user_interface.h"
+
+#include "global.h"
+#include "broker_conn.h"
+#include "conn_buf.h"
+#include "mem_gov.h"
+
+uint32_t mem_rejected_connections = 0;
+uint32_t mem_dropped_messages = 0;
+
+MEM_LEVEL ICACHE_FLASH_ATTR mem_gov_level(void) {
+    uint32_t free_heap = system_get_free_heap_size();
+
+    if (free_heap < MEM_DROP_HEAP)
+	return MEM_DROP;
+    if (free_heap < MEM_REJECT_HEAP)
+	return MEM_REJECT;
+    if (free_heap < MEM_THROTTLE_HEAP)
+	return MEM_THROTTLE;
+    return MEM_OK;
+}
+
+const char * ICACHE_FLASH_ATTR mem_gov_level_name(MEM_LEVEL level) {
+    switch (level) {
+    case MEM_THROTTLE:
+	return "throttle";
+    case MEM_REJECT:
+	return "reject";
+    case MEM_DROP:
+	return "drop";
+    default:
+	return "ok";
+    }
+}
+
+static bool ICACHE_FLASH_ATTR retained_size_cb(retained_entry *entry, void *user_data) {
+    if (entry->topic != NULL)
+	*(uint32_t *)user_data += os_strlen(entry->topic) + 1 + entry->data_len;
+    return false;
+}
+
+void ICACHE_FLASH_ATTR mem_gov_usage(mem_usage *usage) {
+    usage->client_bufs = MQTT_server_countClientCon() * (MQTT_BUF_SIZE + QUEUE_BUFFER_SIZE);
+    usage->retained = 0;
+    iterate_retainedtopics(retained_size_cb, &usage->retained);
+    usage->conn_bufs = conn_buf_allocated();
+#ifdef SCRIPTED
+    usage->pub_queue = pub_list_bytes();
+    usage->script = my_script != NULL ? *(uint32_t *)my_script : 0;
+#else
+    usage->pub_queue = 0;
+    usage->script = 0;
+#endif
+}
+
+void ICACHE_FLASH_ATTR mem_gov_tick(void) {
+    broker_conn *bc, *busiest = NULL;
+
+    if (mem_gov_level() == MEM_OK) {
+	for (bc = broker_conn_list; bc != NULL; bc = bc->next)
+	    broker_conn_release(bc, HOLD_MEMORY);
+	return;
+    }
+
+    // Stop reading from one more client per second, the busiest first
+    for (bc = broker_conn_list; bc != NULL; bc = bc->next) {
+	if ((bc->hold & HOLD_MEMORY) == 0 && bc->rx_last > 0 &&
+	    (busiest == NULL || bc->rx_last > busiest->rx_last))
+	    busiest = bc;
+    }
+    if (busiest != NULL)
+	broker_conn_hold(busiest, HOLD_MEMORY);
+}
+
+bool ICACHE_FLASH_ATTR mem_gov_accept_connection(void) {
+    if (mem_gov_level() >= MEM_REJECT) {
+	mem_rejected_connections++;
+	return false;
+    }
+    return true;
+}
+
+bool ICACHE_FLASH_ATTR mem_gov_accept_message(void) {
+    if (mem_gov_level() >= MEM_DROP) {
+	mem_dropped_messages++;
+	return false;
+    }
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef _MEM_GOV_
+#define _MEM_GOV_
+
+#include "c_types.h"
+
+/*
+ * Memory governor: graded backpressure depending on the free heap.
+ * Each level includes the measures of the levels below.
+ */
+
+typedef enum {MEM_OK=0, MEM_THROTTLE, MEM_REJECT, MEM_DROP} MEM_LEVEL;
+
+typedef struct _mem_usage {
+    uint32_t client_bufs;	// Estimated, MQTT_BUF_SIZE + QUEUE_BUFFER_SIZE per client
+    uint32_t pub_queue;
+    uint32_t retained;
+    uint32_t conn_bufs;
+    uint32_t script;
+} mem_usage;
+
+extern uint32_t mem_rejected_connections;
+extern uint32_t mem_dropped_messages;
+
+MEM_LEVEL mem_gov_level(void);
+const char *mem_gov_level_name(MEM_LEVEL level);
+void mem_gov_usage(mem_usage *usage);
+
+// Call once per second, after broker_conn_tick()
+void mem_gov_tick(void);
+
+// Admission checks, false if the governor refuses
+bool mem_gov_accept_connection(void);
+bool mem_gov_accept_message(void);
+
+#endif /* _MEM_GOV_ */
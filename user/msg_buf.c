@@ -0,0 +1,53 @@
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+#include "user_interface.h"
+
+#include "msg_buf.h"
+
+msg_buf * ICACHE_FLASH_ATTR msg_buf_new(const char *topic, uint32_t topic_len, const char *data, uint32_t data_len) {
+    msg_buf *msg;
+
+    if (topic_len > 0xffff)
+	return NULL;
+    msg = (msg_buf *)os_malloc(sizeof(msg_buf) + topic_len + 1 + data_len + 1);
+    if (msg == NULL)
+	return NULL;
+
+    msg->ref_count = 1;
+    msg->topic_len = topic_len;
+    msg->data_len = data_len;
+    msg->created = system_get_time();
+    msg->topic = msg->buf;
+    msg->data = msg->buf + topic_len + 1;
+
+    os_memcpy(msg->topic, topic, topic_len);
+    msg->topic[topic_len] = '\0';
+    os_memcpy(msg->data, data, data_len);
+    msg->data[data_len] = '\0';
+    return msg;
+}
+
+msg_buf * ICACHE_FLASH_ATTR msg_buf_ref(msg_buf *msg) {
+    if (msg != NULL)
+	msg->ref_count++;
+    return msg;
+}
+
+void ICACHE_FLASH_ATTR msg_buf_unref(msg_buf *msg) {
+    if (msg == NULL)
+	return;
+    if (--msg->ref_count == 0)
+	os_free(msg);
+}
+
+msg_buf * ICACHE_FLASH_ATTR msg_src_buf(msg_src *src) {
+    if (src->msg == NULL)
+	src->msg = msg_buf_new(src->topic, src->topic_len, src->data, src->data_len);
+    return src->msg;
+}
+
+void ICACHE_FLASH_ATTR msg_src_done(msg_src *src) {
+    msg_buf_unref(src->msg);
+    src->msg = NULL;
+}
@@ -0,0 +1,44 @@
+#ifndef _MSG_BUF_
+#define _MSG_BUF_
+
+#include "c_types.h"
+
+/*
+ * A published message (topic and payload) in a single allocation.
+ * It is shared by all queues that hold it and freed with the last
+ * reference. Topic and data are always null-terminated.
+ */
+
+typedef struct _msg_buf {
+    uint16_t ref_count;
+    uint16_t topic_len;
+    uint32_t data_len;
+    uint32_t created;		// system_get_time()
+    char *topic;
+    char *data;
+    char buf[];
+} msg_buf;
+
+msg_buf *msg_buf_new(const char *topic, uint32_t topic_len, const char *data, uint32_t data_len);
+msg_buf *msg_buf_ref(msg_buf *msg);
+void msg_buf_unref(msg_buf *msg);
+
+/*
+ * A received message that is passed to several consumers. It is copied
+ * into a msg_buf only when the first consumer queues it, the others
+ * share that copy.
+ */
+typedef struct _msg_src {
+    const char *topic;
+    uint32_t topic_len;
+    const char *data;
+    uint32_t data_len;
+    msg_buf *msg;
+} msg_src;
+
+// The shared copy, NULL if out of memory
+msg_buf *msg_src_buf(msg_src *src);
+// Drops the reference of the source
+void msg_src_done(msg_src *src);
+
+#endif /* _MSG_BUF_ */
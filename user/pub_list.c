@@ -5,61 +5,83 @@
 
 #include "lang.h"
 #include "pub_list.h"
+#include "latency.h"
+#include "trace.h"
 
 typedef struct _pub_entry {
-    char *topic;
-    char *data;
-    uint32_t data_len;
+    msg_buf *msg;
     bool local;
     struct _pub_entry *next;
 } pub_entry;
 
+// FIFO, new entries are appended at the tail
 static pub_entry *pub_list = NULL;
+static pub_entry *pub_list_tail = NULL;
+static uint32_t pub_bytes = 0;
+static uint16_t pub_count = 0;
 
-void ICACHE_FLASH_ATTR pub_insert(const char* topic, uint32_t topic_len, const char *data, uint32_t data_len, bool local)
+#define PUB_ENTRY_SIZE(pub) (sizeof(pub_entry) + sizeof(msg_buf) + (pub)->msg->topic_len + (pub)->msg->data_len + 2)
+
+bool ICACHE_FLASH_ATTR pub_insert_msg(msg_buf *msg, bool local)
 {
     pub_entry *pub = (pub_entry *)os_malloc(sizeof(pub_entry));
     if (pub == NULL)
-	return;
-    pub->topic = (char*)os_malloc(topic_len+1);
-    if (pub->topic == NULL) {
-	os_free(pub);
-	return;
-    }
-    pub->data = (char*)os_malloc(data_len+1);
-    if (pub->data == NULL) {
-	os_free(pub->topic);
-	os_free(pub);
-	return;
-    }
-    os_memcpy(pub->topic, topic, topic_len);
-    pub->topic[topic_len] = '\0';
-    os_memcpy(pub->data, data, data_len);
-    pub->data_len = data_len;
-    pub->data[data_len] = '\0';
+	return false;
+
+    pub->msg = msg_buf_ref(msg);
     pub->local = local;
+    pub->next = NULL;
+
+    if (pub_list_tail != NULL)
+	pub_list_tail->next = pub;
+    else
+	pub_list = pub;
+    pub_list_tail = pub;
+    pub_bytes += PUB_ENTRY_SIZE(pub);
+    pub_count++;
+    TRACE_EVENT(TR_QUEUE, pub_count, pub_bytes);
+    return true;
+}
 
-    pub->next = pub_list;
-    pub_list = pub;
+void ICACHE_FLASH_ATTR pub_insert(const char* topic, uint32_t topic_len, const char *data, uint32_t data_len, bool local)
+{
+    msg_buf *msg = msg_buf_new(topic, topic_len, data, data_len);
+    if (msg == NULL)
+	return;
+
+    pub_insert_msg(msg, local);
+    msg_buf_unref(msg);
 }
 
 
 void ICACHE_FLASH_ATTR pub_process()
 {
-    pub_entry **pre_last, *last;
+    pub_entry *first;
 
     while (pub_list != NULL) {
-	pre_last = &pub_list;
-	while ((*pre_last)->next != NULL)
-	    pre_last = &((*pre_last)->next);
+	first = pub_list;
+	pub_list = first->next;
+	if (pub_list == NULL)
+	    pub_list_tail = NULL;
 
-	last = *pre_last;
-	*pre_last = NULL;
+	pub_bytes -= PUB_ENTRY_SIZE(first);
+	pub_count--;
 
-	interpreter_topic_received(last->topic, last->data, last->data_len, last->local);
+	latency_dequeued(first->msg->created);
+	interpreter_topic_received(first->msg->topic, first->msg->data, first->msg->data_len, first->local);
+	latency_done();
 
-	os_free(last->topic);
-	os_free(last->data);
-	os_free(last);
+	msg_buf_unref(first->msg);
+	os_free(first);
     }
 }
+
+uint32_t ICACHE_FLASH_ATTR pub_list_bytes()
+{
+    return pub_bytes;
+}
+
+uint16_t ICACHE_FLASH_ATTR pub_list_count()
+{
+    return pub_count;
+}
@@ -1,7 +1,14 @@
 #ifndef _PUB_LIST_
 #define _PUB_LIST_
 
+#include "msg_buf.h"
+
 void pub_insert(const char* topic, uint32_t topic_len, const char *data, uint32_t data_len, bool local);
+// Queues a shared message, takes an additional reference
+bool pub_insert_msg(msg_buf *msg, bool local);
 void pub_process();
+// Heap held by the queued messages
+uint32_t pub_list_bytes();
+uint16_t pub_list_count();
 
 #endif /* _PUB_LIST_ */
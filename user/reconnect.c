@@ -0,0 +1,101 @@
+#include "c_types.h"
+#include "osapi.h"
+#include "os_type.h"
+#include "user_interface.h"
+
+#include "global.h"
+#include "sys_time.h"
+#include "reconnect.h"
+
+#ifdef MQTT_CLIENT
+
+static os_timer_t reconnect_timer;
+static bool scheduled = false;
+static uint64_t next_attempt;
+static uint32_t backoff;
+static uint32_t connect_start;
+
+uint16_t reconnect_attempts = 0;
+uint32_t reconnect_connects = 0;
+uint32_t reconnect_last_ms = 0;
+
+// Doubles with every failed attempt, half of it is random ("equal jitter")
+static uint32_t ICACHE_FLASH_ATTR next_delay(void) {
+    uint16_t i;
+
+    backoff = MQTT_BACKOFF_MIN_MS;
+    for (i = 0; i < reconnect_attempts && backoff < MQTT_BACKOFF_MAX_MS; i++)
+	backoff *= 2;
+    if (backoff > MQTT_BACKOFF_MAX_MS)
+	backoff = MQTT_BACKOFF_MAX_MS;
+
+    return backoff / 2 + os_random() % (backoff / 2 + 1);
+}
+
+static void ICACHE_FLASH_ATTR reconnect_timer_cb(void *arg) {
+    scheduled = false;
+    if (!mqtt_enabled || !connected || mqtt_connected)
+	return;
+
+    reconnect_attempts++;
+    connect_start = system_get_time();
+    MQTT_Connect(&mqttClient);
+}
+
+static void ICACHE_FLASH_ATTR schedule(uint32_t delay_ms) {
+    os_timer_disarm(&reconnect_timer);
+    os_timer_setfn(&reconnect_timer, (os_timer_func_t *) reconnect_timer_cb, NULL);
+    os_timer_arm(&reconnect_timer, delay_ms, 0);
+    next_attempt = get_long_systime() + (uint64_t) delay_ms * 1000;
+    scheduled = true;
+}
+
+void ICACHE_FLASH_ATTR reconnect_wifi_up(void) {
+    if (!mqtt_enabled)
+	return;
+
+    // The broker was not the problem, a short jitter is enough
+    reconnect_attempts = 0;
+    backoff = 0;
+    schedule(1 + os_random() % MQTT_BACKOFF_FAST_MS);
+}
+
+void ICACHE_FLASH_ATTR reconnect_wifi_down(void) {
+    os_timer_disarm(&reconnect_timer);
+    scheduled = false;
+}
+
+void ICACHE_FLASH_ATTR reconnect_connected(void) {
+    os_timer_disarm(&reconnect_timer);
+    scheduled = false;
+    reconnect_attempts = 0;
+    backoff = 0;
+    reconnect_connects++;
+    // DNS, TCP, the TLS handshake (if any) and the MQTT CONNECT
+    reconnect_last_ms = (system_get_time() - connect_start) / 1000;
+}
+
+void ICACHE_FLASH_ATTR reconnect_tick(void) {
+    if (!mqtt_enabled || !connected || mqtt_connected || scheduled)
+	return;
+
+    // The library waits MQTT_RECONNECT_TIMEOUT seconds in this state, stop it before
+    if (mqttClient.connState == TCP_RECONNECT_REQ) {
+	MQTT_Disconnect(&mqttClient);
+	schedule(next_delay());
+    }
+}
+
+uint32_t ICACHE_FLASH_ATTR reconnect_backoff(void) {
+    return backoff;
+}
+
+int32_t ICACHE_FLASH_ATTR reconnect_next_in(void) {
+    uint64_t now = get_long_systime();
+
+    if (!scheduled)
+	return -1;
+    return next_attempt > now ? (int32_t) ((next_attempt - now) / 1000000) : 0;
+}
+
+#endif				/* MQTT_CLIENT */
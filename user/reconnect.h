@@ -0,0 +1,28 @@
+#ifndef _RECONNECT_
+#define _RECONNECT_
+
+#include "c_types.h"
+
+/*
+ * Reconnect scheduler of the remote client. Instead of retrying at the
+ * fixed MQTT_RECONNECT_TIMEOUT of the library, failed connects are
+ * retried after a capped exponential backoff with random jitter, so
+ * that the nodes of a fleet do not retry in lockstep while the remote
+ * broker is down. After WiFi is back the first attempt starts at once.
+ */
+
+extern uint16_t reconnect_attempts;	// Failed attempts since the last connect
+extern uint32_t reconnect_connects;
+extern uint32_t reconnect_last_ms;	// Duration of the last successful connect
+
+void reconnect_wifi_up(void);
+void reconnect_wifi_down(void);
+void reconnect_connected(void);
+
+// Called once per second, takes over from the retry timer of the library
+void reconnect_tick(void);
+
+uint32_t reconnect_backoff(void);
+int32_t reconnect_next_in(void);	// In seconds, -1 if nothing is scheduled
+
+#endif /* _RECONNECT_ */
@@ -0,0 +1,403 @@
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+#include "os_type.h"
+#include "spi_flash.h"
+#include "user_interface.h"
+#include "espconn.h"
+
+#include "global.h"
+#include "sys_time.h"
+#include "recorder.h"
+#include "trace.h"
+
+#ifdef RECORDER
+
+uint32_t recorder_count = 0, recorder_dropped = 0;
+
+// Allocated only while recording, NULL makes recorder_event() a no-op
+static ringbuf_t rec_ring = NULL;
+static os_timer_t flush_timer;
+static bool flush_armed = false;
+static bool clock_recorded;
+static uint32_t *flush_buf = NULL;	// Copy of the RAM ring for a write or send
+
+/*
+ * The flash ring: RECORDER_FLASH_SECTORS sectors, used in ring order
+ * like the one of the remote queue. Each sector starts with a header,
+ * then follow the records, never split across sectors. When full, the
+ * oldest sector is overwritten.
+ */
+#define RS_MAGIC		0x53434552	// "RECS"
+#define RS_EMPTY		0xffffffff
+
+typedef struct _rs_sector_header {
+    uint32_t magic;
+    uint32_t seq;
+} rs_sector_header;
+
+#define PAD4(x) (((x) + 3) & ~3)
+#define SECTOR_ADDR(sec) ((RECORDER_FLASH_SECTOR + (sec)) * SPI_FLASH_SEC_SIZE)
+
+static bool flash_ok = false;
+static uint16_t tail_sec, tail_off;	// tail_off 0: no sector in use yet
+static uint32_t flash_seq;
+
+// The client of the recorder port, one at a time
+static struct espconn *rec_server = NULL;
+static struct espconn *rec_conn = NULL;
+static uint16_t rec_conn_port;
+static uint8_t rec_conn_ip[4];
+static bool send_pending = false;
+
+static void ICACHE_FLASH_ATTR schedule_flush(void) {
+    if (!flush_armed) {
+	flush_armed = true;
+	os_timer_arm(&flush_timer, RECORDER_FLUSH_MS, 0);
+    }
+}
+
+void ICACHE_FLASH_ATTR recorder_event(uint8_t type, uint8_t arg, const void *d1, uint16_t len1, const void *d2, uint16_t len2) {
+    static const uint8_t zero[4] = { 0 };
+    rec_header hdr;
+    uint16_t len = sizeof(rec_header) + len1 + len2;
+
+    if (rec_ring == NULL || (config.record_mode == REC_TCP && rec_conn == NULL))
+	return;
+
+    if (PAD4(len) > ringbuf_bytes_free(rec_ring)) {
+	recorder_dropped++;
+	return;
+    }
+
+    hdr.time = (uint32_t)(get_long_systime() / 1000);
+    hdr.type = type;
+    hdr.arg = arg;
+    hdr.len = len1 + len2;
+    ringbuf_memcpy_into(rec_ring, &hdr, sizeof(hdr));
+    if (len1 != 0)
+	ringbuf_memcpy_into(rec_ring, d1, len1);
+    if (len2 != 0)
+	ringbuf_memcpy_into(rec_ring, d2, len2);
+    if (PAD4(len) != len)
+	ringbuf_memcpy_into(rec_ring, zero, PAD4(len) - len);
+    recorder_count++;
+
+    schedule_flush();
+}
+
+static void ICACHE_FLASH_ATTR start_recording(void) {
+    clock_recorded = false;
+    RECORD_EVENT(REC_START, config.record_mode, ESP_UBROKER_VERSION, os_strlen(ESP_UBROKER_VERSION), NULL, 0);
+}
+
+void ICACHE_FLASH_ATTR recorder_clock(const char *timestr, const char *weekday) {
+    char buf[16];
+
+    if (rec_ring == NULL || clock_recorded)
+	return;
+    clock_recorded = true;
+    os_sprintf(buf, "%s %s", timestr, weekday);
+    RECORD_EVENT(REC_CLOCK, 0, buf, os_strlen(buf), NULL, 0);
+}
+
+/* Flash ring */
+
+// Returns the end of the records in a sector
+static uint16_t ICACHE_FLASH_ATTR sector_end(uint16_t sec) {
+    rec_header hdr;
+    uint16_t off = sizeof(rs_sector_header);
+
+    while (off + sizeof(rec_header) <= SPI_FLASH_SEC_SIZE) {
+	spi_flash_read(SECTOR_ADDR(sec) + off, (uint32_t *)&hdr, sizeof(hdr));
+	// Empty, interrupted write or garbage
+	if (*(uint32_t *)&hdr == RS_EMPTY || hdr.type == REC_NONE || hdr.type >= REC_TYPES
+	    || off + PAD4(sizeof(rec_header) + hdr.len) > SPI_FLASH_SEC_SIZE)
+	    break;
+	off += PAD4(sizeof(rec_header) + hdr.len);
+    }
+    return off;
+}
+
+static bool ICACHE_FLASH_ATTR sector_valid(uint16_t sec) {
+    rs_sector_header sh;
+
+    spi_flash_read(SECTOR_ADDR(sec), (uint32_t *)&sh, sizeof(sh));
+    return sh.magic == RS_MAGIC;
+}
+
+static void ICACHE_FLASH_ATTR flash_init(void) {
+    enum flash_size_map map = system_get_flash_size_map();
+    rs_sector_header sh;
+    uint16_t sec;
+    uint32_t max_seq = 0;
+    bool found = false;
+
+    // The ring is placed above the firmware, this needs at least 1MB flash
+    flash_ok = map != FLASH_SIZE_4M_MAP_256_256 && map != FLASH_SIZE_2M;
+    tail_sec = tail_off = 0;
+    flash_seq = 0;
+    if (!flash_ok)
+	return;
+
+    for (sec = 0; sec < RECORDER_FLASH_SECTORS; sec++) {
+	spi_flash_read(SECTOR_ADDR(sec), (uint32_t *)&sh, sizeof(sh));
+	if (sh.magic != RS_MAGIC || sh.seq < max_seq)
+	    continue;
+	found = true;
+	max_seq = sh.seq;
+	tail_sec = sec;
+    }
+
+    flash_seq = max_seq;
+    if (found)
+	tail_off = sector_end(tail_sec);
+}
+
+static void ICACHE_FLASH_ATTR flash_write(uint8_t *buf, uint16_t len) {
+    spi_flash_write(SECTOR_ADDR(tail_sec) + tail_off, (uint32_t *)buf, len);
+    TRACE_EVENT(TR_FLASH_WRITE, RECORDER_FLASH_SECTOR + tail_sec, len);
+    tail_off += len;
+}
+
+// Moves the RAM ring to flash, a write per sector touched
+static void ICACHE_FLASH_ATTR flash_flush(void) {
+    uint8_t *buf = (uint8_t *)flush_buf;
+    uint16_t fill = 0, len;
+    rec_header hdr;
+
+    while (ringbuf_bytes_used(rec_ring) >= sizeof(rec_header)) {
+	ringbuf_memcpy_from(&hdr, rec_ring, sizeof(hdr));
+	len = PAD4(sizeof(rec_header) + hdr.len);
+
+	if (tail_off == 0 || tail_off + fill + len > SPI_FLASH_SEC_SIZE) {
+	    uint16_t next = tail_off == 0 ? tail_sec : (tail_sec + 1) % RECORDER_FLASH_SECTORS;
+	    rs_sector_header sh;
+
+	    if (fill != 0) {
+		flash_write(buf, fill);
+		fill = 0;
+	    }
+	    spi_flash_erase_sector(RECORDER_FLASH_SECTOR + next);
+	    sh.magic = RS_MAGIC;
+	    sh.seq = ++flash_seq;
+	    spi_flash_write(SECTOR_ADDR(next), (uint32_t *)&sh, sizeof(sh));
+	    TRACE_EVENT(TR_FLASH_WRITE, RECORDER_FLASH_SECTOR + next, sizeof(sh));
+	    tail_sec = next;
+	    tail_off = sizeof(rs_sector_header);
+	}
+
+	os_memcpy(buf + fill, &hdr, sizeof(hdr));
+	ringbuf_memcpy_from(buf + fill + sizeof(hdr), rec_ring, len - sizeof(hdr));
+	fill += len;
+    }
+    if (fill != 0)
+	flash_write(buf, fill);
+}
+
+uint32_t ICACHE_FLASH_ATTR recorder_flash_bytes(void) {
+    uint16_t sec;
+    uint32_t bytes = 0;
+
+    if (!flash_ok)
+	return 0;
+    for (sec = 0; sec < RECORDER_FLASH_SECTORS; sec++) {
+	if (sec == tail_sec && tail_off != 0)
+	    bytes += tail_off - sizeof(rs_sector_header);
+	else if (sector_valid(sec))
+	    bytes += sector_end(sec) - sizeof(rs_sector_header);
+    }
+    return bytes;
+}
+
+// Reads from one sector at most, pos and buf aligned to 4 bytes
+uint16_t ICACHE_FLASH_ATTR recorder_flash_read(uint32_t pos, uint8_t *buf, uint16_t len) {
+    uint16_t sec, n, size;
+
+    if (!flash_ok)
+	return 0;
+
+    // Oldest sector first, the one after the tail in ring order
+    for (n = 1; n <= RECORDER_FLASH_SECTORS; n++) {
+	sec = (tail_sec + n) % RECORDER_FLASH_SECTORS;
+	if (sec == tail_sec)
+	    size = tail_off != 0 ? tail_off - sizeof(rs_sector_header) : 0;
+	else
+	    size = sector_valid(sec) ? sector_end(sec) - sizeof(rs_sector_header) : 0;
+	if (pos < size) {
+	    if (len > size - pos)
+		len = size - pos;
+	    spi_flash_read(SECTOR_ADDR(sec) + sizeof(rs_sector_header) + pos, (uint32_t *)buf, PAD4(len));
+	    return len;
+	}
+	pos -= size;
+    }
+    return 0;
+}
+
+void ICACHE_FLASH_ATTR recorder_flash_clear(void) {
+    uint16_t sec;
+
+    if (!flash_ok)
+	return;
+    if (rec_ring != NULL)
+	ringbuf_reset(rec_ring);
+    for (sec = 0; sec < RECORDER_FLASH_SECTORS; sec++) {
+	if (sector_valid(sec))
+	    spi_flash_erase_sector(RECORDER_FLASH_SECTOR + sec);
+    }
+    tail_sec = tail_off = 0;
+    flash_seq = 0;
+    if (config.record_mode == REC_FLASH)
+	start_recording();
+}
+
+/* TCP stream */
+
+static void ICACHE_FLASH_ATTR tcp_flush(void) {
+    uint16_t len;
+
+    if (rec_conn == NULL) {
+	ringbuf_reset(rec_ring);
+	return;
+    }
+    // The sent callback continues
+    if (send_pending)
+	return;
+
+    len = ringbuf_bytes_used(rec_ring);
+    if (len > RECORDER_RAM)
+	len = RECORDER_RAM;
+    ringbuf_memcpy_from(flush_buf, rec_ring, len);
+    if (espconn_send(rec_conn, (uint8_t *)flush_buf, len) == 0)
+	send_pending = true;
+    else
+	recorder_dropped++;
+}
+
+static void ICACHE_FLASH_ATTR rec_sent_cb(void *arg) {
+    send_pending = false;
+    if (rec_ring != NULL && ringbuf_bytes_used(rec_ring) != 0)
+	schedule_flush();
+}
+
+static void ICACHE_FLASH_ATTR rec_discon_cb(void *arg) {
+    struct espconn *pespconn = (struct espconn *)arg;
+
+    // A rejected second client shares the callbacks
+    if (rec_conn == NULL || pespconn->proto.tcp->remote_port != rec_conn_port
+	|| os_memcmp(pespconn->proto.tcp->remote_ip, rec_conn_ip, 4) != 0)
+	return;
+    rec_conn = NULL;
+    send_pending = false;
+    if (rec_ring != NULL)
+	ringbuf_reset(rec_ring);
+}
+
+static void ICACHE_FLASH_ATTR rec_connected_cb(void *arg) {
+    struct espconn *pespconn = (struct espconn *)arg;
+    uint32_t magic = REC_MAGIC;
+
+    if (rec_ring == NULL || config.record_mode != REC_TCP || rec_conn != NULL
+	|| !check_connection_access(pespconn, config.config_access)) {
+	espconn_disconnect(pespconn);
+	return;
+    }
+
+    espconn_regist_sentcb(pespconn, rec_sent_cb);
+    espconn_regist_disconcb(pespconn, rec_discon_cb);
+    rec_conn = pespconn;
+    rec_conn_port = pespconn->proto.tcp->remote_port;
+    os_memcpy(rec_conn_ip, pespconn->proto.tcp->remote_ip, 4);
+    send_pending = false;
+
+    ringbuf_reset(rec_ring);
+    ringbuf_memcpy_into(rec_ring, &magic, sizeof(magic));
+    start_recording();
+}
+
+static void ICACHE_FLASH_ATTR tcp_server_start(void) {
+    if (rec_server != NULL)
+	return;
+    if ((rec_server = (struct espconn *)os_zalloc(sizeof(struct espconn))) == NULL)
+	return;
+    rec_server->type = ESPCONN_TCP;
+    rec_server->state = ESPCONN_NONE;
+    rec_server->proto.tcp = (esp_tcp *)os_zalloc(sizeof(esp_tcp));
+    rec_server->proto.tcp->local_port = RECORDER_PORT;
+    espconn_regist_connectcb(rec_server, rec_connected_cb);
+    espconn_accept(rec_server);
+}
+
+static void ICACHE_FLASH_ATTR flush_timer_cb(void *arg) {
+    flush_armed = false;
+    if (rec_ring == NULL)
+	return;
+
+    if (config.record_mode == REC_TCP)
+	tcp_flush();
+    else
+	flash_flush();
+
+    if (ringbuf_bytes_used(rec_ring) != 0 && !send_pending)
+	schedule_flush();
+}
+
+bool ICACHE_FLASH_ATTR recorder_client_connected(void) {
+    return rec_conn != NULL;
+}
+
+bool ICACHE_FLASH_ATTR recorder_set_mode(uint8_t mode) {
+    if (mode == REC_FLASH && !flash_ok)
+	return false;
+
+    // Keep what is recorded so far
+    if (rec_ring != NULL && config.record_mode == REC_FLASH)
+	flash_flush();
+    if (rec_conn != NULL)
+	espconn_disconnect(rec_conn);
+
+    config.record_mode = mode;
+    if (mode == REC_OFF) {
+	os_timer_disarm(&flush_timer);
+	flush_armed = false;
+	if (rec_ring != NULL) {
+	    ringbuf_free(&rec_ring);
+	    os_free(flush_buf);
+	    rec_ring = NULL;
+	    flush_buf = NULL;
+	}
+	return true;
+    }
+
+    if (rec_ring == NULL) {
+	rec_ring = ringbuf_new(RECORDER_RAM);
+	flush_buf = (uint32_t *)os_malloc(RECORDER_RAM);
+	if (rec_ring == NULL || flush_buf == NULL) {
+	    if (rec_ring != NULL)
+		ringbuf_free(&rec_ring);
+	    if (flush_buf != NULL)
+		os_free(flush_buf);
+	    rec_ring = NULL;
+	    flush_buf = NULL;
+	    config.record_mode = REC_OFF;
+	    return false;
+	}
+    }
+    ringbuf_reset(rec_ring);
+
+    if (mode == REC_TCP)
+	tcp_server_start();
+    else
+	start_recording();
+    return true;
+}
+
+void ICACHE_FLASH_ATTR recorder_init(void) {
+    os_timer_setfn(&flush_timer, flush_timer_cb, NULL);
+    flash_init();
+    if (!recorder_set_mode(config.record_mode))
+	config.record_mode = REC_OFF;
+}
+
+#endif /* RECORDER */
@@ -0,0 +1,68 @@
+#ifndef _RECORDER_
+#define _RECORDER_
+
+#include "c_types.h"
+
+/*
+ * Recorder of the inputs of the script for an offline replay
+ * (tools/record_decode turns a recording into a timeline for
+ * tools/script_replay). On the hot path an event is only copied into
+ * a RAM ring, a timer moves it later to a ring of flash sectors or to
+ * the client of the recorder port.
+ *
+ * A record is a rec_header followed by the data, padded to 4 bytes.
+ * The TCP stream starts with REC_MAGIC.
+ */
+
+#define REC_OFF		0
+#define REC_FLASH	1
+#define REC_TCP		2
+
+#define REC_MAGIC	0x31434552	// "REC1"
+
+typedef enum {
+    REC_NONE = 0,
+    REC_START,		// Start of a recording
+    REC_TOPIC_LOCAL,	// data: topic, '\0', payload
+    REC_TOPIC_REMOTE,	// data: topic, '\0', payload
+    REC_TIMER,		// arg: timer number
+    REC_ALARM,		// arg: alarm number
+    REC_CLOCK,		// data: "HH:MM:SS Ddd"
+    REC_GPIO,		// arg: pin, data: level (after the debounce)
+    REC_SERIAL,		// data: the line
+    REC_HTTP,		// data: status (2 bytes), body
+    REC_WIFI,		// arg: 1 connect, 0 disconnect
+    REC_MQTT,		// arg: 1 connect, 0 disconnect
+    REC_ADC,		// data: value read by the script (2 bytes)
+    REC_TYPES
+} REC_TYPE;
+
+typedef struct _rec_header {
+    uint32_t time;	// ms since the boot
+    uint8_t type;
+    uint8_t arg;
+    uint16_t len;	// of the data
+} rec_header;
+
+#ifdef RECORDER
+#define RECORD_EVENT(type, arg, d1, len1, d2, len2)	recorder_event((type), (arg), (d1), (len1), (d2), (len2))
+#else
+#define RECORD_EVENT(type, arg, d1, len1, d2, len2)
+#endif
+
+extern uint32_t recorder_count, recorder_dropped;
+
+void recorder_init(void);
+// Switches the mode (config.record_mode), starts a new recording
+bool recorder_set_mode(uint8_t mode);
+void recorder_event(uint8_t type, uint8_t arg, const void *d1, uint16_t len1, const void *d2, uint16_t len2);
+// Records the wall clock once per recording, call when the time is known
+void recorder_clock(const char *timestr, const char *weekday);
+bool recorder_client_connected(void);
+
+// Bytes of the recording in flash, copies from a position in the recording
+uint32_t recorder_flash_bytes(void);
+uint16_t recorder_flash_read(uint32_t pos, uint8_t *buf, uint16_t len);
+void recorder_flash_clear(void);
+
+#endif /* _RECORDER_ */
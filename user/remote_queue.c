@@ -0,0 +1,430 @@
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+#include "os_type.h"
+#include "spi_flash.h"
+#include "user_interface.h"
+
+#include "global.h"
+#include "msg_buf.h"
+#include "mem_gov.h"
+#include "remote_queue.h"
+#include "trace.h"
+
+#ifdef MQTT_CLIENT
+
+typedef struct _queue_entry {
+    msg_buf *msg;		// Shared with the other queues of a local message
+    char *topic;		// msg->topic or a copy, if the bridge mapped it
+    uint8_t qos;
+    uint8_t retain;
+    struct _queue_entry *next;
+} queue_entry;
+
+#define OWN_TOPIC_SIZE(e) ((e)->topic != (e)->msg->topic ? os_strlen((e)->topic) + 1 : 0)
+#define ENTRY_SIZE(e) (sizeof(queue_entry) + sizeof(msg_buf) + (e)->msg->topic_len + (e)->msg->data_len + 2 + \
+		       OWN_TOPIC_SIZE(e))
+
+static queue_entry *ram_head = NULL, *ram_tail = NULL;
+static uint16_t ram_count = 0;
+static uint32_t ram_bytes = 0;
+
+uint32_t remote_queue_dropped = 0;
+
+/*
+ * The flash ring: REMOTE_QUEUE_FLASH_SECTORS sectors, used in ring
+ * order. Each sector starts with a header, then follow the records.
+ * A record is never split across sectors. Replayed records are marked
+ * by clearing their state byte, which needs no erase.
+ */
+#define RQ_MAGIC		0x31305152
+#define RQ_PENDING		0xff
+#define RQ_DONE			0x00
+#define RQ_EMPTY		0xffffffff
+
+typedef struct _rq_sector_header {
+    uint32_t magic;
+    uint32_t seq;
+} rq_sector_header;
+
+typedef struct _rq_record_header {
+    uint8_t state;
+    uint8_t flags;		// Bit 0-1: qos, bit 2: retain
+    uint16_t len;		// Of the whole record incl. header and padding
+    uint16_t topic_len;		// Incl. the terminating '\0'
+    uint16_t data_len;
+} rq_record_header;
+
+#define PAD4(x) (((x) + 3) & ~3)
+#define SECTOR_ADDR(sec) ((REMOTE_QUEUE_FLASH_SECTOR + (sec)) * SPI_FLASH_SEC_SIZE)
+
+static bool flash_ok = false;
+static uint16_t head_sec, head_off;
+static uint16_t tail_sec, tail_off;	// tail_off 0: no sector in use yet
+static uint32_t flash_seq;
+static uint16_t flash_count = 0;
+
+static os_timer_t drain_timer;
+static bool drain_active = false;
+static uint32_t drain_tokens;
+
+static bool ICACHE_FLASH_ATTR read_record_header(uint16_t sec, uint16_t off, rq_record_header *hdr) {
+    if (off + sizeof(rq_record_header) > SPI_FLASH_SEC_SIZE)
+	return false;
+    spi_flash_read(SECTOR_ADDR(sec) + off, (uint32_t *)hdr, sizeof(rq_record_header));
+    return *(uint32_t *)hdr != RQ_EMPTY;
+}
+
+// Counts the pending records from off to the end of the sector, returns the end
+static uint16_t ICACHE_FLASH_ATTR scan_sector(uint16_t sec, uint16_t off, uint16_t *pending, uint16_t *first) {
+    rq_record_header hdr;
+
+    while (read_record_header(sec, off, &hdr)) {
+	// Interrupted write or garbage
+	if (hdr.len < sizeof(rq_record_header) || off + hdr.len > SPI_FLASH_SEC_SIZE)
+	    break;
+	if (hdr.state == RQ_PENDING) {
+	    if (*pending == 0 && first != NULL)
+		*first = off;
+	    (*pending)++;
+	}
+	off += hdr.len;
+    }
+    return off;
+}
+
+static void ICACHE_FLASH_ATTR flash_init(void) {
+    enum flash_size_map map = system_get_flash_size_map();
+    rq_sector_header sh;
+    uint16_t sec, oldest = 0, newest = 0, n;
+    uint32_t min_seq = 0xffffffff, max_seq = 0;
+    bool found = false;
+
+    // The ring is placed above the firmware, this needs at least 1MB flash
+    flash_ok = map != FLASH_SIZE_4M_MAP_256_256 && map != FLASH_SIZE_2M;
+    if (!flash_ok)
+	return;
+
+    for (sec = 0; sec < REMOTE_QUEUE_FLASH_SECTORS; sec++) {
+	spi_flash_read(SECTOR_ADDR(sec), (uint32_t *)&sh, sizeof(sh));
+	if (sh.magic != RQ_MAGIC)
+	    continue;
+	found = true;
+	if (sh.seq < min_seq) {
+	    min_seq = sh.seq;
+	    oldest = sec;
+	}
+	if (sh.seq >= max_seq) {
+	    max_seq = sh.seq;
+	    newest = sec;
+	}
+    }
+
+    flash_count = 0;
+    head_sec = tail_sec = 0;
+    head_off = tail_off = 0;
+    flash_seq = max_seq;
+    if (!found)
+	return;
+
+    // Pending records left from before the reset
+    for (sec = oldest, n = 0; n < REMOTE_QUEUE_FLASH_SECTORS; sec = (sec + 1) % REMOTE_QUEUE_FLASH_SECTORS, n++) {
+	uint16_t pending = 0, first = 0;
+
+	tail_off = scan_sector(sec, sizeof(rq_sector_header), &pending, &first);
+	if (pending != 0 && flash_count == 0) {
+	    head_sec = sec;
+	    head_off = first;
+	}
+	flash_count += pending;
+	if (sec == newest)
+	    break;
+    }
+    tail_sec = newest;
+}
+
+static bool ICACHE_FLASH_ATTR flash_append(const char *topic, const char *data, uint32_t data_len,
+					   uint8_t qos, uint8_t retain) {
+    rq_record_header *hdr;
+    uint32_t topic_len = os_strlen(topic);
+    uint32_t len = PAD4(sizeof(rq_record_header) + topic_len + 1 + data_len);
+    uint8_t *record;
+
+    if (!flash_ok || len > SPI_FLASH_SEC_SIZE - sizeof(rq_sector_header))
+	return false;
+
+    if (tail_off == 0 || tail_off + len > SPI_FLASH_SEC_SIZE) {
+	uint16_t next = tail_off == 0 ? tail_sec : (tail_sec + 1) % REMOTE_QUEUE_FLASH_SECTORS;
+	rq_sector_header sh;
+
+	// Ring full: drop the oldest sector
+	if (flash_count != 0 && next == head_sec) {
+	    uint16_t pending = 0;
+
+	    scan_sector(head_sec, head_off, &pending, NULL);
+	    flash_count -= pending;
+	    remote_queue_dropped += pending;
+	    head_sec = (head_sec + 1) % REMOTE_QUEUE_FLASH_SECTORS;
+	    head_off = sizeof(rq_sector_header);
+	}
+
+	spi_flash_erase_sector(REMOTE_QUEUE_FLASH_SECTOR + next);
+	sh.magic = RQ_MAGIC;
+	sh.seq = ++flash_seq;
+	spi_flash_write(SECTOR_ADDR(next), (uint32_t *)&sh, sizeof(sh));
+	TRACE_EVENT(TR_FLASH_WRITE, REMOTE_QUEUE_FLASH_SECTOR + next, sizeof(sh));
+	tail_sec = next;
+	tail_off = sizeof(rq_sector_header);
+    }
+
+    if ((record = (uint8_t *)os_malloc(len)) == NULL)
+	return false;
+    os_memset(record, 0, len);
+    hdr = (rq_record_header *)record;
+    hdr->state = RQ_PENDING;
+    hdr->flags = (qos & 0x03) | (retain ? 0x04 : 0);
+    hdr->len = len;
+    hdr->topic_len = topic_len + 1;
+    hdr->data_len = data_len;
+    os_memcpy(record + sizeof(rq_record_header), topic, topic_len + 1);
+    os_memcpy(record + sizeof(rq_record_header) + topic_len + 1, data, data_len);
+    spi_flash_write(SECTOR_ADDR(tail_sec) + tail_off, (uint32_t *)record, len);
+    TRACE_EVENT(TR_FLASH_WRITE, REMOTE_QUEUE_FLASH_SECTOR + tail_sec, len);
+    os_free(record);
+
+    if (flash_count == 0) {
+	head_sec = tail_sec;
+	head_off = tail_off;
+    }
+    tail_off += len;
+    flash_count++;
+    return true;
+}
+
+// Replays the oldest record in flash, false if the client did not take it
+static bool ICACHE_FLASH_ATTR flash_replay(void) {
+    rq_record_header hdr;
+    uint8_t *record;
+    uint32_t word;
+    bool sent;
+
+    if (!read_record_header(head_sec, head_off, &hdr))
+	return false;
+    if ((record = (uint8_t *)os_malloc(hdr.len)) == NULL)
+	return false;
+
+    spi_flash_read(SECTOR_ADDR(head_sec) + head_off, (uint32_t *)record, hdr.len);
+    sent = MQTT_Publish(&mqttClient, record + sizeof(rq_record_header),
+			record + sizeof(rq_record_header) + hdr.topic_len, hdr.data_len,
+			hdr.flags & 0x03, (hdr.flags & 0x04) != 0);
+    os_free(record);
+    if (!sent)
+	return false;
+
+    // Mark it as done
+    word = (*(uint32_t *)&hdr & ~0xff) | RQ_DONE;
+    spi_flash_write(SECTOR_ADDR(head_sec) + head_off, &word, 4);
+
+    head_off += hdr.len;
+    flash_count--;
+    if (flash_count != 0 && !read_record_header(head_sec, head_off, &hdr)) {
+	head_sec = (head_sec + 1) % REMOTE_QUEUE_FLASH_SECTORS;
+	head_off = sizeof(rq_sector_header);
+    }
+    return true;
+}
+
+static void ICACHE_FLASH_ATTR ram_free(queue_entry *e) {
+    ram_count--;
+    ram_bytes -= ENTRY_SIZE(e);
+    if (e->topic != e->msg->topic)
+	os_free(e->topic);
+    msg_buf_unref(e->msg);
+    os_free(e);
+}
+
+static void ICACHE_FLASH_ATTR ram_remove_first(void) {
+    queue_entry *e = ram_head;
+
+    ram_head = e->next;
+    if (ram_head == NULL)
+	ram_tail = NULL;
+    ram_free(e);
+}
+
+static void ICACHE_FLASH_ATTR ram_remove_topic(const char *topic) {
+    queue_entry **e_p = &ram_head, *e, *prev = NULL;
+
+    while ((e = *e_p) != NULL) {
+	if (os_strcmp(e->topic, topic) == 0) {
+	    *e_p = e->next;
+	    if (ram_tail == e)
+		ram_tail = prev;
+	    ram_free(e);
+	    return;
+	}
+	prev = e;
+	e_p = &e->next;
+    }
+}
+
+static bool ICACHE_FLASH_ATTR ram_append(const char *topic, msg_buf *msg, uint8_t qos, uint8_t retain) {
+    queue_entry *e = (queue_entry *)os_malloc(sizeof(queue_entry));
+
+    if (e == NULL)
+	return false;
+    e->topic = msg->topic;
+    if (os_strcmp(topic, msg->topic) != 0) {
+	if ((e->topic = (char *)os_malloc(os_strlen(topic) + 1)) == NULL) {
+	    os_free(e);
+	    return false;
+	}
+	os_strcpy(e->topic, topic);
+    }
+    e->msg = msg_buf_ref(msg);
+    e->qos = qos;
+    e->retain = retain;
+    e->next = NULL;
+    if (ram_tail != NULL)
+	ram_tail->next = e;
+    else
+	ram_head = e;
+    ram_tail = e;
+    ram_count++;
+    ram_bytes += ENTRY_SIZE(e);
+    return true;
+}
+
+static void ICACHE_FLASH_ATTR drain_cb(void *arg) {
+    int sent = 0;
+
+    if (!mqtt_connected || (ram_count == 0 && flash_count == 0)) {
+	os_timer_disarm(&drain_timer);
+	drain_active = false;
+	return;
+    }
+
+    // mqtt_queue_rate msgs/s in ticks of 100ms, 0: as fast as the client takes them
+    drain_tokens += config.mqtt_queue_rate;
+    while (ram_count != 0 || flash_count != 0) {
+	if (config.mqtt_queue_rate != 0 && drain_tokens < 10)
+	    break;
+	if (config.mqtt_queue_rate == 0 && sent >= REMOTE_QUEUE_BURST)
+	    break;
+
+	// RAM holds the older messages, see enqueue()
+	if (ram_count != 0) {
+	    if (!MQTT_Publish(&mqttClient, ram_head->topic, ram_head->msg->data, ram_head->msg->data_len,
+			      ram_head->qos, ram_head->retain))
+		break;
+	    ram_remove_first();
+	} else if (!flash_replay()) {
+	    break;
+	}
+	sent++;
+	if (config.mqtt_queue_rate != 0)
+	    drain_tokens -= 10;
+    }
+    if (drain_tokens > 10 * config.mqtt_queue_rate)
+	drain_tokens = 10 * config.mqtt_queue_rate;
+}
+
+static void ICACHE_FLASH_ATTR start_drain(void) {
+    if (drain_active || !mqtt_connected || (ram_count == 0 && flash_count == 0))
+	return;
+    drain_tokens = 0;
+    drain_active = true;
+    os_timer_arm(&drain_timer, 100, 1);
+}
+
+/*
+ * Messages go to RAM only as long as the flash ring is empty, so all
+ * messages in RAM are older than the ones in flash.
+ */
+static bool ICACHE_FLASH_ATTR enqueue(const char *topic, msg_src *src, uint8_t qos, uint8_t retain) {
+    msg_buf *msg;
+    bool queued = false;
+    uint32_t size;
+
+    if (config.mqtt_queue_mode == QUEUE_LATEST)
+	ram_remove_topic(topic);
+
+    size = sizeof(queue_entry) + sizeof(msg_buf) + src->topic_len + src->data_len + 2;
+    if (os_strlen(topic) != src->topic_len || os_strncmp(topic, src->topic, src->topic_len) != 0)
+	size += os_strlen(topic) + 1;
+    if (flash_count == 0 && ram_bytes + size <= REMOTE_QUEUE_RAM && mem_gov_level() < MEM_DROP) {
+	if ((msg = msg_src_buf(src)) != NULL)
+	    queued = ram_append(topic, msg, qos, retain);
+    } else if (flash_ok) {
+	queued = flash_append(topic, src->data, src->data_len, qos, retain);
+    } else {
+	// No flash: keep the newest messages
+	while (ram_count != 0 && ram_bytes + size > REMOTE_QUEUE_RAM) {
+	    ram_remove_first();
+	    remote_queue_dropped++;
+	}
+	if (size <= REMOTE_QUEUE_RAM && (msg = msg_src_buf(src)) != NULL)
+	    queued = ram_append(topic, msg, qos, retain);
+    }
+
+    if (!queued)
+	remote_queue_dropped++;
+    start_drain();
+    return queued;
+}
+
+bool ICACHE_FLASH_ATTR remote_publish_src(const char *topic, msg_src *src, uint8_t qos, uint8_t retain) {
+    if (!mqtt_enabled)
+	return false;
+
+    TRACE_EVENT(TR_REMOTE_PUBLISH, !mqtt_connected || ram_count != 0 || flash_count != 0, src->data_len);
+    // Keep the order, nothing may overtake the queued messages
+    if (mqtt_connected && ram_count == 0 && flash_count == 0) {
+	if (MQTT_Publish(&mqttClient, topic, src->data, src->data_len, qos, retain))
+	    return true;
+	// The outbound buffer of the client is full, the queue takes it
+	if (config.mqtt_queue_mode == QUEUE_OFF)
+	    return false;
+	return enqueue(topic, src, qos, retain);
+    }
+
+    if (config.mqtt_queue_mode == QUEUE_OFF) {
+	if (mqtt_connected)
+	    return MQTT_Publish(&mqttClient, topic, src->data, src->data_len, qos, retain);
+	return false;
+    }
+    return enqueue(topic, src, qos, retain);
+}
+
+bool ICACHE_FLASH_ATTR remote_publish(const char *topic, const char *data, uint32_t data_len, uint8_t qos, uint8_t retain) {
+    msg_src src = { topic, os_strlen(topic), data, data_len, NULL };
+    bool published;
+
+    published = remote_publish_src(topic, &src, qos, retain);
+    msg_src_done(&src);
+    return published;
+}
+
+void ICACHE_FLASH_ATTR remote_queue_init(void) {
+    os_timer_disarm(&drain_timer);
+    os_timer_setfn(&drain_timer, drain_cb, NULL);
+    flash_init();
+}
+
+void ICACHE_FLASH_ATTR remote_queue_connected(void) {
+    start_drain();
+}
+
+uint16_t ICACHE_FLASH_ATTR remote_queue_ram_count(void) {
+    return ram_count;
+}
+
+uint32_t ICACHE_FLASH_ATTR remote_queue_ram_bytes(void) {
+    return ram_bytes;
+}
+
+uint16_t ICACHE_FLASH_ATTR remote_queue_flash_count(void) {
+    return flash_count;
+}
+
+#endif /* MQTT_CLIENT */
@@ -0,0 +1,32 @@
+#ifndef _REMOTE_QUEUE_
+#define _REMOTE_QUEUE_
+
+#include "c_types.h"
+#include "msg_buf.h"
+
+/*
+ * Store-and-forward queue for publishes to the remote broker. While
+ * the client is disconnected (or the queue is not yet drained) the
+ * messages are kept in RAM, then spilled to a ring of flash sectors.
+ * After a (re)connect they are replayed in order at a limited rate.
+ */
+
+#define QUEUE_OFF	0
+#define QUEUE_ALL	1	// Oldest first, every message
+#define QUEUE_LATEST	2	// Only the latest message per topic (in RAM)
+
+extern uint32_t remote_queue_dropped;
+
+void remote_queue_init(void);
+void remote_queue_connected(void);
+
+// Publishes to the remote broker or queues the message
+bool remote_publish(const char *topic, const char *data, uint32_t data_len, uint8_t qos, uint8_t retain);
+// As above, a queued message shares the copy of the source
+bool remote_publish_src(const char *topic, msg_src *src, uint8_t qos, uint8_t retain);
+
+uint16_t remote_queue_ram_count(void);
+uint32_t remote_queue_ram_bytes(void);
+uint16_t remote_queue_flash_count(void);
+
+#endif /* _REMOTE_QUEUE_ */
@@ -0,0 +1,95 @@
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+
+#include "topic_trie.h"
+#include "retained_index.h"
+
+static topic_node *retained_trie = NULL;
+static bool retained_stale;
+
+typedef struct _retained_lookup {
+    find_retainedtopic_cb cb;
+    void *user_data;
+    bool found;
+} retained_lookup;
+
+static bool ICACHE_FLASH_ATTR is_entry(void *value, void *user_data) {
+    return value == user_data;
+}
+
+static void ICACHE_FLASH_ATTR index_entry(retained_entry *entry) {
+    if (entry->topic == NULL || entry->data_len == 0)
+	return;
+    if (retained_trie == NULL && (retained_trie = topic_trie_new()) == NULL)
+	return;
+    topic_trie_insert(retained_trie, entry->topic, entry);
+}
+
+void ICACHE_FLASH_ATTR retained_index_add(retained_entry *entry) {
+    if (entry == NULL || entry->topic == NULL)
+	return;
+
+    // Updates of an existing topic report the same entry again
+    if (topic_trie_find(retained_trie, entry->topic, is_entry, entry))
+	return;
+
+    /*
+     * A new topic may reuse the slot of a deleted one, which is still
+     * indexed under its old topic. New topics are rare compared to
+     * updates and lookups, so simply start over.
+     */
+    retained_index_rebuild();
+}
+
+static bool ICACHE_FLASH_ATTR add_cb(retained_entry *entry, void *user_data) {
+    index_entry(entry);
+    return false;
+}
+
+void ICACHE_FLASH_ATTR retained_index_clear(void) {
+    topic_trie_free(retained_trie);
+    retained_trie = NULL;
+    retained_stale = false;
+}
+
+void ICACHE_FLASH_ATTR retained_index_rebuild(void) {
+    retained_index_clear();
+    iterate_retainedtopics(add_cb, NULL);
+}
+
+static bool ICACHE_FLASH_ATTR lookup_cb(void *value, void *user_data) {
+    retained_lookup *lookup = (retained_lookup *)user_data;
+    retained_entry *entry = (retained_entry *)value;
+
+    // Deleting a retained topic (empty publish) is not reported by the broker
+    if (entry->topic == NULL || entry->data_len == 0) {
+	retained_stale = true;
+	return false;
+    }
+
+    lookup->found = true;
+    return lookup->cb(entry, lookup->user_data);
+}
+
+bool ICACHE_FLASH_ATTR retained_index_find(uint8_t *topic, find_retainedtopic_cb cb, void *user_data) {
+    retained_lookup lookup;
+    bool has_wildcards;
+
+    if (retained_trie == NULL)
+	return false;
+
+    lookup.cb = cb;
+    lookup.user_data = user_data;
+    lookup.found = false;
+
+    has_wildcards = os_strchr(topic, '+') != NULL || os_strchr(topic, '#') != NULL;
+    if (has_wildcards)
+	topic_trie_filter(retained_trie, topic, lookup_cb, &lookup);
+    else
+	topic_trie_find(retained_trie, topic, lookup_cb, &lookup);
+
+    if (retained_stale)
+	retained_index_rebuild();
+    return lookup.found;
+}
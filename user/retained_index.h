@@ -0,0 +1,19 @@
+#ifndef _RETAINED_INDEX_
+#define _RETAINED_INDEX_
+
+#include "mqtt/mqtt_retainedlist.h"
+
+/*
+ * A topic trie over the entries of the broker's retained list.
+ * The entries stay owned by the retained list, the index only
+ * refers to them and verifies them on every lookup.
+ */
+
+void retained_index_add(retained_entry *entry);
+void retained_index_rebuild(void);
+void retained_index_clear(void);
+
+// Same contract as find_retainedtopic(), the topic may contain '+' and '#'
+bool retained_index_find(uint8_t *topic, find_retainedtopic_cb cb, void *user_data);
+
+#endif /* _RETAINED_INDEX_ */
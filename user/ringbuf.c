@@ -179,6 +179,20 @@ void *ringbuf_memcpy_from(void *dst, ringbuf_t src, size_t count) {
     return src->tail;
 }
 
+size_t ringbuf_peek_span(const struct ringbuf_t *rb, const void **span) {
+    *span = rb->tail;
+    if (rb->head >= rb->tail)
+	return rb->head - rb->tail;
+    else
+	return ringbuf_end(rb) - rb->tail;
+}
+
+void ringbuf_consume(ringbuf_t rb, size_t count) {
+    if (count > ringbuf_bytes_used(rb))
+	return;
+    rb->tail = rb->buf + ((rb->tail - rb->buf + count) % ringbuf_buffer_size(rb));
+}
+
 void *ringbuf_copy(ringbuf_t dst, ringbuf_t src, size_t count) {
     size_t src_bytes_used = ringbuf_bytes_used(src);
     if (count > src_bytes_used)
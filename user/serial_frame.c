@@ -0,0 +1,200 @@
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+#include "user_interface.h"
+#include "driver/uart.h"
+
+#include "global.h"
+#include "serial_frame.h"
+#include "sub_refs.h"
+
+#ifdef SERIAL_FRAMES
+
+#define FRAME_OUT_CHUNK	64
+#define FRAME_TOPIC_LEN	128
+
+uint32_t serial_frames_in, serial_frames_out;
+uint32_t serial_frames_bad, serial_frames_dropped;
+
+// Frame being received, allocated only in the frame mode
+static uint8_t *frame_buf;
+static uint16_t frame_len;
+static bool frame_esc, frame_overflow;
+
+// Set while a received frame is published, it is not sent back
+static bool publishing;
+
+static uint16_t ICACHE_FLASH_ATTR crc16_update(uint16_t crc, const uint8_t *data, uint32_t len) {
+    uint32_t i;
+    int bit;
+
+    for (i = 0; i < len; i++) {
+	crc ^= (uint16_t)data[i] << 8;
+	for (bit = 0; bit < 8; bit++)
+	    crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+static bool ICACHE_FLASH_ATTR topic_is_set(void) {
+    return os_strcmp(config.serial_topic, "none") != 0;
+}
+
+bool ICACHE_FLASH_ATTR serial_frame_active(void) {
+    return frame_buf != NULL;
+}
+
+void ICACHE_FLASH_ATTR serial_frame_init(void) {
+    ringbuf_t rx;
+
+    if (config.serial_mode != SERIAL_SLIP)
+	return;
+    // The console line ring is too small, the rx ring holds two frames
+    if ((frame_buf = (uint8_t *)os_malloc(SERIAL_FRAME_SIZE)) == NULL ||
+	(rx = ringbuf_new(2 * SERIAL_FRAME_SIZE)) == NULL) {
+	if (frame_buf != NULL)
+	    os_free(frame_buf);
+	frame_buf = NULL;
+	os_printf("No memory for the serial frames\r\n");
+	return;
+    }
+    frame_len = 0;
+    frame_esc = frame_overflow = false;
+
+    UART_Echo(0);
+    UART_SetFrameEnd(SLIP_END, rx);
+    ringbuf_free(&con_sessions[0].rx_buffer);
+    con_sessions[0].rx_buffer = rx;
+    if (console_conn == NULL)
+	console_select(&con_sessions[0]);
+    if (topic_is_set() && config.mqtt_broker_access != 0)
+	sub_refs_add(config.serial_topic, false, 0, SUB_SERIAL);
+}
+
+void ICACHE_FLASH_ATTR serial_frame_set_topic(const char *topic) {
+    if (serial_frame_active() && topic_is_set() && config.mqtt_broker_access != 0)
+	sub_refs_remove(config.serial_topic, false, SUB_SERIAL);
+    os_strncpy(config.serial_topic, topic, sizeof(config.serial_topic) - 1);
+    config.serial_topic[sizeof(config.serial_topic) - 1] = '\0';
+    if (serial_frame_active() && topic_is_set() && config.mqtt_broker_access != 0)
+	sub_refs_add(config.serial_topic, false, 0, SUB_SERIAL);
+}
+
+static void ICACHE_FLASH_ATTR frame_received(void) {
+    uint16_t crc, topic_len;
+
+    if (frame_overflow || frame_len < 3) {
+	serial_frames_bad++;
+	return;
+    }
+    frame_len -= 2;
+    crc = frame_buf[frame_len] << 8 | frame_buf[frame_len + 1];
+    for (topic_len = 0; topic_len < frame_len && frame_buf[topic_len] != '\0'; topic_len++);
+    // The topic may not be a filter
+    if (crc16_update(0xffff, frame_buf, frame_len) != crc || topic_len == 0 || topic_len == frame_len
+	|| Topics_hasWildcards(frame_buf)) {
+	serial_frames_bad++;
+	return;
+    }
+
+    publishing = true;
+    if (MQTT_local_publish(frame_buf, frame_buf + topic_len + 1, frame_len - topic_len - 1, 0, 0))
+	serial_frames_in++;
+    else
+	serial_frames_dropped++;
+    publishing = false;
+}
+
+void ICACHE_FLASH_ATTR serial_frame_input(ringbuf_t rx) {
+    const void *span;
+    const uint8_t *p;
+    size_t len, i;
+    uint8_t c;
+
+    while ((len = ringbuf_peek_span(rx, &span)) != 0) {
+	p = (const uint8_t *)span;
+	for (i = 0; i < len; i++) {
+	    c = p[i];
+	    if (c == SLIP_END) {
+		// Empty frames only resync the receiver
+		if (frame_len > 0 || frame_overflow)
+		    frame_received();
+		frame_len = 0;
+		frame_esc = frame_overflow = false;
+		continue;
+	    }
+	    if (c == SLIP_ESC) {
+		frame_esc = true;
+		continue;
+	    }
+	    if (frame_esc) {
+		frame_esc = false;
+		if (c == SLIP_ESC_END)
+		    c = SLIP_END;
+		else if (c == SLIP_ESC_ESC)
+		    c = SLIP_ESC;
+	    }
+	    if (frame_len < SERIAL_FRAME_SIZE)
+		frame_buf[frame_len++] = c;
+	    else
+		frame_overflow = true;
+	}
+	ringbuf_consume(rx, len);
+    }
+}
+
+static void ICACHE_FLASH_ATTR put_byte(uint8_t *out, uint16_t *len, uint8_t c) {
+    if (*len + 2 > FRAME_OUT_CHUNK) {
+	UART_Send(0, out, *len);
+	*len = 0;
+    }
+    if (c == SLIP_END) {
+	out[(*len)++] = SLIP_ESC;
+	c = SLIP_ESC_END;
+    } else if (c == SLIP_ESC) {
+	out[(*len)++] = SLIP_ESC;
+	c = SLIP_ESC_ESC;
+    }
+    out[(*len)++] = c;
+}
+
+static void ICACHE_FLASH_ATTR put_bytes(uint8_t *out, uint16_t *len, const uint8_t *data, uint32_t data_len) {
+    uint32_t i;
+
+    for (i = 0; i < data_len; i++)
+	put_byte(out, len, data[i]);
+}
+
+void ICACHE_FLASH_ATTR serial_frame_local_received(const char *topic, uint32_t topic_len, const char *data, uint32_t data_len) {
+    char topic_str[FRAME_TOPIC_LEN];
+    uint8_t out[FRAME_OUT_CHUNK], zero = 0;
+    uint16_t len = 0, crc;
+
+    if (!serial_frame_active() || publishing || !topic_is_set() || topic_len >= sizeof(topic_str))
+	return;
+    os_memcpy(topic_str, topic, topic_len);
+    topic_str[topic_len] = '\0';
+    if (!Topics_matches(config.serial_topic, Topics_hasWildcards(config.serial_topic), topic_str))
+	return;
+
+    crc = crc16_update(0xffff, topic, topic_len);
+    crc = crc16_update(crc, &zero, 1);
+    crc = crc16_update(crc, data, data_len);
+
+    // A leading END flushes line noise at the receiver
+    out[len++] = SLIP_END;
+    put_bytes(out, &len, topic, topic_len);
+    put_byte(out, &len, 0);
+    put_bytes(out, &len, data, data_len);
+    put_byte(out, &len, crc >> 8);
+    put_byte(out, &len, crc & 0xff);
+    if (len + 1 > FRAME_OUT_CHUNK) {
+	UART_Send(0, out, len);
+	len = 0;
+    }
+    out[len++] = SLIP_END;
+    UART_Send(0, out, len);
+    serial_frames_out++;
+}
+
+#endif /* SERIAL_FRAMES */
@@ -0,0 +1,41 @@
+#ifndef _SERIAL_FRAME_
+#define _SERIAL_FRAME_
+
+#include "c_types.h"
+#include "ringbuf.h"
+
+/*
+ * Binary framed serial mode (config.serial_mode SERIAL_SLIP): the serial
+ * line carries SLIP frames (RFC 1055) instead of console lines. Before
+ * the escaping a frame is the topic, 0x00, the payload and a
+ * CRC-16/CCITT (poly 0x1021, init 0xffff, big endian). The CRC covers
+ * all bytes before it: topic, 0x00 and payload.
+ *
+ * Received frames are published locally without the interpreter, a
+ * script only sees them if it subscribes to the topics itself. Local
+ * messages that match config.serial_topic are sent back as frames.
+ */
+
+#define SERIAL_LINES	0
+#define SERIAL_SLIP	1
+
+#define SLIP_END	0xc0
+#define SLIP_ESC	0xdb
+#define SLIP_ESC_END	0xdc
+#define SLIP_ESC_ESC	0xdd
+
+extern uint32_t serial_frames_in, serial_frames_out;
+extern uint32_t serial_frames_bad, serial_frames_dropped;
+
+// Switches the UART to frames, if configured
+void serial_frame_init(void);
+bool serial_frame_active(void);
+// Changes config.serial_topic and its local subscription
+void serial_frame_set_topic(const char *topic);
+
+// Decodes the bytes of the serial rx ring, publishes the complete frames
+void serial_frame_input(ringbuf_t rx);
+// Called for every message from the local broker
+void serial_frame_local_received(const char *topic, uint32_t topic_len, const char *data, uint32_t data_len);
+
+#endif /* _SERIAL_FRAME_ */
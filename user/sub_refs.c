@@ -0,0 +1,134 @@
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+
+#include "global.h"
+#include "sub_refs.h"
+
+typedef struct _sub_ref {
+    struct _sub_ref *next;
+    bool remote;
+    uint8_t qos;
+    uint8_t owners;		// SUB_SCRIPT, SUB_SERIAL
+    uint8_t bridge_refs;
+    char filter[];
+} sub_ref;
+
+static sub_ref *sub_list;
+
+static sub_ref ICACHE_FLASH_ATTR *find_ref(const char *filter, bool remote, sub_ref ***link) {
+    sub_ref **l;
+
+    for (l = &sub_list; *l != NULL; l = &(*l)->next) {
+	if ((*l)->remote == remote && os_strcmp((*l)->filter, filter) == 0) {
+	    if (link != NULL)
+		*link = l;
+	    return *l;
+	}
+    }
+    return NULL;
+}
+
+static bool ICACHE_FLASH_ATTR subscribe(sub_ref *ref) {
+    if (!ref->remote)
+	return MQTT_local_subscribe(ref->filter, 0);
+#ifdef MQTT_CLIENT
+    if (mqtt_connected)
+	return MQTT_Subscribe(&mqttClient, ref->filter, ref->qos);
+#endif
+    return true;
+}
+
+static void ICACHE_FLASH_ATTR unsubscribe(sub_ref *ref) {
+    if (!ref->remote) {
+	MQTT_local_unsubscribe(ref->filter);
+	return;
+    }
+#ifdef MQTT_CLIENT
+    if (mqtt_connected)
+	MQTT_UnSubscribe(&mqttClient, ref->filter);
+#endif
+}
+
+static void ICACHE_FLASH_ATTR drop_ref(sub_ref *ref, sub_ref **link, bool subscribed) {
+    if (ref->owners != 0 || ref->bridge_refs != 0)
+	return;
+    if (subscribed)
+	unsubscribe(ref);
+    *link = ref->next;
+    os_free(ref);
+}
+
+bool ICACHE_FLASH_ATTR sub_refs_add(const char *filter, bool remote, uint8_t qos, uint8_t owner) {
+    sub_ref *ref, **link;
+    bool first;
+
+    if ((ref = find_ref(filter, remote, &link)) == NULL) {
+	if ((ref = (sub_ref *)os_malloc(sizeof(sub_ref) + os_strlen(filter) + 1)) == NULL)
+	    return false;
+	os_bzero(ref, sizeof(sub_ref));
+	os_strcpy(ref->filter, filter);
+	ref->remote = remote;
+	ref->next = sub_list;
+	sub_list = ref;
+	link = &sub_list;
+    } else if (owner != SUB_BRIDGE && (ref->owners & owner)) {
+	return true;
+    }
+
+    first = ref->owners == 0 && ref->bridge_refs == 0;
+    if (owner == SUB_BRIDGE)
+	ref->bridge_refs++;
+    else
+	ref->owners |= owner;
+
+    // A higher QoS than the one of the other users renews the subscription
+    if (first || (remote && qos > ref->qos)) {
+	if (qos > ref->qos)
+	    ref->qos = qos;
+	if (!subscribe(ref) && first) {
+	    ref->owners = ref->bridge_refs = 0;
+	    drop_ref(ref, link, false);
+	    return false;
+	}
+    }
+    return true;
+}
+
+bool ICACHE_FLASH_ATTR sub_refs_remove(const char *filter, bool remote, uint8_t owner) {
+    sub_ref *ref, **link;
+
+    if ((ref = find_ref(filter, remote, &link)) == NULL)
+	return false;
+    if (owner == SUB_BRIDGE) {
+	if (ref->bridge_refs == 0)
+	    return false;
+	ref->bridge_refs--;
+    } else {
+	if ((ref->owners & owner) == 0)
+	    return false;
+	ref->owners &= ~owner;
+    }
+    drop_ref(ref, link, true);
+    return true;
+}
+
+void ICACHE_FLASH_ATTR sub_refs_mqtt_connected(void) {
+    sub_ref *ref;
+
+    for (ref = sub_list; ref != NULL; ref = ref->next) {
+	if (ref->remote)
+	    subscribe(ref);
+    }
+}
+
+bool ICACHE_FLASH_ATTR sub_refs_match(const char *topic, bool remote, uint8_t owner) {
+    sub_ref *ref;
+
+    for (ref = sub_list; ref != NULL; ref = ref->next) {
+	if (ref->remote == remote && (ref->owners & owner)
+	    && Topics_matches(ref->filter, Topics_hasWildcards(ref->filter), (char *)topic))
+	    return true;
+    }
+    return false;
+}
@@ -0,0 +1,26 @@
+#ifndef _SUB_REFS_
+#define _SUB_REFS_
+
+#include "c_types.h"
+
+/*
+ * Subscriptions of the local client and of the remote MQTT client. The
+ * script, the bridge and the serial frames share both clients, so a
+ * filter is subscribed by its first user and unsubscribed only when the
+ * last one drops it. The script and the serial frames hold at most one
+ * reference per filter, the bridge one per rule.
+ */
+
+#define SUB_BRIDGE	0x01
+#define SUB_SCRIPT	0x02
+#define SUB_SERIAL	0x04
+
+// Remote filters are subscribed now, if connected, and on every connect
+bool sub_refs_add(const char *filter, bool remote, uint8_t qos, uint8_t owner);
+bool sub_refs_remove(const char *filter, bool remote, uint8_t owner);
+void sub_refs_mqtt_connected(void);
+
+// Does a filter of the owner (SUB_SCRIPT or SUB_SERIAL) match the topic?
+bool sub_refs_match(const char *topic, bool remote, uint8_t owner);
+
+#endif /* _SUB_REFS_ */
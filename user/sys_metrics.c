@@ -0,0 +1,152 @@
+#include "c_types.h"
+#include "osapi.h"
+#include "user_interface.h"
+
+#include "global.h"
+#include "sys_time.h"
+#include "broker_conn.h"
+#include "mem_gov.h"
+#include "remote_queue.h"
+#include "latency.h"
+#include "sys_metrics.h"
+
+// Moving averages of a counter in 1/100 per minute over 1, 5 and 15 min
+typedef struct _load_avg {
+    uint32_t last;
+    uint32_t load[3];
+} load_avg;
+
+static const uint16_t load_windows[3] = { 60, 300, 900 };
+static const char *load_names[3] = { "1min", "5min", "15min" };
+
+static load_avg load_msgs_received, load_msgs_sent;
+static load_avg load_pubs_received, load_pubs_sent;
+static load_avg load_bytes_received, load_bytes_sent;
+
+static uint16_t seconds = 0;
+uint32_t sys_heap_min = 0xffffffff;
+
+static void ICACHE_FLASH_ATTR update_load(load_avg *l, uint32_t total, uint16_t secs) {
+    int64_t per_min = (uint64_t) (total - l->last) * 6000 / secs;
+    int i;
+
+    l->last = total;
+    for (i = 0; i < 3; i++)
+	l->load[i] += (per_min - (int64_t) l->load[i]) * secs / (load_windows[i] + secs);
+}
+
+static void ICACHE_FLASH_ATTR publish_str(const char *topic, const char *value) {
+    MQTT_local_publish((uint8_t *) topic, (uint8_t *) value, os_strlen(value), 0, 0);
+}
+
+static void ICACHE_FLASH_ATTR publish_value(const char *topic, uint32_t value) {
+    char buf[12];
+
+    os_sprintf(buf, "%d", value);
+    publish_str(topic, buf);
+}
+
+static void ICACHE_FLASH_ATTR publish_load(const char *name, load_avg *l) {
+    char topic[64], buf[16];
+    int i;
+
+    for (i = 0; i < 3; i++) {
+	os_sprintf(topic, "$SYS/broker/load/%s/%s", name, load_names[i]);
+	os_sprintf(buf, "%d.%02d", l->load[i] / 100, l->load[i] % 100);
+	publish_str(topic, buf);
+    }
+}
+
+static bool ICACHE_FLASH_ATTR count_cb(void *entry, void *user_data) {
+    (*(uint32_t *) user_data)++;
+    return false;
+}
+
+#ifdef SCRIPTED
+static void ICACHE_FLASH_ATTR publish_latency(void) {
+    static const uint8_t percents[] = { 50, 90, 99 };
+    char topic[48];
+    LAT_STAGE stage;
+    int i;
+
+    for (stage = 0; stage < LAT_STAGES; stage++) {
+	for (i = 0; i < sizeof(percents); i++) {
+	    os_sprintf(topic, "$SYS/broker/latency/%s/p%d", latency_stage_name(stage), percents[i]);
+	    publish_value(topic, latency_percentile(stage, percents[i]));
+	}
+    }
+}
+#endif
+
+static void ICACHE_FLASH_ATTR publish_metrics(void) {
+    MQTT_ClientCon *clientcon;
+    uint32_t count;
+    char buf[24];
+
+    os_sprintf(buf, "%d seconds", (uint32_t) (get_long_systime() / 1000000));
+    publish_str("$SYS/broker/uptime", buf);
+
+    count = 0;
+    for (clientcon = clientcon_list; clientcon != NULL; clientcon = clientcon->next)
+	count++;
+    publish_value("$SYS/broker/clients/connected", count);
+
+    count = 0;
+    iterate_topics((iterate_topic_cb) count_cb, &count);
+    publish_value("$SYS/broker/subscriptions/count", count);
+
+    count = 0;
+    iterate_retainedtopics((iterate_retainedtopic_cb) count_cb, &count);
+    publish_value("$SYS/broker/retained messages/count", count);
+
+    publish_value("$SYS/broker/messages/received", broker_msgs_received);
+    publish_value("$SYS/broker/messages/sent", broker_msgs_sent);
+    publish_value("$SYS/broker/publish/messages/received", broker_pubs_received);
+    publish_value("$SYS/broker/publish/messages/sent", broker_pubs_sent);
+    publish_value("$SYS/broker/bytes/received", broker_bytes_received);
+    publish_value("$SYS/broker/bytes/sent", broker_bytes_sent);
+
+    update_load(&load_msgs_received, broker_msgs_received, config.sys_interval);
+    update_load(&load_msgs_sent, broker_msgs_sent, config.sys_interval);
+    update_load(&load_pubs_received, broker_pubs_received, config.sys_interval);
+    update_load(&load_pubs_sent, broker_pubs_sent, config.sys_interval);
+    update_load(&load_bytes_received, broker_bytes_received, config.sys_interval);
+    update_load(&load_bytes_sent, broker_bytes_sent, config.sys_interval);
+    publish_load("messages/received", &load_msgs_received);
+    publish_load("messages/sent", &load_msgs_sent);
+    publish_load("publish/received", &load_pubs_received);
+    publish_load("publish/sent", &load_pubs_sent);
+    publish_load("bytes/received", &load_bytes_received);
+    publish_load("bytes/sent", &load_bytes_sent);
+
+    count = mem_dropped_messages;
+#ifdef MQTT_CLIENT
+    count += remote_queue_dropped;
+#endif
+    publish_value("$SYS/broker/publish/messages/dropped", count);
+
+    publish_value("$SYS/broker/heap/free", system_get_free_heap_size());
+    publish_value("$SYS/broker/heap/free/min", sys_heap_min);
+
+    publish_value("$SYS/broker/queue/script", pub_list_count());
+#ifdef MQTT_CLIENT
+    publish_value("$SYS/broker/queue/remote", remote_queue_ram_count() + remote_queue_flash_count());
+#endif
+#ifdef SCRIPTED
+    publish_value("$SYS/broker/interpreter/loop_time", loop_time);
+    if (config.sys_latency)
+	publish_latency();
+#endif
+}
+
+void ICACHE_FLASH_ATTR sys_metrics_tick(void) {
+    uint32_t heap = system_get_free_heap_size();
+
+    if (heap < sys_heap_min)
+	sys_heap_min = heap;
+
+    if (config.sys_interval == 0 || ++seconds < config.sys_interval)
+	return;
+    seconds = 0;
+    publish_metrics();
+}
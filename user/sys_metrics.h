@@ -0,0 +1,18 @@
+#ifndef _SYS_METRICS_
+#define _SYS_METRICS_
+
+#include "c_types.h"
+
+/*
+ * Publishes the broker metrics every config.sys_interval seconds to
+ * the local broker, with the same topics and formats as mosquitto
+ * uses under $SYS/broker/. Metrics mosquitto does not have are
+ * published below $SYS/broker/heap, /queue and /interpreter.
+ */
+
+extern uint32_t sys_heap_min;
+
+// Call once per second
+void sys_metrics_tick(void);
+
+#endif /* _SYS_METRICS_ */
@@ -0,0 +1,256 @@
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+
+#include "topic_trie.h"
+
+static topic_node * ICACHE_FLASH_ATTR node_new(const char *level, uint16_t level_len) {
+    topic_node *node = (topic_node *)os_malloc(sizeof(topic_node) + level_len + 1);
+    if (node == NULL)
+	return NULL;
+
+    node->child = NULL;
+    node->sibling = NULL;
+    node->values = NULL;
+    node->level_len = level_len;
+    os_memcpy(node->level, level, level_len);
+    node->level[level_len] = '\0';
+    return node;
+}
+
+static topic_node * ICACHE_FLASH_ATTR find_child(topic_node *node, const char *level, uint16_t level_len) {
+    topic_node *child;
+
+    for (child = node->child; child != NULL; child = child->sibling) {
+	if (child->level_len == level_len && os_memcmp(child->level, level, level_len) == 0)
+	    return child;
+    }
+    return NULL;
+}
+
+// Length of the topic level starting at p (up to the next '/' or the end)
+static uint16_t ICACHE_FLASH_ATTR level_length(const char *p) {
+    const char *q;
+
+    for (q = p; *q != '\0' && *q != '/'; q++);
+    return q - p;
+}
+
+topic_node * ICACHE_FLASH_ATTR topic_trie_new(void) {
+    return node_new("", 0);
+}
+
+void ICACHE_FLASH_ATTR topic_trie_free(topic_node *root) {
+    topic_node *child, *next_child;
+    topic_value *val, *next_val;
+
+    if (root == NULL)
+	return;
+
+    for (child = root->child; child != NULL; child = next_child) {
+	next_child = child->sibling;
+	topic_trie_free(child);
+    }
+    for (val = root->values; val != NULL; val = next_val) {
+	next_val = val->next;
+	os_free(val);
+    }
+    os_free(root);
+}
+
+bool ICACHE_FLASH_ATTR topic_trie_insert(topic_node *root, const char *topic, void *value) {
+    topic_node *node = root, *child;
+    topic_value *val;
+    const char *p = topic;
+    uint16_t len;
+
+    if (root == NULL || topic == NULL)
+	return false;
+
+    while (true) {
+	len = level_length(p);
+	child = find_child(node, p, len);
+	if (child == NULL) {
+	    if ((child = node_new(p, len)) == NULL)
+		return false;
+	    child->sibling = node->child;
+	    node->child = child;
+	}
+	node = child;
+	if (p[len] == '\0')
+	    break;
+	p += len + 1;
+    }
+
+    if ((val = (topic_value *)os_malloc(sizeof(topic_value))) == NULL)
+	return false;
+    val->value = value;
+    val->next = node->values;
+    node->values = val;
+    return true;
+}
+
+static bool ICACHE_FLASH_ATTR remove_from(topic_node *node, const char *p, void *value) {
+    topic_node **child_p, *child;
+    uint16_t len = level_length(p);
+    bool removed = false;
+
+    for (child_p = &node->child; *child_p != NULL; child_p = &(*child_p)->sibling) {
+	if ((*child_p)->level_len == len && os_memcmp((*child_p)->level, p, len) == 0)
+	    break;
+    }
+    if ((child = *child_p) == NULL)
+	return false;
+
+    if (p[len] == '\0') {
+	topic_value **val_p, *val;
+
+	for (val_p = &child->values; *val_p != NULL; val_p = &(*val_p)->next) {
+	    if ((*val_p)->value == value) {
+		val = *val_p;
+		*val_p = val->next;
+		os_free(val);
+		removed = true;
+		break;
+	    }
+	}
+    } else {
+	removed = remove_from(child, p + len + 1, value);
+    }
+
+    // Prune nodes that are no longer in use
+    if (removed && child->values == NULL && child->child == NULL) {
+	*child_p = child->sibling;
+	os_free(child);
+    }
+    return removed;
+}
+
+bool ICACHE_FLASH_ATTR topic_trie_remove(topic_node *root, const char *topic, void *value) {
+    if (root == NULL || topic == NULL)
+	return false;
+    return remove_from(root, topic, value);
+}
+
+static bool ICACHE_FLASH_ATTR report_values(topic_node *node, topic_trie_cb cb, void *user_data) {
+    topic_value *val;
+
+    for (val = node->values; val != NULL; val = val->next) {
+	if (cb(val->value, user_data))
+	    return true;
+    }
+    return false;
+}
+
+/*
+ * p points to the next level of the topic or is NULL, if all levels
+ * have been consumed. The cost is proportional to the topic depth
+ * times the number of wildcard branches on the way, not to the number
+ * of stored filters.
+ */
+static bool ICACHE_FLASH_ATTR match_from(topic_node *node, const char *p, topic_trie_cb cb, void *user_data) {
+    topic_node *child;
+    const char *next;
+    uint16_t len;
+
+    if (p == NULL) {
+	if (report_values(node, cb, user_data))
+	    return true;
+	// "a/#" also matches "a"
+	if ((child = find_child(node, "#", 1)) != NULL)
+	    return report_values(child, cb, user_data);
+	return false;
+    }
+
+    len = level_length(p);
+    next = p[len] == '\0' ? NULL : p + len + 1;
+
+    for (child = node->child; child != NULL; child = child->sibling) {
+	if (child->level_len == 1 && child->level[0] == '#') {
+	    if (report_values(child, cb, user_data))
+		return true;
+	} else if (child->level_len == 1 && child->level[0] == '+') {
+	    if (match_from(child, next, cb, user_data))
+		return true;
+	} else if (child->level_len == len && os_memcmp(child->level, p, len) == 0) {
+	    if (match_from(child, next, cb, user_data))
+		return true;
+	}
+    }
+    return false;
+}
+
+bool ICACHE_FLASH_ATTR topic_trie_match(topic_node *root, const char *topic, topic_trie_cb cb, void *user_data) {
+    if (root == NULL || topic == NULL)
+	return false;
+    return match_from(root, topic, cb, user_data);
+}
+
+bool ICACHE_FLASH_ATTR topic_trie_find(topic_node *root, const char *topic, topic_trie_cb cb, void *user_data) {
+    topic_node *node = root;
+    const char *p = topic;
+    uint16_t len;
+
+    if (root == NULL || topic == NULL)
+	return false;
+
+    while (true) {
+	len = level_length(p);
+	if ((node = find_child(node, p, len)) == NULL)
+	    return false;
+	if (p[len] == '\0')
+	    break;
+	p += len + 1;
+    }
+    return report_values(node, cb, user_data);
+}
+
+static bool ICACHE_FLASH_ATTR report_subtree(topic_node *node, topic_trie_cb cb, void *user_data) {
+    topic_node *child;
+
+    if (report_values(node, cb, user_data))
+	return true;
+    for (child = node->child; child != NULL; child = child->sibling) {
+	if (report_subtree(child, cb, user_data))
+	    return true;
+    }
+    return false;
+}
+
+/*
+ * The reverse of match_from(): here the filter has the wildcards and
+ * the trie holds concrete topics. Only the subtrees that can match are
+ * visited.
+ */
+static bool ICACHE_FLASH_ATTR filter_from(topic_node *node, const char *p, topic_trie_cb cb, void *user_data) {
+    topic_node *child;
+    const char *next;
+    uint16_t len;
+
+    if (p == NULL)
+	return report_values(node, cb, user_data);
+
+    len = level_length(p);
+    next = p[len] == '\0' ? NULL : p + len + 1;
+
+    if (len == 1 && p[0] == '#') {
+	// "a/#" also matches "a"
+	return report_subtree(node, cb, user_data);
+    }
+    if (len == 1 && p[0] == '+') {
+	for (child = node->child; child != NULL; child = child->sibling) {
+	    if (filter_from(child, next, cb, user_data))
+		return true;
+	}
+	return false;
+    }
+    if ((child = find_child(node, p, len)) == NULL)
+	return false;
+    return filter_from(child, next, cb, user_data);
+}
+
+bool ICACHE_FLASH_ATTR topic_trie_filter(topic_node *root, const char *filter, topic_trie_cb cb, void *user_data) {
+    if (root == NULL || filter == NULL)
+	return false;
+    return filter_from(root, filter, cb, user_data);
+}
@@ -0,0 +1,44 @@
+#ifndef _TOPIC_TRIE_
+#define _TOPIC_TRIE_
+
+#include "c_types.h"
+
+/*
+ * A level-indexed trie of MQTT topics. Every node stands for one topic
+ * level, "+" and "#" are stored as ordinary level names and are only
+ * interpreted during matching. Each node carries a list of user values,
+ * so the same topic (filter) may be registered by several owners.
+ */
+
+typedef struct _topic_value {
+    void *value;
+    struct _topic_value *next;
+} topic_value;
+
+typedef struct _topic_node {
+    struct _topic_node *child;
+    struct _topic_node *sibling;
+    topic_value *values;
+    uint16_t level_len;
+    char level[];
+} topic_node;
+
+// Return true to stop the iteration
+typedef bool (*topic_trie_cb)(void *value, void *user_data);
+
+topic_node *topic_trie_new(void);
+void topic_trie_free(topic_node *root);
+
+bool topic_trie_insert(topic_node *root, const char *topic, void *value);
+bool topic_trie_remove(topic_node *root, const char *topic, void *value);
+
+// Calls cb for all stored filters (with '+' and '#') that match the concrete topic
+bool topic_trie_match(topic_node *root, const char *topic, topic_trie_cb cb, void *user_data);
+
+// Calls cb for the values stored under exactly this topic
+bool topic_trie_find(topic_node *root, const char *topic, topic_trie_cb cb, void *user_data);
+
+// Calls cb for all stored concrete topics that match the filter (with '+' and '#')
+bool topic_trie_filter(topic_node *root, const char *filter, topic_trie_cb cb, void *user_data);
+
+#endif /* _TOPIC_TRIE_ */
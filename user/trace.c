@@ -0,0 +1,100 @@
+#include "c_types.h"
+#include "osapi.h"
+#include "user_interface.h"
+
+#include "user_config.h"
+#include "trace.h"
+
+static const char *event_names[TR_EVENTS] = {
+    "none", "connect", "disconnect", "publish", "queue", "drop", "clause", "timer",
+    "local_publish", "remote_publish", "remote_connect", "remote_disconnect", "flash_write"
+};
+
+#ifdef TRACE
+static trace_rec ring[TRACE_ENTRIES];
+static uint16_t ring_next = 0;
+static bool ring_full = false;
+static uint32_t ring_seq = 0;
+
+void ICACHE_FLASH_ATTR trace_record(uint16_t id, uint16_t arg1, uint32_t arg2) {
+    trace_rec *rec = &ring[ring_next];
+
+    rec->time = system_get_time();
+    rec->id = id;
+    rec->arg1 = arg1;
+    rec->arg2 = arg2;
+    ring_seq++;
+    if (++ring_next == TRACE_ENTRIES) {
+	ring_next = 0;
+	ring_full = true;
+    }
+}
+
+uint16_t ICACHE_FLASH_ATTR trace_count(void) {
+    return ring_full ? TRACE_ENTRIES : ring_next;
+}
+
+uint32_t ICACHE_FLASH_ATTR trace_seq(void) {
+    return ring_seq;
+}
+
+bool ICACHE_FLASH_ATTR trace_get(uint16_t no, trace_rec *rec) {
+    if (no >= trace_count())
+	return false;
+    if (ring_full)
+	no = (ring_next + no) % TRACE_ENTRIES;
+    *rec = ring[no];
+    return true;
+}
+#endif
+
+const char * ICACHE_FLASH_ATTR trace_event_name(uint16_t id) {
+    return id < TR_EVENTS ? event_names[id] : "?";
+}
+
+int ICACHE_FLASH_ATTR trace_format(char *buf, const trace_rec *rec, uint32_t prev_time) {
+    const char *name = trace_event_name(rec->id);
+    uint32_t delta = prev_time == 0 ? 0 : rec->time - prev_time;
+    int len;
+
+    len = os_sprintf(buf, "%7d.%03d ms +%7d us %s", rec->time / 1000, rec->time % 1000, delta, name);
+    switch (rec->id) {
+    case TR_CONNECT:
+	len += os_sprintf(buf + len, " clients %d from %d.%d.%d.%d", rec->arg1,
+			  rec->arg2 & 0xff, (rec->arg2 >> 8) & 0xff, (rec->arg2 >> 16) & 0xff, rec->arg2 >> 24);
+	break;
+    case TR_DISCONNECT:
+	len += os_sprintf(buf + len, " clients %d", rec->arg1);
+	if (rec->arg2 != 0)
+	    len += os_sprintf(buf + len, ", error %d", (sint8)rec->arg2);
+	break;
+    case TR_PUBLISH:
+	len += os_sprintf(buf + len, " topic %d bytes, data %d bytes", rec->arg1, rec->arg2);
+	break;
+    case TR_QUEUE:
+	len += os_sprintf(buf + len, " %d msgs, %d bytes", rec->arg1, rec->arg2);
+	break;
+    case TR_DROP:
+	len += os_sprintf(buf + len, " level %d", rec->arg1);
+	break;
+    case TR_CLAUSE:
+	len += os_sprintf(buf + len, " token %d, %d us", rec->arg1, rec->arg2);
+	break;
+    case TR_TIMER:
+	len += os_sprintf(buf + len, " %d", rec->arg1);
+	break;
+    case TR_LOCAL_PUBLISH:
+	len += os_sprintf(buf + len, " %d bytes", rec->arg2);
+	break;
+    case TR_REMOTE_PUBLISH:
+	len += os_sprintf(buf + len, " %d bytes%s", rec->arg2, rec->arg1 ? " queued" : "");
+	break;
+    case TR_REMOTE_CONNECT:
+	len += os_sprintf(buf + len, " after %d ms", rec->arg2);
+	break;
+    case TR_FLASH_WRITE:
+	len += os_sprintf(buf + len, " sector 0x%x, %d bytes", rec->arg1, rec->arg2);
+	break;
+    }
+    return len;
+}
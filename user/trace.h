@@ -0,0 +1,55 @@
+#ifndef _TRACE_
+#define _TRACE_
+
+#include "c_types.h"
+
+/*
+ * Binary trace of hot-path events. A record is an event id, two
+ * numeric arguments and the system_get_time() timestamp, formatting
+ * happens only when the ring is shown (on the device or on the host
+ * with tools/trace_decode).
+ */
+
+typedef enum {
+    TR_NONE = 0,
+    TR_CONNECT,		// arg1: clients, arg2: IP address
+    TR_DISCONNECT,	// arg1: clients left, arg2: connection error
+    TR_PUBLISH,		// arg1: topic length, arg2: data length
+    TR_QUEUE,		// arg1: queued messages, arg2: queued bytes
+    TR_DROP,		// arg1: memory level
+    TR_CLAUSE,		// arg1: token of the "on", arg2: duration in us
+    TR_TIMER,		// arg1: timer number
+    TR_LOCAL_PUBLISH,	// arg2: data length
+    TR_REMOTE_PUBLISH,	// arg1: 1 if queued, arg2: data length
+    TR_REMOTE_CONNECT,	// arg2: duration of the connect in ms
+    TR_REMOTE_DISCONNECT,
+    TR_FLASH_WRITE,	// arg1: sector, arg2: length
+    TR_EVENTS
+} TRACE_EVENT_ID;
+
+typedef struct _trace_rec {
+    uint32_t time;
+    uint16_t id;
+    uint16_t arg1;
+    uint32_t arg2;
+} trace_rec;
+
+#ifdef TRACE
+#define TRACE_EVENT(id, arg1, arg2)	trace_record((id), (arg1), (arg2))
+#else
+#define TRACE_EVENT(id, arg1, arg2)
+#endif
+
+void trace_record(uint16_t id, uint16_t arg1, uint32_t arg2);
+
+// Copies record no (0: oldest) of the ring, false if there is none
+bool trace_get(uint16_t no, trace_rec *rec);
+uint16_t trace_count(void);
+// Records since the boot, record no of the ring is trace_seq() - trace_count() + no
+uint32_t trace_seq(void);
+
+const char *trace_event_name(uint16_t id);
+// Formats a record, the time relative to the previous one
+int trace_format(char *buf, const trace_rec *rec, uint32_t prev_time);
+
+#endif /* _TRACE_ */
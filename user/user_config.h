@@ -30,8 +30,51 @@
 #define MQTT_BUF_SIZE   1024
 #define QUEUE_BUFFER_SIZE 2048
 
+//
+// Native bridge between the local broker and the remote client: number of rules,
+// max. length of a mapped topic, and how long a forwarded message is remembered
+// to suppress its echo from the other side
+//
+#define MAX_BRIDGE_RULES	4
+#define BRIDGE_TOPIC_LEN	128
+#define BRIDGE_ORIGIN_TAGS	16
+#define BRIDGE_ORIGIN_TIMEOUT	5000000
+
+//
+// Store-and-forward queue of the remote client: RAM used before spilling to
+// the flash ring (only with >= 1MB flash, above the firmware), and the max.
+// number of messages replayed per 100ms if the rate is not limited
+//
+#define REMOTE_QUEUE_RAM		4096
+#define REMOTE_QUEUE_BURST		16
+#define REMOTE_QUEUE_FLASH_SECTOR	0x80
+#define REMOTE_QUEUE_FLASH_SECTORS	8
+
+//
+// Receive buffers of script uploads and HTTP requests start with CONN_BUF_INITIAL_SIZE
+// and grow on demand. All of them together may not use more than CONN_BUF_BUDGET bytes.
+//
+#define CONN_BUF_INITIAL_SIZE	256
+#define CONN_BUF_BUDGET		12288
+
+//
+// Memory governor: below these amounts of free heap the broker stops reading from
+// the busiest clients, then rejects new clients, then drops messages for the script
+//
+#define MEM_THROTTLE_HEAP	12000
+#define MEM_REJECT_HEAP		9000
+#define MEM_DROP_HEAP		6000
+
 #define MQTT_KEEPALIVE    120  /*seconds*/
 #define MQTT_RECONNECT_TIMEOUT  5 /*seconds*/
+
+//
+// Reconnects of the remote client back off exponentially from MQTT_BACKOFF_MIN_MS
+// up to MQTT_BACKOFF_MAX_MS (with jitter), after WiFi is back within MQTT_BACKOFF_FAST_MS
+//
+#define MQTT_BACKOFF_MIN_MS	2000
+#define MQTT_BACKOFF_MAX_MS	300000
+#define MQTT_BACKOFF_FAST_MS	1000
 //#define PROTOCOL_NAMEv31  /*MQTT version 3.1 compatible with Mosquitto v0.15*/
 #define PROTOCOL_NAMEv311     /*MQTT version 3.11 compatible with https://eclipse.org/paho/clients/testing/*/
 
@@ -112,10 +155,38 @@
 #define BACKLOG      1
 
 //
-// Size of the console buffers
+// Define this to record hot-path events into a binary ring for "show trace"
+// (TRACE_ENTRIES records of 12 bytes)
+//
+#define TRACE	     1
+#define TRACE_ENTRIES	     128
+
+//
+// Define this to support the recorder of script inputs for an offline replay
+// (set record_mode): RAM ring, flash ring (only with >= 1MB flash, above the
+// remote queue), TCP port of the stream and the max. delay of a record
+//
+#define RECORDER		1
+#define RECORDER_RAM		2048
+#define RECORDER_FLASH_SECTOR	0x88
+#define RECORDER_FLASH_SECTORS	16
+#define RECORDER_PORT		7780
+#define RECORDER_FLUSH_MS	100
+
+//
+// Define this to support the binary framed serial mode (set serial_mode slip)
+// with frames up to SERIAL_FRAME_SIZE bytes (topic, payload and CRC), the serial
+// rx ring holds two of them in this mode
+//
+#define SERIAL_FRAMES		1
+#define SERIAL_FRAME_SIZE	512
+
+//
+// Size of the console buffers, number of remote console sessions
 //
 #define MAX_CON_SEND_SIZE    1024
 #define MAX_CON_CMD_SIZE     160
+#define MAX_CON_SESSIONS     3
 
 //
 // Flash save slots (currently max. 0-2)
@@ -126,7 +197,7 @@
 
 #define MAX_RETAINED_LEN 0x1000
 
-typedef enum {SIG_DO_NOTHING=0, SIG_START_SERVER=1, SIG_UART0, SIG_TOPIC_RECEIVED, SIG_SCRIPT_LOADED, SIG_SCRIPT_HTTP_LOADED, SIG_CONSOLE_TX_RAW, SIG_CONSOLE_TX, SIG_CONSOLE_RX} USER_SIGNALS;
+typedef enum {SIG_DO_NOTHING=0, SIG_START_SERVER=1, SIG_UART0, SIG_TOPIC_RECEIVED, SIG_SCRIPT_LOADED, SIG_SCRIPT_HTTP_LOADED, SIG_CONSOLE_TX_RAW, SIG_CONSOLE_TX, SIG_CONSOLE_RX, SIG_CLIENT_CONNECTED} USER_SIGNALS;
 
 #define LOCAL_ACCESS 0x01
 #define REMOTE_ACCESS 0x02
@@ -30,14 +30,26 @@ static struct mdns_info mdnsinfo;
 #include "dns_responder.h"
 #endif
 
+#include "broker_conn.h"
+#include "mem_gov.h"
+#include "msg_buf.h"
+#include "bridge.h"
+#include "sub_refs.h"
+#include "remote_queue.h"
+#include "reconnect.h"
+#include "sys_metrics.h"
+#include "trace.h"
+#include "recorder.h"
+#include "serial_frame.h"
+
 #ifdef SCRIPTED
 #include "lang.h"
 #include "pub_list.h"
+#include "conn_buf.h"
 
 struct espconn *downloadCon;
 struct espconn *scriptcon;
-uint8_t *load_script;
-uint32_t load_size;
+conn_buf load_script;
 #endif
 
 /* System Task, for signals refer to user_config.h */
@@ -56,6 +68,7 @@ uint64_t t_old;
 /* Hold the system wide configuration */
 sysconfig_t config;
 
+console_session con_sessions[MAX_CON_SESSIONS + 1];
 ringbuf_t console_rx_buffer, console_tx_buffer;
 
 ip_addr_t my_ip;
@@ -69,7 +82,6 @@ void ICACHE_FLASH_ATTR user_set_softap_ip_config(void);
 
 uint8_t remote_console_disconnect;
 struct espconn *console_conn;
-bool client_sent_pending;
 
 LOCAL ICACHE_FLASH_ATTR void void_write_char(char c) {}
 
@@ -103,6 +115,10 @@ static void ICACHE_FLASH_ATTR mqttConnectedCb(uint32_t * args) {
 
     MQTT_Client *client = (MQTT_Client *) args;
     mqtt_connected = true;
+    reconnect_connected();
+    TRACE_EVENT(TR_REMOTE_CONNECT, 0, reconnect_last_ms);
+    sub_refs_mqtt_connected();
+    remote_queue_connected();
 #ifdef SCRIPTED
     interpreter_mqtt_connect();
 #endif
@@ -112,6 +128,8 @@ static void ICACHE_FLASH_ATTR mqttConnectedCb(uint32_t * args) {
 static void ICACHE_FLASH_ATTR mqttDisconnectedCb(uint32_t * args) {
     MQTT_Client *client = (MQTT_Client *) args;
     mqtt_connected = false;
+    TRACE_EVENT(TR_REMOTE_DISCONNECT, 0, 0);
+    RECORD_EVENT(REC_MQTT, 0, NULL, 0, NULL, 0);
     os_printf("MQTT client disconnected\r\n");
 }
 
@@ -122,6 +140,8 @@ static void ICACHE_FLASH_ATTR mqttPublishedCb(uint32_t * args) {
 
 static void ICACHE_FLASH_ATTR mqttDataCb(uint32_t * args, const char *topic,
 					 uint32_t topic_len, const char *data, uint32_t data_len) {
+    bridge_remote_received(topic, topic_len, data, data_len);
+
 #ifdef SCRIPTED
     MQTT_Client *client = (MQTT_Client *) args;
 
@@ -131,7 +151,9 @@ static void ICACHE_FLASH_ATTR mqttDataCb(uint32_t * args, const char *topic,
     os_memcpy(topic_copy, topic, topic_len);
     topic_copy[topic_len] = '\0';
 
-    interpreter_topic_received(topic_copy, data, data_len, false);
+    // Bridged topics only, if the script didn't subscribe as well
+    if (sub_refs_match(topic_copy, true, SUB_SCRIPT))
+	interpreter_topic_received(topic_copy, data, data_len, false);
 
     os_free(topic_copy);
 
@@ -145,15 +167,14 @@ static void ICACHE_FLASH_ATTR mqttDataCb(uint32_t * args, const char *topic,
 #ifdef SCRIPTED
 static void ICACHE_FLASH_ATTR script_recv_cb(void *arg, char *data, unsigned short length) {
     struct espconn *pespconn = (struct espconn *)arg;
-    int index;
-    uint8_t ch;
+    uint32_t space;
 
-    for (index = 0; index < length; index++) {
-	ch = *(data + index);
-	//os_printf("%c", ch);
-	if (load_size < MAX_SCRIPT_SIZE - 5)
-	    load_script[4 + load_size++] = ch;
-    }
+    if (load_script.data == NULL)
+	return;
+    space = load_script.max_size - load_script.len - 1;
+    // Cut off anything beyond MAX_SCRIPT_SIZE, out of budget fails the upload
+    if (!conn_buf_append(&load_script, data, length < space ? length : space))
+	conn_buf_free(&load_script);
 }
 
 void ICACHE_FLASH_ATTR http_script_cb(char* hostname, char* path, char *response_body, int http_status, char *response_headers, int body_size) {
@@ -193,11 +214,19 @@ void ICACHE_FLASH_ATTR http_script_cb(char* hostname, char* path, char *response
 
 static void ICACHE_FLASH_ATTR script_discon_cb(void *arg) {
     char response[64];
+    uint32_t load_size;
 
-    load_script[4 + load_size] = '\0';
-    *(uint32_t *) load_script = load_size + 5;
-    blob_save(SCRIPT_SLOT, (uint32_t *) load_script, load_size + 5);
-    os_free(load_script);
+    if (load_script.data == NULL) {
+	os_sprintf(response, "\rScript upload failed (out of memory)\r\n");
+	to_console(response);
+	return;
+    }
+
+    // The buffer starts with the 4 byte length field
+    load_size = load_script.len - 4;
+    *(uint32_t *) load_script.data = load_size + 5;
+    blob_save(SCRIPT_SLOT, (uint32_t *) load_script.data, load_size + 5);
+    conn_buf_free(&load_script);
     blob_zero(VARS_SLOT, MAX_FLASH_SLOTS * FLASH_SLOT_LEN);
 
     os_sprintf(response, "\rScript upload completed (%d Bytes)\r\n", load_size);
@@ -211,8 +240,10 @@ void ICACHE_FLASH_ATTR script_connected_cb(void *arg) {
     char response[64];
     struct espconn *pespconn = (struct espconn *)arg;
 
-    load_script = (uint8_t *) os_malloc(MAX_SCRIPT_SIZE);
-    load_size = 0;
+    // Grows with the upload, the 4 bytes are the placeholder for the length
+    conn_buf_free(&load_script);
+    if (conn_buf_init(&load_script, MAX_SCRIPT_SIZE))
+	conn_buf_append(&load_script, "\0\0\0\0", 4);
 
     //espconn_regist_sentcb(pespconn,     tcp_client_sent_cb);
     espconn_regist_disconcb(pespconn, script_discon_cb);
@@ -260,38 +291,120 @@ void ICACHE_FLASH_ATTR free_script(void) {
 }
 #endif				/* SCRIPTED */
 
-void ICACHE_FLASH_ATTR console_send_response(struct espconn *pespconn, bool serial_force) {
-    uint16_t len = ringbuf_bytes_used(console_tx_buffer);
-    char payload[len];
+console_session * ICACHE_FLASH_ATTR console_session_of(struct espconn *pespconn) {
+    int i;
+
+    if (pespconn == NULL)
+	return &con_sessions[0];
+    for (i = 1; i <= MAX_CON_SESSIONS; i++) {
+	if (con_sessions[i].conn == pespconn)
+	    return &con_sessions[i];
+    }
+    return NULL;
+}
 
-    if (len == 0)
+void ICACHE_FLASH_ATTR console_select(console_session *session) {
+    console_rx_buffer = session->rx_buffer;
+    console_tx_buffer = session->tx_buffer;
+    console_conn = session->conn;
+}
+
+void ICACHE_FLASH_ATTR console_send_response(console_session *session, bool serial_force) {
+    const void *span;
+    uint16_t len;
+    int i;
+
+    if (session->conn != NULL) {
+	// Sent directly from the ring, the rest follows after the sent callback
+	if (session->sent_pending || (len = ringbuf_peek_span(session->tx_buffer, &span)) == 0)
+	    return;
+	if (espconn_send(session->conn, (uint8_t *) span, len) == 0)
+	    session->sent_pending = true;
+	ringbuf_consume(session->tx_buffer, len);
 	return;
+    }
 
-    ringbuf_memcpy_from(payload, console_tx_buffer, len);
-    if (pespconn != NULL) {
-	if (!client_sent_pending) {
-	    espconn_send(pespconn, payload, len);
-	    client_sent_pending = true;
-	}
-    } else {
+    while ((len = ringbuf_peek_span(session->tx_buffer, &span)) != 0) {
 	if (system_output >= SYSTEM_OUTPUT_CMD || serial_force) {
-	    UART_Send(0, payload, len);
+	    UART_Send(0, (char *)span, len);
 	}
 #ifdef BACKLOG
+	// Overflows drop the oldest bytes of the backlog
 	if (backlog_buffer != NULL) {
-	    char outbuf[10];
-	    if (ringbuf_bytes_free(backlog_buffer) < len && !ringbuf_is_empty(backlog_buffer)) {
-		ringbuf_memcpy_from(outbuf, backlog_buffer, sizeof(outbuf));
-	    }
-	    ringbuf_memcpy_into(backlog_buffer, payload, len);
+	    ringbuf_memcpy_into(backlog_buffer, span, len);
 	}
 #endif
+	for (i = 1; i <= MAX_CON_SESSIONS; i++) {
+	    if (con_sessions[i].log)
+		ringbuf_memcpy_into(con_sessions[i].tx_buffer, span, len);
+	}
+	ringbuf_consume(session->tx_buffer, len);
+    }
+}
+
+/*
+ * Sends the output of all sessions. The serial console goes first, as it
+ * feeds the log sessions, then one span per remote session, starting
+ * with a different one each time.
+ */
+static void ICACHE_FLASH_ATTR console_flush(void) {
+    static uint8_t next;
+    console_session *session;
+    int i;
+
+    console_send_response(&con_sessions[0], false);
+    for (i = 0; i < MAX_CON_SESSIONS; i++) {
+	session = &con_sessions[1 + (next + i) % MAX_CON_SESSIONS];
+	if (session->conn == NULL)
+	    continue;
+	console_send_response(session, false);
+	if (session->disconnect && !session->sent_pending && ringbuf_is_empty(session->tx_buffer)) {
+	    session->disconnect = false;
+	    espconn_disconnect(session->conn);
+	}
+    }
+    next = (next + 1) % MAX_CON_SESSIONS;
+}
+
+#ifdef TRACE
+// Formats the new trace records into the log sessions
+static void ICACHE_FLASH_ATTR console_log_trace(void) {
+    char line[128];
+    trace_rec rec;
+    uint32_t seq = trace_seq(), prev_time;
+    uint16_t count = trace_count();
+    console_session *session;
+    bool sent = false;
+    int i;
+
+    for (i = 1; i <= MAX_CON_SESSIONS; i++) {
+	session = &con_sessions[i];
+	if (!session->log)
+	    continue;
+	// Records overwritten in the meantime are skipped
+	if (seq - session->trace_seq > count)
+	    session->trace_seq = seq - count;
+	prev_time = 0;
+	if (seq - session->trace_seq < count && trace_get(count - (seq - session->trace_seq) - 1, &rec))
+	    prev_time = rec.time;
+	for (; session->trace_seq != seq && ringbuf_bytes_free(session->tx_buffer) >= sizeof(line); session->trace_seq++) {
+	    trace_get(count - (seq - session->trace_seq), &rec);
+	    trace_format(line, &rec, prev_time);
+	    os_sprintf(line + os_strlen(line), "\r\n");
+	    ringbuf_memcpy_into(session->tx_buffer, line, os_strlen(line));
+	    prev_time = rec.time;
+	    sent = true;
+	}
     }
+    if (sent)
+	system_os_post(user_procTaskPrio, SIG_CONSOLE_TX_RAW, 0);
 }
+#endif
 
+// Script output goes to the serial console (and the backlog and log sessions)
 void ICACHE_FLASH_ATTR con_print(uint8_t *str) {
-    ringbuf_memcpy_into(console_tx_buffer, str, os_strlen(str));
-    system_os_post(user_procTaskPrio, SIG_CONSOLE_TX_RAW, (ETSParam) console_conn);
+    ringbuf_memcpy_into(con_sessions[0].tx_buffer, str, os_strlen(str));
+    system_os_post(user_procTaskPrio, SIG_CONSOLE_TX_RAW, 0);
 }
 
 void ICACHE_FLASH_ATTR serial_out(uint8_t *str) {
@@ -300,6 +413,7 @@ void ICACHE_FLASH_ATTR serial_out(uint8_t *str) {
 
 bool ICACHE_FLASH_ATTR delete_retainedtopics() {
     clear_retainedtopics();
+    retained_index_clear();
     blob_zero(RETAINED_SLOT, MAX_RETAINED_LEN);
     return true;
 }
@@ -319,46 +433,76 @@ bool ICACHE_FLASH_ATTR save_retainedtopics() {
 bool ICACHE_FLASH_ATTR load_retainedtopics() {
     uint8_t buffer[MAX_RETAINED_LEN];
     int len = sizeof(buffer);
+    bool success;
 
     blob_load(RETAINED_SLOT, (uint32_t *)buffer, len);
-    return deserialize_retainedtopics(buffer, len);
+    success = deserialize_retainedtopics(buffer, len);
+    retained_index_rebuild();
+    return success;
 }
 
 void MQTT_local_DataCallback(uint32_t * args, const char *topic, uint32_t topic_len, const char *data, uint32_t length) {
     //os_printf("Received: \"%s\" len: %d\r\n", topic, length);
+    // Copied once, if the bridge queue and the script both keep it
+    msg_src src = { topic, topic_len, data, length, NULL };
+
+    TRACE_EVENT(TR_PUBLISH, topic_len, length);
+#ifdef MQTT_CLIENT
+    bridge_local_received(&src);
+#endif
+#ifdef SERIAL_FRAMES
+    serial_frame_local_received(topic, topic_len, data, length);
+#endif
 #ifdef SCRIPTED
-    //interpreter_topic_received(topic, data, length, true);
-    pub_insert(topic, topic_len, data, length, true);
-    system_os_post(user_procTaskPrio, SIG_TOPIC_RECEIVED, 0);
+    char topic_str[topic_len + 1];
+
+    // Bridged and serial traffic is not queued for the script
+    os_memcpy(topic_str, topic, topic_len);
+    topic_str[topic_len] = '\0';
+    if (script_enabled && sub_refs_match(topic_str, false, SUB_SCRIPT)) {
+	//interpreter_topic_received(topic, data, length, true);
+	if (!mem_gov_accept_message()) {
+	    TRACE_EVENT(TR_DROP, mem_gov_level(), 0);
+	} else if (msg_src_buf(&src) != NULL) {
+	    pub_insert_msg(src.msg, true);
+	    system_os_post(user_procTaskPrio, SIG_TOPIC_RECEIVED, 0);
+	}
+    }
 #endif
+    msg_src_done(&src);
 }
 
 #ifdef SCRIPTED
-void ICACHE_FLASH_ATTR do_command(char *t1, char *t2, char *t3) {
-    ringbuf_memcpy_into(console_rx_buffer, t1, os_strlen(t1));
-    ringbuf_memcpy_into(console_rx_buffer, " ", 1);
-    ringbuf_memcpy_into(console_rx_buffer, t2, os_strlen(t2));
-    ringbuf_memcpy_into(console_rx_buffer, " ", 1);
-    ringbuf_memcpy_into(console_rx_buffer, t3, os_strlen(t3));
+// Command of a script, the console input is left alone
+void ICACHE_FLASH_ATTR do_command(char *cmd_line) {
+    char line[MAX_CON_CMD_SIZE + 1];
+
+    os_strncpy(line, cmd_line, MAX_CON_CMD_SIZE);
+    line[MAX_CON_CMD_SIZE] = '\0';
 
+    struct espconn *save_conn = console_conn;
     uint8_t save_locked = config.locked;
+    console_select(&con_sessions[0]);
     config.locked = false;
-    console_handle_command(console_conn);
+    console_execute(NULL, line);
     config.locked = save_locked;
-
-    system_os_post(user_procTaskPrio, SIG_CONSOLE_TX_RAW, (ETSParam) console_conn);
+    console_select(console_session_of(save_conn));
 }
 #endif
 
 #ifdef REMOTE_CONFIG
 static void ICACHE_FLASH_ATTR tcp_client_recv_cb(void *arg, char *data, unsigned short length) {
     struct espconn *pespconn = (struct espconn *)arg;
+    console_session *session = console_session_of(pespconn);
     int index;
     uint8_t ch;
 
+    if (session == NULL)
+	return;
+
     for (index = 0; index < length; index++) {
 	ch = *(data + index);
-	ringbuf_memcpy_into(console_rx_buffer, &ch, 1);
+	ringbuf_memcpy_into(session->rx_buffer, &ch, 1);
 
 	// If a complete commandline is received, then signal the main
 	// task that command is available for processing
@@ -370,23 +514,41 @@ static void ICACHE_FLASH_ATTR tcp_client_recv_cb(void *arg, char *data, unsigned
 }
 
 static void ICACHE_FLASH_ATTR tcp_client_sent_cb(void *arg) {
-    struct espconn *pespconn = (struct espconn *)arg;
+    console_session *session = console_session_of((struct espconn *)arg);
 
-    client_sent_pending = false;
-    console_send_response(pespconn, false);
-    
+    if (session == NULL)
+	return;
+    session->sent_pending = false;
+    system_os_post(user_procTaskPrio, SIG_CONSOLE_TX_RAW, (ETSParam) arg);
 }
 
 static void ICACHE_FLASH_ATTR tcp_client_discon_cb(void *arg) {
-    os_printf("tcp_client_discon_cb(): client disconnected\n");
     struct espconn *pespconn = (struct espconn *)arg;
-    console_conn = NULL;
+    console_session *session;
+    int i;
+
+    os_printf("tcp_client_discon_cb(): client disconnected\n");
+    // Found by the address, the callback may not get the espconn of the session
+    for (i = 1; i <= MAX_CON_SESSIONS; i++) {
+	session = &con_sessions[i];
+	if (session->conn == NULL || session->remote_port != pespconn->proto.tcp->remote_port ||
+	    os_memcmp(session->remote_ip, pespconn->proto.tcp->remote_ip, 4) != 0)
+	    continue;
+	if (console_conn == session->conn)
+	    console_select(&con_sessions[0]);
+	ringbuf_free(&session->rx_buffer);
+	ringbuf_free(&session->tx_buffer);
+	os_memset(session, 0, sizeof(console_session));
+	return;
+    }
 }
 
 /* Called when a client connects to the console server */
 static void ICACHE_FLASH_ATTR tcp_client_connected_cb(void *arg) {
     char payload[128];
     struct espconn *pespconn = (struct espconn *)arg;
+    console_session *session;
+    int i;
 
     os_printf("tcp_client_connected_cb(): Client connected\r\n");
 
@@ -396,18 +558,38 @@ static void ICACHE_FLASH_ATTR tcp_client_connected_cb(void *arg) {
 	return;
     }
 
+    for (i = 1; i <= MAX_CON_SESSIONS && con_sessions[i].conn != NULL; i++);
+    if (i > MAX_CON_SESSIONS) {
+	os_printf("Client disconnected - all %d console sessions in use\r\n", MAX_CON_SESSIONS);
+	espconn_disconnect(pespconn);
+	return;
+    }
+    session = &con_sessions[i];
+    session->rx_buffer = ringbuf_new(MAX_CON_CMD_SIZE);
+    session->tx_buffer = ringbuf_new(MAX_CON_SEND_SIZE);
+    if (session->rx_buffer == NULL || session->tx_buffer == NULL) {
+	os_printf("Client disconnected - out of memory\r\n");
+	if (session->rx_buffer != NULL)
+	    ringbuf_free(&session->rx_buffer);
+	if (session->tx_buffer != NULL)
+	    ringbuf_free(&session->tx_buffer);
+	espconn_disconnect(pespconn);
+	return;
+    }
+
     espconn_regist_sentcb(pespconn, tcp_client_sent_cb);
     espconn_regist_disconcb(pespconn, tcp_client_discon_cb);
     espconn_regist_recvcb(pespconn, tcp_client_recv_cb);
     espconn_regist_time(pespconn, 300, 1);	// Specific to console only
 
-    ringbuf_reset(console_rx_buffer);
-    ringbuf_reset(console_tx_buffer);
+    session->conn = pespconn;
+    os_memcpy(session->remote_ip, pespconn->proto.tcp->remote_ip, 4);
+    session->remote_port = pespconn->proto.tcp->remote_port;
+    session->disconnect = false;
+    session->log = false;
 
     os_sprintf(payload, "CMD>");
-    espconn_send(pespconn, payload, os_strlen(payload));
-    client_sent_pending = true;
-    console_conn = pespconn;
+    session->sent_pending = espconn_send(pespconn, payload, os_strlen(payload)) == 0;
 }
 #endif				/* REMOTE_CONFIG */
 
@@ -457,11 +639,25 @@ void ICACHE_FLASH_ATTR timer_func(void *arg) {
 	timeval[1] = atoi(&timestr[3]);
 	timeval[2] = atoi(&timestr[6]);
 	system_rtc_mem_write (66, (uint32_t *) timeval, 4);	
+#ifdef RECORDER
+	recorder_clock((char *)timestr, (char *)get_weekday());
+#endif
 #ifdef SCRIPTED
 	check_timestamps(timestr);
 #endif
     }
 #endif
+
+    broker_conn_tick();
+    mem_gov_tick();
+    sys_metrics_tick();
+#ifdef TRACE
+    console_log_trace();
+#endif
+#ifdef MQTT_CLIENT
+    reconnect_tick();
+#endif
+
     os_timer_arm(&ptimer, 1000, 0);
 }
 
@@ -474,6 +670,10 @@ static void ICACHE_FLASH_ATTR user_procTask(os_event_t * events) {
     case SIG_START_SERVER:
 	// Anything else to do here, when the broker has received its IP?
 	break;
+
+    case SIG_CLIENT_CONNECTED:
+	broker_conn_track((struct espconn *)events->par);
+	break;
 #ifdef SCRIPTED
     case SIG_TOPIC_RECEIVED:
 	{
@@ -502,34 +702,52 @@ static void ICACHE_FLASH_ATTR user_procTask(os_event_t * events) {
 #endif
     case SIG_CONSOLE_TX:
 	{
-	    ringbuf_memcpy_into(console_tx_buffer, "CMD>", 4);
+	    console_session *session = console_session_of((struct espconn *)events->par);
+
+	    // The script download prompts on the current session
+	    if (session == NULL)
+		session = console_session_of(console_conn);
+	    if (!session->log)
+		ringbuf_memcpy_into(session->tx_buffer, "CMD>", 4);
 	}
 
     case SIG_CONSOLE_TX_RAW:
 	{
-	    struct espconn *pespconn = (struct espconn *)events->par;
-	    console_send_response(pespconn, false);
-
-	    if (pespconn != 0 && remote_console_disconnect)
-		espconn_disconnect(pespconn);
-	    remote_console_disconnect = 0;
+	    console_flush();
 	}
 	break;
 
     case SIG_CONSOLE_RX:
 	{
 	    struct espconn *pespconn = (struct espconn *)events->par;
+	    console_session *session = console_session_of(pespconn);
+
+	    if (session == NULL)
+		break;
+#ifdef SERIAL_FRAMES
+	    if (pespconn == 0 && serial_frame_active()) {
+		serial_frame_input(session->rx_buffer);
+		break;
+	    }
+#endif
 	    if (pespconn == 0 && system_output == SYSTEM_OUTPUT_NONE) {
-		int bytes_count = ringbuf_bytes_used(console_rx_buffer);
+		int bytes_count = ringbuf_bytes_used(session->rx_buffer);
 		char data[bytes_count];
-		ringbuf_memcpy_from(data, console_rx_buffer, bytes_count);
+		ringbuf_memcpy_from(data, session->rx_buffer, bytes_count);
 		// overwrite the trailing '\n'
 		data[bytes_count-1] = '\0';
 #ifdef SCRIPTED
 		interpreter_serial_input(data, bytes_count-1);
 #endif
+	    } else if (session->log) {
+		// Log sessions are read-only
+		ringbuf_reset(session->rx_buffer);
 	    } else {
+		console_select(session);
 		console_handle_command(pespconn);
+		if (pespconn != 0 && remote_console_disconnect)
+		    session->disconnect = true;
+		remote_console_disconnect = 0;
 	    }
 	}
 	break;
@@ -571,9 +789,11 @@ void wifi_handle_event_cb(System_Event_t * evt) {
 	interpreter_wifi_disconnect();
 #endif
 #ifdef MQTT_CLIENT
-	if (mqtt_enabled)
+	if (mqtt_enabled) {
 // Missing test for local
+	    reconnect_wifi_down();
 	    MQTT_Disconnect(&mqttClient);
+	}
 #endif				/* MQTT_CLIENT */
 
 #ifdef MDNS
@@ -604,8 +824,7 @@ void wifi_handle_event_cb(System_Event_t * evt) {
 #endif
 
 #ifdef MQTT_CLIENT
-	if (mqtt_enabled)
-	    MQTT_Connect(&mqttClient);
+	reconnect_wifi_up();
 #endif
 
 #ifdef NTP
@@ -746,11 +965,20 @@ bool ICACHE_FLASH_ATTR mqtt_broker_connect(struct espconn *pesp_conn, uint16_t c
 	return false;
     }
 
+    if (!mem_gov_accept_connection()) {
+	os_printf("Client disconnected - low memory\r\n");
+	return false;
+    }
+
+    TRACE_EVENT(TR_CONNECT, client_count, ((ip_addr_t *)pesp_conn->proto.tcp->remote_ip)->addr);
+    // The broker registers its callbacks after this
+    system_os_post(user_procTaskPrio, SIG_CLIENT_CONNECTED, (ETSParam) pesp_conn);
     return true;
 }
 
 
 void ICACHE_FLASH_ATTR mqtt_got_retained(retained_entry *topic) {
+    retained_index_add(topic);
     if (config.auto_retained)
 	save_retainedtopics();
 }
@@ -780,8 +1008,9 @@ void  user_init() {
     backlog_buffer = NULL;
 #endif
 
-    console_rx_buffer = ringbuf_new(MAX_CON_CMD_SIZE);
-    console_tx_buffer = ringbuf_new(MAX_CON_SEND_SIZE);
+    con_sessions[0].rx_buffer = ringbuf_new(MAX_CON_CMD_SIZE);
+    con_sessions[0].tx_buffer = ringbuf_new(MAX_CON_SEND_SIZE);
+    console_select(&con_sessions[0]);
 #ifdef GPIO
     gpio_init();
 #endif
@@ -837,9 +1066,15 @@ void  user_init() {
 #endif
 
     // Set bit rate to config value
+    UART_Flush(UART0);
     uart_div_modify(0, UART_CLK_FREQ / config.bit_rate);
 
     system_output = config.system_output;
+#ifdef SERIAL_FRAMES
+    // The frames need the serial line for themselves
+    if (config.serial_mode == SERIAL_SLIP)
+	system_output = SYSTEM_OUTPUT_NONE;
+#endif
     if (system_output < SYSTEM_OUTPUT_INFO) {
 	// all system output to /dev/null
 	system_set_os_print(0);
@@ -917,11 +1152,11 @@ void  user_init() {
 	MQTT_OnDisconnected(&mqttClient, mqttDisconnectedCb);
 	MQTT_OnPublished(&mqttClient, mqttPublishedCb);
 	MQTT_OnData(&mqttClient, mqttDataCb);
+	remote_queue_init();
     }
 #endif				/* MQTT_CLIENT */
 
     remote_console_disconnect = 0;
-    console_conn = NULL;
 
     // Now start the STA-Mode
     user_set_station_config();
@@ -941,7 +1176,13 @@ void  user_init() {
 			  config.max_retained_messages);
 	load_retainedtopics();
 	set_on_retainedtopic_cb(mqtt_got_retained);
+#ifdef MQTT_CLIENT
+	bridge_init();
+#endif
     }
+#ifdef SERIAL_FRAMES
+    serial_frame_init();
+#endif
 
     //Start task
     system_os_task(user_procTask, user_procTaskPrio, user_procTaskQueue, user_procTaskQueueLen);
@@ -949,6 +1190,9 @@ void  user_init() {
 #ifdef SCRIPTED
     interpreter_init();
 #endif
+#ifdef RECORDER
+    recorder_init();
+#endif
 
     // Start the timer
     os_timer_setfn(&ptimer, timer_func, 0);